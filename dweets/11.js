@@ -0,0 +1,4 @@
+c.width|=0;x.moveTo(960,540)
+for(i=0;i<3e3;i++)x.lineTo(960+S(i*.7+t)*i/3,540+C(i*1.1-t)*i/6)
+for(i=40;i--;)x.moveTo(960+i*12,540),x.arc(960,540,i*12,t,t+5)
+x.stroke()
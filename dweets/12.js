@@ -0,0 +1 @@
+c.width|=0;for(i=2e3;i--;)x.setTransform(1,0,0,1,960+S(i*7+t)*900,540+C(i*3)*500),x.rotate(i+t),x.fillStyle=R(i%255,99,i%99),x.fillRect(-9,-9,18,18)
@@ -0,0 +1 @@
+P=globalThis.P||new Float32Array(12e4);K=globalThis.K||new Uint8Array(12e4);c.width|=0;for(i=3e4;i--;)P[j=i*4]=960+S(i*.1+t)*i/35,P[j+1]=540+C(i*.13+t*1.3)*i/60,P[j+2]=P[j+3]=4,K[j]=i%255,K[j+1]=99,K[j+2]=i%199,K[j+3]=255;x.fillRectsColored(P,K,3e4)
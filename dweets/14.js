@@ -0,0 +1 @@
+c.width|=0;for(i=4e3;i--;)x.beginPath(),x.fillStyle=R(i%255,i%99,199),x.arc(960+S(i*.3+t)*i/4.5,540+C(i*.7)*i/8,2+i%30,0,7),x.fill()
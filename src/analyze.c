@@ -0,0 +1,1249 @@
+#include "analyze.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The analysis tokenizes the source and walks it once in execution order
+// (a for loop's update clause is visited after its body), tracking which
+// variables are definitely assigned. Conditionally executed code (loop and
+// if bodies, ?: branches, the right side of && and ||, function bodies)
+// opens a region; assignments made inside a region are forgotten when it
+// closes. Reading a variable that the dweet assigns somewhere, while it is
+// not definitely assigned, means the value may come from the previous frame.
+
+enum TokenType {
+    TOK_IDENT,
+    TOK_NUMBER,
+    TOK_STRING,
+    TOK_REGEX,
+    TOK_PUNCT,
+    TOK_TEMPLATE,      // `...` without substitutions
+    TOK_TEMPLATE_HEAD, // `...${
+    TOK_TEMPLATE_MID,  // }...${
+    TOK_TEMPLATE_TAIL, // }...`
+};
+
+struct Token {
+    enum TokenType type;
+    const char *s;
+    int len;
+    bool nl_before;
+    bool param; // arrow function parameter
+};
+
+struct Var {
+    const char *name;
+    int len;
+    // Region level the variable was assigned at, -1 if not assigned
+    int def_level;
+    bool written; // assigned anywhere in the dweet
+    bool local;   // declared with var, let or const
+};
+
+enum FrameKind {
+    FRAME_PAREN,
+    FRAME_BRACKET,
+    FRAME_OBJECT,
+    FRAME_TEMPLATE,
+    FRAME_FOR_HEADER,  // ( after for
+    FRAME_COND_HEADER, // ( after if or while
+    FRAME_BLOCK,       // statement block or function body
+    FRAME_BODY,        // single-statement body of for, if, while, else
+    FRAME_THEN,        // a ? here : ...
+    FRAME_ELSE,        // a ? ... : here
+    FRAME_LOGIC,       // a && here
+    FRAME_ARROW,       // expression body of an arrow function
+};
+
+struct Frame {
+    enum FrameKind kind;
+    // Opens a conditional region at this level (0 = not a region)
+    int level;
+    // BLOCK: closing it ends the enclosing statement
+    bool ends_stmt;
+    // FOR_HEADER: clause being read (0 init, 1 condition)
+    int clause;
+    // Update clause of a for loop, run at the end of its body
+    int update_start, update_end;
+    // FOR_HEADER: the variable of a for-in or for-of loop, which only the
+    // loop's body sees assigned (an empty iteration leaves it as it was)
+    struct Var *loop_var;
+};
+
+struct Pending {
+    struct Var *var;
+    int depth;
+};
+
+struct Analyzer {
+    struct Token *toks;
+    int ntoks;
+
+    struct Var *vars;
+    int nvars;
+
+    struct Frame *stack;
+    int depth;
+    int level;
+
+    // Assignments take effect once their right-hand side is done
+    struct Pending *pending;
+    int npending;
+
+    bool stmt_start;
+    bool drawn; // anything that may draw or look at the canvas has run
+    bool reset; // canvas reset before drawing, unconditionally
+    bool stateful;
+    bool nondeterministic;
+    char reason[96];
+};
+
+static const char *puncts[] = {
+    ">>>=", "...", "===", "!==", "**=", "<<=", ">>=", ">>>", "&&=", "||=",
+    "?\?=", "=>", "==", "!=", "<=", ">=", "&&", "||", "??", "?.", "++", "--",
+    "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "**", "<<", ">>", NULL
+};
+
+static const char *assign_ops[] = {
+    "=", "+=", "-=", "*=", "/=", "%=", "**=", "<<=", ">>=", ">>>=", "&=",
+    "|=", "^=", "&&=", "||=", "?\?=", NULL
+};
+
+static const char *keywords[] = {
+    "break", "case", "catch", "class", "const", "continue", "default",
+    "delete", "do", "else", "false", "finally", "for", "function", "if", "in",
+    "instanceof", "let", "new", "null", "of", "return", "switch", "this",
+    "throw", "true", "try", "typeof", "var", "void", "while", "with", NULL
+};
+
+// Globals that reach outside the frame or run code the analysis can't see
+static const char *dynamic_globals[] = {
+    "eval", "Function", "globalThis", "setTimeout", "setInterval",
+    "requestAnimationFrame", "window", "self", NULL
+};
+
+// Globals the runtime provides that never draw
+static const char *pure_functions[] = { "S", "C", "T", "R", NULL };
+
+// Properties of the context that resetting the canvas restores, so writing
+// them carries nothing over to the next frame
+static const char *context_state[] = {
+    "fillStyle", "globalAlpha", "lineWidth", "globalCompositeOperation",
+    "imageSmoothingEnabled", "antialias", NULL
+};
+
+static bool
+tok_is(const struct Token *tok, const char *s)
+{
+    return tok && (int) strlen(s) == tok->len &&
+        memcmp(tok->s, s, tok->len) == 0 &&
+        (tok->type == TOK_PUNCT || tok->type == TOK_IDENT);
+}
+
+static bool
+tok_in(const struct Token *tok, const char **list)
+{
+    for (; *list; list++)
+        if (tok_is(tok, *list))
+            return true;
+    return false;
+}
+
+// Token starts a property access
+static bool
+is_member(const struct Token *tok)
+{
+    return tok_is(tok, ".") || tok_is(tok, "?.") || tok_is(tok, "[");
+}
+
+static bool
+is_ident_start(unsigned char c)
+{
+    return isalpha(c) || c == '_' || c == '$' || c >= 0x80;
+}
+
+static bool
+is_ident_char(unsigned char c)
+{
+    return is_ident_start(c) || isdigit(c);
+}
+
+// Token ends an expression, so a following / divides and a following
+// newline may end the statement
+static bool
+is_operand_end(const struct Token *tok)
+{
+    if (!tok)
+        return false;
+    switch (tok->type) {
+    case TOK_IDENT:
+        return !tok_in(tok, keywords) || tok_is(tok, "this") ||
+            tok_is(tok, "true") || tok_is(tok, "false") ||
+            tok_is(tok, "null");
+    case TOK_PUNCT:
+        return tok_is(tok, ")") || tok_is(tok, "]") || tok_is(tok, "}") ||
+            tok_is(tok, "++") || tok_is(tok, "--");
+    case TOK_TEMPLATE_HEAD:
+    case TOK_TEMPLATE_MID:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static int
+add_token(struct Token **toks, int *ntoks, int *cap, struct Token tok)
+{
+    if (*ntoks == *cap) {
+        int new_cap = *cap ? *cap * 2 : 256;
+        struct Token *t = realloc(*toks, new_cap * sizeof(*t));
+        if (!t)
+            return -1;
+        *toks = t;
+        *cap = new_cap;
+    }
+    (*toks)[(*ntoks)++] = tok;
+    return 0;
+}
+
+// Scan template text starting after ` or }; returns the end and the token
+// type (by whether it stops at ` or ${)
+static const char *
+scan_template(const char *p, bool head, enum TokenType *type)
+{
+    for (; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '`') {
+            *type = head ? TOK_TEMPLATE : TOK_TEMPLATE_TAIL;
+            return p + 1;
+        } else if (*p == '$' && p[1] == '{') {
+            *type = head ? TOK_TEMPLATE_HEAD : TOK_TEMPLATE_MID;
+            return p + 2;
+        }
+    }
+    return NULL;
+}
+
+static int
+tokenize(const char *src, struct Token **out)
+{
+    struct Token *toks = NULL;
+    int ntoks = 0, cap = 0;
+    // Brace depth at each open ${ so its } resumes the template
+    int tmpl[64];
+    int ntmpl = 0;
+    int braces = 0;
+    bool nl = false;
+
+    const char *p = src;
+    while (*p) {
+        unsigned char c = *p;
+        if (c == '\n') {
+            nl = true;
+            p++;
+            continue;
+        }
+        if (isspace(c)) {
+            p++;
+            continue;
+        }
+        if (c == '/' && p[1] == '/') {
+            while (*p && *p != '\n')
+                p++;
+            continue;
+        }
+        if (c == '/' && p[1] == '*') {
+            const char *end = strstr(p + 2, "*/");
+            if (!end)
+                goto fail;
+            for (; p < end; p++)
+                nl |= *p == '\n';
+            p = end + 2;
+            continue;
+        }
+
+        struct Token tok = { .s = p, .nl_before = nl };
+        const struct Token *prev = ntoks ? &toks[ntoks - 1] : NULL;
+        enum TokenType type;
+
+        if (is_ident_start(c)) {
+            tok.type = TOK_IDENT;
+            while (is_ident_char(*p))
+                p++;
+        } else if (isdigit(c) || (c == '.' && isdigit((unsigned char) p[1]))) {
+            bool hex = c == '0' && (p[1] == 'x' || p[1] == 'X');
+            tok.type = TOK_NUMBER;
+            for (p++; isalnum((unsigned char) *p) || *p == '.' || *p == '_' ||
+                 ((*p == '+' || *p == '-') && !hex &&
+                     (p[-1] == 'e' || p[-1] == 'E'));
+                 p++)
+                ;
+        } else if (c == '"' || c == '\'') {
+            tok.type = TOK_STRING;
+            for (p++; *p && *p != c; p++)
+                if (*p == '\\' && p[1])
+                    p++;
+            if (!*p)
+                goto fail;
+            p++;
+        } else if (c == '`') {
+            p = scan_template(p + 1, true, &type);
+            if (!p || (type == TOK_TEMPLATE_HEAD && ntmpl == 64))
+                goto fail;
+            tok.type = type;
+            if (type == TOK_TEMPLATE_HEAD)
+                tmpl[ntmpl++] = braces;
+        } else if (c == '}' && ntmpl && tmpl[ntmpl - 1] == braces) {
+            p = scan_template(p + 1, false, &type);
+            if (!p)
+                goto fail;
+            tok.type = type;
+            if (type == TOK_TEMPLATE_TAIL)
+                ntmpl--;
+        } else if (c == '/' && !is_operand_end(prev)) {
+            bool in_class = false;
+            tok.type = TOK_REGEX;
+            for (p++; *p && (*p != '/' || in_class); p++) {
+                if (*p == '\\' && p[1])
+                    p++;
+                else if (*p == '[')
+                    in_class = true;
+                else if (*p == ']')
+                    in_class = false;
+                else if (*p == '\n')
+                    goto fail;
+            }
+            if (!*p)
+                goto fail;
+            for (p++; is_ident_char(*p); p++)
+                ;
+        } else {
+            tok.type = TOK_PUNCT;
+            int len = 1;
+            for (const char **op = puncts; *op; op++) {
+                int n = strlen(*op);
+                if (strncmp(p, *op, n) == 0) {
+                    len = n;
+                    break;
+                }
+            }
+            // a?.5:b is a conditional, not optional chaining
+            if (len == 2 && p[0] == '?' && p[1] == '.' &&
+                isdigit((unsigned char) p[2]))
+                len = 1;
+            if (c == '{')
+                braces++;
+            else if (c == '}')
+                braces--;
+            p += len;
+        }
+
+        tok.len = p - tok.s;
+        if (add_token(&toks, &ntoks, &cap, tok) < 0)
+            goto fail;
+        nl = false;
+    }
+
+    if (ntmpl)
+        goto fail;
+    *out = toks;
+    return ntoks;
+
+fail:
+    free(toks);
+    return -1;
+}
+
+static struct Var *
+get_var(struct Analyzer *a, const struct Token *tok)
+{
+    for (int i = 0; i < a->nvars; i++)
+        if (a->vars[i].len == tok->len &&
+            memcmp(a->vars[i].name, tok->s, tok->len) == 0)
+            return &a->vars[i];
+    // At most one variable per token, allocated up front
+    struct Var *var = &a->vars[a->nvars++];
+    *var = (struct Var) { .name = tok->s, .len = tok->len, .def_level = -1 };
+    return var;
+}
+
+static void
+set_stateful(struct Analyzer *a, const char *fmt, const struct Token *tok)
+{
+    if (a->stateful)
+        return;
+    a->stateful = true;
+    snprintf(a->reason, sizeof(a->reason), fmt, tok ? tok->len : 0,
+        tok ? tok->s : "");
+}
+
+static void
+define(struct Analyzer *a, struct Var *var)
+{
+    if (var->def_level < 0 || var->def_level > a->level)
+        var->def_level = a->level;
+}
+
+static void
+read_var(struct Analyzer *a, struct Var *var, const struct Token *tok)
+{
+    if (var->written && !var->local && var->def_level < 0)
+        set_stateful(a, "reads %.*s before assigning it", tok);
+}
+
+static void
+flush(struct Analyzer *a)
+{
+    while (a->npending && a->pending[a->npending - 1].depth >= a->depth)
+        define(a, a->pending[--a->npending].var);
+}
+
+static struct Frame *
+top(struct Analyzer *a)
+{
+    return a->depth ? &a->stack[a->depth - 1] : NULL;
+}
+
+static struct Frame *
+push(struct Analyzer *a, enum FrameKind kind, bool region)
+{
+    // The stack holds at most one frame per token; see analyze_dweet
+    struct Frame *f = &a->stack[a->depth++];
+    *f = (struct Frame) { .kind = kind };
+    if (region)
+        f->level = ++a->level;
+    return f;
+}
+
+static void
+pop(struct Analyzer *a)
+{
+    flush(a);
+    struct Frame *f = &a->stack[--a->depth];
+    if (f->level) {
+        for (int i = 0; i < a->nvars; i++)
+            if (a->vars[i].def_level >= f->level)
+                a->vars[i].def_level = -1;
+        a->level--;
+    }
+}
+
+static bool
+is_expr_region(const struct Frame *f)
+{
+    return f &&
+        (f->kind == FRAME_THEN || f->kind == FRAME_ELSE ||
+            f->kind == FRAME_LOGIC || f->kind == FRAME_ARROW);
+}
+
+static void
+process(struct Analyzer *a, int start, int end, bool expr_only);
+
+// End of a for/if/while body: a for loop's update runs after the body
+static void
+close_body(struct Analyzer *a)
+{
+    struct Frame *f = top(a);
+    if (f->update_end > f->update_start) {
+        int depth = a->depth;
+        process(a, f->update_start, f->update_end, true);
+        while (a->depth > depth && is_expr_region(top(a)))
+            pop(a);
+    }
+    pop(a);
+}
+
+static void
+end_statement(struct Analyzer *a)
+{
+    for (;;) {
+        flush(a);
+        struct Frame *f = top(a);
+        if (is_expr_region(f))
+            pop(a);
+        else if (f && f->kind == FRAME_BODY)
+            close_body(a);
+        else
+            break;
+    }
+    a->stmt_start = true;
+}
+
+// Before a closing bracket: end whatever expressions and bodies it contains
+static void
+close_expr(struct Analyzer *a)
+{
+    for (;;) {
+        struct Frame *f = top(a);
+        if (is_expr_region(f))
+            pop(a);
+        else if (f && f->kind == FRAME_BODY)
+            close_body(a);
+        else
+            break;
+    }
+    flush(a);
+}
+
+static bool
+can_insert_semicolon(struct Analyzer *a)
+{
+    for (int i = a->depth - 1; i >= 0; i--) {
+        const struct Frame *f = &a->stack[i];
+        if (f->kind == FRAME_BLOCK || f->kind == FRAME_BODY)
+            return true;
+        if (!is_expr_region(f))
+            return false;
+    }
+    return true;
+}
+
+static const struct Token *
+tok_at(struct Analyzer *a, int i)
+{
+    return i >= 0 && i < a->ntoks ? &a->toks[i] : NULL;
+}
+
+// Index of the bracket closing the one open at depth (1 = the token at i)
+static int
+find_close(struct Analyzer *a, int i, int depth)
+{
+    for (; i < a->ntoks; i++) {
+        const struct Token *tok = &a->toks[i];
+        if (tok_is(tok, "(") || tok_is(tok, "[") || tok_is(tok, "{") ||
+            tok->type == TOK_TEMPLATE_HEAD)
+            depth++;
+        else if (tok_is(tok, ")") || tok_is(tok, "]") || tok_is(tok, "}") ||
+            tok->type == TOK_TEMPLATE_TAIL)
+            if (--depth == 0)
+                return i;
+    }
+    return -1;
+}
+
+static int
+matching_paren(struct Analyzer *a, int i)
+{
+    return find_close(a, i, 0);
+}
+
+// The ) of a for header, from a token inside it
+static int
+header_end(struct Analyzer *a, int i)
+{
+    return find_close(a, i, 1);
+}
+
+static void
+open_body(struct Analyzer *a, int *i, int update_start, int update_end)
+{
+    struct Frame *f;
+    if (tok_is(tok_at(a, *i + 1), "{")) {
+        f = push(a, FRAME_BLOCK, true);
+        f->ends_stmt = true;
+        (*i)++;
+    } else {
+        f = push(a, FRAME_BODY, true);
+    }
+    f->update_start = update_start;
+    f->update_end = update_end;
+    a->stmt_start = true;
+}
+
+// Index of the bracket opening the one that closes at i
+static int
+find_open(struct Analyzer *a, int i)
+{
+    int depth = 0;
+    for (; i >= 0; i--) {
+        const struct Token *tok = &a->toks[i];
+        if (tok_is(tok, ")") || tok_is(tok, "]") || tok_is(tok, "}") ||
+            tok->type == TOK_TEMPLATE_TAIL)
+            depth++;
+        else if (tok_is(tok, "(") || tok_is(tok, "[") || tok_is(tok, "{") ||
+            tok->type == TOK_TEMPLATE_HEAD)
+            if (--depth == 0)
+                return i;
+    }
+    return -1;
+}
+
+// Last token of the operand starting at i: a name followed by any number
+// of .name and [...] accesses
+static int
+operand_end(struct Analyzer *a, int i)
+{
+    for (;;) {
+        const struct Token *next = tok_at(a, i + 1);
+        if ((tok_is(next, ".") || tok_is(next, "?.")) &&
+            tok_at(a, i + 2) && tok_at(a, i + 2)->type == TOK_IDENT) {
+            i += 2;
+        } else if (tok_is(next, "[")) {
+            int close = find_close(a, i + 1, 0);
+            if (close < 0)
+                return i;
+            i = close;
+        } else {
+            return i;
+        }
+    }
+}
+
+// An assignment, update or delete of a property at the operand ending at
+// end. Such writes to builtin objects outlive the frame, so only a few are
+// allowed: the canvas size (which resets the canvas), the context's state
+// (which the reset restores) and single properties of the dweet's own
+// objects. Computed (obj[k]) and nested (a.b.c) writes and writes through
+// a prototype can reach anything, so they always make the dweet stateful.
+static void
+member_write(struct Analyzer *a, int end, bool assign)
+{
+    int levels = 0;
+    bool computed = false, proto = false;
+    const struct Token *prop = NULL;
+    int j = end;
+    const struct Token *base;
+    for (;;) {
+        base = tok_at(a, j);
+        const struct Token *prev = tok_at(a, j - 1);
+        if (base && base->type == TOK_IDENT &&
+            (tok_is(prev, ".") || tok_is(prev, "?."))) {
+            if (!levels)
+                prop = base;
+            proto |= tok_is(base, "prototype") || tok_is(base, "__proto__");
+            levels++;
+            j -= 2;
+        } else if (tok_is(base, "]")) {
+            computed = true;
+            levels++;
+            j = find_open(a, j) - 1;
+        } else {
+            break;
+        }
+    }
+    if (!levels)
+        return;
+
+    const struct Token *name = base && base->type == TOK_IDENT ? base : NULL;
+    if (computed) {
+        set_stateful(a, "writes a computed property%.*s", NULL);
+    } else if (proto) {
+        set_stateful(a, "writes through a prototype%.*s", NULL);
+    } else if (levels > 1 || !name || name->param ||
+        tok_in(name, keywords)) {
+        set_stateful(a, "writes a property of %.*s", name);
+    } else {
+        struct Var *var = get_var(a, name);
+        if (var->written || var->local)
+            return;
+        if (tok_is(name, "c") &&
+            (tok_is(prop, "width") || tok_is(prop, "height")) && assign) {
+            if (a->level == 0 && !a->drawn)
+                a->reset = true;
+        } else if (!tok_is(name, "x") || !tok_in(prop, context_state)) {
+            char s[64];
+            snprintf(s, sizeof(s), "%.*s.%.*s", name->len, name->s,
+                prop->len, prop->s);
+            struct Token t = { .s = s, .len = strlen(s) };
+            set_stateful(a, "writes %.*s", &t);
+        }
+    }
+}
+
+static void
+process_ident(struct Analyzer *a, int i)
+{
+    const struct Token *tok = &a->toks[i];
+    const struct Token *prev = tok_at(a, i - 1);
+    const struct Token *next = tok_at(a, i + 1);
+
+    if (tok_is(prev, ".") || tok_is(prev, "?.")) {
+        if (tok_is(tok, "random") && tok_is(tok_at(a, i - 2), "Math"))
+            a->nondeterministic = true;
+        return;
+    }
+    if (tok_is(tok, "Date") || tok_is(tok, "performance"))
+        a->nondeterministic = true;
+    if (tok_in(tok, dynamic_globals) || tok_is(tok, "this")) {
+        set_stateful(a, "uses %.*s", tok);
+        return;
+    }
+    if (tok->param || tok_in(tok, keywords))
+        return;
+    struct Frame *f = top(a);
+    if (f && f->kind == FRAME_OBJECT && tok_is(next, ":") &&
+        (tok_is(prev, "{") || tok_is(prev, ",")))
+        return;
+
+    struct Var *var = get_var(a, tok);
+    if (tok_is(next, "=")) {
+        a->pending[a->npending++] = (struct Pending) { var, a->depth };
+    } else if (tok_in(next, assign_ops)) {
+        read_var(a, var, tok);
+        a->pending[a->npending++] = (struct Pending) { var, a->depth };
+    } else if (tok_is(next, "++") || tok_is(next, "--") ||
+        ((tok_is(prev, "++") || tok_is(prev, "--")) && !is_member(next))) {
+        read_var(a, var, tok);
+        define(a, var);
+    } else if ((tok_is(next, "of") || tok_is(next, "in")) && f &&
+        f->kind == FRAME_FOR_HEADER) {
+        f->loop_var = var;
+    } else {
+        read_var(a, var, tok);
+    }
+
+    bool call = tok_is(next, "(") ||
+        (next &&
+            (next->type == TOK_TEMPLATE || next->type == TOK_TEMPLATE_HEAD));
+    if (tok_is(tok, "x") || (call && !tok_in(tok, pure_functions)))
+        a->drawn = true;
+}
+
+// Mark arrow parameters before the arrow at i
+static void
+define_arrow_params(struct Analyzer *a, int i)
+{
+    const struct Token *prev = tok_at(a, i - 1);
+    if (prev && prev->type == TOK_IDENT) {
+        define(a, get_var(a, prev));
+        return;
+    }
+    int depth = 0;
+    for (int j = i - 1; j >= 0; j--) {
+        const struct Token *tok = &a->toks[j];
+        if (tok_is(tok, ")"))
+            depth++;
+        else if (tok_is(tok, "("))
+            if (--depth == 0)
+                break;
+        if (depth == 1 && tok->type == TOK_IDENT &&
+            (tok_is(tok_at(a, j - 1), "(") || tok_is(tok_at(a, j - 1), ",")))
+            define(a, get_var(a, tok));
+    }
+}
+
+// Function declaration or expression at i; returns the last token consumed
+static int
+process_function(struct Analyzer *a, int i)
+{
+    int j = i + 1;
+    const struct Token *name = tok_at(a, j);
+    if (name && name->type == TOK_IDENT)
+        j++;
+    else
+        name = NULL;
+    if (!tok_is(tok_at(a, j), "("))
+        return -1;
+    int k = matching_paren(a, j);
+    if (k < 0 || !tok_is(tok_at(a, k + 1), "{"))
+        return -1;
+
+    if (name)
+        define(a, get_var(a, name));
+    struct Frame *f = push(a, FRAME_BLOCK, true);
+    f->ends_stmt = a->stmt_start;
+    for (int p = j + 1; p < k; p++) {
+        const struct Token *tok = &a->toks[p];
+        if (tok->type == TOK_IDENT &&
+            (tok_is(tok_at(a, p - 1), "(") || tok_is(tok_at(a, p - 1), ",")))
+            define(a, get_var(a, tok));
+    }
+    a->stmt_start = true;
+    return k + 1;
+}
+
+static void
+parse_error(struct Analyzer *a)
+{
+    set_stateful(a, "could not follow the source%.*s", NULL);
+}
+
+static void
+process(struct Analyzer *a, int start, int end, bool expr_only)
+{
+    for (int i = start; i < end && !a->stateful; i++) {
+        const struct Token *tok = &a->toks[i];
+        struct Frame *f;
+
+        if (!expr_only && tok->nl_before && !a->stmt_start &&
+            is_operand_end(tok_at(a, i - 1)) && can_insert_semicolon(a) &&
+            (tok->type != TOK_PUNCT || tok_is(tok, "++") ||
+                tok_is(tok, "--") || tok_is(tok, "!") || tok_is(tok, "~")) &&
+            tok->type != TOK_TEMPLATE_MID && tok->type != TOK_TEMPLATE_TAIL &&
+            !tok_in(tok, keywords))
+            end_statement(a);
+
+        bool stmt_start = a->stmt_start;
+        a->stmt_start = false;
+
+        switch (tok->type) {
+        case TOK_IDENT:
+            if (tok_is(tok, "for") || tok_is(tok, "if") ||
+                tok_is(tok, "while")) {
+                if (!tok_is(tok_at(a, i + 1), "(")) {
+                    parse_error(a);
+                    break;
+                }
+                push(a, tok_is(tok, "for") ? FRAME_FOR_HEADER
+                                           : FRAME_COND_HEADER,
+                    false);
+                i++;
+            } else if (tok_is(tok, "else") || tok_is(tok, "do")) {
+                open_body(a, &i, 0, 0);
+            } else if (tok_is(tok, "function")) {
+                a->stmt_start = stmt_start;
+                i = process_function(a, i);
+                if (i < 0)
+                    parse_error(a);
+            } else if (tok_is(tok, "delete")) {
+                member_write(a, operand_end(a, i + 1), false);
+            } else if (tok_is(tok, "switch") || tok_is(tok, "try") ||
+                tok_is(tok, "class") || tok_is(tok, "with")) {
+                set_stateful(a, "uses %.*s", tok);
+            } else {
+                process_ident(a, i);
+            }
+            break;
+
+        case TOK_TEMPLATE_HEAD:
+            push(a, FRAME_TEMPLATE, false);
+            break;
+
+        case TOK_TEMPLATE_MID:
+        case TOK_TEMPLATE_TAIL:
+            close_expr(a);
+            f = top(a);
+            if (!f || f->kind != FRAME_TEMPLATE)
+                parse_error(a);
+            else if (tok->type == TOK_TEMPLATE_TAIL)
+                pop(a);
+            break;
+
+        case TOK_PUNCT:
+            if (tok_in(tok, assign_ops)) {
+                member_write(a, i - 1, true);
+            } else if (tok_is(tok, "++") || tok_is(tok, "--")) {
+                if (is_operand_end(tok_at(a, i - 1)) && !tok->nl_before)
+                    member_write(a, i - 1, false);
+                else
+                    member_write(a, operand_end(a, i + 1), false);
+            }
+
+            if (tok_is(tok, "(")) {
+                push(a, FRAME_PAREN, false);
+            } else if (tok_is(tok, "[")) {
+                push(a, FRAME_BRACKET, false);
+            } else if (tok_is(tok, "{")) {
+                if (stmt_start) {
+                    push(a, FRAME_BLOCK, false)->ends_stmt = true;
+                    a->stmt_start = true;
+                } else {
+                    push(a, FRAME_OBJECT, false);
+                }
+            } else if (tok_is(tok, ")")) {
+                close_expr(a);
+                f = top(a);
+                if (f && f->kind == FRAME_PAREN) {
+                    pop(a);
+                } else if (f &&
+                    (f->kind == FRAME_FOR_HEADER ||
+                        f->kind == FRAME_COND_HEADER)) {
+                    int us = f->update_start, ue = f->update_end;
+                    struct Var *loop_var = f->loop_var;
+                    pop(a);
+                    open_body(a, &i, us, ue);
+                    if (loop_var)
+                        define(a, loop_var);
+                } else {
+                    parse_error(a);
+                }
+            } else if (tok_is(tok, "]")) {
+                close_expr(a);
+                f = top(a);
+                if (f && f->kind == FRAME_BRACKET)
+                    pop(a);
+                else
+                    parse_error(a);
+            } else if (tok_is(tok, "}")) {
+                close_expr(a);
+                f = top(a);
+                if (f && f->kind == FRAME_OBJECT) {
+                    pop(a);
+                } else if (f && f->kind == FRAME_BLOCK) {
+                    bool ends_stmt = f->ends_stmt;
+                    close_body(a);
+                    if (ends_stmt)
+                        end_statement(a);
+                } else {
+                    parse_error(a);
+                }
+            } else if (tok_is(tok, ";")) {
+                while (is_expr_region(top(a)))
+                    pop(a);
+                flush(a);
+                f = top(a);
+                if (f && f->kind == FRAME_FOR_HEADER) {
+                    if (++f->clause == 2) {
+                        // Visit the update clause after the body instead
+                        int close = header_end(a, i + 1);
+                        if (close < 0) {
+                            parse_error(a);
+                            break;
+                        }
+                        f->update_start = i + 1;
+                        f->update_end = close;
+                        i = close - 1;
+                    }
+                } else {
+                    end_statement(a);
+                }
+            } else if (tok_is(tok, ",")) {
+                flush(a);
+                while (top(a) && (top(a)->kind == FRAME_ELSE ||
+                           top(a)->kind == FRAME_LOGIC ||
+                           top(a)->kind == FRAME_ARROW))
+                    pop(a);
+            } else if (tok_is(tok, "?")) {
+                while (top(a) && top(a)->kind == FRAME_LOGIC)
+                    pop(a);
+                push(a, FRAME_THEN, true);
+            } else if (tok_is(tok, ":")) {
+                while (top(a) && top(a)->kind == FRAME_LOGIC)
+                    pop(a);
+                if (top(a) && top(a)->kind == FRAME_THEN) {
+                    pop(a);
+                    push(a, FRAME_ELSE, true);
+                }
+            } else if (tok_is(tok, "&&") || tok_is(tok, "||") ||
+                tok_is(tok, "??")) {
+                push(a, FRAME_LOGIC, true);
+            } else if (tok_is(tok, "=>")) {
+                if (tok_is(tok_at(a, i + 1), "{")) {
+                    push(a, FRAME_BLOCK, true);
+                    a->stmt_start = true;
+                    i++;
+                } else {
+                    push(a, FRAME_ARROW, true);
+                }
+                define_arrow_params(a, i);
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+// Variables assigned anywhere, declared locals and arrow parameters
+static void
+prepass(struct Analyzer *a)
+{
+    for (int i = 0; i < a->ntoks; i++) {
+        struct Token *tok = &a->toks[i];
+        const struct Token *prev = tok_at(a, i - 1);
+        const struct Token *next = tok_at(a, i + 1);
+
+        if (tok_is(tok, "=>")) {
+            if (prev && prev->type == TOK_IDENT) {
+                a->toks[i - 1].param = true;
+                continue;
+            }
+            int depth = 0;
+            for (int j = i - 1; j >= 0; j--) {
+                struct Token *t = &a->toks[j];
+                if (tok_is(t, ")"))
+                    depth++;
+                else if (tok_is(t, "("))
+                    if (--depth == 0)
+                        break;
+                if (depth == 1 && t->type == TOK_IDENT &&
+                    (tok_is(tok_at(a, j - 1), "(") ||
+                        tok_is(tok_at(a, j - 1), ",")))
+                    t->param = true;
+            }
+            continue;
+        }
+
+        if (tok_is(tok, "var") || tok_is(tok, "let") || tok_is(tok, "const")) {
+            bool expect_name = true;
+            int depth = 0;
+            for (int j = i + 1; j < a->ntoks; j++) {
+                const struct Token *t = &a->toks[j];
+                if (expect_name && t->type == TOK_IDENT)
+                    get_var(a, t)->local = true;
+                expect_name = false;
+                if (tok_is(t, "(") || tok_is(t, "[") || tok_is(t, "{"))
+                    depth++;
+                else if (tok_is(t, ")") || tok_is(t, "]") || tok_is(t, "}"))
+                    depth--;
+                if (depth < 0 ||
+                    (depth == 0 &&
+                        (tok_is(t, ";") || tok_is(t, "of") ||
+                            tok_is(t, "in") || (t->nl_before && j > i + 1))))
+                    break;
+                expect_name = depth == 0 && tok_is(t, ",");
+            }
+            continue;
+        }
+
+        if (tok->type != TOK_IDENT || tok_is(prev, ".") ||
+            tok_is(prev, "?.") || tok_in(tok, keywords))
+            continue;
+        if (tok_in(next, assign_ops) || tok_is(next, "++") ||
+            tok_is(next, "--") ||
+            ((tok_is(prev, "++") || tok_is(prev, "--")) && !is_member(next)) ||
+            tok_is(next, "of") || tok_is(next, "in") ||
+            tok_is(prev, "function"))
+            get_var(a, tok)->written = true;
+    }
+}
+
+// Dwitter's compressed form, eval(unescape(escape`...`.replace(/u../g,''))),
+// packs two ASCII characters into each astral code point. Returns the
+// decoded source, or NULL if code isn't in that form.
+static char *
+unpack(const char *code)
+{
+    static const char prefix[] = "eval(unescape(escape`";
+    while (isspace((unsigned char) *code))
+        code++;
+    if (strncmp(code, prefix, strlen(prefix)) != 0)
+        return NULL;
+    const char *start = code + strlen(prefix);
+    const char *end = strchr(start, '`');
+    if (!end)
+        return NULL;
+    const char *rest = end + 1;
+    if (strncmp(rest, ".replace(/u../g,'')))", 21) != 0 &&
+        strncmp(rest, ".replace(/u../g,\"\")))", 21) != 0)
+        return NULL;
+    for (rest += 21; *rest; rest++)
+        if (!isspace((unsigned char) *rest) && *rest != ';')
+            return NULL;
+
+    // Each UTF-16 unit escapes to %XX or %uXXXX; the replace drops every
+    // u and the two characters after it, and unescape turns the remaining
+    // %XX into a character. That leaves the low byte of each unit (and
+    // plain ASCII as itself, less any u).
+    char *out = malloc(end - start + 1);
+    if (!out)
+        return NULL;
+    size_t n = 0;
+    int skip = 0;
+    for (const unsigned char *p = (const unsigned char *) start;
+         p < (const unsigned char *) end;) {
+        uint32_t cp;
+        int len;
+        if (*p < 0x80) {
+            cp = *p, len = 1;
+        } else if ((*p & 0xE0) == 0xC0) {
+            cp = *p & 0x1F, len = 2;
+        } else if ((*p & 0xF0) == 0xE0) {
+            cp = *p & 0x0F, len = 3;
+        } else {
+            cp = *p & 0x07, len = 4;
+        }
+        for (int k = 1; k < len; k++)
+            cp = (cp << 6) | (p[k] & 0x3F);
+        p += len;
+
+        uint32_t units[2];
+        int nunits = 0;
+        if (cp > 0xFFFF) {
+            units[nunits++] = 0xD800 + ((cp - 0x10000) >> 10);
+            units[nunits++] = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+        } else {
+            units[nunits++] = cp;
+        }
+
+        for (int k = 0; k < nunits; k++) {
+            uint32_t u = units[k];
+            char esc[16];
+            if (u < 0x80 &&
+                (isalnum(u) || strchr("@*_+-./", (int) u)))
+                snprintf(esc, sizeof(esc), "%c", (int) u);
+            else if (u < 0x100)
+                snprintf(esc, sizeof(esc), "%%%02X", u);
+            else
+                snprintf(esc, sizeof(esc), "%%u%04X", u);
+
+            // Apply the replace, then unescape what is left
+            char kept[16];
+            int nkept = 0;
+            for (char *e = esc; *e; e++) {
+                if (skip) {
+                    skip--;
+                } else if (*e == 'u') {
+                    skip = 2;
+                } else {
+                    kept[nkept++] = *e;
+                }
+            }
+            if (nkept == 3 && kept[0] == '%') {
+                out[n++] = (char) strtol(kept + 1, NULL, 16);
+            } else {
+                memcpy(out + n, kept, nkept);
+                n += nkept;
+            }
+        }
+    }
+    out[n] = '\0';
+    return out;
+}
+
+void
+analyze_dweet(const char *code, struct DweetAnalysis *analysis)
+{
+    *analysis = (struct DweetAnalysis) { .kind = DWEET_STATEFUL };
+
+    char *unpacked = unpack(code);
+    struct Analyzer a = { 0 };
+    a.ntoks = tokenize(unpacked ? unpacked : code, &a.toks);
+    if (a.ntoks < 0) {
+        snprintf(analysis->reason, sizeof(analysis->reason),
+            "could not tokenize the source");
+        free(unpacked);
+        return;
+    }
+
+    // Every token adds at most one variable, frame or pending assignment
+    int n = a.ntoks + 1;
+    a.vars = calloc(n, sizeof(*a.vars));
+    a.stack = calloc(n, sizeof(*a.stack));
+    a.pending = calloc(n, sizeof(*a.pending));
+    if (!a.vars || !a.stack || !a.pending) {
+        snprintf(analysis->reason, sizeof(analysis->reason), "out of memory");
+        goto out;
+    }
+
+    // u(t)'s parameter
+    struct Token t = { .type = TOK_IDENT, .s = "t", .len = 1 };
+    get_var(&a, &t)->def_level = 0;
+
+    prepass(&a);
+    a.stmt_start = true;
+    process(&a, 0, a.ntoks, false);
+    if (!a.stateful) {
+        end_statement(&a);
+        if (a.depth != 0)
+            parse_error(&a);
+    }
+
+    analysis->nondeterministic = a.nondeterministic;
+    if (a.stateful) {
+        analysis->kind = DWEET_STATEFUL;
+        snprintf(analysis->reason, sizeof(analysis->reason), "%s", a.reason);
+    } else if (!a.reset) {
+        analysis->kind = DWEET_ACCUMULATING;
+        snprintf(analysis->reason, sizeof(analysis->reason),
+            "draws over the previous frame");
+    } else {
+        analysis->kind = DWEET_STATELESS;
+    }
+
+out:
+    free(a.vars);
+    free(a.stack);
+    free(a.pending);
+    free(a.toks);
+    free(unpacked);
+}
+
+static bool
+is_name(const struct Token *tok, const char *const *names, size_t n)
+{
+    if (!tok || tok->type != TOK_IDENT)
+        return false;
+    for (size_t i = 0; i < n; i++)
+        if (tok_is(tok, names[i]))
+            return true;
+    return false;
+}
+
+// Whether the bracketed pattern closed at i, followed by = or a for-in/of
+// keyword, is a destructuring target that includes one of names
+static bool
+pattern_has_name(const struct Token *toks, int i, const char *const *names,
+    size_t n)
+{
+    int depth = 0;
+    for (int j = i; j >= 0; j--) {
+        const struct Token *t = &toks[j];
+        if (tok_is(t, ")") || tok_is(t, "]") || tok_is(t, "}"))
+            depth++;
+        else if (tok_is(t, "(") || tok_is(t, "[") || tok_is(t, "{"))
+            depth--;
+        if (depth == 0) {
+            // a[k] = ... writes a property, not a pattern
+            if (tok_is(t, "[") && j > 0 && is_operand_end(&toks[j - 1]))
+                return false;
+            for (int k = j + 1; k < i; k++)
+                if (is_name(&toks[k], names, n) && !tok_is(&toks[k - 1], ".") &&
+                    !tok_is(&toks[k - 1], "?."))
+                    return true;
+            return false;
+        }
+    }
+    return false;
+}
+
+bool
+analyze_rebinds(const char *code, const char *const *names, size_t n)
+{
+    char *unpacked = unpack(code);
+    struct Token *toks;
+    int ntoks = tokenize(unpacked ? unpacked : code, &toks);
+    if (ntoks < 0) {
+        free(unpacked);
+        return true;
+    }
+
+    bool rebinds = false;
+    for (int i = 0; i < ntoks && !rebinds; i++) {
+        const struct Token *tok = &toks[i];
+        const struct Token *prev = i > 0 ? &toks[i - 1] : NULL;
+        const struct Token *next = i + 1 < ntoks ? &toks[i + 1] : NULL;
+        bool target = tok_in(next, assign_ops) || tok_is(next, "of") ||
+            tok_is(next, "in");
+        bool global_object = tok_is(tok, "globalThis") ||
+            tok_is(tok, "window") || tok_is(tok, "self") ||
+            tok_is(tok, "this");
+        // globalThis.P is some other global
+        if (global_object && !tok_is(prev, ".") && tok_is(next, ".") &&
+            i + 2 < ntoks && toks[i + 2].type == TOK_IDENT &&
+            !is_name(&toks[i + 2], names, n))
+            continue;
+        if ((global_object || tok_in(tok, dynamic_globals) ||
+                tok_is(tok, "with")) &&
+            !tok_is(prev, ".") && !tok_is(prev, "?."))
+            rebinds = true;
+        else if ((tok_is(tok, "]") || tok_is(tok, "}")) && target)
+            rebinds = pattern_has_name(toks, i, names, n);
+        else if (is_name(tok, names, n) && !tok_is(prev, ".") &&
+            !tok_is(prev, "?."))
+            rebinds = target || tok_is(next, "++") || tok_is(next, "--") ||
+                tok_is(prev, "++") || tok_is(prev, "--");
+    }
+    free(toks);
+    free(unpacked);
+    return rebinds;
+}
+
+const char *
+analyze_kind_name(enum DweetKind kind)
+{
+    switch (kind) {
+    case DWEET_STATELESS:
+        return "stateless";
+    case DWEET_ACCUMULATING:
+        return "accumulating-canvas";
+    case DWEET_STATEFUL:
+        return "stateful-globals";
+    }
+    return "unknown";
+}
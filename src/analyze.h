@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Source-level classification of a dweet body, deciding whether frames can
+// be rendered independently of each other (e.g. in parallel, out of order).
+//
+// A dweet is stateless when it resets the canvas (c.width = ...) before
+// drawing anything and assigns every variable it reads earlier in the same
+// frame, so each frame depends only on t. The analysis is conservative:
+// anything it cannot follow (eval, writes to builtins, reads that might see
+// the previous frame's value) makes the dweet stateful.
+
+enum DweetKind {
+    DWEET_STATELESS,
+    // No canvas reset; every frame draws over the previous one
+    DWEET_ACCUMULATING,
+    // Carries values across frames in global variables
+    DWEET_STATEFUL,
+};
+
+struct DweetAnalysis {
+    enum DweetKind kind;
+    // Uses Math.random or the clock, so renders of the same t may differ
+    bool nondeterministic;
+    // Why the dweet isn't stateless, e.g. "reads f before assigning it"
+    char reason[96];
+};
+
+void
+analyze_dweet(const char *code, struct DweetAnalysis *analysis);
+const char *
+analyze_kind_name(enum DweetKind kind);
+
+// Whether running the dweet may give one of the n globals in names a new
+// value: by assigning it or applying ++ or -- to it, as part of a
+// destructuring or for-in/of target, or through code that can reach the
+// global object (eval, this, globalThis, ...). Like the classification it
+// errs towards true.
+bool
+analyze_rebinds(const char *code, const char *const *names, size_t n);
@@ -0,0 +1,215 @@
+#include "bench.h"
+
+#ifdef HAVE_PERF_EVENT
+#include "perfctr.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *phase_names[BENCH_NPHASES] = {
+    [BENCH_JS] = "js",
+    [BENCH_UPLOAD] = "upload",
+    [BENCH_PRESENT] = "present",
+};
+
+struct PhaseStats {
+    double begin;
+    double total;
+    double max;
+    double cpu_begin;
+    double cpu_total;
+#ifdef HAVE_PERF_EVENT
+    struct PerfSample counters_begin;
+    double counters_total[PERF_NCOUNTERS];
+#endif
+};
+
+#define BENCH_MAX_COUNTS 16
+
+struct Count {
+    const char *name;
+    uint64_t value;
+};
+
+struct Bench {
+    struct PhaseStats phases[BENCH_NPHASES];
+    struct Count counts[BENCH_MAX_COUNTS];
+    int ncounts;
+    uint64_t frames;
+    double start;
+    double cpu_start;
+    double origin;
+    // Origin to the end of the first bench_frame()
+    double ttff;
+#ifdef HAVE_PERF_EVENT
+    // NULL unless bench_enable_counters() found some
+    struct PerfCounters *counters;
+#endif
+};
+
+static double
+clock_seconds(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct Bench *
+bench_new(void)
+{
+    struct Bench *bench = calloc(1, sizeof(*bench));
+    if (!bench)
+        return NULL;
+    bench->start = clock_seconds(CLOCK_MONOTONIC);
+    bench->origin = bench->start;
+    bench->cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    return bench;
+}
+
+void
+bench_destroy(struct Bench *bench)
+{
+    if (!bench)
+        return;
+#ifdef HAVE_PERF_EVENT
+    perf_counters_close(bench->counters);
+#endif
+    free(bench);
+}
+
+int
+bench_enable_counters(struct Bench *bench)
+{
+#ifdef HAVE_PERF_EVENT
+    if (!bench->counters)
+        bench->counters = perf_counters_open();
+    return bench->counters ? 0 : -1;
+#else
+    (void) bench;
+    fprintf(stderr, "error: no hardware counters (built without "
+                    "perf_event_open); timings only\n");
+    return -1;
+#endif
+}
+
+void
+bench_begin(struct Bench *bench, enum BenchPhase phase)
+{
+    struct PhaseStats *p = &bench->phases[phase];
+    p->begin = clock_seconds(CLOCK_MONOTONIC);
+    p->cpu_begin = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+#ifdef HAVE_PERF_EVENT
+    // Last, and first in bench_end, to leave the clocks out of the counts
+    if (bench->counters &&
+        perf_counters_read(bench->counters, &p->counters_begin) < 0) {
+        perf_counters_close(bench->counters);
+        bench->counters = NULL;
+    }
+#endif
+}
+
+void
+bench_end(struct Bench *bench, enum BenchPhase phase)
+{
+    struct PhaseStats *p = &bench->phases[phase];
+#ifdef HAVE_PERF_EVENT
+    struct PerfSample now;
+    if (bench->counters && perf_counters_read(bench->counters, &now) == 0) {
+        double delta[PERF_NCOUNTERS];
+        perf_counters_delta(&p->counters_begin, &now, delta);
+        for (int i = 0; i < PERF_NCOUNTERS; i++)
+            p->counters_total[i] += delta[i];
+    }
+#endif
+    double elapsed = clock_seconds(CLOCK_MONOTONIC) - p->begin;
+    p->cpu_total += clock_seconds(CLOCK_THREAD_CPUTIME_ID) - p->cpu_begin;
+    p->total += elapsed;
+    if (elapsed > p->max)
+        p->max = elapsed;
+}
+
+void
+bench_frame(struct Bench *bench)
+{
+    if (bench->frames++ == 0)
+        bench->ttff = clock_seconds(CLOCK_MONOTONIC) - bench->origin;
+}
+
+void
+bench_set_origin(struct Bench *bench, double origin)
+{
+    bench->origin = origin;
+}
+
+void
+bench_set_count(struct Bench *bench, const char *name, uint64_t value)
+{
+    for (int i = 0; i < bench->ncounts; i++) {
+        if (strcmp(bench->counts[i].name, name) == 0) {
+            bench->counts[i].value = value;
+            return;
+        }
+    }
+    if (bench->ncounts < BENCH_MAX_COUNTS)
+        bench->counts[bench->ncounts++] = (struct Count) { name, value };
+}
+
+#ifdef HAVE_PERF_EVENT
+// Per-frame averages of the counters there are, and instructions per cycle
+static void
+write_counters(const struct PerfCounters *pc, const struct PhaseStats *p,
+    FILE *f, double n)
+{
+    for (int i = 0; i < PERF_NCOUNTERS; i++)
+        if (perf_counters_has(pc, i))
+            fprintf(f, ", \"%s\": %.0f", perf_counter_name(i),
+                p->counters_total[i] / n);
+    if (perf_counters_has(pc, PERF_CYCLES) &&
+        perf_counters_has(pc, PERF_INSTRUCTIONS) &&
+        p->counters_total[PERF_CYCLES] > 0)
+        fprintf(f, ", \"ipc\": %.3f",
+            (double) p->counters_total[PERF_INSTRUCTIONS] /
+                p->counters_total[PERF_CYCLES]);
+}
+#endif
+
+void
+bench_write_json(struct Bench *bench, FILE *f, const char *dweet,
+    const char *backend)
+{
+    double wall = clock_seconds(CLOCK_MONOTONIC) - bench->start;
+    double cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - bench->cpu_start;
+    double n = bench->frames ? (double) bench->frames : 1;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"dweet\": \"%s\",\n", dweet);
+    fprintf(f, "  \"backend\": \"%s\",\n", backend);
+    fprintf(f, "  \"frames\": %llu,\n", (unsigned long long) bench->frames);
+    fprintf(f, "  \"wall_s\": %.6f,\n", wall);
+    fprintf(f, "  \"fps\": %.2f,\n", wall > 0 ? bench->frames / wall : 0);
+    fprintf(f, "  \"cpu_ms_per_frame\": %.4f,\n", cpu * 1e3 / n);
+    fprintf(f, "  \"ttff_ms\": %.3f,\n", bench->ttff * 1e3);
+    for (int i = 0; i < bench->ncounts; i++)
+        fprintf(f, "  \"%s\": %llu,\n", bench->counts[i].name,
+            (unsigned long long) bench->counts[i].value);
+    fprintf(f, "  \"phases\": {\n");
+    for (int i = 0; i < BENCH_NPHASES; i++) {
+        struct PhaseStats *p = &bench->phases[i];
+        fprintf(f,
+            "    \"%s\": { \"avg_ms\": %.4f, \"max_ms\": %.4f, "
+            "\"cpu_avg_ms\": %.4f",
+            phase_names[i], p->total * 1e3 / n, p->max * 1e3,
+            p->cpu_total * 1e3 / n);
+#ifdef HAVE_PERF_EVENT
+        if (bench->counters)
+            write_counters(bench->counters, p, f, n);
+#endif
+        fprintf(f, " }%s\n", i + 1 < BENCH_NPHASES ? "," : "");
+    }
+    fprintf(f, "  }\n");
+    fprintf(f, "}\n");
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct Bench;
+
+enum BenchPhase {
+    BENCH_JS,      // u(t) including rasterization
+    BENCH_UPLOAD,  // handing the frame to the backend
+    BENCH_PRESENT, // present, including any wait for vsync or page flip
+    BENCH_NPHASES,
+};
+
+struct Bench *
+bench_new(void);
+void
+bench_destroy(struct Bench *bench);
+
+// Also count cycles, instructions, last level cache misses and branch
+// misses in each phase of the calling thread, reported per frame. Returns
+// -1, having said why, if the system has no counters to give; the
+// timings go on without them.
+int
+bench_enable_counters(struct Bench *bench);
+
+void
+bench_begin(struct Bench *bench, enum BenchPhase phase);
+void
+bench_end(struct Bench *bench, enum BenchPhase phase);
+// Count a presented frame
+void
+bench_frame(struct Bench *bench);
+// Time to first frame is measured from this CLOCK_MONOTONIC time in seconds
+// (default: when the bench was created), e.g. process start
+void
+bench_set_origin(struct Bench *bench, double origin);
+
+// Report a named count alongside the timings (e.g. scheduler statistics);
+// setting the same name again replaces the value
+void
+bench_set_count(struct Bench *bench, const char *name, uint64_t value);
+
+void
+bench_write_json(struct Bench *bench, FILE *f, const char *dweet,
+    const char *backend);
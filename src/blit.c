@@ -0,0 +1,452 @@
+#include "blit.h"
+
+#include "pixfmt.h"
+
+#include <stdbool.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLIT_X86 1
+#include <immintrin.h>
+#endif
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// The row loops are written once over the operator and instantiated per
+// operator, so each kernel is straight-line code for its blend
+struct Kernels {
+    void (*composite_row[BLIT_OP_COUNT])(uint32_t *dst, const uint32_t *src,
+        int width, unsigned alpha);
+    void (*fill_row[BLIT_OP_COUNT])(uint32_t *dst, uint32_t color, int width,
+        unsigned coverage);
+    void (*bilinear_row)(uint32_t *dst, const uint32_t *src0,
+        const uint32_t *src1, int src_width, int fy, int32_t u, int32_t du,
+        int width);
+};
+
+// ============================================================================
+// Scalar reference
+// ============================================================================
+
+// x * a / 255 rounded, for x, a <= 255
+static inline unsigned
+div255(unsigned x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t
+mul_px(uint32_t p, unsigned a)
+{
+    return div255((p & 0xFF) * a) | div255(((p >> 8) & 0xFF) * a) << 8 |
+        div255(((p >> 16) & 0xFF) * a) << 16 | div255((p >> 24) * a) << 24;
+}
+
+// One channel of op(s, d), saturating like the SIMD versions; sa and da are
+// the alphas, is_alpha whether this is the alpha channel itself
+static ALWAYS_INLINE unsigned
+composite_channel(enum BlitOp op, unsigned s, unsigned d, unsigned sa,
+    unsigned da, bool is_alpha)
+{
+    unsigned c;
+    switch (op) {
+    case BLIT_SRC_OVER:
+        c = s + div255(d * (255 - sa));
+        break;
+    case BLIT_COPY:
+        c = s;
+        break;
+    case BLIT_LIGHTER:
+        c = s + d;
+        break;
+    case BLIT_DST_OUT:
+        c = div255(d * (255 - sa));
+        break;
+    case BLIT_XOR:
+        c = div255(s * (255 - da)) + div255(d * (255 - sa));
+        break;
+    case BLIT_MULTIPLY:
+        c = is_alpha ? s + d - div255(s * d)
+                     : div255(s * (255 - da)) + div255(d * (255 - sa)) +
+                div255(s * d);
+        break;
+    default:
+        c = d;
+        break;
+    }
+    return c > 255 ? 255 : c;
+}
+
+static ALWAYS_INLINE uint32_t
+composite_px(enum BlitOp op, uint32_t s, uint32_t d)
+{
+    unsigned sa = s >> 24, da = d >> 24;
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        out |= (uint32_t) composite_channel(op, (s >> shift) & 0xFF,
+                   (d >> shift) & 0xFF, sa, da, shift == 24)
+            << shift;
+    return out;
+}
+
+// a * coverage + b * (255 - coverage), per channel
+static inline uint32_t
+mix_px(uint32_t a, uint32_t b, unsigned coverage)
+{
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        out |= div255(((a >> shift) & 0xFF) * coverage +
+                   ((b >> shift) & 0xFF) * (255 - coverage))
+            << shift;
+    return out;
+}
+
+static inline int
+clamp_x(int32_t x, int src_width)
+{
+    return x < 0 ? 0 : x >= src_width ? src_width - 1 : x;
+}
+
+static ALWAYS_INLINE void
+composite_row_scalar(enum BlitOp op, uint32_t *dst, const uint32_t *src,
+    int width, unsigned alpha)
+{
+    for (int x = 0; x < width; x++) {
+        uint32_t s = alpha == 255 ? src[x] : mul_px(src[x], alpha);
+        dst[x] = composite_px(op, s, dst[x]);
+    }
+}
+
+static ALWAYS_INLINE void
+fill_row_scalar(enum BlitOp op, uint32_t *dst, uint32_t color, int width,
+    unsigned coverage)
+{
+    for (int x = 0; x < width; x++) {
+        uint32_t c = composite_px(op, color, dst[x]);
+        dst[x] = coverage == 255 ? c : mix_px(c, dst[x], coverage);
+    }
+}
+
+#define SPECIALIZE_SCALAR(name, op)                                          \
+    static void name##_composite_scalar(uint32_t *dst, const uint32_t *src, \
+        int width, unsigned alpha)                                           \
+    {                                                                        \
+        composite_row_scalar(op, dst, src, width, alpha);                    \
+    }                                                                        \
+    static void name##_fill_scalar(uint32_t *dst, uint32_t color, int width, \
+        unsigned coverage)                                                   \
+    {                                                                        \
+        fill_row_scalar(op, dst, color, width, coverage);                    \
+    }
+
+SPECIALIZE_SCALAR(over, BLIT_SRC_OVER)
+SPECIALIZE_SCALAR(copy, BLIT_COPY)
+SPECIALIZE_SCALAR(lighter, BLIT_LIGHTER)
+SPECIALIZE_SCALAR(dst_out, BLIT_DST_OUT)
+SPECIALIZE_SCALAR(xor, BLIT_XOR)
+SPECIALIZE_SCALAR(multiply, BLIT_MULTIPLY)
+
+static inline uint32_t
+bilinear(uint32_t p00, uint32_t p01, uint32_t p10, uint32_t p11, int fx,
+    int fy)
+{
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int left = ((p00 >> shift) & 0xFF) * (128 - fy) +
+            ((p10 >> shift) & 0xFF) * fy;
+        int right = ((p01 >> shift) & 0xFF) * (128 - fy) +
+            ((p11 >> shift) & 0xFF) * fy;
+        out |= (uint32_t) ((left * (128 - fx) + right * fx + 8192) >> 14)
+            << shift;
+    }
+    return out;
+}
+
+static void
+bilinear_row_scalar(uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+    int src_width, int fy, int32_t u, int32_t du, int width)
+{
+    for (int x = 0; x < width; x++, u += du) {
+        int32_t i = u >> 16;
+        int x0 = clamp_x(i, src_width), x1 = clamp_x(i + 1, src_width);
+        int fx = (u >> 9) & 127;
+        dst[x] = bilinear(src0[x0], src0[x1], src1[x0], src1[x1], fx, fy);
+    }
+}
+
+static const struct Kernels scalar_kernels = {
+    .composite_row = {
+        [BLIT_SRC_OVER] = over_composite_scalar,
+        [BLIT_COPY] = copy_composite_scalar,
+        [BLIT_LIGHTER] = lighter_composite_scalar,
+        [BLIT_DST_OUT] = dst_out_composite_scalar,
+        [BLIT_XOR] = xor_composite_scalar,
+        [BLIT_MULTIPLY] = multiply_composite_scalar,
+    },
+    .fill_row = {
+        [BLIT_SRC_OVER] = over_fill_scalar,
+        [BLIT_COPY] = copy_fill_scalar,
+        [BLIT_LIGHTER] = lighter_fill_scalar,
+        [BLIT_DST_OUT] = dst_out_fill_scalar,
+        [BLIT_XOR] = xor_fill_scalar,
+        [BLIT_MULTIPLY] = multiply_fill_scalar,
+    },
+    .bilinear_row = bilinear_row_scalar,
+};
+
+#ifdef BLIT_X86
+
+// ============================================================================
+// SSE2 (also used when AVX2 is selected; these rows are bound by the
+// scattered loads, not the arithmetic)
+// ============================================================================
+
+// 16-bit lanes x * a / 255 rounded, for x, a <= 255
+static inline __m128i
+div255_sse2(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i
+mul_sse2(__m128i x, __m128i a)
+{
+    return div255_sse2(_mm_mullo_epi16(x, a));
+}
+
+static inline __m128i
+alpha_sse2(__m128i px)
+{
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+        _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// op(s, d) for two pixels widened to 16 bits; results above 255 saturate
+// when packed
+static ALWAYS_INLINE __m128i
+composite2_sse2(enum BlitOp op, __m128i s, __m128i d)
+{
+    const __m128i c255 = _mm_set1_epi16(255);
+    __m128i isa = _mm_sub_epi16(c255, alpha_sse2(s));
+    __m128i ida = _mm_sub_epi16(c255, alpha_sse2(d));
+    switch (op) {
+    case BLIT_SRC_OVER:
+        return _mm_add_epi16(s, mul_sse2(d, isa));
+    case BLIT_COPY:
+        return s;
+    case BLIT_LIGHTER:
+        return _mm_add_epi16(s, d);
+    case BLIT_DST_OUT:
+        return mul_sse2(d, isa);
+    case BLIT_XOR:
+        return _mm_add_epi16(mul_sse2(s, ida), mul_sse2(d, isa));
+    case BLIT_MULTIPLY: {
+        const __m128i alpha = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+        __m128i sd = mul_sse2(s, d);
+        __m128i c = _mm_add_epi16(
+            _mm_add_epi16(mul_sse2(s, ida), mul_sse2(d, isa)), sd);
+        __m128i a = _mm_sub_epi16(_mm_add_epi16(s, d), sd);
+        return _mm_or_si128(_mm_andnot_si128(alpha, c),
+            _mm_and_si128(alpha, a));
+    }
+    default:
+        return d;
+    }
+}
+
+static ALWAYS_INLINE void
+composite_row_sse2(enum BlitOp op, uint32_t *dst, const uint32_t *src,
+    int width, unsigned alpha)
+{
+    const __m128i opaque = _mm_set1_epi32((int) 0xFF000000);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i a16 = _mm_set1_epi16((short) alpha);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + x));
+        // Source-over of opaque runs is a copy, of transparent ones a no-op
+        if (op == BLIT_SRC_OVER) {
+            if (alpha == 255 &&
+                _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, opaque),
+                    opaque)) == 0xFFFF) {
+                _mm_storeu_si128((__m128i *) (dst + x), s);
+                continue;
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xFFFF)
+                continue;
+        }
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + x));
+        __m128i slo = _mm_unpacklo_epi8(s, zero);
+        __m128i shi = _mm_unpackhi_epi8(s, zero);
+        if (alpha != 255) {
+            slo = mul_sse2(slo, a16);
+            shi = mul_sse2(shi, a16);
+        }
+        __m128i lo = composite2_sse2(op, slo, _mm_unpacklo_epi8(d, zero));
+        __m128i hi = composite2_sse2(op, shi, _mm_unpackhi_epi8(d, zero));
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(lo, hi));
+    }
+    composite_row_scalar(op, dst + x, src + x, width - x, alpha);
+}
+
+// Partial coverage only happens on rect edges, which stay scalar
+static ALWAYS_INLINE void
+fill_row_sse2(enum BlitOp op, uint32_t *dst, uint32_t color, int width,
+    unsigned coverage)
+{
+    int x = 0;
+    if (coverage == 255) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i c = _mm_set1_epi32((int) color);
+        __m128i c16 = _mm_unpacklo_epi8(c, zero);
+        for (; x + 4 <= width; x += 4) {
+            if (op == BLIT_COPY ||
+                (op == BLIT_SRC_OVER && (color >> 24) == 255)) {
+                _mm_storeu_si128((__m128i *) (dst + x), c);
+                continue;
+            }
+            __m128i d = _mm_loadu_si128((const __m128i *) (dst + x));
+            __m128i lo = composite2_sse2(op, c16, _mm_unpacklo_epi8(d, zero));
+            __m128i hi = composite2_sse2(op, c16, _mm_unpackhi_epi8(d, zero));
+            _mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(lo, hi));
+        }
+    }
+    fill_row_scalar(op, dst + x, color, width - x, coverage);
+}
+
+#define SPECIALIZE_SSE2(name, op)                                            \
+    static void name##_composite_sse2(uint32_t *dst, const uint32_t *src,   \
+        int width, unsigned alpha)                                           \
+    {                                                                        \
+        composite_row_sse2(op, dst, src, width, alpha);                      \
+    }                                                                        \
+    static void name##_fill_sse2(uint32_t *dst, uint32_t color, int width,   \
+        unsigned coverage)                                                   \
+    {                                                                        \
+        fill_row_sse2(op, dst, color, width, coverage);                      \
+    }
+
+SPECIALIZE_SSE2(over, BLIT_SRC_OVER)
+SPECIALIZE_SSE2(copy, BLIT_COPY)
+SPECIALIZE_SSE2(lighter, BLIT_LIGHTER)
+SPECIALIZE_SSE2(dst_out, BLIT_DST_OUT)
+SPECIALIZE_SSE2(xor, BLIT_XOR)
+SPECIALIZE_SSE2(multiply, BLIT_MULTIPLY)
+
+// One bilinear sample as four 32-bit channels
+static inline __m128i
+bilinear1_sse2(uint32_t p00, uint32_t p01, uint32_t p10, uint32_t p11, int fx,
+    __m128i wy0, __m128i wy1)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i top = _mm_unpacklo_epi8(
+        _mm_unpacklo_epi32(_mm_cvtsi32_si128((int) p00),
+            _mm_cvtsi32_si128((int) p01)),
+        zero);
+    __m128i bottom = _mm_unpacklo_epi8(
+        _mm_unpacklo_epi32(_mm_cvtsi32_si128((int) p10),
+            _mm_cvtsi32_si128((int) p11)),
+        zero);
+    // Left pixel channels in the low half, right in the high half
+    __m128i v = _mm_add_epi16(_mm_mullo_epi16(top, wy0),
+        _mm_mullo_epi16(bottom, wy1));
+    __m128i lr = _mm_unpacklo_epi16(v, _mm_srli_si128(v, 8));
+    __m128i wx = _mm_set1_epi32((fx << 16) | (128 - fx));
+    return _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(lr, wx),
+                              _mm_set1_epi32(8192)),
+        14);
+}
+
+static void
+bilinear_row_sse2(uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+    int src_width, int fy, int32_t u, int32_t du, int width)
+{
+    const __m128i wy0 = _mm_set1_epi16((short) (128 - fy));
+    const __m128i wy1 = _mm_set1_epi16((short) fy);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i px[4];
+        for (int k = 0; k < 4; k++, u += du) {
+            int32_t i = u >> 16;
+            int x0 = clamp_x(i, src_width), x1 = clamp_x(i + 1, src_width);
+            px[k] = bilinear1_sse2(src0[x0], src0[x1], src1[x0], src1[x1],
+                (u >> 9) & 127, wy0, wy1);
+        }
+        _mm_storeu_si128((__m128i *) (dst + x),
+            _mm_packus_epi16(_mm_packs_epi32(px[0], px[1]),
+                _mm_packs_epi32(px[2], px[3])));
+    }
+    bilinear_row_scalar(dst + x, src0, src1, src_width, fy, u, du, width - x);
+}
+
+static const struct Kernels sse2_kernels = {
+    .composite_row = {
+        [BLIT_SRC_OVER] = over_composite_sse2,
+        [BLIT_COPY] = copy_composite_sse2,
+        [BLIT_LIGHTER] = lighter_composite_sse2,
+        [BLIT_DST_OUT] = dst_out_composite_sse2,
+        [BLIT_XOR] = xor_composite_sse2,
+        [BLIT_MULTIPLY] = multiply_composite_sse2,
+    },
+    .fill_row = {
+        [BLIT_SRC_OVER] = over_fill_sse2,
+        [BLIT_COPY] = copy_fill_sse2,
+        [BLIT_LIGHTER] = lighter_fill_sse2,
+        [BLIT_DST_OUT] = dst_out_fill_sse2,
+        [BLIT_XOR] = xor_fill_sse2,
+        [BLIT_MULTIPLY] = multiply_fill_sse2,
+    },
+    .bilinear_row = bilinear_row_sse2,
+};
+
+#endif // BLIT_X86
+
+// ============================================================================
+// Dispatch
+// ============================================================================
+
+static const struct Kernels *
+get_kernels(void)
+{
+#ifdef BLIT_X86
+    if (pixfmt_get_isa() >= PIXFMT_SSE2)
+        return &sse2_kernels;
+#endif
+    return &scalar_kernels;
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+void
+blit_composite_row(enum BlitOp op, uint32_t *dst, const uint32_t *src,
+    int width, unsigned alpha)
+{
+    get_kernels()->composite_row[op](dst, src, width, alpha);
+}
+
+void
+blit_fill_row(enum BlitOp op, uint32_t *dst, uint32_t color, int width,
+    unsigned coverage)
+{
+    if (coverage > 0)
+        get_kernels()->fill_row[op](dst, color, width, coverage);
+}
+
+// Nothing to vectorize without a gather; the copy is what it costs
+void
+blit_nearest_row(uint32_t *dst, const uint32_t *src, int src_width, int32_t u,
+    int32_t du, int width)
+{
+    for (int x = 0; x < width; x++, u += du)
+        dst[x] = src[clamp_x(u >> 16, src_width)];
+}
+
+void
+blit_bilinear_row(uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+    int src_width, int fy, int32_t u, int32_t du, int width)
+{
+    get_kernels()->bilinear_row(dst, src0, src1, src_width, fy, u, du, width);
+}
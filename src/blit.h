@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+// Row kernels for compositing premultiplied ARGB32 spans in the canvas fast
+// paths. As in pixfmt, each has a scalar reference and SIMD versions with
+// identical output; the instruction set follows pixfmt_set_isa().
+
+// Canvas composite operations that have kernels (globalCompositeOperation
+// names in comments)
+enum BlitOp {
+    BLIT_SRC_OVER, // source-over
+    BLIT_COPY,     // copy
+    BLIT_LIGHTER,  // lighter
+    BLIT_DST_OUT,  // destination-out
+    BLIT_XOR,      // xor
+    BLIT_MULTIPLY, // multiply
+    BLIT_OP_COUNT,
+};
+
+// dst = op(src * alpha / 255, dst)
+void
+blit_composite_row(enum BlitOp op, uint32_t *dst, const uint32_t *src,
+    int width, unsigned alpha);
+// dst = op(color, dst), mixed with the old dst by coverage / 255
+void
+blit_fill_row(enum BlitOp op, uint32_t *dst, uint32_t color, int width,
+    unsigned coverage);
+
+// Resample width pixels from a row of src_width pixels. u is the source x of
+// the first sample in 16.16 fixed point and du the step; samples outside the
+// row clamp to its edge pixels.
+void
+blit_nearest_row(uint32_t *dst, const uint32_t *src, int src_width, int32_t u,
+    int32_t du, int width);
+// Bilinear between rows src0 and src1, weighting src1 by fy / 128. u is the
+// sample position minus half a pixel, so whole values hit pixel centers.
+void
+blit_bilinear_row(uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+    int src_width, int fy, int32_t u, int32_t du, int width);
@@ -0,0 +1,131 @@
+#include "budget.h"
+
+#include "dweet.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *policy_names[] = {
+    [BUDGET_RESTART] = "restart",
+    [BUDGET_EXIT] = "exit",
+};
+
+#define MB(bytes) ((double) (bytes) / (1 << 20))
+
+void
+budget_init(struct Budget *budget, size_t limit, enum BudgetPolicy policy,
+    size_t display, double interval, bool print)
+{
+    *budget = (struct Budget) {
+        .limit = limit,
+        .policy = policy,
+        .display = display,
+        .interval = interval,
+        .print = print,
+        .next = -1,
+    };
+}
+
+static size_t
+total(const struct Budget *budget, const struct DweetMemory *mem)
+{
+    return mem->js_heap + mem->surfaces + mem->surfaces_cached +
+        mem->scratch + budget->display;
+}
+
+static void
+print_memory(const struct Budget *budget, const struct DweetMemory *mem)
+{
+    fprintf(stderr, "memory: js %.1f MB (%llu objects", MB(mem->js_heap),
+        (unsigned long long) mem->js_objects);
+    if (mem->js_limit)
+        fprintf(stderr, ", limit %.1f MB", MB(mem->js_limit));
+    fprintf(stderr,
+        "), canvases %.1f MB + %.1f MB cached, scratch %.1f MB, "
+        "display %.1f MB, total %.1f MB",
+        MB(mem->surfaces), MB(mem->surfaces_cached), MB(mem->scratch),
+        MB(budget->display), MB(total(budget, mem)));
+    if (budget->limit)
+        fprintf(stderr, " of %.1f MB", MB(budget->limit));
+    fprintf(stderr, "\n");
+}
+
+static enum BudgetAction
+over_budget(struct Budget *budget)
+{
+    if (budget->policy == BUDGET_EXIT) {
+        fprintf(stderr, "memory: over budget, exiting\n");
+        return BUDGET_DO_EXIT;
+    }
+    fprintf(stderr, "memory: over budget, restarting the dweet\n");
+    return BUDGET_DO_RESTART;
+}
+
+enum BudgetAction
+budget_check(struct Budget *budget, struct Dweet *dweet, double now,
+    bool force)
+{
+    if (!budget->limit && !budget->print)
+        return BUDGET_OK;
+    if (!force && now < budget->next)
+        return BUDGET_OK;
+    budget->next = now + budget->interval;
+
+    struct DweetMemory mem;
+    dweet_memory(dweet, &mem);
+    size_t used = total(budget, &mem);
+    if (used > budget->peak)
+        budget->peak = used;
+    if (budget->print)
+        print_memory(budget, &mem);
+    if (!budget->limit || used <= budget->limit)
+        return BUDGET_OK;
+
+    // Degrade before giving up on the dweet: garbage it no longer reaches
+    // and memory kept only for speed may be all it takes
+    dweet_trim_memory(dweet);
+    budget->trims++;
+    dweet_memory(dweet, &mem);
+    used = total(budget, &mem);
+    if (used <= budget->limit) {
+        fprintf(stderr, "memory: over the %.1f MB budget, trimmed to %.1f MB\n",
+            MB(budget->limit), MB(used));
+        return BUDGET_OK;
+    }
+    print_memory(budget, &mem);
+    return over_budget(budget);
+}
+
+enum BudgetAction
+budget_out_of_memory(struct Budget *budget)
+{
+    fprintf(stderr, "memory: the dweet ran out of JS heap\n");
+    return over_budget(budget);
+}
+
+void
+budget_restarted(struct Budget *budget)
+{
+    budget->restarts++;
+    budget->next = -1;
+}
+
+void
+budget_print_stats(const struct Budget *budget)
+{
+    fprintf(stderr, "memory: peak %.1f MB, %lu trims, %lu restarts\n",
+        MB(budget->peak), budget->trims, budget->restarts);
+}
+
+int
+budget_parse_policy(const char *name, enum BudgetPolicy *policy)
+{
+    for (unsigned i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]);
+         i++) {
+        if (strcmp(name, policy_names[i]) == 0) {
+            *policy = i;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct Dweet;
+
+// What the player does when a dweet stays over its memory budget after
+// garbage collection and freeing every cache, or runs out of JS heap
+enum BudgetPolicy {
+    // Tear the dweet down and load it afresh; t carries on
+    BUDGET_RESTART,
+    // Quit with BUDGET_EXIT_STATUS so a supervisor can restart the player
+    BUDGET_EXIT,
+};
+
+#define BUDGET_EXIT_STATUS 3
+
+enum BudgetAction {
+    BUDGET_OK,
+    BUDGET_DO_RESTART,
+    BUDGET_DO_EXIT,
+};
+
+struct Budget {
+    // Total bytes allowed (0 = none), with the policy for going over it
+    size_t limit;
+    enum BudgetPolicy policy;
+    // Memory outside the dweet counted in the total: the frame texture and
+    // ring slots
+    size_t display;
+    // Seconds between checks, and print each one
+    double interval;
+    bool print;
+
+    double next;
+    size_t peak;
+    unsigned long trims;
+    unsigned long restarts;
+};
+
+void
+budget_init(struct Budget *budget, size_t limit, enum BudgetPolicy policy,
+    size_t display, double interval, bool print);
+// Measure dweet if a check is due at now (always when force is set), trim
+// it if it is over the limit and say what to do if that wasn't enough.
+// Measuring walks the JS heap, which is why it only runs every interval.
+enum BudgetAction
+budget_check(struct Budget *budget, struct Dweet *dweet, double now,
+    bool force);
+// The action for a dweet that ran out of JS heap
+enum BudgetAction
+budget_out_of_memory(struct Budget *budget);
+// Count a restart and check the new dweet from scratch
+void
+budget_restarted(struct Budget *budget);
+void
+budget_print_stats(const struct Budget *budget);
+
+int
+budget_parse_policy(const char *name, enum BudgetPolicy *policy);
@@ -1,7 +1,17 @@
 #include "canvas.h"
 
+#include "blit.h"
+#include "disc.h"
+#include "gradient.h"
+#include "hairline.h"
+#include "pixfmt.h"
 #include "plutovg.h"
+#include "record.h"
+#include "scanfill.h"
+#include "surfpool.h"
 
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,43 +20,314 @@ struct Canvas {
     unsigned width;
     unsigned height;
 
+    // Size of the backing surface; differs from width x height when the
+    // canvas is rasterized at a lower resolution than it reports to JS
+    unsigned surface_width;
+    unsigned surface_height;
+    // Height of the whole rendering and the first row of it the surface
+    // holds; surface_height and 0 unless the canvas renders in bands
+    unsigned raster_height;
+    unsigned band_y;
+    // Where the pixels come from; NULL for plain malloc
+    struct SurfacePool *surfaces;
+    // Made by document.createElement or OffscreenCanvas: resizable and
+    // transparent where the main canvas is fixed and white
+    bool offscreen;
+
     struct Context2D *ctx2d;
 };
 
+// Surface-sized pixel buffers, shared between the context and the ImageData
+// arrays getImageData lends to JS, which may outlive the context
+struct PixelPool {
+    int refs;
+    struct SurfacePool *surfaces;
+    size_t frame_size;
+    // Surface memory, NULL while rendering into an external target
+    unsigned char *active;
+    // active holds straight RGBA from putImageData, not yet premultiplied
+    bool rgba;
+    unsigned char *spare;
+    // Buffers JS still references
+    struct LentPixels {
+        unsigned char *data;
+        size_t size;
+        // From surfaces rather than malloc
+        bool pooled;
+    } *lent;
+    unsigned nlent, lent_cap;
+    bool closed;
+};
+
+// globalCompositeOperation values. blit is the span kernel (-1: PlutoVG
+// only, so no fast paths); layer marks kernels PlutoVG has no operator for,
+// whose general paths go through a layer (see layer_begin).
+static const struct CompositeOp {
+    const char *name;
+    plutovg_operator_t pvg;
+    int blit;
+    bool layer;
+} composite_ops[] = {
+    {"source-over", PLUTOVG_OPERATOR_SRC_OVER, BLIT_SRC_OVER, false},
+    {"copy", PLUTOVG_OPERATOR_SRC, BLIT_COPY, false},
+    {"lighter", PLUTOVG_OPERATOR_SRC_OVER, BLIT_LIGHTER, true},
+    {"destination-out", PLUTOVG_OPERATOR_DST_OUT, BLIT_DST_OUT, false},
+    {"xor", PLUTOVG_OPERATOR_XOR, BLIT_XOR, false},
+    {"multiply", PLUTOVG_OPERATOR_SRC_OVER, BLIT_MULTIPLY, true},
+    {"source-in", PLUTOVG_OPERATOR_SRC_IN, -1, false},
+    {"source-out", PLUTOVG_OPERATOR_SRC_OUT, -1, false},
+    {"source-atop", PLUTOVG_OPERATOR_SRC_ATOP, -1, false},
+    {"destination-over", PLUTOVG_OPERATOR_DST_OVER, -1, false},
+    {"destination-in", PLUTOVG_OPERATOR_DST_IN, -1, false},
+    {"destination-atop", PLUTOVG_OPERATOR_DST_ATOP, -1, false},
+};
+
+// Copy of the current path for the hairline stroker, in user space like
+// PlutoVG's own
+struct PathSeg {
+    enum { SEG_MOVE, SEG_LINE, SEG_ARC, SEG_CLOSE } op;
+    bool ccw;
+    // x, y; for arcs x, y, radius, start and end angle
+    float v[5];
+};
+
+// What the current device matrix does, so fast paths can test it with one
+// comparison: kinds up to MATRIX_SCALE keep b == c == 0
+enum MatrixKind {
+    MATRIX_IDENTITY,
+    MATRIX_TRANSLATE,
+    MATRIX_SCALE,
+    MATRIX_GENERAL,
+};
+
+// Samples per pixel along each axis in ANTIALIAS_SUPERSAMPLE
+#define SUPERSAMPLE_GRID 4
+
+// Depth of save() that restore() can undo; deeper saves only count levels
+#define STATE_STACK_SIZE 32
+
+// Drawing state that save() and restore() cover (the path is not part of it)
+struct SavedState {
+    plutovg_matrix_t matrix;
+    enum MatrixKind matrix_kind;
+    plutovg_color_t fillStyle;
+    struct Gradient *fill_gradient;
+    plutovg_color_t strokeStyle;
+    float opacity;
+    float line_width;
+    float font_size;
+    const struct CompositeOp *composite;
+    enum Antialias antialias;
+    bool image_smoothing;
+};
+
 struct Context2D {
     struct Canvas *canvas;
 
     plutovg_surface_t *pvg_surface;
     plutovg_canvas_t *pvg_canvas;
+    struct PixelPool *pool;
+    // The surface has yet to get its initial white clear, which waits for
+    // the first own_pixels() so a canvas that is reset before anything
+    // reads it never pays for it
+    bool clear_pending;
+    // The PlutoVG path has segments; it can't be carried to a new surface
+    bool path_pending;
+    struct PathSeg *path;
+    unsigned npath, path_cap;
+    // False once a segment could not be recorded
+    bool path_complete;
+    // Stroke thin lines with hairline_line() instead of PlutoVG
+    bool hairline;
+
+    // Maps canvas coordinates to surface pixels, applied under every
+    // user transform
+    plutovg_matrix_t base_matrix;
+    // User transform followed by base_matrix, as set on the PlutoVG canvas
+    plutovg_matrix_t matrix;
+    enum MatrixKind matrix_kind;
+
+    struct SavedState states[STATE_STACK_SIZE];
+    unsigned nstates;
+    // save() calls past the end of states
+    unsigned states_lost;
 
     plutovg_color_t fillStyle;
+    // Fill style when it is a gradient rather than fillStyle
+    struct Gradient *fill_gradient;
     plutovg_color_t strokeStyle;
 
+    // Loaded by the first fillText; most dweets never draw text
     plutovg_font_face_t *font_face;
+    bool font_loaded;
     float font_size;
+
+    bool image_smoothing;
+    enum Antialias antialias;
+    // What reset goes back to
+    enum Antialias antialias_default;
+    // Rasterizer for the sampled antialiasing modes, made on first use
+    struct Scanfill *scanfill;
+    // Snapshot of the source rect when drawing the canvas onto itself
+    unsigned char *scratch;
+    size_t scratch_size;
+
+    const struct CompositeOp *composite;
+    // Pixels under the active layer, box in device pixels
+    unsigned char *layer;
+    size_t layer_size;
+    int layer_x0, layer_y0, layer_x1, layer_y1;
+
+    bool raster;
+    // Where drawing calls go while raster is off, or NULL
+    struct Recording *recording;
 };
 
+// Append a call to the context's recording, if it has one
+#define RECORD(ctx2d, ...)                          \
+    do {                                            \
+        if ((ctx2d)->recording)                     \
+            recording_add((ctx2d)->recording,       \
+                &(struct RecordCmd) {__VA_ARGS__}); \
+    } while (0)
+
+static bool
+pool_is_lent(const struct PixelPool *pool, const unsigned char *data)
+{
+    for (unsigned i = 0; i < pool->nlent; i++)
+        if (pool->lent[i].data == data)
+            return true;
+    return false;
+}
+
+static unsigned char *
+pool_take(struct PixelPool *pool)
+{
+    unsigned char *data = pool->spare;
+    pool->spare = NULL;
+    return data ? data : surface_pool_take(pool->surfaces, pool->frame_size);
+}
+
+// Hand back a buffer the surface no longer uses (JS may still hold it)
+static void
+pool_give(struct PixelPool *pool, unsigned char *data)
+{
+    if (!data || pool_is_lent(pool, data))
+        return;
+    if (!pool->spare && !pool->closed)
+        pool->spare = data;
+    else
+        surface_pool_give(pool->surfaces, data, pool->frame_size);
+}
+
+static void
+pool_unref(struct PixelPool *pool)
+{
+    if (--pool->refs > 0)
+        return;
+    surface_pool_give(pool->surfaces, pool->spare, pool->frame_size);
+    free(pool->lent);
+    free(pool);
+}
+
+static void
+set_matrix(struct Context2D *ctx2d, const plutovg_matrix_t *m)
+{
+    ctx2d->matrix = *m;
+    // A product that overflowed to infinity or NaN must not reach the
+    // rect fast paths, which would clamp it to the whole surface
+    if (m->b != 0 || m->c != 0 ||
+        !isfinite(m->a + m->b + m->c + m->d + m->e + m->f))
+        ctx2d->matrix_kind = MATRIX_GENERAL;
+    else if (m->a != 1 || m->d != 1)
+        ctx2d->matrix_kind = MATRIX_SCALE;
+    else if (m->e != 0 || m->f != 0)
+        ctx2d->matrix_kind = MATRIX_TRANSLATE;
+    else
+        ctx2d->matrix_kind = MATRIX_IDENTITY;
+    plutovg_canvas_set_matrix(ctx2d->pvg_canvas, m);
+}
+
+static void
+drop_states(struct Context2D *ctx2d)
+{
+    while (ctx2d->nstates > 0)
+        gradient_unref(ctx2d->states[--ctx2d->nstates].fill_gradient);
+    ctx2d->states_lost = 0;
+}
+
+// Canvas coordinates to the rendering's resolution, less the rows above the
+// band the surface holds
+static void
+set_base_matrix(struct Context2D *ctx2d)
+{
+    const struct Canvas *canvas = ctx2d->canvas;
+    plutovg_matrix_init_scale(&ctx2d->base_matrix,
+        (float) canvas->surface_width / canvas->width,
+        (float) canvas->raster_height / canvas->height);
+    ctx2d->base_matrix.f = -(float) canvas->band_y;
+}
+
 static struct Context2D *
 ctx2d_new(struct Canvas *canvas)
 {
     struct Context2D *ctx2d = malloc(sizeof(*ctx2d));
-    if (!ctx2d)
+    struct PixelPool *pool = calloc(1, sizeof(*pool));
+    if (!ctx2d || !pool) {
+        free(ctx2d);
+        free(pool);
         return NULL;
+    }
 
     *ctx2d = (struct Context2D) {
         .canvas = canvas,
+        .pool = pool,
+        .image_smoothing = true,
+        .antialias = ANTIALIAS_ANALYTIC,
+        .antialias_default = ANTIALIAS_ANALYTIC,
+        .composite = &composite_ops[0],
+        .path_complete = true,
+        .hairline = true,
+        .raster = true,
     };
 
-    ctx2d->pvg_surface = plutovg_surface_create(canvas->width, canvas->height);
+    // The context owns the pixel memory so putImageData can swap in the
+    // buffer it was given
+    int stride = canvas->surface_width * 4;
+    pool->refs = 1;
+    pool->surfaces = canvas->surfaces;
+    pool->frame_size = (size_t) stride * canvas->surface_height;
+    pool->active = pool_take(pool);
+    ctx2d->pvg_surface = pool->active
+        ? plutovg_surface_create_for_data(pool->active, canvas->surface_width,
+              canvas->surface_height, stride)
+        : NULL;
+    if (!ctx2d->pvg_surface) {
+        surface_pool_give(pool->surfaces, pool->active, pool->frame_size);
+        free(pool);
+        free(ctx2d);
+        return NULL;
+    }
     ctx2d->pvg_canvas = plutovg_canvas_create(ctx2d->pvg_surface);
 
-    // Clear to white (dwitter default)
-    plutovg_surface_clear(ctx2d->pvg_surface, &PLUTOVG_WHITE_COLOR);
+    set_base_matrix(ctx2d);
+    set_matrix(ctx2d, &ctx2d->base_matrix);
+
+    // Clear to white (dwitter default) on first use
+    ctx2d->clear_pending = true;
 
     ctx2d->fillStyle = PLUTOVG_BLACK_COLOR;
     ctx2d->strokeStyle = PLUTOVG_BLACK_COLOR;
     plutovg_canvas_set_opacity(ctx2d->pvg_canvas, 1.0f);
+    ctx2d->font_size = 10.0f;
 
+    return ctx2d;
+}
+
+static void
+load_font(struct Context2D *ctx2d)
+{
+    ctx2d->font_loaded = true;
     // Try to load a default font (prefer fonts with good Unicode coverage)
     static const char *font_paths[] = {
         "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf",
@@ -56,15 +337,11 @@ ctx2d_new(struct Canvas *canvas)
         "C:\\Windows\\Fonts\\arial.ttf",
         NULL
     };
-    ctx2d->font_face = NULL;
     for (const char **path = font_paths; *path; path++) {
         ctx2d->font_face = plutovg_font_face_load_from_file(*path, 0);
         if (ctx2d->font_face)
             break;
     }
-    ctx2d->font_size = 10.0f;
-
-    return ctx2d;
 }
 
 static void
@@ -74,13 +351,123 @@ ctx2d_destroy(struct Context2D *ctx2d)
         return;
     if (ctx2d->font_face)
         plutovg_font_face_destroy(ctx2d->font_face);
+    gradient_unref(ctx2d->fill_gradient);
+    drop_states(ctx2d);
+    free(ctx2d->scratch);
+    free(ctx2d->layer);
+    free(ctx2d->path);
+    scanfill_destroy(ctx2d->scanfill);
     plutovg_canvas_destroy(ctx2d->pvg_canvas);
     plutovg_surface_destroy(ctx2d->pvg_surface);
+    struct PixelPool *pool = ctx2d->pool;
+    pool->closed = true;
+    pool_give(pool, pool->active);
+    pool->active = NULL;
+    pool_unref(pool);
     free(ctx2d);
 }
 
+// Point the context at new pixel memory (owned: from the pool), optionally
+// copying the current pixels. The new surface has the canvas's surface size,
+// which only differs from the old one's when a resize doesn't copy.
+// Transform, alpha and line width carry over.
+static int
+replace_surface(struct Context2D *ctx2d, unsigned char *data, int stride,
+    bool owned, bool copy)
+{
+    int width = ctx2d->canvas->surface_width;
+    int height = ctx2d->canvas->surface_height;
+    plutovg_surface_t *surface = plutovg_surface_create_for_data(data, width,
+        height, stride);
+    if (!surface)
+        return -1;
+    plutovg_canvas_t *pvg_canvas = plutovg_canvas_create(surface);
+    if (!pvg_canvas) {
+        plutovg_surface_destroy(surface);
+        return -1;
+    }
+
+    if (copy) {
+        unsigned char *old_data = plutovg_surface_get_data(ctx2d->pvg_surface);
+        int old_stride = plutovg_surface_get_stride(ctx2d->pvg_surface);
+        for (int y = 0; y < height; y++)
+            memcpy(data + (size_t) y * stride,
+                old_data + (size_t) y * old_stride, (size_t) width * 4);
+    }
+
+    plutovg_canvas_set_matrix(pvg_canvas, &ctx2d->matrix);
+    plutovg_canvas_set_opacity(pvg_canvas,
+        plutovg_canvas_get_opacity(ctx2d->pvg_canvas));
+    plutovg_canvas_set_line_width(pvg_canvas,
+        plutovg_canvas_get_line_width(ctx2d->pvg_canvas));
+    plutovg_canvas_set_operator(pvg_canvas, ctx2d->composite->pvg);
+
+    plutovg_canvas_destroy(ctx2d->pvg_canvas);
+    plutovg_surface_destroy(ctx2d->pvg_surface);
+    ctx2d->pvg_canvas = pvg_canvas;
+    ctx2d->pvg_surface = surface;
+    ctx2d->path_pending = false;
+    if (!copy)
+        ctx2d->clear_pending = false;
+    ctx2d->npath = 0;
+    ctx2d->path_complete = true;
+
+    struct PixelPool *pool = ctx2d->pool;
+    pool_give(pool, pool->active);
+    pool->active = owned ? data : NULL;
+    pool->rgba = false;
+    return 0;
+}
+
+// What the canvas shows where nothing was drawn: dwitter's white page for
+// the main canvas, transparent black for offscreen ones as in browsers
+static const plutovg_color_t *
+background(const struct Context2D *ctx2d)
+{
+    static const plutovg_color_t white = PLUTOVG_WHITE_COLOR;
+    static const plutovg_color_t transparent = PLUTOVG_TRANSPARENT_COLOR;
+    return ctx2d->canvas->offscreen ? &transparent : &white;
+}
+
+// Premultiply what putImageData left in the surface before anything reads
+// or draws on it (keep = false when it is about to be overwritten). If JS
+// still holds that memory, the surface moves to a fresh buffer instead.
+static void
+own_pixels(struct Context2D *ctx2d, bool keep)
+{
+    if (ctx2d->clear_pending) {
+        ctx2d->clear_pending = false;
+        if (keep)
+            plutovg_surface_clear(ctx2d->pvg_surface, background(ctx2d));
+    }
+    struct PixelPool *pool = ctx2d->pool;
+    if (!pool->rgba)
+        return;
+    unsigned char *data = pool->active;
+    int width = plutovg_surface_get_width(ctx2d->pvg_surface);
+    int height = plutovg_surface_get_height(ctx2d->pvg_surface);
+    int stride = width * 4;
+
+    // With a path pending the surface can't be replaced; converting in place
+    // means the ImageData sees the premultiplied pixels, which is the lesser
+    // evil
+    if (pool_is_lent(pool, data) && !ctx2d->path_pending) {
+        unsigned char *copy = pool_take(pool);
+        if (copy) {
+            if (keep)
+                pixfmt_rgba_to_argb(copy, stride, data, stride, width, height);
+            if (replace_surface(ctx2d, copy, stride, true, false) == 0)
+                return;
+            pool_give(pool, copy);
+        }
+    }
+    if (keep)
+        pixfmt_rgba_to_argb(data, stride, data, stride, width, height);
+    pool->rgba = false;
+}
+
 struct Canvas *
-canvas_new(unsigned width, unsigned height)
+canvas_new(unsigned width, unsigned height, struct SurfacePool *surfaces)
 {
     struct Canvas *canvas = malloc(sizeof(*canvas));
     if (!canvas)
@@ -88,11 +475,28 @@ canvas_new(unsigned width, unsigned height)
     *canvas = (struct Canvas) {
         .width = width,
         .height = height,
+        .surface_width = width,
+        .surface_height = height,
+        .raster_height = height,
+        .surfaces = surfaces,
         .ctx2d = NULL,
     };
     return canvas;
 }
 
+struct Canvas *
+canvas_new_offscreen(unsigned width, unsigned height,
+    struct SurfacePool *surfaces)
+{
+    if (width > CANVAS_MAX_SIZE || height > CANVAS_MAX_SIZE)
+        return NULL;
+    struct Canvas *canvas = canvas_new(width ? width : 1, height ? height : 1,
+        surfaces);
+    if (canvas)
+        canvas->offscreen = true;
+    return canvas;
+}
+
 void
 canvas_destroy(struct Canvas *canvas)
 {
@@ -102,6 +506,38 @@ canvas_destroy(struct Canvas *canvas)
     free(canvas);
 }
 
+void
+canvas_set_resolution(struct Canvas *canvas, unsigned width, unsigned height)
+{
+    // Only takes effect before the context (and its surface) is created
+    if (canvas->ctx2d || width == 0 || height == 0)
+        return;
+    canvas->surface_width = width;
+    canvas->surface_height = height;
+    canvas->raster_height = height;
+}
+
+static void
+ctx2d_reset(struct Context2D *ctx2d);
+
+int
+canvas_set_band(struct Canvas *canvas, unsigned y, unsigned rows)
+{
+    if (rows == 0 || y >= canvas->raster_height)
+        return -1;
+    if (!canvas->ctx2d) {
+        canvas->surface_height = rows;
+        canvas->band_y = y;
+        return 0;
+    }
+    if (rows != canvas->surface_height)
+        return -1;
+    canvas->band_y = y;
+    set_base_matrix(canvas->ctx2d);
+    ctx2d_reset(canvas->ctx2d);
+    return 0;
+}
+
 struct Context2D *
 canvas_getContext(struct Canvas *canvas, const char *contextType)
 {
@@ -117,20 +553,74 @@ canvas_getContext(struct Canvas *canvas, const char *contextType)
     return ctx2d;
 }
 
-static void
-ctx2d_reset(struct Context2D *ctx2d);
-
 unsigned
 canvas_width_get(struct Canvas *canvas)
 {
     return canvas->width;
 }
 
-void
+// Give an offscreen canvas's context a blank surface of the canvas's new
+// size. ImageData that JS still holds keeps its old buffer, which
+// ctx2d_image_data_free returns to the shared pool.
+static int
+ctx2d_resize(struct Context2D *ctx2d)
+{
+    struct Canvas *canvas = ctx2d->canvas;
+    struct PixelPool *pool = ctx2d->pool;
+    size_t size = (size_t) canvas->surface_width * canvas->surface_height * 4;
+    unsigned char *data = surface_pool_take(pool->surfaces, size);
+    unsigned char *old = pool->active;
+    // Keep replace_surface from taking the old buffer as the spare
+    pool->active = NULL;
+    if (!data ||
+        replace_surface(ctx2d, data, canvas->surface_width * 4, true, false) <
+            0) {
+        surface_pool_give(pool->surfaces, data, size);
+        pool->active = old;
+        return -1;
+    }
+    if (old && !pool_is_lent(pool, old))
+        surface_pool_give(pool->surfaces, old, pool->frame_size);
+    surface_pool_give(pool->surfaces, pool->spare, pool->frame_size);
+    pool->spare = NULL;
+    pool->frame_size = size;
+    // Cleared on first use, or right away by the reset that follows
+    ctx2d->clear_pending = true;
+    return 0;
+}
+
+static int
+canvas_resize(struct Canvas *canvas, unsigned width, unsigned height)
+{
+    if (width > CANVAS_MAX_SIZE || height > CANVAS_MAX_SIZE)
+        return -1;
+    width = width ? width : 1;
+    height = height ? height : 1;
+    unsigned old_width = canvas->width, old_height = canvas->height;
+    canvas->surface_width = canvas->width = width;
+    canvas->surface_height = canvas->raster_height = canvas->height = height;
+    if (!canvas->ctx2d)
+        return 0;
+    if ((width != old_width || height != old_height) &&
+        ctx2d_resize(canvas->ctx2d) < 0) {
+        canvas->surface_width = canvas->width = old_width;
+        canvas->surface_height = canvas->raster_height = canvas->height =
+            old_height;
+        return -1;
+    }
+    ctx2d_reset(canvas->ctx2d);
+    return 0;
+}
+
+int
 canvas_width_set(struct Canvas *canvas, unsigned val)
 {
+    // The main canvas keeps dwitter's size; setting it only clears
+    if (canvas->offscreen)
+        return canvas_resize(canvas, val, canvas->height);
     if (canvas->ctx2d)
         ctx2d_reset(canvas->ctx2d);
+    return 0;
 }
 
 unsigned
@@ -139,29 +629,48 @@ canvas_height_get(struct Canvas *canvas)
     return canvas->height;
 }
 
-void
+int
 canvas_height_set(struct Canvas *canvas, unsigned val)
 {
+    if (canvas->offscreen)
+        return canvas_resize(canvas, canvas->width, val);
     if (canvas->ctx2d)
         ctx2d_reset(canvas->ctx2d);
+    return 0;
 }
 
 static void
 ctx2d_reset(struct Context2D *ctx2d)
 {
-    // Clear to white (dwitter default)
-    plutovg_surface_clear(ctx2d->pvg_surface, &PLUTOVG_WHITE_COLOR);
+    if (ctx2d->recording)
+        recording_reset(ctx2d->recording);
+    // Clear to white (dwitter default), or transparent offscreen
+    if (ctx2d->raster) {
+        own_pixels(ctx2d, false);
+        plutovg_surface_clear(ctx2d->pvg_surface, background(ctx2d));
+    }
 
     // Reset path
     plutovg_canvas_new_path(ctx2d->pvg_canvas);
+    ctx2d->path_pending = false;
+    ctx2d->npath = 0;
+    ctx2d->path_complete = true;
 
-    // Reset transform
-    plutovg_canvas_reset_matrix(ctx2d->pvg_canvas);
+    // Reset transform and state stack
+    set_matrix(ctx2d, &ctx2d->base_matrix);
+    drop_states(ctx2d);
 
     // Reset properties to defaults
     ctx2d->fillStyle = PLUTOVG_BLACK_COLOR;
+    gradient_unref(ctx2d->fill_gradient);
+    ctx2d->fill_gradient = NULL;
     ctx2d->strokeStyle = PLUTOVG_BLACK_COLOR;
     plutovg_canvas_set_opacity(ctx2d->pvg_canvas, 1.0f);
+    plutovg_canvas_set_line_width(ctx2d->pvg_canvas, 1.0f);
+    ctx2d->image_smoothing = true;
+    ctx2d->antialias = ctx2d->antialias_default;
+    ctx2d->composite = &composite_ops[0];
+    plutovg_canvas_set_operator(ctx2d->pvg_canvas, ctx2d->composite->pvg);
 }
 
 // Instance properties
@@ -187,7 +696,20 @@ color_to_argb(plutovg_color_t c)
 void
 ctx2d_fillStyle_set(struct Context2D *ctx2d, uint32_t color)
 {
+    RECORD(ctx2d, REC_FILL_STYLE, {color});
     ctx2d->fillStyle = color_from_argb(color);
+    gradient_unref(ctx2d->fill_gradient);
+    ctx2d->fill_gradient = NULL;
+}
+
+void
+ctx2d_fillStyle_set_gradient(struct Context2D *ctx2d,
+    struct Gradient *gradient)
+{
+    RECORD(ctx2d, REC_FILL_GRADIENT, .ptr = gradient);
+    gradient_ref(gradient);
+    gradient_unref(ctx2d->fill_gradient);
+    ctx2d->fill_gradient = gradient;
 }
 
 uint32_t
@@ -199,6 +721,7 @@ ctx2d_fillStyle_get(struct Context2D *ctx2d)
 void
 ctx2d_globalAlpha_set(struct Context2D *ctx2d, double globalAlpha)
 {
+    RECORD(ctx2d, REC_GLOBAL_ALPHA, {globalAlpha});
     if (globalAlpha < 0.0)
         globalAlpha = 0.0;
     if (globalAlpha > 1.0)
@@ -215,6 +738,7 @@ ctx2d_globalAlpha_get(struct Context2D *ctx2d)
 void
 ctx2d_lineWidth_set(struct Context2D *ctx2d, double lineWidth)
 {
+    RECORD(ctx2d, REC_LINE_WIDTH, {lineWidth});
     plutovg_canvas_set_line_width(ctx2d->pvg_canvas, (float) lineWidth);
 }
 
@@ -224,88 +748,1426 @@ ctx2d_lineWidth_get(struct Context2D *ctx2d)
     return plutovg_canvas_get_line_width(ctx2d->pvg_canvas);
 }
 
+void
+ctx2d_imageSmoothingEnabled_set(struct Context2D *ctx2d, bool enabled)
+{
+    RECORD(ctx2d, REC_IMAGE_SMOOTHING, {enabled});
+    ctx2d->image_smoothing = enabled;
+}
+
+bool
+ctx2d_imageSmoothingEnabled_get(struct Context2D *ctx2d)
+{
+    return ctx2d->image_smoothing;
+}
+
+static const char *const antialias_names[] = {
+    [ANTIALIAS_NONE] = "none",
+    [ANTIALIAS_ANALYTIC] = "analytic",
+    [ANTIALIAS_SUPERSAMPLE] = "supersample",
+};
+
+int
+antialias_parse(const char *name, enum Antialias *mode)
+{
+    for (size_t i = 0; i < sizeof(antialias_names) / sizeof(*antialias_names);
+        i++) {
+        if (strcmp(name, antialias_names[i]) == 0) {
+            *mode = (enum Antialias) i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *
+antialias_name(enum Antialias mode)
+{
+    return antialias_names[mode];
+}
+
+int
+ctx2d_antialias_set(struct Context2D *ctx2d, const char *name)
+{
+    if (antialias_parse(name, &ctx2d->antialias) < 0)
+        return -1;
+    RECORD(ctx2d, REC_ANTIALIAS, {ctx2d->antialias});
+    return 0;
+}
+
+const char *
+ctx2d_antialias_get(struct Context2D *ctx2d)
+{
+    return antialias_name(ctx2d->antialias);
+}
+
+int
+ctx2d_globalCompositeOperation_set(struct Context2D *ctx2d, const char *name)
+{
+    for (size_t i = 0; i < sizeof(composite_ops) / sizeof(composite_ops[0]);
+        i++) {
+        if (strcmp(name, composite_ops[i].name) == 0) {
+            ctx2d->composite = &composite_ops[i];
+            RECORD(ctx2d, REC_COMPOSITE, .ptr = composite_ops[i].name);
+            plutovg_canvas_set_operator(ctx2d->pvg_canvas,
+                composite_ops[i].pvg);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *
+ctx2d_globalCompositeOperation_get(struct Context2D *ctx2d)
+{
+    return ctx2d->composite->name;
+}
+
 // Instance functions
 
-void
-ctx2d_fillRect(struct Context2D *ctx2d, double x, double y, double w, double h)
+// Operators PlutoVG lacks: the shape is drawn source-over onto a cleared
+// patch of the surface, which is then blended back over the saved pixels
+// with the span kernel. extents is in user space, as PlutoVG reports them
+// (NULL: whole surface).
+// Returns false if the draw can't touch any pixel.
+static bool
+layer_begin(struct Context2D *ctx2d, const plutovg_rect_t *extents)
+{
+    int width = plutovg_surface_get_width(ctx2d->pvg_surface);
+    int height = plutovg_surface_get_height(ctx2d->pvg_surface);
+    int x0 = 0, y0 = 0, x1 = width, y1 = height;
+    if (extents) {
+        plutovg_rect_t box;
+        plutovg_matrix_map_rect(&ctx2d->matrix, extents, &box);
+        // A pixel of slack for antialiasing
+        x0 = (int) fmax(floor(box.x) - 1, 0);
+        y0 = (int) fmax(floor(box.y) - 1, 0);
+        x1 = (int) fmin(ceil(box.x + box.w) + 1, width);
+        y1 = (int) fmin(ceil(box.y + box.h) + 1, height);
+        if (x0 >= x1 || y0 >= y1)
+            return false;
+    }
+
+    size_t row_size = (size_t) (x1 - x0) * 4;
+    size_t size = row_size * (y1 - y0);
+    if (size > ctx2d->layer_size) {
+        unsigned char *layer = realloc(ctx2d->layer, size);
+        if (!layer)
+            return false;
+        ctx2d->layer = layer;
+        ctx2d->layer_size = size;
+    }
+    unsigned char *data = plutovg_surface_get_data(ctx2d->pvg_surface);
+    int stride = plutovg_surface_get_stride(ctx2d->pvg_surface);
+    for (int y = y0; y < y1; y++) {
+        unsigned char *row = data + (size_t) y * stride + (size_t) x0 * 4;
+        memcpy(ctx2d->layer + (y - y0) * row_size, row, row_size);
+        memset(row, 0, row_size);
+    }
+    ctx2d->layer_x0 = x0;
+    ctx2d->layer_y0 = y0;
+    ctx2d->layer_x1 = x1;
+    ctx2d->layer_y1 = y1;
+    return true;
+}
+
+static void
+layer_end(struct Context2D *ctx2d)
 {
+    unsigned char *data = plutovg_surface_get_data(ctx2d->pvg_surface);
+    int stride = plutovg_surface_get_stride(ctx2d->pvg_surface);
+    int w = ctx2d->layer_x1 - ctx2d->layer_x0;
+    size_t row_size = (size_t) w * 4;
+    for (int y = ctx2d->layer_y0; y < ctx2d->layer_y1; y++) {
+        unsigned char *row =
+            data + (size_t) y * stride + (size_t) ctx2d->layer_x0 * 4;
+        unsigned char *saved = ctx2d->layer + (y - ctx2d->layer_y0) * row_size;
+        blit_composite_row(ctx2d->composite->blit, (uint32_t *) saved,
+            (const uint32_t *) row, w, 255);
+        memcpy(row, saved, row_size);
+    }
+}
+
+// Select the fill style on the PlutoVG canvas; false if it paints nothing
+static bool
+set_fill_paint(struct Context2D *ctx2d)
+{
+    if (ctx2d->fill_gradient) {
+        plutovg_paint_t *paint = gradient_get_paint(ctx2d->fill_gradient);
+        if (!paint)
+            return false;
+        plutovg_canvas_set_paint(ctx2d->pvg_canvas, paint);
+        return true;
+    }
     plutovg_color_t *c = &ctx2d->fillStyle;
     plutovg_canvas_set_rgba(ctx2d->pvg_canvas, c->r, c->g, c->b, c->a);
+    return true;
+}
+
+// Premultiplied ARGB32 of c drawn at opacity
+static uint32_t
+premultiply(const plutovg_color_t *c, double opacity)
+{
+    double a = c->a * opacity * 255;
+    return (uint32_t) (a + 0.5) << 24 | (uint32_t) (c->r * a + 0.5) << 16 |
+        (uint32_t) (c->g * a + 0.5) << 8 | (uint32_t) (c->b * a + 0.5);
+}
+
+// Shrink a device box to the whole pixels whose centers it covers, for
+// ANTIALIAS_NONE
+static void
+snap_box(double *left, double *right, double *top, double *bottom)
+{
+    *left = ceil(*left - 0.5);
+    *right = ceil(*right - 0.5);
+    *top = ceil(*top - 0.5);
+    *bottom = ceil(*bottom - 0.5);
+}
+
+static inline uint32_t
+byte_mul(uint32_t x, uint32_t a)
+{
+    uint32_t t = (x & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+    x = ((x >> 8) & 0xff00ff) * a;
+    x = x + ((x >> 8) & 0xff00ff) + 0x800080;
+    x &= 0xff00ff00;
+    return x | t;
+}
+
+// fillRect with a linear gradient under a scale/translate transform, which
+// is how dweets paint gradient backgrounds: shade straight from the
+// gradient's color table instead of going through the rasterizer. Returns
+// false if the fast path doesn't apply.
+static bool
+fill_rect_linear_gradient(struct Context2D *ctx2d, double x, double y,
+    double w, double h)
+{
+    struct Gradient *gradient = ctx2d->fill_gradient;
+    const plutovg_matrix_t m = ctx2d->matrix;
+    if (ctx2d->matrix_kind == MATRIX_GENERAL ||
+        gradient_get_type(gradient) != GRADIENT_LINEAR || m.a == 0 ||
+        m.d == 0 || ctx2d->composite->blit != BLIT_SRC_OVER)
+        return false;
+
+    const uint32_t *lut = gradient_get_lut(gradient);
+    if (!lut)
+        return true;
+
+    // Rect in device pixels, clipped to the surface
+    int width = plutovg_surface_get_width(ctx2d->pvg_surface);
+    int height = plutovg_surface_get_height(ctx2d->pvg_surface);
+    double left = fmax(fmin(m.a * x, m.a * (x + w)) + m.e, 0);
+    double right = fmin(fmax(m.a * x, m.a * (x + w)) + m.e, width);
+    double top = fmax(fmin(m.d * y, m.d * (y + h)) + m.f, 0);
+    double bottom = fmin(fmax(m.d * y, m.d * (y + h)) + m.f, height);
+    if (ctx2d->antialias == ANTIALIAS_NONE)
+        snap_box(&left, &right, &top, &bottom);
+    if (!(left < right && top < bottom))
+        return true;
+
+    // Gradient offset as a linear function of the device position
+    double gx0, gy0, gr0, gx1, gy1, gr1;
+    gradient_get_geometry(gradient, &gx0, &gy0, &gr0, &gx1, &gy1, &gr1);
+    double dx = gx1 - gx0, dy = gy1 - gy0;
+    double len2 = dx * dx + dy * dy;
+    // A gradient of zero length paints nothing
+    if (len2 == 0)
+        return true;
+    double tx = dx / (m.a * len2);
+    double ty = dy / (m.d * len2);
+    double t0 = ((-m.e / m.a - gx0) * dx + (-m.f / m.d - gy0) * dy) / len2;
+
+    double opacity = plutovg_canvas_get_opacity(ctx2d->pvg_canvas);
+    unsigned char *data = plutovg_surface_get_data(ctx2d->pvg_surface);
+    int stride = plutovg_surface_get_stride(ctx2d->pvg_surface);
+    int px0 = (int) left, px1 = (int) ceil(right);
+    int py0 = (int) top, py1 = (int) ceil(bottom);
+
+    for (int py = py0; py < py1; py++) {
+        uint32_t *row = (uint32_t *) (data + (size_t) py * stride);
+        double cov_y = (fmin(py + 1, bottom) - fmax(py, top)) * opacity;
+        double t = t0 + ty * (py + 0.5) + tx * (px0 + 0.5);
+        for (int px = px0; px < px1; px++, t += tx) {
+            double cov = cov_y;
+            if (px == px0 || px == px1 - 1)
+                cov *= fmin(px + 1, right) - fmax(px, left);
+            // NaN (from a transform that overflows) takes the first
+            // color rather than an undefined index
+            int i = !(t > 0) ? 0
+                : t >= 1     ? GRADIENT_LUT_SIZE - 1
+                             : (int) (t * (GRADIENT_LUT_SIZE - 1) + 0.5);
+            uint32_t src = lut[i];
+            uint32_t a = (uint32_t) (cov * 255 + 0.5);
+            if (a < 255)
+                src = byte_mul(src, a);
+            row[px] = src + byte_mul(row[px], 255 - (src >> 24));
+        }
+    }
+    return true;
+}
+
+// Whether fill_rect_color() can draw with the current transform and
+// operator
+static bool
+can_fill_rect_color(const struct Context2D *ctx2d)
+{
+    return ctx2d->matrix_kind != MATRIX_GENERAL && ctx2d->composite->blit >= 0;
+}
+
+// Solid rect in color (premultiplied) under a scale/translate transform,
+// with an operator that has a span kernel: interior rows are one kernel
+// call, edges get their exact coverage
+static void
+fill_rect_color(struct Context2D *ctx2d, double x, double y, double w,
+    double h, uint32_t color)
+{
+    const plutovg_matrix_t m = ctx2d->matrix;
+    enum BlitOp op = ctx2d->composite->blit;
+
+    int width = plutovg_surface_get_width(ctx2d->pvg_surface);
+    int height = plutovg_surface_get_height(ctx2d->pvg_surface);
+    double left = fmax(fmin(m.a * x, m.a * (x + w)) + m.e, 0);
+    double right = fmin(fmax(m.a * x, m.a * (x + w)) + m.e, width);
+    double top = fmax(fmin(m.d * y, m.d * (y + h)) + m.f, 0);
+    double bottom = fmin(fmax(m.d * y, m.d * (y + h)) + m.f, height);
+    if (ctx2d->antialias == ANTIALIAS_NONE)
+        snap_box(&left, &right, &top, &bottom);
+    if (!(left < right && top < bottom))
+        return;
+
+    unsigned char *data = plutovg_surface_get_data(ctx2d->pvg_surface);
+    int stride = plutovg_surface_get_stride(ctx2d->pvg_surface);
+    int px0 = (int) left, px1 = (int) ceil(right);
+    int py0 = (int) top, py1 = (int) ceil(bottom);
+    double cov_left = fmin(px0 + 1, right) - left;
+    double cov_right = right - fmax(px1 - 1, left);
+    for (int py = py0; py < py1; py++) {
+        uint32_t *row = (uint32_t *) (data + (size_t) py * stride);
+        double cov_y = fmin(py + 1, bottom) - fmax(py, top);
+        unsigned cov = (unsigned) (cov_y * 255 + 0.5);
+        if (px1 - px0 == 1) {
+            blit_fill_row(op, row + px0, color, 1,
+                (unsigned) ((right - left) * cov_y * 255 + 0.5));
+            continue;
+        }
+        blit_fill_row(op, row + px0, color, 1,
+            (unsigned) (cov_left * cov_y * 255 + 0.5));
+        blit_fill_row(op, row + px0 + 1, color, px1 - px0 - 2, cov);
+        blit_fill_row(op, row + px1 - 1, color, 1,
+            (unsigned) (cov_right * cov_y * 255 + 0.5));
+    }
+}
+
+// fillRect in fillStyle by fill_rect_color(). Returns false if the fast
+// path doesn't apply.
+static bool
+fill_rect_solid(struct Context2D *ctx2d, double x, double y, double w,
+    double h)
+{
+    if (!can_fill_rect_color(ctx2d))
+        return false;
+    fill_rect_color(ctx2d, x, y, w, h,
+        premultiply(&ctx2d->fillStyle,
+            plutovg_canvas_get_opacity(ctx2d->pvg_canvas)));
+    return true;
+}
+
+// Solid fillRect under a transform that turns it, in the sampled
+// antialiasing modes (axis-aligned rects take fill_rect_solid). Returns
+// false if the fast path doesn't apply.
+static bool
+fill_rect_sampled(struct Context2D *ctx2d, double x, double y, double w,
+    double h)
+{
+    if (ctx2d->antialias == ANTIALIAS_ANALYTIC || ctx2d->composite->blit < 0)
+        return false;
+    if (!ctx2d->scanfill && !(ctx2d->scanfill = scanfill_new()))
+        return false;
+
+    const plutovg_matrix_t *m = &ctx2d->matrix;
+    double ux[4] = { x, x + w, x + w, x }, uy[4] = { y, y, y + h, y + h };
+    float dx[4], dy[4];
+    for (int i = 0; i < 4; i++) {
+        dx[i] = (float) (m->a * ux[i] + m->c * uy[i] + m->e);
+        dy[i] = (float) (m->b * ux[i] + m->d * uy[i] + m->f);
+    }
+    struct Scanfill *sf = ctx2d->scanfill;
+    scanfill_reset(sf);
+    for (int i = 0; i < 4; i++)
+        if (scanfill_line(sf, dx[i], dy[i], dx[(i + 1) % 4],
+                dy[(i + 1) % 4]) < 0)
+            return false;
+
+    uint32_t color = premultiply(&ctx2d->fillStyle,
+        plutovg_canvas_get_opacity(ctx2d->pvg_canvas));
+    int samples = ctx2d->antialias == ANTIALIAS_NONE ? 1 : SUPERSAMPLE_GRID;
+    uint32_t *data = (uint32_t *) plutovg_surface_get_data(ctx2d->pvg_surface);
+    int stride = plutovg_surface_get_stride(ctx2d->pvg_surface) / 4;
+    int width = plutovg_surface_get_width(ctx2d->pvg_surface);
+    int height = plutovg_surface_get_height(ctx2d->pvg_surface);
+    return scanfill_fill(sf, data, stride, width, height,
+               ctx2d->composite->blit, color, samples) == 0;
+}
+
+void
+ctx2d_fillRect(struct Context2D *ctx2d, double x, double y, double w, double h)
+{
+    RECORD(ctx2d, REC_FILL_RECT, {x, y, w, h});
+    // Like browsers, ignore rects with infinite or NaN sides, which the
+    // fast paths would clamp to the whole surface
+    if (!ctx2d->raster || !isfinite(x + y + w + h))
+        return;
+    own_pixels(ctx2d, true);
+    if (ctx2d->fill_gradient
+            ? fill_rect_linear_gradient(ctx2d, x, y, w, h)
+            : (fill_rect_solid(ctx2d, x, y, w, h) ||
+                  fill_rect_sampled(ctx2d, x, y, w, h)))
+        return;
+    if (!set_fill_paint(ctx2d))
+        return;
+    plutovg_rect_t extents = {(float) x, (float) y, (float) w, (float) h};
+    bool layer = ctx2d->composite->layer;
+    if (layer && !layer_begin(ctx2d, &extents))
+        return;
     plutovg_canvas_fill_rect(ctx2d->pvg_canvas, (float) x, (float) y, (float) w,
         (float) h);
+    if (layer)
+        layer_end(ctx2d);
+}
+
+static inline plutovg_color_t
+rgba_color(const uint8_t *c)
+{
+    return (plutovg_color_t) {
+        c[0] / 255.0f, c[1] / 255.0f, c[2] / 255.0f, c[3] / 255.0f,
+    };
+}
+
+void
+ctx2d_fillRects(struct Context2D *ctx2d, const float *rects,
+    const uint8_t *colors, size_t count, size_t stride)
+{
+    if (ctx2d->recording)
+        recording_add_rects(ctx2d->recording, rects, colors, count, stride);
+    if (!ctx2d->raster || count == 0)
+        return;
+    own_pixels(ctx2d, true);
+    double opacity = plutovg_canvas_get_opacity(ctx2d->pvg_canvas);
+
+    if (can_fill_rect_color(ctx2d) && (colors || !ctx2d->fill_gradient)) {
+        uint32_t color = premultiply(&ctx2d->fillStyle, opacity);
+        for (size_t i = 0; i < count; i++) {
+            const float *r = rects + i * stride;
+            if (!isfinite(r[0] + r[1] + r[2] + r[3]))
+                continue;
+            if (colors) {
+                plutovg_color_t c = rgba_color(colors + i * 4);
+                color = premultiply(&c, opacity);
+            }
+            fill_rect_color(ctx2d, r[0], r[1], r[2], r[3], color);
+        }
+        return;
+    }
+
+    // Transforms that turn rects, and operators without a span kernel, go
+    // through fillRect one rect at a time; colors stand in for fillStyle
+    plutovg_color_t fill_style = ctx2d->fillStyle;
+    struct Gradient *fill_gradient = ctx2d->fill_gradient;
+    if (colors)
+        ctx2d->fill_gradient = NULL;
+    for (size_t i = 0; i < count; i++) {
+        const float *r = rects + i * stride;
+        if (colors)
+            ctx2d->fillStyle = rgba_color(colors + i * 4);
+        ctx2d_fillRect(ctx2d, r[0], r[1], r[2], r[3]);
+    }
+    ctx2d->fillStyle = fill_style;
+    ctx2d->fill_gradient = fill_gradient;
 }
 
 void
 ctx2d_clearRect(struct Context2D *ctx2d, double x, double y, double w, double h)
 {
+    RECORD(ctx2d, REC_CLEAR_RECT, {x, y, w, h});
     // Clear to white (dwitter's page background)
     // In browsers, clearRect makes pixels transparent, revealing the page
     // background. For dwitter compatibility, we clear to white since that's
-    // dwitter's background.
+    // dwitter's background. Offscreen canvases do become transparent.
+    if (!ctx2d->raster)
+        return;
+    own_pixels(ctx2d, true);
     float opacity = plutovg_canvas_get_opacity(ctx2d->pvg_canvas);
     plutovg_canvas_set_opacity(ctx2d->pvg_canvas, 1.0f);
-    plutovg_canvas_set_rgba(ctx2d->pvg_canvas, 1, 1, 1, 1);
+    const plutovg_color_t *bg = background(ctx2d);
+    plutovg_canvas_set_rgba(ctx2d->pvg_canvas, bg->r, bg->g, bg->b, bg->a);
     plutovg_canvas_set_operator(ctx2d->pvg_canvas, PLUTOVG_OPERATOR_SRC);
     plutovg_canvas_fill_rect(ctx2d->pvg_canvas, (float) x, (float) y, (float) w,
         (float) h);
-    plutovg_canvas_set_operator(ctx2d->pvg_canvas, PLUTOVG_OPERATOR_SRC_OVER);
+    plutovg_canvas_set_operator(ctx2d->pvg_canvas, ctx2d->composite->pvg);
     plutovg_canvas_set_opacity(ctx2d->pvg_canvas, opacity);
 }
 
+static struct PathSeg *
+path_add(struct Context2D *ctx2d, int op)
+{
+    ctx2d->path_pending = true;
+    if (ctx2d->npath == ctx2d->path_cap) {
+        unsigned cap = ctx2d->path_cap ? ctx2d->path_cap * 2 : 64;
+        struct PathSeg *path = realloc(ctx2d->path, cap * sizeof(*path));
+        if (!path) {
+            ctx2d->path_complete = false;
+            return NULL;
+        }
+        ctx2d->path = path;
+        ctx2d->path_cap = cap;
+    }
+    struct PathSeg *seg = &ctx2d->path[ctx2d->npath++];
+    seg->op = op;
+    seg->ccw = false;
+    return seg;
+}
+
 void
 ctx2d_beginPath(struct Context2D *ctx2d)
 {
+    RECORD(ctx2d, REC_BEGIN_PATH);
     plutovg_canvas_new_path(ctx2d->pvg_canvas);
+    ctx2d->path_pending = false;
+    ctx2d->npath = 0;
+    ctx2d->path_complete = true;
+}
+
+void
+ctx2d_moveTo(struct Context2D *ctx2d, double x, double y)
+{
+    RECORD(ctx2d, REC_MOVE_TO, {x, y});
+    plutovg_canvas_move_to(ctx2d->pvg_canvas, (float) x, (float) y);
+    struct PathSeg *seg = path_add(ctx2d, SEG_MOVE);
+    if (seg) {
+        seg->v[0] = (float) x;
+        seg->v[1] = (float) y;
+    }
+}
+
+void
+ctx2d_lineTo(struct Context2D *ctx2d, double x, double y)
+{
+    RECORD(ctx2d, REC_LINE_TO, {x, y});
+    plutovg_canvas_line_to(ctx2d->pvg_canvas, (float) x, (float) y);
+    struct PathSeg *seg = path_add(ctx2d, SEG_LINE);
+    if (seg) {
+        seg->v[0] = (float) x;
+        seg->v[1] = (float) y;
+    }
+}
+
+void
+ctx2d_closePath(struct Context2D *ctx2d)
+{
+    RECORD(ctx2d, REC_CLOSE_PATH);
+    plutovg_canvas_close_path(ctx2d->pvg_canvas);
+    path_add(ctx2d, SEG_CLOSE);
 }
 
 void
 ctx2d_arc(struct Context2D *ctx2d, double x, double y, double r,
     double startAngle, double endAngle, int ccw)
 {
+    RECORD(ctx2d, REC_ARC, {x, y, r, startAngle, endAngle, ccw});
     plutovg_canvas_arc(ctx2d->pvg_canvas, (float) x, (float) y, (float) r,
         (float) startAngle, (float) endAngle, ccw);
+    struct PathSeg *seg = path_add(ctx2d, SEG_ARC);
+    if (seg) {
+        seg->ccw = ccw;
+        seg->v[0] = (float) x;
+        seg->v[1] = (float) y;
+        seg->v[2] = (float) r;
+        seg->v[3] = (float) startAngle;
+        seg->v[4] = (float) endAngle;
+    }
+}
+
+// Signed sweep of an arc, as the canvas spec defines it
+static double
+arc_sweep(double start, double end, bool ccw)
+{
+    double d = ccw ? start - end : end - start;
+    if (d >= 2 * M_PI) {
+        d = 2 * M_PI;
+    } else {
+        d = fmod(d, 2 * M_PI);
+        if (d < 0)
+            d += 2 * M_PI;
+    }
+    return ccw ? -d : d;
+}
+
+// Walks the path in device space, keeping the current point, and hands
+// each line to the hairline stroker or to scanfill
+struct Pen {
+    plutovg_matrix_t m;
+    // Device radius per user unit, for flattening arcs
+    double scale;
+    float x, y, start_x, start_y;
+    bool has_point;
+    void (*line)(struct Pen *pen, float x0, float y0, float x1, float y1);
+    struct Hairline hl;
+    // Hairlines: lineWidth, for the device width across each line
+    double line_width;
+    struct Scanfill *sf;
+    // scanfill ran out of memory
+    bool failed;
+};
+
+static void
+pen_hairline(struct Pen *pen, float x0, float y0, float x1, float y1)
+{
+    // Under a transform that stretches unevenly the stroke is wider across
+    // some lines than others: it is lineWidth times the stretch of the
+    // user-space direction perpendicular to the line
+    const plutovg_matrix_t *m = &pen->m;
+    double dx = x1 - x0, dy = y1 - y0;
+    double len = hypot(dx, dy);
+    if (len > 0)
+        pen->hl.weight = (float) (pen->line_width *
+            hypot(m->d * dx - m->c * dy, m->a * dy - m->b * dx) / len);
+    hairline_line(&pen->hl, x0, y0, x1, y1);
+}
+
+static void
+pen_scanfill(struct Pen *pen, float x0, float y0, float x1, float y1)
+{
+    if (scanfill_line(pen->sf, x0, y0, x1, y1) < 0)
+        pen->failed = true;
+}
+
+static void
+pen_line_to(struct Pen *pen, float x, float y)
+{
+    if (pen->has_point) {
+        pen->line(pen, pen->x, pen->y, x, y);
+    } else {
+        pen->start_x = x;
+        pen->start_y = y;
+        pen->has_point = true;
+    }
+    pen->x = x;
+    pen->y = y;
+}
+
+static void
+pen_map(const struct Pen *pen, double x, double y, float *dx,
+    float *dy)
+{
+    const plutovg_matrix_t *m = &pen->m;
+    *dx = (float) (m->a * x + m->c * y + m->e);
+    *dy = (float) (m->b * x + m->d * y + m->f);
+}
+
+static void
+pen_arc(struct Pen *pen, const struct PathSeg *seg)
+{
+    double cx = seg->v[0], cy = seg->v[1], r = seg->v[2];
+    double start = seg->v[3];
+    double sweep = arc_sweep(start, seg->v[4], seg->ccw);
+
+    // Enough chords that none strays more than a quarter pixel from the arc
+    double radius = r * pen->scale;
+    double step = radius > 0.25 ? 2 * acos(1 - 0.25 / radius) : M_PI / 2;
+    double n = ceil(fabs(sweep) / step);
+    int count = n < 1 ? 1 : n > 4096 ? 4096 : (int) n;
+
+    float x, y;
+    for (int i = 0; i <= count; i++) {
+        double a = start + sweep * i / count;
+        pen_map(pen, cx + r * cos(a), cy + r * sin(a), &x, &y);
+        pen_line_to(pen, x, y);
+    }
+}
+
+// Back to the start of the subpath, which fill() does for every subpath
+static void
+pen_close(struct Pen *pen)
+{
+    if (pen->has_point && (pen->x != pen->start_x || pen->y != pen->start_y))
+        pen_line_to(pen, pen->start_x, pen->start_y);
+}
+
+// Hand every line of the path to the pen; fill closes each subpath
+static void
+pen_walk(struct Pen *pen, const struct Context2D *ctx2d, bool fill)
+{
+    float x, y;
+    for (unsigned i = 0; i < ctx2d->npath; i++) {
+        const struct PathSeg *seg = &ctx2d->path[i];
+        switch (seg->op) {
+        case SEG_MOVE:
+            if (fill)
+                pen_close(pen);
+            pen_map(pen, seg->v[0], seg->v[1], &x, &y);
+            pen->has_point = false;
+            pen_line_to(pen, x, y);
+            break;
+        case SEG_LINE:
+            pen_map(pen, seg->v[0], seg->v[1], &x, &y);
+            pen_line_to(pen, x, y);
+            break;
+        case SEG_ARC:
+            pen_arc(pen, seg);
+            break;
+        case SEG_CLOSE:
+            if (pen->has_point) {
+                pen_line_to(pen, pen->start_x, pen->start_y);
+                // The next segment starts a new subpath at the same point
+                pen->has_point = false;
+                pen_line_to(pen, pen->start_x, pen->start_y);
+            }
+            break;
+        }
+    }
+    if (fill)
+        pen_close(pen);
+}
+
+// Strokes of at most 1.5 device pixels in source-over; anything else is
+// left to PlutoVG's stroker. Returns whether the path was drawn.
+static bool
+stroke_hairline(struct Context2D *ctx2d)
+{
+    if (!ctx2d->hairline || !ctx2d->path_complete ||
+        ctx2d->composite->blit != BLIT_SRC_OVER)
+        return false;
+    struct Pen pen = {.m = ctx2d->matrix, .line = pen_hairline};
+    const plutovg_matrix_t *m = &pen.m;
+    // The widest the stroke gets is lineWidth times the matrix's larger
+    // singular value, e.g. 100 under scale(0.01, 100)
+    double a = m->a, b = m->b, c = m->c, d = m->d;
+    double det = fabs(a * d - b * c);
+    double sum = a * a + b * b + c * c + d * d;
+    double stretch =
+        sqrt((sum + sqrt(fmax(sum * sum - 4 * det * det, 0))) / 2);
+    pen.line_width = plutovg_canvas_get_line_width(ctx2d->pvg_canvas);
+    double width = pen.line_width * sqrt(det);
+    if (!(width > 0 && pen.line_width * stretch <= 1.5))
+        return false;
+
+    pen.hl = (struct Hairline) {
+        .data = (uint32_t *) plutovg_surface_get_data(ctx2d->pvg_surface),
+        .stride = plutovg_surface_get_stride(ctx2d->pvg_surface) / 4,
+        .width = plutovg_surface_get_width(ctx2d->pvg_surface),
+        .height = plutovg_surface_get_height(ctx2d->pvg_surface),
+        .color = premultiply(&ctx2d->strokeStyle,
+            plutovg_canvas_get_opacity(ctx2d->pvg_canvas)),
+        .weight = (float) width,
+        .aliased = ctx2d->antialias == ANTIALIAS_NONE,
+    };
+    if (pen.hl.color == 0)
+        return true;
+    pen.scale = fmax(hypot(m->a, m->b), hypot(m->c, m->d));
+
+    pen_walk(&pen, ctx2d, false);
+    return true;
+}
+
+// Whether the path is one full circle under a transform that keeps it
+// round, e.g. beginPath(); arc(x, y, r, 0, 7). Gives its center and radius
+// in device pixels. A moveTo before the arc adds a line to it and back,
+// which fill() ignores and stroke() would draw.
+static bool
+path_circle(const struct Context2D *ctx2d, bool stroke, double *cx,
+    double *cy, double *r)
+{
+    if (!ctx2d->path_complete)
+        return false;
+    const struct PathSeg *arc = NULL;
+    for (unsigned i = 0; i < ctx2d->npath; i++) {
+        const struct PathSeg *seg = &ctx2d->path[i];
+        if (seg->op == SEG_MOVE && !arc && !stroke)
+            continue;
+        if (seg->op == SEG_ARC && !arc)
+            arc = seg;
+        else if (seg->op != SEG_CLOSE || !arc)
+            return false;
+    }
+    if (!arc || fabs(arc_sweep(arc->v[3], arc->v[4], arc->ccw)) < 2 * M_PI)
+        return false;
+
+    // Rotation, uniform scale and reflection: orthogonal columns of equal
+    // length
+    const plutovg_matrix_t *m = &ctx2d->matrix;
+    double sx = hypot(m->a, m->b), sy = hypot(m->c, m->d);
+    if (fabs(sx - sy) > 1e-4 * sx ||
+        fabs((double) m->a * m->c + (double) m->b * m->d) > 1e-4 * sx * sy)
+        return false;
+    *cx = m->a * arc->v[0] + m->c * arc->v[1] + m->e;
+    *cy = m->b * arc->v[0] + m->d * arc->v[1] + m->f;
+    *r = arc->v[2] * sx;
+    return *r > 0 && *r <= DISC_MAX_RADIUS;
+}
+
+static struct Disc
+disc_target(const struct Context2D *ctx2d, const plutovg_color_t *color)
+{
+    int samples = ctx2d->antialias == ANTIALIAS_ANALYTIC ? 0
+        : ctx2d->antialias == ANTIALIAS_NONE             ? 1
+                                                         : SUPERSAMPLE_GRID;
+    return (struct Disc) {
+        .data = (uint32_t *) plutovg_surface_get_data(ctx2d->pvg_surface),
+        .stride = plutovg_surface_get_stride(ctx2d->pvg_surface) / 4,
+        .width = plutovg_surface_get_width(ctx2d->pvg_surface),
+        .height = plutovg_surface_get_height(ctx2d->pvg_surface),
+        .op = ctx2d->composite->blit,
+        .color = premultiply(color,
+            plutovg_canvas_get_opacity(ctx2d->pvg_canvas)),
+        .samples = samples,
+    };
+}
+
+// A full circle stroked wider than a hairline, or with an operator the
+// hairline rasterizer lacks, as a ring. Returns whether it was drawn.
+static bool
+stroke_circle(struct Context2D *ctx2d)
+{
+    double cx, cy, r;
+    // Off with the hairline rasterizer, so that --no-hairline compares
+    // against PlutoVG's stroker alone
+    if (!ctx2d->hairline || ctx2d->composite->blit < 0 || !path_circle(ctx2d, true, &cx, &cy, &r))
+        return false;
+    const plutovg_matrix_t *m = &ctx2d->matrix;
+    double half = plutovg_canvas_get_line_width(ctx2d->pvg_canvas) *
+        hypot(m->a, m->b) / 2;
+    if (!(half > 0 && r + half <= DISC_MAX_RADIUS))
+        return false;
+    struct Disc disc = disc_target(ctx2d, &ctx2d->strokeStyle);
+    disc_fill(&disc, cx, cy, r + half, r - half);
+    return true;
+}
+
+// fill() of a full circle in a solid color. Returns whether it was drawn.
+static bool
+fill_circle(struct Context2D *ctx2d)
+{
+    double cx, cy, r;
+    if (ctx2d->fill_gradient || ctx2d->composite->blit < 0 ||
+        !path_circle(ctx2d, false, &cx, &cy, &r))
+        return false;
+    struct Disc disc = disc_target(ctx2d, &ctx2d->fillStyle);
+    disc_fill(&disc, cx, cy, r, 0);
+    return true;
+}
+
+// Solid fill() of any other path in the sampled antialiasing modes, with
+// arcs flattened as for hairlines. Returns false if the fast path doesn't
+// apply.
+static bool
+fill_path_sampled(struct Context2D *ctx2d)
+{
+    if (ctx2d->antialias == ANTIALIAS_ANALYTIC || ctx2d->fill_gradient ||
+        ctx2d->composite->blit < 0 || !ctx2d->path_complete)
+        return false;
+    if (!ctx2d->scanfill && !(ctx2d->scanfill = scanfill_new()))
+        return false;
+
+    struct Pen pen = {
+        .m = ctx2d->matrix,
+        .line = pen_scanfill,
+        .sf = ctx2d->scanfill,
+    };
+    const plutovg_matrix_t *m = &pen.m;
+    pen.scale = fmax(hypot(m->a, m->b), hypot(m->c, m->d));
+    scanfill_reset(pen.sf);
+    pen_walk(&pen, ctx2d, true);
+    if (pen.failed)
+        return false;
+
+    uint32_t color = premultiply(&ctx2d->fillStyle,
+        plutovg_canvas_get_opacity(ctx2d->pvg_canvas));
+    int samples = ctx2d->antialias == ANTIALIAS_NONE ? 1 : SUPERSAMPLE_GRID;
+    return scanfill_fill(pen.sf,
+               (uint32_t *) plutovg_surface_get_data(ctx2d->pvg_surface),
+               plutovg_surface_get_stride(ctx2d->pvg_surface) / 4,
+               plutovg_surface_get_width(ctx2d->pvg_surface),
+               plutovg_surface_get_height(ctx2d->pvg_surface),
+               ctx2d->composite->blit, color, samples) == 0;
+}
+
+void
+ctx2d_fill(struct Context2D *ctx2d)
+{
+    RECORD(ctx2d, REC_FILL);
+    if (!ctx2d->raster)
+        return;
+    own_pixels(ctx2d, true);
+    if (fill_circle(ctx2d) || fill_path_sampled(ctx2d))
+        return;
+    if (!set_fill_paint(ctx2d))
+        return;
+    plutovg_rect_t extents;
+    plutovg_canvas_fill_extents(ctx2d->pvg_canvas, &extents);
+    bool layer = ctx2d->composite->layer;
+    if (layer && !layer_begin(ctx2d, &extents))
+        return;
+    // Like stroke(), fill() keeps the path
+    plutovg_canvas_fill_preserve(ctx2d->pvg_canvas);
+    if (layer)
+        layer_end(ctx2d);
 }
 
 void
 ctx2d_stroke(struct Context2D *ctx2d)
 {
+    RECORD(ctx2d, REC_STROKE);
+    if (!ctx2d->raster)
+        return;
+    own_pixels(ctx2d, true);
+    if (stroke_hairline(ctx2d) || stroke_circle(ctx2d))
+        return;
     plutovg_color_t *c = &ctx2d->strokeStyle;
     plutovg_canvas_set_rgba(ctx2d->pvg_canvas, c->r, c->g, c->b, c->a);
+    plutovg_rect_t extents;
+    plutovg_canvas_stroke_extents(ctx2d->pvg_canvas, &extents);
+    bool layer = ctx2d->composite->layer;
+    if (layer && !layer_begin(ctx2d, &extents))
+        return;
     // Use stroke_preserve - Canvas2D stroke() does not clear the path
     plutovg_canvas_stroke_preserve(ctx2d->pvg_canvas);
+    if (layer)
+        layer_end(ctx2d);
+}
+
+void
+ctx2d_save(struct Context2D *ctx2d)
+{
+    RECORD(ctx2d, REC_SAVE);
+    if (ctx2d->nstates == STATE_STACK_SIZE) {
+        ctx2d->states_lost++;
+        return;
+    }
+    ctx2d->states[ctx2d->nstates++] = (struct SavedState) {
+        .matrix = ctx2d->matrix,
+        .matrix_kind = ctx2d->matrix_kind,
+        .fillStyle = ctx2d->fillStyle,
+        .fill_gradient = ctx2d->fill_gradient
+            ? gradient_ref(ctx2d->fill_gradient)
+            : NULL,
+        .strokeStyle = ctx2d->strokeStyle,
+        .opacity = plutovg_canvas_get_opacity(ctx2d->pvg_canvas),
+        .line_width = plutovg_canvas_get_line_width(ctx2d->pvg_canvas),
+        .font_size = ctx2d->font_size,
+        .composite = ctx2d->composite,
+        .antialias = ctx2d->antialias,
+        .image_smoothing = ctx2d->image_smoothing,
+    };
+}
+
+void
+ctx2d_restore(struct Context2D *ctx2d)
+{
+    RECORD(ctx2d, REC_RESTORE);
+    if (ctx2d->states_lost > 0) {
+        ctx2d->states_lost--;
+        return;
+    }
+    if (ctx2d->nstates == 0)
+        return;
+    // The saved gradient reference moves back to the context
+    const struct SavedState *state = &ctx2d->states[--ctx2d->nstates];
+    ctx2d->matrix = state->matrix;
+    ctx2d->matrix_kind = state->matrix_kind;
+    plutovg_canvas_set_matrix(ctx2d->pvg_canvas, &state->matrix);
+    ctx2d->fillStyle = state->fillStyle;
+    gradient_unref(ctx2d->fill_gradient);
+    ctx2d->fill_gradient = state->fill_gradient;
+    ctx2d->strokeStyle = state->strokeStyle;
+    plutovg_canvas_set_opacity(ctx2d->pvg_canvas, state->opacity);
+    plutovg_canvas_set_line_width(ctx2d->pvg_canvas, state->line_width);
+    ctx2d->font_size = state->font_size;
+    ctx2d->composite = state->composite;
+    plutovg_canvas_set_operator(ctx2d->pvg_canvas, state->composite->pvg);
+    ctx2d->antialias = state->antialias;
+    ctx2d->image_smoothing = state->image_smoothing;
+}
+
+// The transform methods apply their matrix before the current one, so it
+// acts on coordinates first
+static void
+transform_by(struct Context2D *ctx2d, const plutovg_matrix_t *t)
+{
+    plutovg_matrix_t m;
+    plutovg_matrix_multiply(&m, t, &ctx2d->matrix);
+    set_matrix(ctx2d, &m);
 }
 
 void
 ctx2d_scale(struct Context2D *ctx2d, double x, double y)
 {
-    plutovg_canvas_scale(ctx2d->pvg_canvas, (float)x, (float)y);
+    // Like browsers, ignore non-finite arguments, e.g. scale(1 / t, 1) at
+    // t = 0, here and in the other transform methods
+    if (!isfinite(x + y))
+        return;
+    RECORD(ctx2d, REC_SCALE, {x, y});
+    plutovg_matrix_t t;
+    plutovg_matrix_init_scale(&t, (float) x, (float) y);
+    transform_by(ctx2d, &t);
+}
+
+void
+ctx2d_translate(struct Context2D *ctx2d, double x, double y)
+{
+    if (!isfinite(x + y))
+        return;
+    RECORD(ctx2d, REC_TRANSLATE, {x, y});
+    plutovg_matrix_t t;
+    plutovg_matrix_init_translate(&t, (float) x, (float) y);
+    transform_by(ctx2d, &t);
+}
+
+void
+ctx2d_rotate(struct Context2D *ctx2d, double angle)
+{
+    if (!isfinite(angle))
+        return;
+    RECORD(ctx2d, REC_ROTATE, {angle});
+    plutovg_matrix_t t;
+    plutovg_matrix_init_rotate(&t, (float) angle);
+    transform_by(ctx2d, &t);
+}
+
+void
+ctx2d_transform(struct Context2D *ctx2d, double a, double b, double c,
+    double d, double e, double f)
+{
+    if (!isfinite(a + b + c + d + e + f))
+        return;
+    RECORD(ctx2d, REC_TRANSFORM, {a, b, c, d, e, f});
+    plutovg_matrix_t t;
+    plutovg_matrix_init(&t, (float) a, (float) b, (float) c, (float) d,
+        (float) e, (float) f);
+    transform_by(ctx2d, &t);
 }
 
 void
 ctx2d_setTransform(struct Context2D *ctx2d, double a, double b, double c,
     double d, double e, double f)
 {
+    if (!isfinite(a + b + c + d + e + f))
+        return;
+    RECORD(ctx2d, REC_SET_TRANSFORM, {a, b, c, d, e, f});
     plutovg_matrix_t matrix;
     plutovg_matrix_init(&matrix, (float)a, (float)b, (float)c, (float)d,
         (float)e, (float)f);
-    plutovg_canvas_set_matrix(ctx2d->pvg_canvas, &matrix);
+    plutovg_matrix_multiply(&matrix, &matrix, &ctx2d->base_matrix);
+    set_matrix(ctx2d, &matrix);
+}
+
+void
+ctx2d_resetTransform(struct Context2D *ctx2d)
+{
+    RECORD(ctx2d, REC_RESET_TRANSFORM);
+    set_matrix(ctx2d, &ctx2d->base_matrix);
 }
 
 void
 ctx2d_fillText(struct Context2D *ctx2d, const char *text, double x, double y)
 {
-    if (!ctx2d->font_face)
+    if (ctx2d->recording)
+        recording_add_text(ctx2d->recording, text, x, y);
+    if (!ctx2d->font_loaded)
+        load_font(ctx2d);
+    if (!ctx2d->font_face || !ctx2d->raster || !set_fill_paint(ctx2d))
+        return;
+    own_pixels(ctx2d, true);
+    // Text extents aren't known up front, so a layer covers the surface
+    bool layer = ctx2d->composite->layer;
+    if (layer && !layer_begin(ctx2d, NULL))
         return;
-    plutovg_color_t *c = &ctx2d->fillStyle;
-    plutovg_canvas_set_rgba(ctx2d->pvg_canvas, c->r, c->g, c->b, c->a);
     plutovg_canvas_set_font(ctx2d->pvg_canvas, ctx2d->font_face, ctx2d->font_size);
     plutovg_canvas_fill_text(ctx2d->pvg_canvas, text, -1, PLUTOVG_TEXT_ENCODING_UTF8,
         (float)x, (float)y);
+    if (layer)
+        layer_end(ctx2d);
+}
+
+// Pixels for drawImage: a rect of w x h source surface pixels, with the
+// requested (possibly fractional) source rect at (x, y) size sw x sh in it
+struct ImageRect {
+    const unsigned char *data;
+    int stride;
+    int w, h;
+    double x, y, sw, sh;
+};
+
+// Scale/translate transforms: blend or resample rows straight into the
+// surface. Pixels whose centers fall inside the destination are drawn.
+// Returns false, having drawn nothing, when the destination is too small
+// for the source to step through in 16.16 fixed point.
+static bool
+draw_image_aligned(struct Context2D *ctx2d, const struct ImageRect *src,
+    const plutovg_matrix_t *m, double dx, double dy, double dw, double dh)
+{
+    int width = plutovg_surface_get_width(ctx2d->pvg_surface);
+    int height = plutovg_surface_get_height(ctx2d->pvg_surface);
+    double left = m->a * dx + m->e, right = m->a * (dx + dw) + m->e;
+    double top = m->d * dy + m->f, bottom = m->d * (dy + dh) + m->f;
+    // Clamp while still in doubles: far off the surface, the ints would
+    // overflow
+    if (!(right > left && bottom > top))
+        return true;
+    double x0 = fmin(fmax(ceil(left - 0.5), 0), width);
+    double x1 = fmin(fmax(ceil(right - 0.5), 0), width);
+    double y0 = fmin(fmax(ceil(top - 0.5), 0), height);
+    double y1 = fmin(fmax(ceil(bottom - 0.5), 0), height);
+    if (!(x0 < x1 && y0 < y1))
+        return true;
+    double step_x = src->sw / (right - left);
+    double step_y = src->sh / (bottom - top);
+    // The 16.16 source positions can't step this far per pixel
+    if (step_x >= 0x7fff || step_y >= 0x7fff)
+        return false;
+    int px0 = (int) x0, px1 = (int) x1, py0 = (int) y0, py1 = (int) y1;
+
+    unsigned char *data = plutovg_surface_get_data(ctx2d->pvg_surface);
+    int stride = plutovg_surface_get_stride(ctx2d->pvg_surface);
+    float opacity = plutovg_canvas_get_opacity(ctx2d->pvg_canvas);
+    unsigned alpha = (unsigned) (opacity * 255 + 0.5f);
+    enum BlitOp op = ctx2d->composite->blit;
+
+    // Whole-pixel offset at 1:1, the usual feedback shift: blend rows as is
+    if (step_x == 1 && step_y == 1 && left == floor(left) &&
+        top == floor(top) && src->x == floor(src->x) &&
+        src->y == floor(src->y)) {
+        int ox = (int) (src->x - left), oy = (int) (src->y - top);
+        for (int py = py0; py < py1; py++)
+            blit_composite_row(op,
+                (uint32_t *) (data + (size_t) py * stride) + px0,
+                (const uint32_t *) (src->data +
+                    (size_t) (py + oy) * src->stride) +
+                    px0 + ox,
+                px1 - px0, alpha);
+        return true;
+    }
+
+    // Resample in chunks that stay in L1, then blend
+    uint32_t row[256];
+    double half = ctx2d->image_smoothing ? 0.5 : 0;
+    int32_t du = (int32_t) lround(step_x * 65536);
+    int32_t u0 = (int32_t) lround(
+        (src->x + (px0 + 0.5 - left) * step_x - half) * 65536);
+    for (int py = py0; py < py1; py++) {
+        uint32_t *dst = (uint32_t *) (data + (size_t) py * stride);
+        int32_t v = (int32_t) lround(
+            (src->y + (py + 0.5 - top) * step_y - half) * 65536);
+        int y0 = v >> 16;
+        y0 = y0 < 0 ? 0 : y0 >= src->h ? src->h - 1 : y0;
+        int y1 = y0 + 1 < src->h && v >= 0 ? y0 + 1 : y0;
+        const uint32_t *row0 =
+            (const uint32_t *) (src->data + (size_t) y0 * src->stride);
+        const uint32_t *row1 =
+            (const uint32_t *) (src->data + (size_t) y1 * src->stride);
+
+        int32_t u = u0;
+        for (int px = px0; px < px1; px += 256) {
+            int n = px1 - px < 256 ? px1 - px : 256;
+            if (ctx2d->image_smoothing)
+                blit_bilinear_row(row, row0, row1, src->w, (v >> 9) & 127, u,
+                    du, n);
+            else
+                blit_nearest_row(row, row0, src->w, u, du, n);
+            blit_composite_row(op, dst + px, row, n, alpha);
+            u += du * n;
+        }
+    }
+    return true;
+}
+
+// Any other transform goes through PlutoVG's texture paint
+static void
+draw_image_texture(struct Context2D *ctx2d, const struct ImageRect *src,
+    double dx, double dy, double dw, double dh)
+{
+    plutovg_surface_t *texture = plutovg_surface_create_for_data(
+        (unsigned char *) src->data, src->w, src->h, src->stride);
+    if (!texture)
+        return;
+    plutovg_matrix_t m;
+    plutovg_matrix_init_translate(&m, (float) dx, (float) dy);
+    plutovg_matrix_scale(&m, (float) (dw / src->sw), (float) (dh / src->sh));
+    plutovg_matrix_translate(&m, (float) -src->x, (float) -src->y);
+    plutovg_canvas_set_texture(ctx2d->pvg_canvas, texture,
+        PLUTOVG_TEXTURE_TYPE_PLAIN, 1.0f, &m);
+    plutovg_rect_t extents = {(float) dx, (float) dy, (float) dw, (float) dh};
+    bool layer = ctx2d->composite->layer;
+    if (!layer || layer_begin(ctx2d, &extents)) {
+        plutovg_canvas_fill_rect(ctx2d->pvg_canvas, (float) dx, (float) dy,
+            (float) dw, (float) dh);
+        if (layer)
+            layer_end(ctx2d);
+    }
+    plutovg_surface_destroy(texture);
+}
+
+// Rects with a negative size extend the other way
+static void
+normalize_rect(double *x, double *y, double *w, double *h)
+{
+    if (*w < 0) {
+        *x += *w;
+        *w = -*w;
+    }
+    if (*h < 0) {
+        *y += *h;
+        *h = -*h;
+    }
+}
+
+void
+ctx2d_drawImage(struct Context2D *ctx2d, struct Canvas *image, double sx,
+    double sy, double sw, double sh, double dx, double dy, double dw,
+    double dh)
+{
+    // A canvas without a context is transparent
+    struct Context2D *source = image->ctx2d;
+    if (ctx2d->recording)
+        recording_fail(ctx2d->recording, "drawImage");
+    if (source && source->recording)
+        recording_fail(source->recording, "drawImage");
+    if (!ctx2d->raster || !source)
+        return;
+    // Ignored, as in browsers
+    if (!isfinite(sx + sy + sw + sh + dx + dy + dw + dh))
+        return;
+    normalize_rect(&sx, &sy, &sw, &sh);
+    normalize_rect(&dx, &dy, &dw, &dh);
+    if (!(sw > 0 && sh > 0 && dw > 0 && dh > 0))
+        return;
+
+    // Clip the source rect to the image, shrinking the destination to match
+    double x0 = fmax(sx, 0), y0 = fmax(sy, 0);
+    double x1 = fmin(sx + sw, image->width);
+    double y1 = fmin(sy + sh, image->height);
+    if (!(x0 < x1 && y0 < y1))
+        return;
+    double kx = dw / sw, ky = dh / sh;
+    dx += (x0 - sx) * kx;
+    dy += (y0 - sy) * ky;
+    dw = (x1 - x0) * kx;
+    dh = (y1 - y0) * ky;
+
+    own_pixels(ctx2d, true);
+    own_pixels(source, true);
+
+    // Source surface pixels the rect touches
+    double scale_x = (double) image->surface_width / image->width;
+    double scale_y = (double) image->surface_height / image->height;
+    int ix0 = (int) floor(x0 * scale_x), iy0 = (int) floor(y0 * scale_y);
+    int ix1 = (int) fmin(ceil(x1 * scale_x), image->surface_width);
+    int iy1 = (int) fmin(ceil(y1 * scale_y), image->surface_height);
+    if (ix0 >= ix1 || iy0 >= iy1)
+        return;
+    int stride = plutovg_surface_get_stride(source->pvg_surface);
+    struct ImageRect src = {
+        .data = plutovg_surface_get_data(source->pvg_surface) +
+            (size_t) iy0 * stride + (size_t) ix0 * 4,
+        .stride = stride,
+        .w = ix1 - ix0,
+        .h = iy1 - iy0,
+        .x = x0 * scale_x - ix0,
+        .y = y0 * scale_y - iy0,
+        .sw = (x1 - x0) * scale_x,
+        .sh = (y1 - y0) * scale_y,
+    };
+
+    // Drawing onto itself reads from a snapshot of the rect
+    if (source == ctx2d) {
+        size_t row_size = (size_t) src.w * 4;
+        size_t size = row_size * src.h;
+        if (size > ctx2d->scratch_size) {
+            unsigned char *scratch = realloc(ctx2d->scratch, size);
+            if (!scratch)
+                return;
+            ctx2d->scratch = scratch;
+            ctx2d->scratch_size = size;
+        }
+        for (int y = 0; y < src.h; y++)
+            memcpy(ctx2d->scratch + y * row_size,
+                src.data + (size_t) y * src.stride, row_size);
+        src.data = ctx2d->scratch;
+        src.stride = (int) row_size;
+    }
+
+    const plutovg_matrix_t *m = &ctx2d->matrix;
+    if (ctx2d->matrix_kind == MATRIX_GENERAL || !(m->a > 0 && m->d > 0) ||
+        ctx2d->composite->blit < 0 ||
+        !draw_image_aligned(ctx2d, &src, m, dx, dy, dw, dh))
+        draw_image_texture(ctx2d, &src, dx, dy, dw, dh);
+}
+
+// Surface pixel for canvas coordinate v along an axis scaled by surface/canvas
+static inline int
+to_surface(double v, unsigned surface, unsigned canvas)
+{
+    return (int) fmax(fmin(floor((v + 0.5) * surface / canvas), INT_MAX),
+        INT_MIN);
+}
+
+unsigned char *
+ctx2d_getImageData(struct Context2D *ctx2d, int x, int y, int w, int h,
+    void **owner)
+{
+    struct Canvas *canvas = ctx2d->canvas;
+    struct PixelPool *pool = ctx2d->pool;
+    if (ctx2d->recording)
+        recording_fail(ctx2d->recording, "getImageData");
+    own_pixels(ctx2d, true);
+
+    int width = plutovg_surface_get_width(ctx2d->pvg_surface);
+    int height = plutovg_surface_get_height(ctx2d->pvg_surface);
+    bool scaled = width != (int) canvas->width ||
+        height != (int) canvas->height;
+    size_t size = (size_t) w * h * 4;
+    unsigned char *rgba = NULL;
+    if (pool->nlent == pool->lent_cap) {
+        unsigned cap = pool->lent_cap ? pool->lent_cap * 2 : 4;
+        struct LentPixels *lent = realloc(pool->lent, cap * sizeof(*lent));
+        if (!lent)
+            return NULL;
+        pool->lent = lent;
+        pool->lent_cap = cap;
+    }
+    bool pooled = size == pool->frame_size && w == width;
+    if (pooled)
+        rgba = pool_take(pool);
+    else
+        rgba = malloc(size ? size : 1);
+    if (!rgba)
+        return NULL;
+
+    const unsigned char *data = plutovg_surface_get_data(ctx2d->pvg_surface);
+    int stride = plutovg_surface_get_stride(ctx2d->pvg_surface);
+    if (!scaled && x == 0 && y == 0 && w == width && h == height) {
+        pixfmt_argb_to_rgba(rgba, w * 4, data, stride, w, h);
+    } else {
+        // Nearest surface pixel for each canvas pixel; outside is transparent
+        for (int j = 0; j < h; j++) {
+            uint32_t *row = (uint32_t *) (rgba + (size_t) j * w * 4);
+            int sy = to_surface((double) y + j, height, canvas->height);
+            for (int i = 0; i < w; i++) {
+                int sx = to_surface((double) x + i, width, canvas->width);
+                row[i] = sx >= 0 && sx < width && sy >= 0 && sy < height
+                    ? ((const uint32_t *) (data + (size_t) sy * stride))[sx]
+                    : 0;
+            }
+            pixfmt_argb_to_rgba((unsigned char *) row, w * 4,
+                (unsigned char *) row, w * 4, w, 1);
+        }
+    }
+
+    pool->lent[pool->nlent++] = (struct LentPixels) {rgba, size, pooled};
+    pool->refs++;
+    *owner = pool;
+    return rgba;
+}
+
+void
+ctx2d_image_data_free(void *owner, unsigned char *data)
+{
+    struct PixelPool *pool = owner;
+    size_t size = 0;
+    bool pooled = false;
+    for (unsigned i = 0; i < pool->nlent; i++) {
+        if (pool->lent[i].data == data) {
+            size = pool->lent[i].size;
+            pooled = pool->lent[i].pooled;
+            pool->lent[i] = pool->lent[--pool->nlent];
+            break;
+        }
+    }
+    // Still the surface after putImageData: the context keeps it. A frame
+    // from before the canvas was resized goes back to the shared pool.
+    if (data != pool->active) {
+        if (!pooled)
+            free(data);
+        else if (size == pool->frame_size)
+            pool_give(pool, data);
+        else
+            surface_pool_give(pool->surfaces, data, size);
+    }
+    pool_unref(pool);
+}
+
+void
+ctx2d_putImageData(struct Context2D *ctx2d, unsigned char *rgba, int w, int h,
+    int dx, int dy)
+{
+    if (ctx2d->recording)
+        recording_fail(ctx2d->recording, "putImageData");
+    if (!ctx2d->raster)
+        return;
+    struct Canvas *canvas = ctx2d->canvas;
+    struct PixelPool *pool = ctx2d->pool;
+    int width = plutovg_surface_get_width(ctx2d->pvg_surface);
+    int height = plutovg_surface_get_height(ctx2d->pvg_surface);
+    bool scaled = width != (int) canvas->width ||
+        height != (int) canvas->height;
+    bool full = !scaled && dx == 0 && dy == 0 && w == width && h == height;
+
+    // A full frame from our own getImageData becomes the surface as is and
+    // is premultiplied when next drawn on or read
+    if (full && rgba == pool->active && pool->rgba)
+        return;
+    if (full && pool->active && rgba != pool->active &&
+        !ctx2d->path_pending && pool_is_lent(pool, rgba) &&
+        replace_surface(ctx2d, rgba, w * 4, true, false) == 0) {
+        pool->rgba = true;
+        return;
+    }
+
+    own_pixels(ctx2d, true);
+    unsigned char *data = plutovg_surface_get_data(ctx2d->pvg_surface);
+    int stride = plutovg_surface_get_stride(ctx2d->pvg_surface);
+    if (!scaled) {
+        // Clip in 64 bits, dx + w may not fit an int
+        long long x0 = dx < 0 ? -(long long) dx : 0;
+        long long y0 = dy < 0 ? -(long long) dy : 0;
+        long long x1 = fmin(w, (long long) width - dx);
+        long long y1 = fmin(h, (long long) height - dy);
+        if (x0 < x1 && y0 < y1)
+            pixfmt_rgba_to_argb(
+                data + (size_t) (dy + y0) * stride + (size_t) (dx + x0) * 4,
+                stride, rgba + ((size_t) y0 * w + x0) * 4, w * 4, x1 - x0,
+                y1 - y0);
+        return;
+    }
+
+    // Scaled surface: nearest source pixel for each covered surface pixel
+    int sx0 = to_surface(dx, width, canvas->width);
+    int sx1 = to_surface((double) dx + w, width, canvas->width);
+    int sy0 = to_surface(dy, height, canvas->height);
+    int sy1 = to_surface((double) dy + h, height, canvas->height);
+    sx0 = sx0 < 0 ? 0 : sx0;
+    sy0 = sy0 < 0 ? 0 : sy0;
+    sx1 = sx1 > width ? width : sx1;
+    sy1 = sy1 > height ? height : sy1;
+    for (int sy = sy0; sy < sy1; sy++) {
+        int j = (int) ((sy + 0.5) * canvas->height / height) - dy;
+        if (j < 0 || j >= h)
+            continue;
+        uint32_t *row = (uint32_t *) (data + (size_t) sy * stride);
+        for (int sx = sx0; sx < sx1; sx++) {
+            int i = (int) ((sx + 0.5) * canvas->width / width) - dx;
+            if (i >= 0 && i < w)
+                pixfmt_rgba_to_argb((unsigned char *) &row[sx], 4,
+                    rgba + ((size_t) j * w + i) * 4, 4, 1, 1);
+        }
+    }
 }
 
 unsigned char *
 ctx2d_get_data(struct Context2D *ctx2d)
 {
+    own_pixels(ctx2d, true);
     return plutovg_surface_get_data(ctx2d->pvg_surface);
 }
 
@@ -314,3 +2176,113 @@ ctx2d_get_stride(struct Context2D *ctx2d)
 {
     return plutovg_surface_get_stride(ctx2d->pvg_surface);
 }
+
+int
+ctx2d_set_target(struct Context2D *ctx2d, unsigned char *data, int stride)
+{
+    // A surface still waiting for its first clear moves without a copy and
+    // is cleared where it ends up
+    bool blank = ctx2d->clear_pending;
+    ctx2d->clear_pending = false;
+    own_pixels(ctx2d, true);
+    int ret = 0;
+    if (data == plutovg_surface_get_data(ctx2d->pvg_surface)) {
+        // Already there
+    } else if (data) {
+        ret = replace_surface(ctx2d, data, stride, false, !blank);
+    } else {
+        // Back to owned memory
+        struct PixelPool *pool = ctx2d->pool;
+        data = pool_take(pool);
+        stride = plutovg_surface_get_width(ctx2d->pvg_surface) * 4;
+        if (!data || replace_surface(ctx2d, data, stride, true, !blank) < 0) {
+            pool_give(pool, data);
+            ret = -1;
+        }
+    }
+    ctx2d->clear_pending = blank;
+    return ret;
+}
+
+int
+ctx2d_leave_target(struct Context2D *ctx2d, const unsigned char *contents,
+    int stride)
+{
+    // Not own_pixels(): a pending clear would write to the old memory
+    bool blank = ctx2d->clear_pending;
+    int width = ctx2d->canvas->surface_width;
+    int height = ctx2d->canvas->surface_height;
+    struct PixelPool *pool = ctx2d->pool;
+    unsigned char *data = pool_take(pool);
+    if (!data || replace_surface(ctx2d, data, width * 4, true, false) < 0) {
+        pool_give(pool, data);
+        return -1;
+    }
+    if (contents) {
+        for (int y = 0; y < height; y++)
+            memcpy(data + (size_t) y * width * 4,
+                contents + (size_t) y * stride, (size_t) width * 4);
+    } else {
+        plutovg_surface_clear(ctx2d->pvg_surface, background(ctx2d));
+    }
+    ctx2d->clear_pending = blank;
+    return 0;
+}
+
+void
+ctx2d_set_raster(struct Context2D *ctx2d, bool raster)
+{
+    ctx2d->raster = raster;
+}
+
+void
+ctx2d_set_recording(struct Context2D *ctx2d, struct Recording *rec)
+{
+    ctx2d->recording = rec;
+    ctx2d->raster = !rec;
+}
+
+void
+ctx2d_set_hairline(struct Context2D *ctx2d, bool hairline)
+{
+    ctx2d->hairline = hairline;
+}
+
+void
+ctx2d_set_default_antialias(struct Context2D *ctx2d, enum Antialias mode)
+{
+    ctx2d->antialias_default = mode;
+    ctx2d->antialias = mode;
+}
+
+size_t
+ctx2d_scratch_memory(const struct Context2D *ctx2d)
+{
+    return ctx2d->path_cap * sizeof(*ctx2d->path) + ctx2d->scratch_size +
+        ctx2d->layer_size + scanfill_memory(ctx2d->scanfill);
+}
+
+void
+ctx2d_trim(struct Context2D *ctx2d)
+{
+    free(ctx2d->scratch);
+    ctx2d->scratch = NULL;
+    ctx2d->scratch_size = 0;
+    free(ctx2d->layer);
+    ctx2d->layer = NULL;
+    ctx2d->layer_size = 0;
+    scanfill_destroy(ctx2d->scanfill);
+    ctx2d->scanfill = NULL;
+}
+
+int
+ctx2d_get_width(struct Context2D *ctx2d)
+{
+    return plutovg_surface_get_width(ctx2d->pvg_surface);
+}
+
+int
+ctx2d_get_height(struct Context2D *ctx2d)
+{
+    return plutovg_surface_get_height(ctx2d->pvg_surface);
+}
@@ -1,23 +1,70 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 struct Canvas;
 struct Context2D;
+struct Gradient;
+struct Recording;
+struct SurfacePool;
+
+// Largest width or height of an offscreen canvas
+#define CANVAS_MAX_SIZE 16384
+
+// How fillRect and thin strokes treat pixels on a shape's edge
+enum Antialias {
+    // Pixels whose centers are inside are painted, the rest left alone
+    ANTIALIAS_NONE,
+    // Exact area coverage (the default)
+    ANTIALIAS_ANALYTIC,
+    // Coverage from a 4x4 grid of samples per pixel
+    ANTIALIAS_SUPERSAMPLE,
+};
+
+// Names as in x.antialias: "none", "analytic" and "supersample". Returns -1
+// for anything else.
+int
+antialias_parse(const char *name, enum Antialias *mode);
+const char *
+antialias_name(enum Antialias mode);
 
 // Canvas
+// The dweet's own canvas: a fixed size, white where nothing was drawn.
+// Pixel memory comes from surfaces (NULL: malloc), which must outlive the
+// canvas and any ImageData taken from it.
+struct Canvas *
+canvas_new(unsigned width, unsigned height, struct SurfacePool *surfaces);
+// A canvas made by the dweet: transparent, and resized (and cleared) by
+// setting its width or height. Sizes of 0 become 1. Returns NULL for sizes
+// over CANVAS_MAX_SIZE.
 struct Canvas *
-canvas_new(unsigned width, unsigned height);
+canvas_new_offscreen(unsigned width, unsigned height,
+    struct SurfacePool *surfaces);
 void
 canvas_destroy(struct Canvas *canvas);
 unsigned
 canvas_width_get(struct Canvas *canvas);
-void
+// Setting the size clears the canvas and resets its context. Returns -1,
+// leaving an offscreen canvas as it was, if the pixels for a new size are
+// past CANVAS_MAX_SIZE or the pool's limit.
+int
 canvas_width_set(struct Canvas *canvas, unsigned val);
 unsigned
 canvas_height_get(struct Canvas *canvas);
-void
+int
 canvas_height_set(struct Canvas *canvas, unsigned val);
+// Rasterize at width x height instead of the canvas size (before getContext)
+void
+canvas_set_resolution(struct Canvas *canvas, unsigned width, unsigned height);
+// Hold only rows y to y + rows - 1 of that resolution, for rendering a frame
+// in bands. rows is set before getContext; later calls move the context to
+// another band of the same height and reset it. Returns -1 for a band that
+// starts past the bottom, or whose height differs from the context's.
+int
+canvas_set_band(struct Canvas *canvas, unsigned y, unsigned rows);
+// NULL for types other than "2d", or if the pixels can't be had
 struct Context2D *
 canvas_getContext(struct Canvas *canvas, const char *contextType);
 
@@ -26,36 +73,156 @@ void
 ctx2d_fillStyle_set(struct Context2D *ctx2d, uint32_t color);
 uint32_t
 ctx2d_fillStyle_get(struct Context2D *ctx2d);
+// Fill with a gradient (the context takes a reference) until the next
+// fillStyle_set
+void
+ctx2d_fillStyle_set_gradient(struct Context2D *ctx2d,
+    struct Gradient *gradient);
 void
 ctx2d_globalAlpha_set(struct Context2D *ctx2d, double globalAlpha);
 double
 ctx2d_globalAlpha_get(struct Context2D *ctx2d);
+// Bilinear (default) or nearest-neighbour sampling in drawImage
+void
+ctx2d_imageSmoothingEnabled_set(struct Context2D *ctx2d, bool enabled);
+bool
+ctx2d_imageSmoothingEnabled_get(struct Context2D *ctx2d);
+// x.antialias, which save() and restore() cover like
+// imageSmoothingEnabled. Returns -1 (and keeps the current mode) for names
+// antialias_parse() doesn't know.
+int
+ctx2d_antialias_set(struct Context2D *ctx2d, const char *name);
+const char *
+ctx2d_antialias_get(struct Context2D *ctx2d);
+// Returns -1 (and keeps the current one) for unsupported operations
+int
+ctx2d_globalCompositeOperation_set(struct Context2D *ctx2d, const char *name);
+const char *
+ctx2d_globalCompositeOperation_get(struct Context2D *ctx2d);
 void
 ctx2d_lineWidth_set(struct Context2D *ctx2d, double lineWidth);
 double
 ctx2d_lineWidth_get(struct Context2D *ctx2d);
 void
 ctx2d_fillRect(struct Context2D *ctx2d, double x, double y, double w, double h);
+// fillRect for count rects in one call, each the x, y, w, h at the start of
+// every stride floats. With colors (straight RGBA, four bytes a rect) each
+// rect is filled in its own color, at globalAlpha, instead of fillStyle.
+void
+ctx2d_fillRects(struct Context2D *ctx2d, const float *rects,
+    const uint8_t *colors, size_t count, size_t stride);
 void
 ctx2d_clearRect(struct Context2D *ctx2d, double x, double y, double w,
     double h);
 void
 ctx2d_beginPath(struct Context2D *ctx2d);
 void
+ctx2d_moveTo(struct Context2D *ctx2d, double x, double y);
+void
+ctx2d_lineTo(struct Context2D *ctx2d, double x, double y);
+void
+ctx2d_closePath(struct Context2D *ctx2d);
+void
 ctx2d_arc(struct Context2D *ctx2d, double x, double y, double r,
     double startAngle, double endAngle, int ccw);
+// Strokes at most 1.5 device pixels wide are drawn by the hairline
+// rasterizer when possible, wider ones of a full circle as a ring by the
+// disc rasterizer, and the rest by PlutoVG
 void
 ctx2d_stroke(struct Context2D *ctx2d);
+// Fill the path under the nonzero rule, keeping it. A full circle in a
+// solid color is a disc for the disc rasterizer; other solid fills in the
+// sampled antialiasing modes go through scanfill, the rest through PlutoVG.
+void
+ctx2d_fill(struct Context2D *ctx2d);
+// Push or pop the transform, styles, alpha, line width, font size,
+// composite operation, antialiasing and image smoothing. The stack is
+// fixed-size and never allocates; past 32 levels save() only counts, and the
+// matching restore() calls do nothing.
+void
+ctx2d_save(struct Context2D *ctx2d);
+void
+ctx2d_restore(struct Context2D *ctx2d);
 void
 ctx2d_scale(struct Context2D *ctx2d, double x, double y);
 void
+ctx2d_translate(struct Context2D *ctx2d, double x, double y);
+void
+ctx2d_rotate(struct Context2D *ctx2d, double angle);
+void
+ctx2d_transform(struct Context2D *ctx2d, double a, double b, double c,
+    double d, double e, double f);
+void
 ctx2d_setTransform(struct Context2D *ctx2d, double a, double b, double c,
     double d, double e, double f);
 void
+ctx2d_resetTransform(struct Context2D *ctx2d);
+void
 ctx2d_fillText(struct Context2D *ctx2d, const char *text, double x, double y);
+// Draw the sw x sh rect at (sx, sy) of image, scaled to dw x dh at (dx, dy)
+// under the current transform; image may be this context's own canvas
+void
+ctx2d_drawImage(struct Context2D *ctx2d, struct Canvas *image, double sx,
+    double sy, double sw, double sh, double dx, double dy, double dw,
+    double dh);
+
+// Straight RGBA copy of a w x h canvas rect, w * 4 bytes per row, lent to
+// the caller until ctx2d_image_data_free(owner, data). A full frame reuses
+// surface-sized buffers, so the steady state allocates nothing.
+unsigned char *
+ctx2d_getImageData(struct Context2D *ctx2d, int x, int y, int w, int h,
+    void **owner);
+void
+ctx2d_image_data_free(void *owner, unsigned char *data);
+// Write straight RGBA pixels at (dx, dy), ignoring transform and alpha. A
+// full frame that getImageData lent is adopted as the surface without a
+// copy, so writes to it show up until the canvas is next drawn on or read.
+void
+ctx2d_putImageData(struct Context2D *ctx2d, unsigned char *rgba, int w, int h,
+    int dx, int dy);
 
 // Get pixel data (ARGB premultiplied format)
 unsigned char *
 ctx2d_get_data(struct Context2D *ctx2d);
 int
 ctx2d_get_stride(struct Context2D *ctx2d);
+// Rasterize into caller-owned memory of the surface's size (or back into an
+// owned surface when data is NULL). The current pixels, transform, alpha and
+// line width carry over; the current path does not, so call between frames.
+int
+ctx2d_set_target(struct Context2D *ctx2d, unsigned char *data, int stride);
+// Back into an owned surface when the current target can't be touched any
+// more (the memory was unlocked and moved), without reading it: the pixels
+// come from contents (stride bytes per row), or are cleared when it is NULL
+int
+ctx2d_leave_target(struct Context2D *ctx2d, const unsigned char *contents,
+    int stride);
+// With raster off, drawing calls only update state (path, transform, style)
+// and leave the pixels alone; used to simulate frames that won't be shown
+void
+ctx2d_set_raster(struct Context2D *ctx2d, bool raster);
+// Turn raster off and append drawing calls to rec (NULL: stop, and draw
+// again). Calls that need the pixels mark rec unplayable, as does drawing
+// this canvas onto another.
+void
+ctx2d_set_recording(struct Context2D *ctx2d, struct Recording *rec);
+// Turn the hairline stroke rasterizer and the circle stroke fast path off
+// (on by default) to compare them with PlutoVG's stroker
+void
+ctx2d_set_hairline(struct Context2D *ctx2d, bool hairline);
+// Antialiasing the context starts with and goes back to on reset, so dweets
+// that never set x.antialias run in mode
+void
+ctx2d_set_default_antialias(struct Context2D *ctx2d, enum Antialias mode);
+// Bytes of path, rasterizer and copy buffers the context keeps between
+// calls; pixel memory is counted by the canvas's SurfacePool
+size_t
+ctx2d_scratch_memory(const struct Context2D *ctx2d);
+// Free the buffers that are only kept to save reallocating them; call
+// between frames
+void
+ctx2d_trim(struct Context2D *ctx2d);
+int
+ctx2d_get_width(struct Context2D *ctx2d);
+int
+ctx2d_get_height(struct Context2D *ctx2d);
@@ -0,0 +1,192 @@
+#include "disc.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Where a horizontal line at height y (relative to the center) cuts a
+// circle: the half chord s and the chord integral at -s and s
+struct Cut {
+    double y, s;
+    double f_lo, f_hi;
+};
+
+// One circle in one row of pixels: the cuts along the row's top and bottom
+// edges, the columns it touches and those it covers whole
+struct Slice {
+    double r;
+    struct Cut top, bottom;
+    int lo, hi;
+    int full_lo, full_hi;
+};
+
+// Antiderivative of the half chord sqrt(r^2 - u^2), for |u| <= r
+static double
+chord_integral(double u, double r)
+{
+    return 0.5 * (u * sqrt(fmax(r * r - u * u, 0)) + r * r * asin(u / r));
+}
+
+static void
+cut_init(struct Cut *cut, double y, double r)
+{
+    cut->y = y;
+    cut->s = fabs(y) < r ? sqrt(r * r - y * y) : 0;
+    cut->f_lo = chord_integral(-cut->s, r);
+    cut->f_hi = chord_integral(cut->s, r);
+}
+
+// Area of the circle above the cut and left of x (in [-r, r]), given the
+// chord integral fx at x. Columns within the half chord reach the cut;
+// beyond it they lie wholly above it (cut below the center) or below it.
+static double
+area_above(const struct Cut *cut, double r, double x, double fx)
+{
+    double y = cut->y, s = cut->s;
+    double f_min = -M_PI * r * r / 4;
+    if (y <= -r)
+        return 0;
+    if (y >= r)
+        return 2 * (fx - f_min);
+    double area = 0;
+    if (x > -s) {
+        bool within = x < s;
+        area += y * ((within ? x : s) + s) + (within ? fx : cut->f_hi) -
+            cut->f_lo;
+    }
+    if (y > 0) {
+        area += 2 * ((x < -s ? fx : cut->f_lo) - f_min);
+        if (x > s)
+            area += 2 * (fx - cut->f_hi);
+    }
+    return area;
+}
+
+// Area of the slice's circle in the row, left of x (relative to the center)
+static double
+slice_area(const struct Slice *sl, double x)
+{
+    double r = sl->r;
+    x = fmin(fmax(x, -r), r);
+    double fx = chord_integral(x, r);
+    return area_above(&sl->bottom, r, x, fx) -
+        area_above(&sl->top, r, x, fx);
+}
+
+// The row from y0 to y0 + 1 (relative to the center); false if the circle
+// misses it
+static bool
+slice_init(struct Slice *sl, double r, double cx, double y0)
+{
+    double y1 = y0 + 1;
+    double near = y0 > 0 ? y0 : y1 < 0 ? -y1 : 0;
+    double far = fmax(fabs(y0), y1 > 0 ? y1 : -y1);
+    if (near >= r)
+        return false;
+    sl->r = r;
+    double w = sqrt(r * r - near * near);
+    sl->lo = (int) floor(cx - w);
+    sl->hi = (int) ceil(cx + w);
+    sl->full_lo = sl->full_hi = sl->lo;
+    if (far < r) {
+        double f = sqrt(r * r - far * far);
+        sl->full_lo = (int) ceil(cx - f);
+        sl->full_hi = (int) floor(cx + f);
+        if (sl->full_hi < sl->full_lo)
+            sl->full_hi = sl->full_lo;
+    }
+    cut_init(&sl->top, y0, r);
+    cut_init(&sl->bottom, y1, r);
+    return true;
+}
+
+// Share of the samples x samples grid of the pixel at (x, y) (its top left
+// corner, relative to the center) that lies in the ring
+static unsigned
+sampled_coverage(int samples, double x, double y, double outer,
+    double inner)
+{
+    double o2 = outer * outer, i2 = inner * inner;
+    unsigned inside = 0;
+    for (int j = 0; j < samples; j++) {
+        double sy = y + (j + 0.5) / samples;
+        for (int i = 0; i < samples; i++) {
+            double sx = x + (i + 0.5) / samples;
+            double d2 = sx * sx + sy * sy;
+            inside += d2 <= o2 && d2 >= i2;
+        }
+    }
+    unsigned total = samples * samples;
+    return (inside * 255 + total / 2) / total;
+}
+
+void
+disc_fill(const struct Disc *disc, double cx, double cy, double outer,
+    double inner)
+{
+    if (!(isfinite(cx) && isfinite(cy) && outer > 0 &&
+            outer <= DISC_MAX_RADIUS && inner < outer))
+        return;
+    if (!(inner > 0))
+        inner = 0;
+    if (cx + outer <= 0 || cx - outer >= disc->width || cy + outer <= 0 ||
+        cy - outer >= disc->height)
+        return;
+
+    int py0 = (int) fmax(floor(cy - outer), 0);
+    int py1 = (int) fmin(ceil(cy + outer), disc->height);
+    for (int py = py0; py < py1; py++) {
+        double y0 = py - cy;
+        struct Slice o, in;
+        if (!slice_init(&o, outer, cx, y0))
+            continue;
+        bool has_inner = inner > 0 && slice_init(&in, inner, cx, y0);
+        if (!has_inner)
+            in.lo = in.hi = in.full_lo = in.full_hi = INT_MIN;
+
+        uint32_t *row = disc->data + (size_t) py * disc->stride;
+        int x = o.lo > 0 ? o.lo : 0;
+        int hi = o.hi < disc->width ? o.hi : disc->width;
+        // Area of the ring in the row left of the pixel boundary area_x
+        int area_x = INT_MIN;
+        double area = 0;
+        while (x < hi) {
+            bool near_inner = x >= in.lo && x < in.hi;
+            if (x >= o.full_lo && x < o.full_hi && !near_inner) {
+                int end = o.full_hi < hi ? o.full_hi : hi;
+                if (x < in.lo && in.lo < end)
+                    end = in.lo;
+                blit_fill_row(disc->op, row + x, disc->color, end - x, 255);
+                x = end;
+                continue;
+            }
+            if (x >= in.full_lo && x < in.full_hi) {
+                x = in.full_hi;
+                continue;
+            }
+
+            unsigned cov;
+            if (disc->samples > 0) {
+                cov = sampled_coverage(disc->samples, x - cx, y0, outer,
+                    inner);
+            } else {
+                double left = area;
+                if (area_x != x) {
+                    left = slice_area(&o, x - cx);
+                    if (has_inner)
+                        left -= slice_area(&in, x - cx);
+                }
+                area = slice_area(&o, x + 1 - cx);
+                if (has_inner)
+                    area -= slice_area(&in, x + 1 - cx);
+                area_x = x + 1;
+                double a = fmin(fmax(area - left, 0), 1);
+                cov = (unsigned) (a * 255 + 0.5);
+            }
+            if (cov > 0)
+                blit_fill_row(disc->op, row + x, disc->color, 1, cov);
+            x++;
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "blit.h"
+
+#include <stdint.h>
+
+// Discs and rings (annuli) drawn straight into a premultiplied ARGB32
+// surface with a span kernel, for fill() of a circle and strokes of one too
+// wide for the hairline rasterizer. The pixels a row covers whole go to the
+// kernel as one span, so only the pixels on the edges cost more than a
+// fillRect; there is no polygon to flatten and scan-convert.
+
+// Past this radius in pixels the area sums lose precision; such circles
+// are left to PlutoVG
+#define DISC_MAX_RADIUS 65536.0
+
+struct Disc {
+    uint32_t *data;
+    int stride; // in pixels
+    int width, height;
+    enum BlitOp op;
+    // Premultiplied color
+    uint32_t color;
+    // Edge pixels get the exact area of the ring inside them (0), or the
+    // share of a samples x samples grid of points in it (1: the center)
+    int samples;
+};
+
+// The ring around (cx, cy) between radii inner and outer, in device pixels;
+// inner 0 fills the disc
+void
+disc_fill(const struct Disc *disc, double cx, double cy, double outer,
+    double inner);
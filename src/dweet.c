@@ -0,0 +1,540 @@
+#define _GNU_SOURCE // asprintf
+
+#include "dweet.h"
+
+#include "analyze.h"
+#include "canvas.h"
+#include "js.h"
+#include "profile.h"
+#include "quickjs.h"
+#include "surfpool.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Dweet {
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSValue canvas;
+    JSValue global;
+    // Makes u from the values of the bound globals
+    JSValue bind_func;
+    // What comes before the dweet's code on its first line
+    const char *prefix;
+    JSValue u_func;
+    struct Context2D *ctx2d;
+    struct SurfacePool *surfaces;
+    char *code;
+    struct Profile *profile;
+    // The t of the current frame, and the Math.random() state once
+    // dweet_set_deterministic() has been called
+    double t;
+    uint64_t random_state;
+};
+
+// Pixel memory all of a dweet's canvases may hold at once
+#define CANVAS_MEMORY_LIMIT ((size_t) 256 << 20)
+
+// dwitter's shorthands that dweets use in their hot loops. They are
+// globals, but u sees them as parameters of an enclosing function, so each
+// use reads a closure variable instead of looking a property up on the
+// global object. That is only the same as reading the global while the two
+// agree: a dweet that may rebind one (x=c.getContext('2d'), or anything
+// through eval) gets the unbound wrapper and reads the globals as before.
+static const char *const bound_globals[] = { "c", "x", "S", "C", "T", "R" };
+#define NUM_BOUND_GLOBALS \
+    (sizeof(bound_globals) / sizeof(bound_globals[0]))
+
+// The dweet's code becomes the body of u(t), after one of these on the
+// same line; the parameters are bound_globals
+#define U_PREFIX "(function (c, x, S, C, T, R) { return function u(t) { "
+#define U_PREFIX_UNBOUND "(function () { return function u(t) { "
+#define U_SUFFIX "\n}; })"
+
+static int
+hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static JSValue
+js_unescape(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+{
+    (void) this_val;
+    if (argc < 1)
+        return JS_NewString(ctx, "");
+
+    const char *str = JS_ToCString(ctx, argv[0]);
+    if (!str)
+        return JS_EXCEPTION;
+
+    size_t len = strlen(str);
+    char *out = malloc(len + 1);
+    if (!out) {
+        JS_FreeCString(ctx, str);
+        return JS_EXCEPTION;
+    }
+
+    size_t j = 0;
+    for (size_t i = 0; i < len;) {
+        if (str[i] == '%' && i + 5 < len && str[i + 1] == 'u') {
+            // %uXXXX
+            int h1 = hex_digit(str[i + 2]);
+            int h2 = hex_digit(str[i + 3]);
+            int h3 = hex_digit(str[i + 4]);
+            int h4 = hex_digit(str[i + 5]);
+            if (h1 >= 0 && h2 >= 0 && h3 >= 0 && h4 >= 0) {
+                int cp = (h1 << 12) | (h2 << 8) | (h3 << 4) | h4;
+                // Encode as UTF-8
+                if (cp < 0x80) {
+                    out[j++] = cp;
+                } else if (cp < 0x800) {
+                    out[j++] = 0xC0 | (cp >> 6);
+                    out[j++] = 0x80 | (cp & 0x3F);
+                } else {
+                    out[j++] = 0xE0 | (cp >> 12);
+                    out[j++] = 0x80 | ((cp >> 6) & 0x3F);
+                    out[j++] = 0x80 | (cp & 0x3F);
+                }
+                i += 6;
+                continue;
+            }
+        } else if (str[i] == '%' && i + 2 < len) {
+            // %XX
+            int h1 = hex_digit(str[i + 1]);
+            int h2 = hex_digit(str[i + 2]);
+            if (h1 >= 0 && h2 >= 0) {
+                out[j++] = (h1 << 4) | h2;
+                i += 3;
+                continue;
+            }
+        }
+        out[j++] = str[i++];
+    }
+    out[j] = '\0';
+
+    JS_FreeCString(ctx, str);
+    JSValue result = JS_NewString(ctx, out);
+    free(out);
+    return result;
+}
+
+static int
+is_safe_char(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+        (c >= '0' && c <= '9') || c == '@' || c == '*' || c == '_' ||
+        c == '+' || c == '-' || c == '.' || c == '/';
+}
+
+static JSValue
+js_escape(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+{
+    (void) this_val;
+    if (argc < 1)
+        return JS_NewString(ctx, "");
+
+    // Handle tagged template literal: escape`...` passes an array as first arg
+    JSValue str_val = argv[0];
+    int free_str_val = 0;
+    if (JS_IsArray(argv[0])) {
+        str_val = JS_GetPropertyUint32(ctx, argv[0], 0);
+        free_str_val = 1;
+    }
+
+    const char *str = JS_ToCString(ctx, str_val);
+    if (free_str_val)
+        JS_FreeValue(ctx, str_val);
+    if (!str)
+        return JS_EXCEPTION;
+
+    size_t len = strlen(str);
+    // Worst case: each char becomes %uXXXX (6 chars)
+    char *out = malloc(len * 6 + 1);
+    if (!out) {
+        JS_FreeCString(ctx, str);
+        return JS_EXCEPTION;
+    }
+
+    size_t j = 0;
+    for (size_t i = 0; i < len;) {
+        unsigned char c = str[i];
+        if (is_safe_char(c)) {
+            out[j++] = c;
+            i++;
+        } else if (c < 0x80) {
+            // Single byte, encode as %XX
+            j += sprintf(out + j, "%%%02X", c);
+            i++;
+        } else {
+            // UTF-8 sequence, decode to code point then encode as %uXXXX
+            int cp = 0;
+            if ((c & 0xE0) == 0xC0 && i + 1 < len) {
+                cp = ((c & 0x1F) << 6) | (str[i + 1] & 0x3F);
+                i += 2;
+            } else if ((c & 0xF0) == 0xE0 && i + 2 < len) {
+                cp = ((c & 0x0F) << 12) | ((str[i + 1] & 0x3F) << 6) |
+                    (str[i + 2] & 0x3F);
+                i += 3;
+            } else if ((c & 0xF8) == 0xF0 && i + 3 < len) {
+                cp = ((c & 0x07) << 18) | ((str[i + 1] & 0x3F) << 12) |
+                    ((str[i + 2] & 0x3F) << 6) | (str[i + 3] & 0x3F);
+                i += 4;
+            } else {
+                // Invalid UTF-8, just encode the byte
+                j += sprintf(out + j, "%%%02X", c);
+                i++;
+                continue;
+            }
+            if (cp > 0xFFFF) {
+                // Surrogate pair for characters > 0xFFFF
+                int hi = 0xD800 + ((cp - 0x10000) >> 10);
+                int lo = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+                j += sprintf(out + j, "%%u%04X%%u%04X", hi, lo);
+            } else {
+                j += sprintf(out + j, "%%u%04X", cp);
+            }
+        }
+    }
+    out[j] = '\0';
+
+    JS_FreeCString(ctx, str);
+    JSValue result = JS_NewString(ctx, out);
+    free(out);
+    return result;
+}
+
+static JSValue
+js_R(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+{
+    double r, g, b, a = 1.0;
+    JS_ToFloat64(ctx, &r, argv[0]);
+    JS_ToFloat64(ctx, &g, argv[1]);
+    JS_ToFloat64(ctx, &b, argv[2]);
+    if (argc > 3)
+        JS_ToFloat64(ctx, &a, argv[3]);
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "rgba(%.0f,%.0f,%.0f,%g)", r, g, b, a);
+    return JS_NewString(ctx, buf);
+}
+
+// Math.random() for dweet_set_deterministic(): xorshift64*
+static JSValue
+js_seeded_random(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    struct Dweet *dweet = JS_GetContextOpaque(ctx);
+    uint64_t x = dweet->random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    dweet->random_state = x;
+    return JS_NewFloat64(ctx, ((x * 0x2545F4914F6CDD1DULL) >> 11) * 0x1p-53);
+}
+
+// Date.now() and performance.now() for dweet_set_deterministic()
+static JSValue
+js_frame_clock(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    struct Dweet *dweet = JS_GetContextOpaque(ctx);
+    return JS_NewFloat64(ctx, dweet->t * 1000);
+}
+
+static void
+setup_globals(JSContext *ctx, JSValue canvas)
+{
+    JSValue global = JS_GetGlobalObject(ctx);
+
+    // S = Math.sin, C = Math.cos, T = Math.tan
+    JSValue math = JS_GetPropertyStr(ctx, global, "Math");
+    JS_SetPropertyStr(ctx, global, "S", JS_GetPropertyStr(ctx, math, "sin"));
+    JS_SetPropertyStr(ctx, global, "C", JS_GetPropertyStr(ctx, math, "cos"));
+    JS_SetPropertyStr(ctx, global, "T", JS_GetPropertyStr(ctx, math, "tan"));
+    JS_FreeValue(ctx, math);
+
+    // R(r,g,b,a) - returns "rgba(r,g,b,a)" string
+    JS_SetPropertyStr(ctx, global, "R", JS_NewCFunction(ctx, js_R, "R", 4));
+
+    // escape/unescape for dweets using eval(unescape(escape`...`)) compression
+    JS_SetPropertyStr(ctx, global, "escape",
+        JS_NewCFunction(ctx, js_escape, "escape", 1));
+    JS_SetPropertyStr(ctx, global, "unescape",
+        JS_NewCFunction(ctx, js_unescape, "unescape", 1));
+
+    // c = canvas, x = 2d context
+    JS_SetPropertyStr(ctx, global, "c", JS_DupValue(ctx, canvas));
+
+    JSValue context = JS_GetPropertyStr(ctx, canvas, "getContext");
+    JSValue args[] = { JS_NewString(ctx, "2d") };
+    JSValue x = JS_Call(ctx, context, canvas, 1, args);
+    JS_FreeValue(ctx, args[0]);
+    JS_FreeValue(ctx, context);
+    JS_SetPropertyStr(ctx, global, "x", x);
+
+    JS_FreeValue(ctx, global);
+}
+
+// Print and clear a pending exception; returns 0 if there was none,
+// DWEET_OUT_OF_MEMORY if it was QuickJS running out of heap, -1 otherwise
+static int
+check_exception(JSContext *ctx, JSValue val)
+{
+    if (!JS_IsException(val))
+        return 0;
+    JSValue exc = JS_GetException(ctx);
+    const char *str = JS_ToCString(ctx, exc);
+    // What JS_ThrowOutOfMemory() throws
+    int ret = str && strcmp(str, "InternalError: out of memory") == 0
+        ? DWEET_OUT_OF_MEMORY
+        : -1;
+    fprintf(stderr, "error: %s\n", str);
+    JS_FreeCString(ctx, str);
+    JSValue stack = JS_GetPropertyStr(ctx, exc, "stack");
+    if (!JS_IsUndefined(stack)) {
+        const char *stack_str = JS_ToCString(ctx, stack);
+        fprintf(stderr, "%s", stack_str);
+        JS_FreeCString(ctx, stack_str);
+    }
+    JS_FreeValue(ctx, stack);
+    JS_FreeValue(ctx, exc);
+    return ret;
+}
+
+// Make u, closing over the current values of the bound globals (which the
+// unbound wrapper ignores)
+static int
+bind_u(struct Dweet *dweet)
+{
+    JSContext *ctx = dweet->ctx;
+    JSValue args[NUM_BOUND_GLOBALS];
+    for (size_t i = 0; i < NUM_BOUND_GLOBALS; i++)
+        args[i] = JS_GetPropertyStr(ctx, dweet->global, bound_globals[i]);
+    JSValue u =
+        JS_Call(ctx, dweet->bind_func, JS_UNDEFINED, NUM_BOUND_GLOBALS, args);
+    for (size_t i = 0; i < NUM_BOUND_GLOBALS; i++)
+        JS_FreeValue(ctx, args[i]);
+    if (check_exception(ctx, u))
+        return -1;
+    JS_FreeValue(ctx, dweet->u_func);
+    dweet->u_func = u;
+    // u used to be a global itself; dweets may still call it
+    JS_SetPropertyStr(ctx, dweet->global, "u", JS_DupValue(ctx, u));
+    return 0;
+}
+
+struct Dweet *
+dweet_new(const char *code, const char *filename, unsigned width,
+    unsigned height)
+{
+    struct Dweet *dweet = malloc(sizeof(*dweet));
+    if (!dweet)
+        return NULL;
+    *dweet = (struct Dweet) {
+        .canvas = JS_UNDEFINED,
+        .global = JS_UNDEFINED,
+        .bind_func = JS_UNDEFINED,
+        .u_func = JS_UNDEFINED,
+    };
+
+    dweet->surfaces = surface_pool_new(CANVAS_MEMORY_LIMIT);
+    if (!dweet->surfaces) {
+        fprintf(stderr, "error: out of memory\n");
+        goto fail;
+    }
+
+    dweet->rt = JS_NewRuntime();
+    if (!dweet->rt) {
+        fprintf(stderr, "error: could not create JS runtime\n");
+        goto fail;
+    }
+
+    dweet->ctx = JS_NewContext(dweet->rt);
+    if (!dweet->ctx) {
+        fprintf(stderr, "error: could not create JS context\n");
+        goto fail;
+    }
+
+    // Initialize canvas classes and create canvas
+    js_canvas_init(dweet->ctx, dweet->surfaces);
+    dweet->canvas = js_canvas_new(dweet->ctx, DWEET_WIDTH, DWEET_HEIGHT);
+    if (JS_IsException(dweet->canvas)) {
+        fprintf(stderr, "error: could not create canvas\n");
+        goto fail;
+    }
+    js_canvas_set_resolution(dweet->ctx, dweet->canvas, width, height);
+
+    // Get Context2D for rendering
+    dweet->ctx2d = js_canvas_get_context2d(dweet->ctx, dweet->canvas);
+    if (!dweet->ctx2d) {
+        fprintf(stderr, "error: could not get 2D context\n");
+        goto fail;
+    }
+
+    setup_globals(dweet->ctx, dweet->canvas);
+
+    // Wrap code in u(t) function
+    dweet->prefix = analyze_rebinds(code, bound_globals, NUM_BOUND_GLOBALS)
+        ? U_PREFIX_UNBOUND
+        : U_PREFIX;
+    char *wrapped;
+    if (asprintf(&wrapped, "%s%s" U_SUFFIX, dweet->prefix, code) == -1) {
+        fprintf(stderr, "error: out of memory\n");
+        goto fail;
+    }
+
+    JSValue result = JS_Eval(dweet->ctx, wrapped, strlen(wrapped), filename,
+        JS_EVAL_TYPE_GLOBAL);
+    free(wrapped);
+
+    if (check_exception(dweet->ctx, result)) {
+        JS_FreeValue(dweet->ctx, result);
+        goto fail;
+    }
+    dweet->bind_func = result;
+    dweet->global = JS_GetGlobalObject(dweet->ctx);
+    if (bind_u(dweet) < 0)
+        goto fail;
+
+    dweet->code = strdup(code);
+    if (!dweet->code) {
+        fprintf(stderr, "error: out of memory\n");
+        goto fail;
+    }
+    return dweet;
+
+fail:
+    dweet_destroy(dweet);
+    return NULL;
+}
+
+void
+dweet_destroy(struct Dweet *dweet)
+{
+    if (!dweet)
+        return;
+    if (dweet->ctx) {
+        JS_FreeValue(dweet->ctx, dweet->u_func);
+        JS_FreeValue(dweet->ctx, dweet->bind_func);
+        JS_FreeValue(dweet->ctx, dweet->global);
+        JS_FreeValue(dweet->ctx, dweet->canvas);
+        JS_FreeContext(dweet->ctx);
+    }
+    if (dweet->rt)
+        JS_FreeRuntime(dweet->rt);
+    // After the runtime, whose canvases and ImageData hold pool memory
+    surface_pool_destroy(dweet->surfaces);
+    free(dweet->code);
+    free(dweet);
+}
+
+void
+dweet_attach_thread(struct Dweet *dweet)
+{
+    // QuickJS measures stack depth from the thread that created the runtime
+    JS_UpdateStackTop(dweet->rt);
+}
+
+void
+dweet_profile(struct Dweet *dweet, struct Profile *profile)
+{
+    static const char *const globals[] = {
+        "S", "C", "T", "R", "escape", "unescape", NULL,
+    };
+    JSContext *ctx = dweet->ctx;
+    profile_attach(profile, ctx, dweet->code, (int) strlen(dweet->prefix));
+    profile_wrap(profile, ctx, dweet->global, NULL, globals);
+    JSValue x = JS_GetPropertyStr(ctx, dweet->global, "x");
+    profile_wrap(profile, ctx, x, "x", NULL);
+    JS_FreeValue(ctx, x);
+    profile_wrap(profile, ctx, dweet->canvas, "c", NULL);
+    dweet->profile = profile;
+    // u closed over S, C, T and R from before they were wrapped
+    bind_u(dweet);
+}
+
+static void
+replace_method(JSContext *ctx, JSValueConst global, const char *obj_name,
+    const char *name, JSCFunction *func)
+{
+    JSValue obj = JS_GetPropertyStr(ctx, global, obj_name);
+    if (JS_IsObject(obj))
+        JS_SetPropertyStr(ctx, obj, name, JS_NewCFunction(ctx, func, name, 0));
+    JS_FreeValue(ctx, obj);
+}
+
+void
+dweet_set_deterministic(struct Dweet *dweet, uint64_t seed)
+{
+    JSContext *ctx = dweet->ctx;
+    JS_SetContextOpaque(ctx, dweet);
+    // xorshift gets stuck at 0
+    dweet->random_state = seed ? seed : 1;
+    replace_method(ctx, dweet->global, "Math", "random", js_seeded_random);
+    replace_method(ctx, dweet->global, "Date", "now", js_frame_clock);
+    replace_method(ctx, dweet->global, "performance", "now", js_frame_clock);
+}
+
+void
+dweet_set_memory_limit(struct Dweet *dweet, size_t bytes)
+{
+    JS_SetMemoryLimit(dweet->rt, bytes);
+}
+
+void
+dweet_memory(struct Dweet *dweet, struct DweetMemory *mem)
+{
+    JSMemoryUsage usage;
+    JS_ComputeMemoryUsage(dweet->rt, &usage);
+    *mem = (struct DweetMemory) {
+        .js_heap = usage.malloc_size,
+        // QuickJS reports no limit as 0 or -1
+        .js_limit = usage.malloc_limit > 0 ? (size_t) usage.malloc_limit : 0,
+        .js_objects = usage.obj_count,
+        .surfaces = surface_pool_in_use(dweet->surfaces),
+        .surfaces_cached = surface_pool_cached(dweet->surfaces),
+        .scratch = ctx2d_scratch_memory(dweet->ctx2d),
+    };
+}
+
+void
+dweet_trim_memory(struct Dweet *dweet)
+{
+    // Garbage first: ImageData and canvases it frees go back to the pool
+    JS_RunGC(dweet->rt);
+    surface_pool_trim(dweet->surfaces);
+    ctx2d_trim(dweet->ctx2d);
+}
+
+int
+dweet_frame(struct Dweet *dweet, double t)
+{
+    dweet->t = t;
+    JSValue t_val = JS_NewFloat64(dweet->ctx, t);
+    if (dweet->profile)
+        profile_frame_begin(dweet->profile);
+    JSValue ret = JS_Call(dweet->ctx, dweet->u_func, dweet->global, 1, &t_val);
+    if (dweet->profile)
+        profile_frame_end(dweet->profile);
+    JS_FreeValue(dweet->ctx, t_val);
+
+    int rc = check_exception(dweet->ctx, ret);
+    JS_FreeValue(dweet->ctx, ret);
+    return rc;
+}
+
+struct Context2D *
+dweet_context2d(struct Dweet *dweet)
+{
+    return dweet->ctx2d;
+}
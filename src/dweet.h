@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct Context2D;
+struct Dweet;
+struct Profile;
+
+// What a dweet holds, in bytes
+struct DweetMemory {
+    // QuickJS heap, its limit (0 = none) and the objects in it
+    size_t js_heap;
+    size_t js_limit;
+    uint64_t js_objects;
+    // Canvas and ImageData pixels handed out, and freed ones kept for reuse
+    size_t surfaces;
+    size_t surfaces_cached;
+    // Path, rasterizer and copy buffers of the dweet's context
+    size_t scratch;
+};
+
+// Dwitter's canvas size; every dweet is written against these coordinates
+#define DWEET_WIDTH  1920
+#define DWEET_HEIGHT 1080
+
+// Create a JS runtime for a dweet whose canvas rasterizes at
+// width x height (the canvas still reports DWEET_WIDTH x DWEET_HEIGHT to JS)
+struct Dweet *
+dweet_new(const char *code, const char *filename, unsigned width,
+    unsigned height);
+void
+dweet_destroy(struct Dweet *dweet);
+
+// Must be called by a thread before it runs a dweet created on another thread
+void
+dweet_attach_thread(struct Dweet *dweet);
+
+// Sample this dweet's u(t) into profile, which must outlive it. The canvas,
+// its context and the S, C, T, R, escape and unescape globals are wrapped
+// so time in them shows up by name.
+void
+dweet_profile(struct Dweet *dweet, struct Profile *profile);
+
+// Make renders repeatable: Math.random() becomes a generator seeded with
+// seed, and Date.now() and performance.now() return t in milliseconds.
+// new Date() still reads the real clock.
+void
+dweet_set_deterministic(struct Dweet *dweet, uint64_t seed);
+
+// Fail JS allocations past bytes (0 = no limit); the dweet sees an out of
+// memory error and dweet_frame() returns DWEET_OUT_OF_MEMORY
+void
+dweet_set_memory_limit(struct Dweet *dweet, size_t bytes);
+// Walks the JS heap, so takes time in proportion to it; not for every frame
+void
+dweet_memory(struct Dweet *dweet, struct DweetMemory *mem);
+// Collect garbage and free memory only kept for reuse; between frames
+void
+dweet_trim_memory(struct Dweet *dweet);
+
+#define DWEET_OUT_OF_MEMORY (-2)
+
+// Run u(t); returns -1 if the dweet threw, DWEET_OUT_OF_MEMORY if it threw
+// because the JS heap hit its limit
+int
+dweet_frame(struct Dweet *dweet, double t);
+
+struct Context2D *
+dweet_context2d(struct Dweet *dweet);
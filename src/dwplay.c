@@ -1,17 +1,26 @@
+#include "analyze.h"
+#include "bench.h"
+#include "budget.h"
 #include "canvas.h"
+#include "dweet.h"
+#include "export.h"
 #include "gfx.h"
-#include "js.h"
-#include "quickjs.h"
-
+#include "golden.h"
+#include "grid.h"
+#include "profile.h"
+#include "ring.h"
+#include "sched.h"
+#include "y4m.h"
+
+#include <getopt.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#define CANVAS_WIDTH  1920
-#define CANVAS_HEIGHT 1080
-
 static char *
 read_file(const char *path)
 {
@@ -40,361 +49,911 @@ read_file(const char *path)
     return buf;
 }
 
+static double
+get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+get_cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Megabytes on the command line, in bytes
 static int
-hex_digit(char c)
+parse_megabytes(const char *str, size_t *bytes)
 {
-    if (c >= '0' && c <= '9')
-        return c - '0';
-    if (c >= 'A' && c <= 'F')
-        return c - 'A' + 10;
-    if (c >= 'a' && c <= 'f')
-        return c - 'a' + 10;
-    return -1;
+    char *end;
+    double mb = strtod(str, &end);
+    if (*str == '\0' || *end != '\0' || !(mb > 0) ||
+        mb >= (double) (SIZE_MAX >> 20))
+        return -1;
+    *bytes = (size_t) (mb * (1 << 20));
+    return 0;
 }
 
-static JSValue
-js_unescape(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+// Samples per second of CPU time for --profile, and hot spots it prints
+#define PROFILE_HZ 1000
+#define PROFILE_HOTSPOTS 10
+
+// Frame rate while another window has the focus
+#define UNFOCUSED_FPS 30
+// How often a hidden window checks whether it is back
+#define HIDDEN_POLL_SECONDS 0.1
+
+// How often memory is checked against --memory-budget by default
+#define BUDGET_INTERVAL 1.0
+
+struct Options {
+    unsigned rows, cols;
+    bool zero_copy;
+    bool hairline;
+    enum Antialias antialias;
+    // Publish frames into this shared-memory ring (NULL = off)
+    const char *ring;
+    unsigned ring_slots;
+    // Also write every frame as YUV4MPEG2 to this path ("-" = stdout)
+    const char *y4m;
+    // Sample u(t) and write folded stacks here
+    const char *profile;
+    // Stop after this many frames and print timings (0 = run until quit)
+    unsigned long bench_frames;
+    // Add hardware counters to the timings
+    bool counters;
+    enum SchedPolicy sched;
+    unsigned fps;
+    unsigned max_catchup;
+    // Present at most this many frames per second (0 = no cap)
+    double max_fps;
+    // Export this many frames to the --y4m file offline instead of playing
+    unsigned long frames;
+    unsigned jobs;
+    bool verify;
+    // Size of the exported frames, rendered this many rows at a time
+    // (0 = whole frames)
+    unsigned export_width, export_height;
+    unsigned band_rows;
+    bool analyze;
+    // JS heap and total memory allowed, in bytes (0 = no limit)
+    size_t js_memory;
+    size_t memory_budget;
+    enum BudgetPolicy budget_policy;
+    // Print memory use this often, in seconds (0 = never)
+    double memory_stats;
+    // Check renders against the golden images in this directory
+    const char *golden;
+    bool update_golden;
+    unsigned tolerance;
+    // When main() started, for the time to first frame
+    double start;
+};
+
+static void
+usage(const char *prog)
 {
-    (void) this_val;
-    if (argc < 1)
-        return JS_NewString(ctx, "");
-
-    const char *str = JS_ToCString(ctx, argv[0]);
-    if (!str)
-        return JS_EXCEPTION;
-
-    size_t len = strlen(str);
-    char *out = malloc(len + 1);
-    if (!out) {
-        JS_FreeCString(ctx, str);
-        return JS_EXCEPTION;
-    }
+    fprintf(stderr,
+        "usage: %s [options] <file.js>...\n"
+        "  --grid RxC        show a mosaic of R rows and C columns of dweets,\n"
+        "                    each rendered on its own thread\n"
+        "  --backend NAME    display backend (%s)\n"
+        "  --bench N         render N frames, then print timings as JSON\n"
+        "  --counters        with --bench, also count cycles, instructions,\n"
+        "                    cache and branch misses per phase\n"
+        "  --ring NAME       publish frames to the shared-memory ring NAME\n"
+        "  --ring-slots N    number of frames in the ring (default 3)\n"
+        "  --y4m FILE        write frames as YUV4MPEG2 to FILE (- for stdout)\n"
+        "  --profile FILE    sample the dweet's JavaScript, write folded stacks\n"
+        "                    for flamegraph tools to FILE and print hot spots\n"
+        "  --sched POLICY    how t advances: realtime (wall clock, default),\n"
+        "                    fixed (1/fps per frame, like dwitter) or catchup\n"
+        "                    (fixed steps kept in sync with the wall clock)\n"
+        "  --fps N           step rate for fixed and catchup (default 60)\n"
+        "  --max-catchup N   frames catchup may simulate without drawing before\n"
+        "                    dropping them (default 4, max %d)\n"
+        "  --max-fps N       present at most N frames per second\n"
+        "  --frames N        export N frames to the --y4m file as fast as\n"
+        "                    possible, without a display; frame-independent\n"
+        "                    dweets render in parallel\n"
+        "  --jobs N          threads for --frames (default: one per CPU)\n"
+        "  --verify          with --frames, check parallel frames against a\n"
+        "                    serial render\n"
+        "  --size WxH        with --frames, export at WxH instead of 1920x1080\n"
+        "  --band N          with --frames, render N rows (even) at a time,\n"
+        "                    for sizes like 7680x4320 in little memory\n"
+        "  --analyze         print whether each dweet is frame-independent\n"
+        "  --js-memory MB    limit the dweet's JS heap; running out counts as\n"
+        "                    going over --memory-budget\n"
+        "  --memory-budget MB\n"
+        "                    limit the JS heap, canvases, caches, texture and\n"
+        "                    ring together; past it the dweet's garbage is\n"
+        "                    collected and caches freed, then --on-budget\n"
+        "  --on-budget POLICY\n"
+        "                    restart (reload the dweet, default) or exit (with\n"
+        "                    status %d for a supervisor to restart dwplay)\n"
+        "  --memory-stats S  print memory use every S seconds\n"
+        "  --golden DIR      render each dweet headless and deterministic at\n"
+        "                    fixed timestamps and compare with the PNGs in\n"
+        "                    DIR; differing frames and heatmaps go to DIR/diff\n"
+        "  --update-golden   with --golden, write the PNGs and timings instead\n"
+        "  --tolerance N     per-channel difference --golden accepts (default\n"
+        "                    0)\n"
+        "  --no-zero-copy    always copy frames into the texture instead of\n"
+        "                    drawing into texture memory directly\n"
+        "  --no-hairline     stroke thin lines and circles with the general\n"
+        "                    stroker (to compare the two with --bench)\n"
+        "  --antialias MODE  edge antialiasing for dweets that don't set\n"
+        "                    x.antialias: none, analytic (default) or\n"
+        "                    supersample\n",
+        prog, gfx_backend_list(), SCHED_MAX_CATCHUP, BUDGET_EXIT_STATUS);
+}
 
-    size_t j = 0;
-    for (size_t i = 0; i < len;) {
-        if (str[i] == '%' && i + 5 < len && str[i + 1] == 'u') {
-            // %uXXXX
-            int h1 = hex_digit(str[i + 2]);
-            int h2 = hex_digit(str[i + 3]);
-            int h3 = hex_digit(str[i + 4]);
-            int h4 = hex_digit(str[i + 5]);
-            if (h1 >= 0 && h2 >= 0 && h3 >= 0 && h4 >= 0) {
-                int cp = (h1 << 12) | (h2 << 8) | (h3 << 4) | h4;
-                // Encode as UTF-8
-                if (cp < 0x80) {
-                    out[j++] = cp;
-                } else if (cp < 0x800) {
-                    out[j++] = 0xC0 | (cp >> 6);
-                    out[j++] = 0x80 | (cp & 0x3F);
-                } else {
-                    out[j++] = 0xE0 | (cp >> 12);
-                    out[j++] = 0x80 | ((cp >> 6) & 0x3F);
-                    out[j++] = 0x80 | (cp & 0x3F);
-                }
-                i += 6;
-                continue;
-            }
-        } else if (str[i] == '%' && i + 2 < len) {
-            // %XX
-            int h1 = hex_digit(str[i + 1]);
-            int h2 = hex_digit(str[i + 2]);
-            if (h1 >= 0 && h2 >= 0) {
-                out[j++] = (h1 << 4) | h2;
-                i += 3;
-                continue;
-            }
-        }
-        out[j++] = str[i++];
+// Hold off the next frame as --max-fps and the window's visibility ask.
+// Returns false while the window is hidden: u(t) is not run at all then,
+// and t resumes where it stopped. Benchmarks always run flat out.
+static bool
+throttle(struct Sched *sched, const struct Options *opts)
+{
+    enum GfxVisibility visibility =
+        opts->bench_frames ? GFX_VISIBLE : gfx_visibility();
+    if (visibility == GFX_HIDDEN) {
+        double now = get_time();
+        sched_sleep_until(now + HIDDEN_POLL_SECONDS);
+        sched_pause(sched, get_time() - now);
+        return false;
     }
-    out[j] = '\0';
 
-    JS_FreeCString(ctx, str);
-    JSValue result = JS_NewString(ctx, out);
-    free(out);
-    return result;
+    double interval = opts->max_fps > 0 ? 1 / opts->max_fps : 0;
+    if (visibility == GFX_UNFOCUSED && interval < 1.0 / UNFOCUSED_FPS)
+        interval = 1.0 / UNFOCUSED_FPS;
+    sched_pace(sched, interval);
+    return true;
+}
+
+static void
+print_cpu_stats(const char *name, unsigned long presented, double cpu)
+{
+    fprintf(stderr, "%s: %lu frames presented, %.2f ms CPU per frame\n", name,
+        presented, presented ? cpu * 1e3 / presented : 0);
+}
+
+static void
+print_sched_stats(const struct Sched *sched)
+{
+    double n = sched->rendered ? (double) sched->rendered : 1;
+    fprintf(stderr,
+        "%s: %llu rendered, %llu simulated, %llu dropped, "
+        "lag avg %.2f ms max %.2f ms\n",
+        sched_policy_name(sched->policy), (unsigned long long) sched->rendered,
+        (unsigned long long) sched->simulated,
+        (unsigned long long) sched->dropped, sched->total_lag * 1e3 / n,
+        sched->max_lag * 1e3);
+}
+
+struct DweetLoad {
+    const char *code;
+    const char *name;
+    struct Dweet *dweet;
+};
+
+static void *
+load_dweet(void *arg)
+{
+    struct DweetLoad *load = arg;
+    load->dweet = dweet_new(load->code, load->name, DWEET_WIDTH, DWEET_HEIGHT);
+    return NULL;
+}
+
+// Settings from the command line, for a dweet that was just loaded
+static void
+setup_dweet(struct Dweet *dweet, const struct Options *opts)
+{
+    struct Context2D *ctx2d = dweet_context2d(dweet);
+    ctx2d_set_hairline(ctx2d, opts->hairline);
+    ctx2d_set_default_antialias(ctx2d, opts->antialias);
+    dweet_set_memory_limit(dweet, opts->js_memory);
 }
 
+// Replace *dweet with a fresh copy, rendering into *target (texture memory
+// or NULL) and sampled by profile (or NULL) like the old one. The old one
+// goes first so the two never take up memory at the same time.
 static int
-is_safe_char(unsigned char c)
+restart_dweet(struct Dweet **dweet, const char *code, const char *name,
+    const struct Options *opts, unsigned char **target,
+    struct Profile *profile)
 {
-    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
-        (c >= '0' && c <= '9') || c == '@' || c == '*' || c == '_' ||
-        c == '+' || c == '-' || c == '.' || c == '/';
+    dweet_destroy(*dweet);
+    *dweet = dweet_new(code, name, DWEET_WIDTH, DWEET_HEIGHT);
+    if (!*dweet)
+        return -1;
+    setup_dweet(*dweet, opts);
+    if (profile)
+        dweet_profile(*dweet, profile);
+    if (*target) {
+        int stride;
+        unsigned char *data = gfx_lock(&stride);
+        if (!data ||
+            ctx2d_set_target(dweet_context2d(*dweet), data, stride) < 0)
+            *target = NULL;
+        if (data)
+            gfx_unlock();
+    }
+    return 0;
 }
 
-static JSValue
-js_escape(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+static int
+run_single(const char *code, const char *name, const struct Options *opts)
 {
-    (void) this_val;
-    if (argc < 1)
-        return JS_NewString(ctx, "");
-
-    // Handle tagged template literal: escape`...` passes an array as first arg
-    JSValue str_val = argv[0];
-    int free_str_val = 0;
-    if (JS_IsArray(argv[0])) {
-        str_val = JS_GetPropertyUint32(ctx, argv[0], 0);
-        free_str_val = 1;
+    // The JS runtime, canvas and compiled dweet are set up on another thread
+    // while this one brings up the display, which some platforms only allow
+    // from the main thread
+    struct DweetLoad load = { code, name, NULL };
+    pthread_t loader;
+    bool threaded = pthread_create(&loader, NULL, load_dweet, &load) == 0;
+    if (!threaded)
+        load_dweet(&load);
+    int gfx_rc = gfx_init(DWEET_WIDTH, DWEET_HEIGHT, "Dwitter Player");
+    if (threaded)
+        pthread_join(loader, NULL);
+
+    struct Dweet *dweet = load.dweet;
+    if (dweet && threaded)
+        dweet_attach_thread(dweet);
+    if (gfx_rc < 0)
+        fprintf(stderr, "error: could not initialize graphics\n");
+    if (!dweet || gfx_rc < 0) {
+        if (gfx_rc == 0)
+            gfx_cleanup();
+        dweet_destroy(dweet);
+        return 1;
+    }
+    setup_dweet(dweet, opts);
+    struct Context2D *ctx2d = dweet_context2d(dweet);
+
+    struct Ring *ring = NULL;
+    if (opts->ring) {
+        ring = ring_create(opts->ring, ctx2d_get_width(ctx2d),
+            ctx2d_get_height(ctx2d), opts->ring_slots);
+        if (!ring) {
+            fprintf(stderr, "error: could not create ring '%s'\n", opts->ring);
+            gfx_cleanup();
+            dweet_destroy(dweet);
+            return 1;
+        }
     }
 
-    const char *str = JS_ToCString(ctx, str_val);
-    if (free_str_val)
-        JS_FreeValue(ctx, str_val);
-    if (!str)
-        return JS_EXCEPTION;
-
-    size_t len = strlen(str);
-    // Worst case: each char becomes %uXXXX (6 chars)
-    char *out = malloc(len * 6 + 1);
-    if (!out) {
-        JS_FreeCString(ctx, str);
-        return JS_EXCEPTION;
+    struct Y4m *y4m = NULL;
+    if (opts->y4m) {
+        y4m = y4m_open(opts->y4m, ctx2d_get_width(ctx2d),
+            ctx2d_get_height(ctx2d), opts->fps);
+        if (!y4m) {
+            fprintf(stderr, "error: could not open '%s'\n", opts->y4m);
+            ring_destroy(ring);
+            gfx_cleanup();
+            dweet_destroy(dweet);
+            return 1;
+        }
     }
 
-    size_t j = 0;
-    for (size_t i = 0; i < len;) {
-        unsigned char c = str[i];
-        if (is_safe_char(c)) {
-            out[j++] = c;
-            i++;
-        } else if (c < 0x80) {
-            // Single byte, encode as %XX
-            j += sprintf(out + j, "%%%02X", c);
-            i++;
-        } else {
-            // UTF-8 sequence, decode to code point then encode as %uXXXX
-            int cp = 0;
-            if ((c & 0xE0) == 0xC0 && i + 1 < len) {
-                cp = ((c & 0x1F) << 6) | (str[i + 1] & 0x3F);
-                i += 2;
-            } else if ((c & 0xF0) == 0xE0 && i + 2 < len) {
-                cp = ((c & 0x0F) << 12) | ((str[i + 1] & 0x3F) << 6) |
-                    (str[i + 2] & 0x3F);
-                i += 3;
-            } else if ((c & 0xF8) == 0xF0 && i + 3 < len) {
-                cp = ((c & 0x07) << 18) | ((str[i + 1] & 0x3F) << 12) |
-                    ((str[i + 2] & 0x3F) << 6) | (str[i + 3] & 0x3F);
-                i += 4;
-            } else {
-                // Invalid UTF-8, just encode the byte
-                j += sprintf(out + j, "%%%02X", c);
-                i++;
-                continue;
+    // Rasterize straight into the texture when the backend allows it (the
+    // ring slots are the render target when publishing). Texture memory
+    // that moves can't be read any more, so a dweet that draws over its
+    // last frame keeps a copy of each one to carry on from; a stateless
+    // one starts its next frame with a reset and needs none.
+    unsigned char *target = NULL, *shadow = NULL;
+    int target_stride = 0;
+    int row_size = ctx2d_get_width(ctx2d) * 4;
+    if (opts->zero_copy && !ring) {
+        struct DweetAnalysis analysis;
+        analyze_dweet(code, &analysis);
+        bool need_shadow = analysis.kind != DWEET_STATELESS;
+        if (need_shadow)
+            shadow = malloc((size_t) row_size * ctx2d_get_height(ctx2d));
+        if (!need_shadow || shadow) {
+            target = gfx_lock(&target_stride);
+            if (target) {
+                if (ctx2d_set_target(ctx2d, target, target_stride) < 0)
+                    target = NULL;
+                gfx_unlock();
             }
-            if (cp > 0xFFFF) {
-                // Surrogate pair for characters > 0xFFFF
-                int hi = 0xD800 + ((cp - 0x10000) >> 10);
-                int lo = 0xDC00 + ((cp - 0x10000) & 0x3FF);
-                j += sprintf(out + j, "%%u%04X%%u%04X", hi, lo);
-            } else {
-                j += sprintf(out + j, "%%u%04X", cp);
+        }
+        if (!target) {
+            free(shadow);
+            shadow = NULL;
+        }
+    }
+
+    struct Profile *profile = NULL;
+    if (opts->profile) {
+        profile = profile_new();
+        if (profile) {
+            dweet_profile(dweet, profile);
+            if (profile_start(profile, PROFILE_HZ) < 0)
+                fprintf(stderr, "error: could not start the profiler\n");
+        }
+    }
+
+    // The texture, and the ring's frames, are held for as long as we run
+    size_t frame_size = (size_t) ctx2d_get_width(ctx2d) *
+        ctx2d_get_height(ctx2d) * 4;
+    struct Budget budget;
+    budget_init(&budget, opts->memory_budget, opts->budget_policy,
+        frame_size * (1 + (ring ? opts->ring_slots : 0) + (shadow != NULL)),
+        opts->memory_stats > 0 ? opts->memory_stats : BUDGET_INTERVAL,
+        opts->memory_stats > 0);
+
+    struct Bench *bench = opts->bench_frames ? bench_new() : NULL;
+    if (bench)
+        bench_set_origin(bench, opts->start);
+    if (bench && opts->counters)
+        bench_enable_counters(bench);
+    int ret = 0;
+    unsigned long frames = 0, presented = 0;
+    double cpu_start = get_cpu_time();
+    struct Sched sched;
+    sched_init(&sched, opts->sched, opts->fps, opts->max_catchup);
+
+    // Main loop
+    while (!gfx_poll_quit()) {
+        if (!throttle(&sched, opts))
+            continue;
+        struct SchedFrame steps[SCHED_MAX_CATCHUP + 1];
+        unsigned nsteps = sched_plan(&sched, get_time(), steps);
+        if (nsteps == 0) {
+            sched_wait(&sched);
+            continue;
+        }
+        double t = steps[nsteps - 1].t;
+
+        unsigned char *locked = target ? gfx_lock(&target_stride) : NULL;
+        if (target && locked != target) {
+            // Texture memory moved, and the old memory is no longer ours to
+            // read: keep drawing from an owned surface holding the last frame
+            if (locked)
+                gfx_unlock();
+            target = NULL;
+            int lrc = ctx2d_leave_target(ctx2d, shadow, row_size);
+            free(shadow);
+            shadow = NULL;
+            if (lrc < 0) {
+                fprintf(stderr, "error: out of memory\n");
+                ret = 1;
+                break;
             }
         }
+
+        if (ring) {
+            // Render straight into the next slot; set_target brings the
+            // previous frame along since dweets draw over the last frame
+            int stride;
+            unsigned char *slot = ring_begin(ring, &stride);
+            if (ctx2d_set_target(ctx2d, slot, stride) < 0) {
+                // Still drawing into the last published slot, so the
+                // slot just begun is left unpublished and we stop
+                fprintf(stderr, "error: could not render into ring '%s'\n",
+                    opts->ring);
+                ret = 1;
+                break;
+            }
+        }
+
+        if (bench)
+            bench_begin(bench, BENCH_JS);
+        int rc = 0;
+        for (unsigned i = 0; i < nsteps && rc == 0; i++) {
+            ctx2d_set_raster(ctx2d, steps[i].render);
+            rc = dweet_frame(dweet, steps[i].t);
+        }
+        ctx2d_set_raster(ctx2d, true);
+        if (bench)
+            bench_end(bench, BENCH_JS);
+
+        if (ring && rc == 0)
+            ring_publish(ring, t);
+        if (y4m && rc == 0 &&
+            y4m_write_frame(y4m, ctx2d_get_data(ctx2d),
+                ctx2d_get_stride(ctx2d)) < 0) {
+            fprintf(stderr, "error: could not write '%s'\n", opts->y4m);
+            rc = -1;
+        }
+
+        if (bench)
+            bench_begin(bench, BENCH_UPLOAD);
+
+        // Update display with PlutoVG surface data
+        if (target) {
+            if (shadow)
+                for (int y = 0; y < ctx2d_get_height(ctx2d); y++)
+                    memcpy(shadow + (size_t) y * row_size,
+                        target + (size_t) y * target_stride, row_size);
+            gfx_unlock();
+        } else
+            gfx_update(ctx2d_get_data(ctx2d), ctx2d_get_stride(ctx2d));
+
+        enum BudgetAction action = BUDGET_OK;
+        if (rc == DWEET_OUT_OF_MEMORY)
+            action = budget_out_of_memory(&budget);
+        else if (rc == 0)
+            action = budget_check(&budget, dweet, get_time(), false);
+        if (action == BUDGET_DO_EXIT) {
+            ret = BUDGET_EXIT_STATUS;
+            break;
+        }
+        if (action == BUDGET_DO_RESTART) {
+            rc = restart_dweet(&dweet, code, name, opts, &target, profile);
+            if (rc < 0) {
+                fprintf(stderr, "error: could not restart %s\n", name);
+                ret = 1;
+                break;
+            }
+            budget_restarted(&budget);
+            ctx2d = dweet_context2d(dweet);
+        }
+        if (rc < 0)
+            break;
+
+        if (bench) {
+            bench_end(bench, BENCH_UPLOAD);
+            bench_begin(bench, BENCH_PRESENT);
+        }
+        gfx_present();
+        presented++;
+        if (bench) {
+            bench_end(bench, BENCH_PRESENT);
+            bench_frame(bench);
+            if (++frames == opts->bench_frames)
+                break;
+        }
     }
-    out[j] = '\0';
 
-    JS_FreeCString(ctx, str);
-    JSValue result = JS_NewString(ctx, out);
-    free(out);
-    return result;
-}
+    print_cpu_stats(name, presented, get_cpu_time() - cpu_start);
+    if (opts->sched != SCHED_REALTIME)
+        print_sched_stats(&sched);
+    if (opts->memory_budget || opts->memory_stats > 0 || budget.restarts)
+        budget_print_stats(&budget);
+    if (bench) {
+        bench_set_count(bench, "frames_rendered", sched.rendered);
+        bench_set_count(bench, "frames_simulated", sched.simulated);
+        bench_set_count(bench, "frames_dropped", sched.dropped);
+        if (budget.peak)
+            bench_set_count(bench, "memory_peak_bytes", budget.peak);
+        bench_write_json(bench, stdout, name, gfx_backend_name());
+        bench_destroy(bench);
+    }
 
-static JSValue
-js_R(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
-{
-    double r, g, b, a = 1.0;
-    JS_ToFloat64(ctx, &r, argv[0]);
-    JS_ToFloat64(ctx, &g, argv[1]);
-    JS_ToFloat64(ctx, &b, argv[2]);
-    if (argc > 3)
-        JS_ToFloat64(ctx, &a, argv[3]);
-
-    char buf[64];
-    snprintf(buf, sizeof(buf), "rgba(%.0f,%.0f,%.0f,%g)", r, g, b, a);
-    return JS_NewString(ctx, buf);
+    // The target is texture or ring memory, which is about to go away. The
+    // texture is unlocked by now, so its pixels are not read.
+    if (dweet && target)
+        ctx2d_leave_target(ctx2d, NULL, 0);
+    else if (dweet && ring)
+        ctx2d_set_target(ctx2d, NULL, 0);
+    free(shadow);
+    ring_destroy(ring);
+    y4m_close(y4m);
+
+    if (profile) {
+        profile_stop(profile);
+        FILE *f = fopen(opts->profile, "w");
+        if (!f || profile_write_folded(profile, f) < 0)
+            fprintf(stderr, "error: could not write '%s'\n", opts->profile);
+        if (f)
+            fclose(f);
+        profile_print_hotspots(profile, stderr, PROFILE_HOTSPOTS);
+    }
+
+    gfx_cleanup();
+    dweet_destroy(dweet);
+    profile_destroy(profile);
+    return ret;
 }
 
+struct GridLoad {
+    char **codes;
+    char **names;
+    int ndweets;
+    const struct Options *opts;
+    struct Grid *grid;
+};
+
 static void
-setup_globals(JSContext *ctx, JSValue canvas)
+setup_cell(struct Dweet *dweet, void *opts)
 {
-    JSValue global = JS_GetGlobalObject(ctx);
-
-    // S = Math.sin, C = Math.cos, T = Math.tan
-    JSValue math = JS_GetPropertyStr(ctx, global, "Math");
-    JS_SetPropertyStr(ctx, global, "S", JS_GetPropertyStr(ctx, math, "sin"));
-    JS_SetPropertyStr(ctx, global, "C", JS_GetPropertyStr(ctx, math, "cos"));
-    JS_SetPropertyStr(ctx, global, "T", JS_GetPropertyStr(ctx, math, "tan"));
-    JS_FreeValue(ctx, math);
-
-    // R(r,g,b,a) - returns "rgba(r,g,b,a)" string
-    JS_SetPropertyStr(ctx, global, "R", JS_NewCFunction(ctx, js_R, "R", 4));
-
-    // escape/unescape for dweets using eval(unescape(escape`...`)) compression
-    JS_SetPropertyStr(ctx, global, "escape",
-        JS_NewCFunction(ctx, js_escape, "escape", 1));
-    JS_SetPropertyStr(ctx, global, "unescape",
-        JS_NewCFunction(ctx, js_unescape, "unescape", 1));
-
-    // c = canvas, x = 2d context
-    JS_SetPropertyStr(ctx, global, "c", JS_DupValue(ctx, canvas));
-
-    JSValue context = JS_GetPropertyStr(ctx, canvas, "getContext");
-    JSValue args[] = { JS_NewString(ctx, "2d") };
-    JSValue x = JS_Call(ctx, context, canvas, 1, args);
-    JS_FreeValue(ctx, args[0]);
-    JS_FreeValue(ctx, context);
-    JS_SetPropertyStr(ctx, global, "x", x);
-
-    JS_FreeValue(ctx, global);
+    setup_dweet(dweet, opts);
 }
 
-static bool
-check_exception(JSContext *ctx, JSValue val)
+static void *
+load_grid(void *arg)
 {
-    if (JS_IsException(val)) {
-        JSValue exc = JS_GetException(ctx);
-        const char *str = JS_ToCString(ctx, exc);
-        fprintf(stderr, "error: %s\n", str);
-        JS_FreeCString(ctx, str);
-        JSValue stack = JS_GetPropertyStr(ctx, exc, "stack");
-        if (!JS_IsUndefined(stack)) {
-            const char *stack_str = JS_ToCString(ctx, stack);
-            fprintf(stderr, "%s", stack_str);
-            JS_FreeCString(ctx, stack_str);
-        }
-        JS_FreeValue(ctx, stack);
-        JS_FreeValue(ctx, exc);
-        return true;
-    }
-    return false;
+    struct GridLoad *load = arg;
+    load->grid = grid_new(load->opts->rows, load->opts->cols, DWEET_WIDTH,
+        DWEET_HEIGHT, load->codes, load->names, load->ndweets, setup_cell,
+        (void *) load->opts);
+    return NULL;
 }
 
-static double
-get_time(void)
+static int
+run_grid(char **codes, char **names, int ndweets, const struct Options *opts)
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec / 1e9;
+    // As in run_single, the dweets load while the display comes up
+    struct GridLoad load = { codes, names, ndweets, opts, NULL };
+    pthread_t loader;
+    bool threaded = pthread_create(&loader, NULL, load_grid, &load) == 0;
+    if (!threaded)
+        load_grid(&load);
+    int gfx_rc = gfx_init(DWEET_WIDTH, DWEET_HEIGHT, "Dwitter Player");
+    if (threaded)
+        pthread_join(loader, NULL);
+
+    struct Grid *grid = load.grid;
+    if (!grid)
+        fprintf(stderr, "error: could not create %ux%u grid\n", opts->rows,
+            opts->cols);
+    if (gfx_rc < 0)
+        fprintf(stderr, "error: could not initialize graphics\n");
+    if (!grid || gfx_rc < 0) {
+        if (gfx_rc == 0)
+            gfx_cleanup();
+        grid_destroy(grid);
+        return 1;
+    }
+
+    unsigned long frames = 0;
+    double cpu_start = get_cpu_time();
+    struct Sched sched;
+    sched_init(&sched, opts->sched, opts->fps, 0);
+
+    while (!gfx_poll_quit()) {
+        if (!throttle(&sched, opts))
+            continue;
+        struct SchedFrame steps[SCHED_MAX_CATCHUP + 1];
+        sched_plan(&sched, get_time(), steps);
+        if (grid_frame(grid, steps[0].t) < 0)
+            break;
+        gfx_update(grid_get_data(grid), grid_get_stride(grid));
+        gfx_present();
+        if (++frames == opts->bench_frames)
+            break;
+    }
+
+    grid_stop(grid);
+    print_cpu_stats("grid", frames, get_cpu_time() - cpu_start);
+    grid_print_stats(grid);
+    gfx_cleanup();
+    grid_destroy(grid);
+    return 0;
 }
 
 int
 main(int argc, char **argv)
 {
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s <file.js>\n", argv[0]);
-        return 1;
+    static const struct option options[] = {
+        { "grid", required_argument, NULL, 'g' },
+        { "backend", required_argument, NULL, 'b' },
+        { "bench", required_argument, NULL, 'B' },
+        { "counters", no_argument, NULL, 'P' },
+        { "ring", required_argument, NULL, 'r' },
+        { "ring-slots", required_argument, NULL, 'R' },
+        { "y4m", required_argument, NULL, 'y' },
+        { "profile", required_argument, NULL, 'p' },
+        { "sched", required_argument, NULL, 's' },
+        { "fps", required_argument, NULL, 'f' },
+        { "max-catchup", required_argument, NULL, 'c' },
+        { "max-fps", required_argument, NULL, 'm' },
+        { "frames", required_argument, NULL, 'F' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "verify", no_argument, NULL, 'V' },
+        { "size", required_argument, NULL, 'W' },
+        { "band", required_argument, NULL, 'N' },
+        { "analyze", no_argument, NULL, 'A' },
+        { "js-memory", required_argument, NULL, 'J' },
+        { "memory-budget", required_argument, NULL, 'M' },
+        { "on-budget", required_argument, NULL, 'O' },
+        { "memory-stats", required_argument, NULL, 'S' },
+        { "golden", required_argument, NULL, 'G' },
+        { "update-golden", no_argument, NULL, 'U' },
+        { "tolerance", required_argument, NULL, 't' },
+        { "no-zero-copy", no_argument, NULL, 'Z' },
+        { "no-hairline", no_argument, NULL, 'L' },
+        { "antialias", required_argument, NULL, 'a' },
+        { "help", no_argument, NULL, 'h' },
+        { 0 },
+    };
+
+    struct Options opts = {
+        .start = get_time(),
+        .zero_copy = true,
+        .hairline = true,
+        .antialias = ANTIALIAS_ANALYTIC,
+        .ring_slots = 3,
+        .sched = SCHED_REALTIME,
+        .fps = 60,
+        .max_catchup = 4,
+        .export_width = DWEET_WIDTH,
+        .export_height = DWEET_HEIGHT,
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'g':
+            if (sscanf(optarg, "%ux%u", &opts.rows, &opts.cols) != 2 ||
+                opts.rows == 0 || opts.cols == 0) {
+                fprintf(stderr, "error: invalid grid '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'b':
+            if (gfx_select(optarg) < 0) {
+                fprintf(stderr, "error: unknown backend '%s' (have %s)\n",
+                    optarg, gfx_backend_list());
+                return 1;
+            }
+            break;
+        case 'B':
+            opts.bench_frames = strtoul(optarg, NULL, 10);
+            if (opts.bench_frames == 0) {
+                fprintf(stderr, "error: invalid frame count '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'P':
+            opts.counters = true;
+            break;
+        case 'r':
+            opts.ring = optarg;
+            break;
+        case 'R':
+            opts.ring_slots = strtoul(optarg, NULL, 10);
+            if (opts.ring_slots < 2) {
+                fprintf(stderr, "error: a ring needs at least 2 slots\n");
+                return 1;
+            }
+            break;
+        case 'y':
+            opts.y4m = optarg;
+            break;
+        case 'p':
+            opts.profile = optarg;
+            break;
+        case 's':
+            if (sched_parse_policy(optarg, &opts.sched) < 0) {
+                fprintf(stderr, "error: unknown scheduler policy '%s'\n",
+                    optarg);
+                return 1;
+            }
+            break;
+        case 'f':
+            opts.fps = strtoul(optarg, NULL, 10);
+            if (opts.fps == 0) {
+                fprintf(stderr, "error: invalid frame rate '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            opts.max_catchup = strtoul(optarg, NULL, 10);
+            if (opts.max_catchup > SCHED_MAX_CATCHUP) {
+                fprintf(stderr, "error: --max-catchup is at most %d\n",
+                    SCHED_MAX_CATCHUP);
+                return 1;
+            }
+            break;
+        case 'm':
+            opts.max_fps = strtod(optarg, NULL);
+            if (!(opts.max_fps > 0)) {
+                fprintf(stderr, "error: invalid frame rate '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'F':
+            opts.frames = strtoul(optarg, NULL, 10);
+            if (opts.frames == 0) {
+                fprintf(stderr, "error: invalid frame count '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'j':
+            opts.jobs = strtoul(optarg, NULL, 10);
+            if (opts.jobs == 0) {
+                fprintf(stderr, "error: invalid job count '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'V':
+            opts.verify = true;
+            break;
+        case 'W':
+            if (sscanf(optarg, "%ux%u", &opts.export_width,
+                    &opts.export_height) != 2 ||
+                opts.export_width == 0 || opts.export_height == 0 ||
+                opts.export_width > CANVAS_MAX_SIZE ||
+                opts.export_height > CANVAS_MAX_SIZE) {
+                fprintf(stderr, "error: invalid size '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'N':
+            opts.band_rows = strtoul(optarg, NULL, 10);
+            if (opts.band_rows == 0 || opts.band_rows % 2 != 0) {
+                fprintf(stderr, "error: --band needs an even number of "
+                                "rows\n");
+                return 1;
+            }
+            break;
+        case 'A':
+            opts.analyze = true;
+            break;
+        case 'J':
+            if (parse_megabytes(optarg, &opts.js_memory) < 0) {
+                fprintf(stderr, "error: invalid size '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'M':
+            if (parse_megabytes(optarg, &opts.memory_budget) < 0) {
+                fprintf(stderr, "error: invalid size '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'O':
+            if (budget_parse_policy(optarg, &opts.budget_policy) < 0) {
+                fprintf(stderr, "error: unknown budget policy '%s'\n",
+                    optarg);
+                return 1;
+            }
+            break;
+        case 'S':
+            opts.memory_stats = strtod(optarg, NULL);
+            if (!(opts.memory_stats > 0)) {
+                fprintf(stderr, "error: invalid interval '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'G':
+            opts.golden = optarg;
+            break;
+        case 'U':
+            opts.update_golden = true;
+            break;
+        case 't': {
+            char *end;
+            unsigned long tolerance = strtoul(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || tolerance > 255) {
+                fprintf(stderr, "error: invalid tolerance '%s'\n", optarg);
+                return 1;
+            }
+            opts.tolerance = tolerance;
+            break;
+        }
+        case 'Z':
+            opts.zero_copy = false;
+            break;
+        case 'L':
+            opts.hairline = false;
+            break;
+        case 'a':
+            if (antialias_parse(optarg, &opts.antialias) < 0) {
+                fprintf(stderr, "error: unknown antialiasing mode '%s'\n",
+                    optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
     }
 
-    char *code = read_file(argv[1]);
-    if (!code) {
-        fprintf(stderr, "error: could not read '%s'\n", argv[1]);
+    int ndweets = argc - optind;
+    if (ndweets < 1) {
+        usage(argv[0]);
         return 1;
     }
-
-    JSRuntime *rt = JS_NewRuntime();
-    if (!rt) {
-        fprintf(stderr, "error: could not create JS runtime\n");
-        free(code);
+    char **names = argv + optind;
+    char **codes = calloc(ndweets, sizeof(*codes));
+    if (!codes) {
+        fprintf(stderr, "error: out of memory\n");
         return 1;
     }
 
-    JSContext *ctx = JS_NewContext(rt);
-    if (!ctx) {
-        fprintf(stderr, "error: could not create JS context\n");
-        JS_FreeRuntime(rt);
-        free(code);
-        return 1;
+    int ret = 1;
+    for (int i = 0; i < ndweets; i++) {
+        codes[i] = read_file(names[i]);
+        if (!codes[i]) {
+            fprintf(stderr, "error: could not read '%s'\n", names[i]);
+            goto cleanup;
+        }
     }
 
-    // Initialize canvas classes and create canvas
-    js_canvas_init(ctx);
-    JSValue canvas = js_canvas_new(ctx, CANVAS_WIDTH, CANVAS_HEIGHT);
-    if (JS_IsException(canvas)) {
-        fprintf(stderr, "error: could not create canvas\n");
-        JS_FreeContext(ctx);
-        JS_FreeRuntime(rt);
-        free(code);
-        return 1;
+    if (opts.analyze) {
+        for (int i = 0; i < ndweets; i++) {
+            struct DweetAnalysis analysis;
+            analyze_dweet(codes[i], &analysis);
+            printf("%s: %s%s%s%s%s\n", names[i],
+                analyze_kind_name(analysis.kind),
+                analysis.nondeterministic ? ", nondeterministic" : "",
+                analysis.reason[0] ? " (" : "", analysis.reason,
+                analysis.reason[0] ? ")" : "");
+        }
+        ret = 0;
+        goto cleanup;
     }
 
-    // Get Context2D for rendering
-    struct Context2D *ctx2d = js_canvas_get_context2d(ctx, canvas);
-    if (!ctx2d) {
-        fprintf(stderr, "error: could not get 2D context\n");
-        JS_FreeValue(ctx, canvas);
-        JS_FreeContext(ctx);
-        JS_FreeRuntime(rt);
-        free(code);
-        return 1;
+    if (opts.counters && (!opts.bench_frames || opts.rows)) {
+        fprintf(stderr, "error: --counters needs --bench and no --grid\n");
+        goto cleanup;
     }
 
-    // Initialize graphics
-    if (gfx_init(CANVAS_WIDTH, CANVAS_HEIGHT, "Dwitter Player") < 0) {
-        fprintf(stderr, "error: could not initialize graphics\n");
-        JS_FreeValue(ctx, canvas);
-        JS_FreeContext(ctx);
-        JS_FreeRuntime(rt);
-        free(code);
-        return 1;
+    if (opts.update_golden && !opts.golden) {
+        fprintf(stderr, "error: --update-golden needs --golden\n");
+        goto cleanup;
     }
-
-    setup_globals(ctx, canvas);
-
-    // Wrap code in u(t) function
-    char *wrapped;
-    if (asprintf(&wrapped, "function u(t) { %s }", code) == -1) {
-        fprintf(stderr, "error: out of memory\n");
+    if (opts.golden) {
+        ret = golden_run(codes, names, ndweets, opts.golden, opts.tolerance,
+            opts.update_golden);
         goto cleanup;
     }
 
-    JSValue result = JS_Eval(ctx, wrapped, strlen(wrapped), argv[1],
-        JS_EVAL_TYPE_GLOBAL);
-    free(wrapped);
-
-    if (check_exception(ctx, result)) {
-        JS_FreeValue(ctx, result);
+    if (opts.frames) {
+        if (!opts.y4m || opts.rows || opts.ring || opts.profile) {
+            fprintf(stderr, "error: --frames needs --y4m and no --grid, "
+                            "--ring or --profile\n");
+            goto cleanup;
+        }
+        if (opts.band_rows && (opts.jobs || opts.verify)) {
+            fprintf(stderr, "error: --band renders serially; --jobs and "
+                            "--verify don't apply\n");
+            goto cleanup;
+        }
+        struct ExportOptions export = {
+            .frames = opts.frames,
+            .fps = opts.fps,
+            .width = opts.export_width,
+            .height = opts.export_height,
+            .jobs = opts.jobs,
+            .verify = opts.verify,
+            .band_rows = opts.band_rows,
+        };
+        ret = export_y4m(codes[0], names[0], opts.y4m, &export);
         goto cleanup;
     }
-    JS_FreeValue(ctx, result);
-
-    // Get u function
-    JSValue global = JS_GetGlobalObject(ctx);
-    JSValue u_func = JS_GetPropertyStr(ctx, global, "u");
 
-    double start_time = -1;
-
-    // Main loop
-    while (!gfx_poll_quit()) {
-        double now = get_time();
-        if (start_time < 0)
-            start_time = now;
-        double t = now - start_time;
+    if (opts.band_rows || opts.export_width != DWEET_WIDTH ||
+        opts.export_height != DWEET_HEIGHT) {
+        fprintf(stderr, "error: --size and --band need --frames\n");
+        goto cleanup;
+    }
 
-        // Call u(t)
-        JSValue t_val = JS_NewFloat64(ctx, t);
-        JSValue ret = JS_Call(ctx, u_func, global, 1, &t_val);
-        JS_FreeValue(ctx, t_val);
+    if (opts.rows && (opts.ring || opts.y4m || opts.profile)) {
+        fprintf(stderr, "error: --ring, --y4m and --profile are not "
+                        "supported with --grid\n");
+        goto cleanup;
+    }
 
-        if (check_exception(ctx, ret)) {
-            JS_FreeValue(ctx, ret);
-            break;
-        }
-        JS_FreeValue(ctx, ret);
+    if (opts.rows &&
+        (opts.js_memory || opts.memory_budget || opts.memory_stats > 0)) {
+        fprintf(stderr, "error: --js-memory, --memory-budget and "
+                        "--memory-stats are not supported with --grid\n");
+        goto cleanup;
+    }
 
-        // Update display with PlutoVG surface data
-        gfx_update(ctx2d_get_data(ctx2d), ctx2d_get_stride(ctx2d));
-        gfx_present();
+    if (opts.rows && opts.sched == SCHED_CATCHUP) {
+        fprintf(stderr, "error: --sched catchup is not supported with "
+                        "--grid\n");
+        goto cleanup;
     }
 
-    JS_FreeValue(ctx, u_func);
-    JS_FreeValue(ctx, global);
+    if (opts.rows)
+        ret = run_grid(codes, names, ndweets, &opts);
+    else
+        ret = run_single(codes[0], names[0], &opts);
 
 cleanup:
-    gfx_cleanup();
-    JS_FreeValue(ctx, canvas);
-    JS_FreeContext(ctx);
-    JS_FreeRuntime(rt);
-    free(code);
-
-    return 0;
+    for (int i = 0; i < ndweets; i++)
+        free(codes[i]);
+    free(codes);
+    return ret;
 }
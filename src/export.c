@@ -0,0 +1,477 @@
+#include "export.h"
+
+#include "analyze.h"
+#include "canvas.h"
+#include "dweet.h"
+#include "record.h"
+#include "y4m.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct Slot {
+    unsigned char *pixels;
+    unsigned long frame;
+    bool ready;
+};
+
+struct Export {
+    unsigned long frames;
+    unsigned fps;
+    int width, height, stride;
+
+    // Workers claim frames in order and render into slot frame % nslots
+    // once the writer is done with the frame nslots before it
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned long next;
+    unsigned long written;
+    bool failed;
+    struct Slot *slots;
+    unsigned nslots;
+};
+
+struct Worker {
+    struct Export *export;
+    struct Dweet *dweet;
+    pthread_t thread;
+    bool started;
+};
+
+static double
+get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+frame_time(const struct Export *ex, unsigned long frame)
+{
+    return (double) frame / ex->fps;
+}
+
+static void
+copy_frame(unsigned char *dst, const struct Export *ex, struct Context2D *ctx2d)
+{
+    const unsigned char *src = ctx2d_get_data(ctx2d);
+    int src_stride = ctx2d_get_stride(ctx2d);
+    for (int y = 0; y < ex->height; y++)
+        memcpy(dst + (size_t) y * ex->stride, src + (size_t) y * src_stride,
+            (size_t) ex->width * 4);
+}
+
+static bool
+same_frame(const unsigned char *a, const struct Export *ex,
+    struct Context2D *ctx2d)
+{
+    const unsigned char *b = ctx2d_get_data(ctx2d);
+    int b_stride = ctx2d_get_stride(ctx2d);
+    for (int y = 0; y < ex->height; y++)
+        if (memcmp(a + (size_t) y * ex->stride, b + (size_t) y * b_stride,
+                (size_t) ex->width * 4) != 0)
+            return false;
+    return true;
+}
+
+static void
+fail(struct Export *ex)
+{
+    pthread_mutex_lock(&ex->lock);
+    ex->failed = true;
+    pthread_cond_broadcast(&ex->cond);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+static void *
+worker_run(void *arg)
+{
+    struct Worker *worker = arg;
+    struct Export *ex = worker->export;
+    struct Context2D *ctx2d = dweet_context2d(worker->dweet);
+
+    dweet_attach_thread(worker->dweet);
+
+    pthread_mutex_lock(&ex->lock);
+    while (ex->next < ex->frames && !ex->failed) {
+        unsigned long frame = ex->next++;
+        while (frame >= ex->written + ex->nslots && !ex->failed)
+            pthread_cond_wait(&ex->cond, &ex->lock);
+        if (ex->failed)
+            break;
+        struct Slot *slot = &ex->slots[frame % ex->nslots];
+        pthread_mutex_unlock(&ex->lock);
+
+        int rc = dweet_frame(worker->dweet, frame_time(ex, frame));
+        if (rc == 0)
+            copy_frame(slot->pixels, ex, ctx2d);
+
+        pthread_mutex_lock(&ex->lock);
+        if (rc < 0) {
+            ex->failed = true;
+        } else {
+            slot->frame = frame;
+            slot->ready = true;
+        }
+        pthread_cond_broadcast(&ex->cond);
+    }
+    pthread_mutex_unlock(&ex->lock);
+    return NULL;
+}
+
+static int
+export_serial(struct Export *ex, struct Dweet *dweet, struct Y4m *y4m)
+{
+    struct Context2D *ctx2d = dweet_context2d(dweet);
+    for (unsigned long i = 0; i < ex->frames; i++) {
+        if (dweet_frame(dweet, frame_time(ex, i)) < 0)
+            return -1;
+        if (y4m_write_frame(y4m, ctx2d_get_data(ctx2d),
+                ctx2d_get_stride(ctx2d)) < 0)
+            return -1;
+        ex->written++;
+    }
+    return 0;
+}
+
+// Writer side of the parallel export; runs the serial reference for verify
+static int
+export_parallel(struct Export *ex, struct Dweet *reference, struct Y4m *y4m,
+    unsigned long *mismatches)
+{
+    for (unsigned long i = 0; i < ex->frames; i++) {
+        struct Slot *slot = &ex->slots[i % ex->nslots];
+
+        pthread_mutex_lock(&ex->lock);
+        while (!(slot->ready && slot->frame == i) && !ex->failed)
+            pthread_cond_wait(&ex->cond, &ex->lock);
+        bool failed = ex->failed;
+        pthread_mutex_unlock(&ex->lock);
+        if (failed)
+            return -1;
+
+        if (reference) {
+            if (dweet_frame(reference, frame_time(ex, i)) < 0) {
+                fail(ex);
+                return -1;
+            }
+            if (!same_frame(slot->pixels, ex, dweet_context2d(reference))) {
+                if (*mismatches == 0)
+                    fprintf(stderr, "verify: frame %lu differs from the "
+                                    "serial render\n",
+                        i);
+                (*mismatches)++;
+            }
+        }
+
+        if (y4m_write_frame(y4m, slot->pixels, ex->stride) < 0) {
+            fail(ex);
+            return -1;
+        }
+
+        pthread_mutex_lock(&ex->lock);
+        slot->ready = false;
+        ex->written++;
+        pthread_cond_broadcast(&ex->cond);
+        pthread_mutex_unlock(&ex->lock);
+    }
+    return 0;
+}
+
+// Banded export: each frame runs once with the canvas recording instead of
+// drawing, then the recording plays into band canvases
+struct Bands {
+    int width, height, rows;
+    unsigned count;
+    // One per band once the dweet has drawn over a frame; until then only
+    // the first, moved from band to band
+    struct Canvas **canvases;
+    bool kept;
+};
+
+static struct Canvas *
+band_canvas_new(const struct Bands *bands, unsigned band)
+{
+    struct Canvas *canvas = canvas_new(DWEET_WIDTH, DWEET_HEIGHT, NULL);
+    if (!canvas)
+        return NULL;
+    canvas_set_resolution(canvas, bands->width, bands->height);
+    if (canvas_set_band(canvas, band * bands->rows, bands->rows) < 0 ||
+        !canvas_getContext(canvas, "2d")) {
+        canvas_destroy(canvas);
+        return NULL;
+    }
+    return canvas;
+}
+
+static int
+write_band(const struct Bands *bands, unsigned band, struct Canvas *canvas,
+    struct Y4m *y4m)
+{
+    struct Context2D *ctx2d = canvas_getContext(canvas, "2d");
+    return y4m_write_rows(y4m, ctx2d_get_data(ctx2d),
+        ctx2d_get_stride(ctx2d), band * bands->rows, bands->rows);
+}
+
+// Give every band a canvas of its own, each holding what the recording
+// (everything since the last reset) draws there
+static int
+keep_bands(struct Bands *bands, const char *name)
+{
+    fprintf(stderr, "%s: draws over earlier frames; keeping all %u bands "
+                    "(%.1f MB)\n",
+        name, bands->count,
+        (double) bands->width * bands->rows * 4 * bands->count / (1 << 20));
+    for (unsigned i = 1; i < bands->count; i++) {
+        bands->canvases[i] = band_canvas_new(bands, i);
+        if (!bands->canvases[i])
+            return -1;
+    }
+    canvas_set_band(bands->canvases[0], 0, bands->rows);
+    bands->kept = true;
+    return 0;
+}
+
+static void
+drop_bands(struct Bands *bands)
+{
+    for (unsigned i = 1; i < bands->count; i++) {
+        canvas_destroy(bands->canvases[i]);
+        bands->canvases[i] = NULL;
+    }
+    bands->kept = false;
+}
+
+// blank: the canvas was reset since the last frame, so the recording holds
+// all of this one
+static int
+render_bands(struct Bands *bands, struct Recording *rec, bool blank,
+    const char *name, struct Y4m *y4m)
+{
+    if (blank) {
+        if (bands->kept)
+            drop_bands(bands);
+        struct Canvas *canvas = bands->canvases[0];
+        for (unsigned i = 0; i < bands->count; i++) {
+            canvas_set_band(canvas, i * bands->rows, bands->rows);
+            recording_play(rec, canvas_getContext(canvas, "2d"));
+            if (write_band(bands, i, canvas, y4m) < 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    // Drawn over the last frame: the kept bands have it, and the recording
+    // only this frame's calls
+    if (!bands->kept && keep_bands(bands, name) < 0) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    for (unsigned i = 0; i < bands->count; i++) {
+        struct Canvas *canvas = bands->canvases[i];
+        recording_play(rec, canvas_getContext(canvas, "2d"));
+        if (write_band(bands, i, canvas, y4m) < 0)
+            return -1;
+    }
+    recording_clear(rec);
+    return 0;
+}
+
+static int
+export_bands(const char *code, const char *name, const char *path,
+    const struct ExportOptions *opts)
+{
+    struct Bands bands = {
+        .width = opts->width,
+        .height = opts->height,
+        .rows = opts->band_rows,
+        .count = (opts->height + opts->band_rows - 1) / opts->band_rows,
+    };
+
+    int ret = 1;
+    unsigned long written = 0;
+    // The recording canvas is never drawn on, so its resolution is moot
+    struct Dweet *dweet = dweet_new(code, name, 1, 1);
+    struct Recording *rec = recording_new();
+    bands.canvases = calloc(bands.count, sizeof(*bands.canvases));
+    struct Y4m *y4m = y4m_open(path, opts->width, opts->height, opts->fps);
+    if (!dweet || !rec || !bands.canvases || !y4m) {
+        fprintf(stderr, "error: could not start export to '%s'\n", path);
+        goto cleanup;
+    }
+    bands.canvases[0] = band_canvas_new(&bands, 0);
+    if (!bands.canvases[0]) {
+        fprintf(stderr, "error: out of memory\n");
+        goto cleanup;
+    }
+    ctx2d_set_recording(dweet_context2d(dweet), rec);
+
+    double start = get_time();
+    size_t recorded = 0;
+    for (unsigned long i = 0; i < opts->frames; i++) {
+        unsigned long resets = recording_resets(rec);
+        if (dweet_frame(dweet, (double) i / opts->fps) < 0)
+            break;
+        const char *call = recording_unplayable(rec);
+        if (call) {
+            fprintf(stderr, "error: %s can't be rendered in bands: %s\n",
+                name, call);
+            break;
+        }
+        if (recording_memory(rec) > recorded)
+            recorded = recording_memory(rec);
+        bool blank = i == 0 || recording_resets(rec) != resets;
+        if (render_bands(&bands, rec, blank, name, y4m) < 0)
+            break;
+        written++;
+    }
+    double elapsed = get_time() - start;
+
+    if (written < opts->frames) {
+        fprintf(stderr, "error: export of %s stopped after %lu frames\n", name,
+            written);
+        goto cleanup;
+    }
+    fprintf(stderr, "%lu frames in %u bands of %d rows in %.2f s (%.1f fps), "
+                    "%.1f MB recorded\n",
+        written, bands.count, bands.rows, elapsed,
+        elapsed > 0 ? written / elapsed : 0, (double) recorded / (1 << 20));
+    ret = 0;
+
+cleanup:
+    if (bands.canvases)
+        for (unsigned i = 0; i < bands.count; i++)
+            canvas_destroy(bands.canvases[i]);
+    free(bands.canvases);
+    y4m_close(y4m);
+    dweet_destroy(dweet);
+    recording_destroy(rec);
+    return ret;
+}
+
+int
+export_y4m(const char *code, const char *name, const char *path,
+    const struct ExportOptions *opts)
+{
+    struct DweetAnalysis analysis;
+    analyze_dweet(code, &analysis);
+    fprintf(stderr, "%s: %s%s%s%s\n", name, analyze_kind_name(analysis.kind),
+        analysis.reason[0] ? " (" : "", analysis.reason,
+        analysis.reason[0] ? ")" : "");
+    if (opts->band_rows)
+        return export_bands(code, name, path, opts);
+
+    unsigned long frames = opts->frames;
+    unsigned fps = opts->fps;
+    unsigned jobs = opts->jobs;
+    bool verify = opts->verify;
+    if (jobs == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = n > 0 ? (unsigned) n : 1;
+    }
+    if (jobs > frames)
+        jobs = frames;
+    if (analysis.kind != DWEET_STATELESS)
+        jobs = 1;
+    if (verify && jobs > 1 && analysis.nondeterministic)
+        fprintf(stderr, "verify: %s uses Math.random or the clock; frames "
+                        "may differ between renders\n",
+            name);
+
+    struct Export ex = {
+        .frames = frames,
+        .fps = fps,
+        .width = opts->width,
+        .height = opts->height,
+        .stride = opts->width * 4,
+        .nslots = jobs * 2,
+    };
+    pthread_mutex_init(&ex.lock, NULL);
+    pthread_cond_init(&ex.cond, NULL);
+
+    int ret = 1;
+    unsigned long mismatches = 0;
+    struct Dweet *reference = NULL;
+    struct Worker *workers = calloc(jobs, sizeof(*workers));
+    ex.slots = calloc(ex.nslots, sizeof(*ex.slots));
+    struct Y4m *y4m = y4m_open(path, ex.width, ex.height, fps);
+    if (!workers || !ex.slots || !y4m) {
+        fprintf(stderr, "error: could not start export to '%s'\n", path);
+        goto cleanup;
+    }
+
+    // Runtimes are created here before any worker starts; class
+    // registration in js.c is not thread safe
+    for (unsigned i = 0; i < jobs; i++) {
+        workers[i].export = &ex;
+        workers[i].dweet = dweet_new(code, name, ex.width, ex.height);
+        if (!workers[i].dweet)
+            goto cleanup;
+    }
+    if (verify && jobs > 1) {
+        reference = dweet_new(code, name, ex.width, ex.height);
+        if (!reference)
+            goto cleanup;
+    }
+
+    double start = get_time();
+    int rc;
+    if (jobs == 1) {
+        rc = export_serial(&ex, workers[0].dweet, y4m);
+    } else {
+        for (unsigned i = 0; i < ex.nslots; i++) {
+            ex.slots[i].pixels = malloc((size_t) ex.stride * ex.height);
+            if (!ex.slots[i].pixels)
+                goto cleanup;
+        }
+        for (unsigned i = 0; i < jobs; i++) {
+            if (pthread_create(&workers[i].thread, NULL, worker_run,
+                    &workers[i]) != 0) {
+                fail(&ex);
+                goto cleanup;
+            }
+            workers[i].started = true;
+        }
+        rc = export_parallel(&ex, reference, y4m, &mismatches);
+    }
+    double elapsed = get_time() - start;
+
+    if (rc < 0) {
+        fprintf(stderr, "error: export of %s stopped after %lu frames\n", name,
+            ex.written);
+        goto cleanup;
+    }
+
+    fprintf(stderr, "%lu frames on %u thread%s in %.2f s (%.1f fps)\n",
+        ex.written, jobs, jobs == 1 ? "" : "s", elapsed,
+        elapsed > 0 ? ex.written / elapsed : 0);
+    if (reference)
+        fprintf(stderr, "verify: %lu of %lu frames differ\n", mismatches,
+            ex.written);
+    ret = mismatches ? 1 : 0;
+
+cleanup:
+    if (workers) {
+        for (unsigned i = 0; i < jobs; i++)
+            if (workers[i].started)
+                pthread_join(workers[i].thread, NULL);
+        for (unsigned i = 0; i < jobs; i++)
+            dweet_destroy(workers[i].dweet);
+    }
+    if (ex.slots)
+        for (unsigned i = 0; i < ex.nslots; i++)
+            free(ex.slots[i].pixels);
+    dweet_destroy(reference);
+    y4m_close(y4m);
+    free(ex.slots);
+    free(workers);
+    pthread_cond_destroy(&ex.cond);
+    pthread_mutex_destroy(&ex.lock);
+    return ret;
+}
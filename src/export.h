@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+
+struct ExportOptions {
+    unsigned long frames;
+    unsigned fps;
+    // Output size; dweets still draw on a DWEET_WIDTH x DWEET_HEIGHT canvas
+    unsigned width, height;
+    // Threads (0 = one per CPU), and whether to check their frames
+    unsigned jobs;
+    bool verify;
+    // Render each frame in bands of this many rows (even; 0 = whole frames)
+    unsigned band_rows;
+};
+
+// Offline export: render frames t = 0, 1/fps, 2/fps, ... as fast as possible
+// and write them as YUV4MPEG2 to path ("-" = stdout).
+//
+// Dweets that analyze_dweet() finds stateless are rendered frame-parallel
+// on up to jobs threads (0 = one per CPU), each with its own runtime; the
+// rest render serially. With verify, every frame is also rendered serially
+// and compared with the parallel result.
+//
+// With band_rows, frames are rendered serially and only a band of them is
+// held at a time, so sizes like 7680x4320 fit in little memory: each frame
+// runs once, recording the canvas calls, which are then played into a
+// band_rows high canvas moved down the frame and written out band by band.
+// A dweet that draws over its last frame instead of resetting the canvas
+// keeps a canvas per band, which is the whole frame again. Dweets that read
+// pixels back (getImageData, drawImage of the canvas) can't be recorded.
+int
+export_y4m(const char *code, const char *name, const char *path,
+    const struct ExportOptions *opts);
@@ -0,0 +1,138 @@
+#include "gfx.h"
+
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+
+static const struct GfxBackend *backends[] = {
+    &gfx_sdl_backend,
+    &gfx_null_backend,
+#ifdef HAVE_FBDEV
+    &gfx_fbdev_backend,
+#endif
+#ifdef HAVE_DRM
+    &gfx_drm_backend,
+#endif
+    NULL,
+};
+
+static const struct GfxBackend *backend = &gfx_sdl_backend;
+
+static volatile sig_atomic_t quit_signaled;
+
+static void
+on_quit_signal(int sig)
+{
+    (void) sig;
+    quit_signaled = 1;
+}
+
+int
+gfx_select(const char *name)
+{
+    for (const struct GfxBackend **b = backends; *b; b++) {
+        if (strcmp((*b)->name, name) == 0) {
+            backend = *b;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *
+gfx_backend_name(void)
+{
+    return backend->name;
+}
+
+const char *
+gfx_backend_list(void)
+{
+    static char list[64];
+    if (list[0])
+        return list;
+    for (const struct GfxBackend **b = backends; *b; b++) {
+        if (b != backends)
+            strncat(list, ",", sizeof(list) - strlen(list) - 1);
+        strncat(list, (*b)->name, sizeof(list) - strlen(list) - 1);
+    }
+    return list;
+}
+
+int
+gfx_init(int width, int height, const char *title)
+{
+    if (!backend->poll_quit) {
+        signal(SIGINT, on_quit_signal);
+        signal(SIGTERM, on_quit_signal);
+    }
+    return backend->init(width, height, title);
+}
+
+void
+gfx_update(const unsigned char *pixels, int stride)
+{
+    backend->update(pixels, stride);
+}
+
+unsigned char *
+gfx_lock(int *stride)
+{
+    if (!backend->lock)
+        return NULL;
+    return backend->lock(stride);
+}
+
+void
+gfx_unlock(void)
+{
+    if (backend->unlock)
+        backend->unlock();
+}
+
+void
+gfx_present(void)
+{
+    backend->present();
+}
+
+int
+gfx_poll_quit(void)
+{
+    if (!backend->poll_quit)
+        return quit_signaled;
+    return backend->poll_quit();
+}
+
+enum GfxVisibility
+gfx_visibility(void)
+{
+    if (!backend->visibility)
+        return GFX_VISIBLE;
+    return backend->visibility();
+}
+
+void
+gfx_cleanup(void)
+{
+    backend->cleanup();
+}
+
+void
+gfx_blit_centered(unsigned char *dst, int dst_stride, int dst_width,
+    int dst_height, const unsigned char *src, int src_stride, int src_width,
+    int src_height)
+{
+    int width = src_width < dst_width ? src_width : dst_width;
+    int height = src_height < dst_height ? src_height : dst_height;
+    int src_x = (src_width - width) / 2;
+    int src_y = (src_height - height) / 2;
+    int dst_x = (dst_width - width) / 2;
+    int dst_y = (dst_height - height) / 2;
+
+    src += (size_t) src_y * src_stride + (size_t) src_x * 4;
+    dst += (size_t) dst_y * dst_stride + (size_t) dst_x * 4;
+    for (int y = 0; y < height; y++)
+        memcpy(dst + (size_t) y * dst_stride, src + (size_t) y * src_stride,
+            (size_t) width * 4);
+}
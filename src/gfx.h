@@ -2,13 +2,73 @@
 
 #include <stdint.h>
 
+// Whether anyone can see what is presented
+enum GfxVisibility {
+    GFX_VISIBLE,
+    GFX_UNFOCUSED, // on screen, but another window has the input focus
+    GFX_HIDDEN,    // minimized or hidden
+};
+
+// A display backend. Pixels are premultiplied ARGB of the size passed to init.
+struct GfxBackend {
+    const char *name;
+    int (*init)(int width, int height, const char *title);
+    void (*update)(const unsigned char *pixels, int stride);
+    // Optional (NULL when unsupported), see gfx_lock
+    unsigned char *(*lock)(int *stride);
+    void (*unlock)(void);
+    void (*present)(void);
+    // Optional; backends without an event source quit on SIGINT/SIGTERM
+    int (*poll_quit)(void);
+    // Optional (NULL: always visible); as of the last poll_quit
+    enum GfxVisibility (*visibility)(void);
+    void (*cleanup)(void);
+};
+
+extern const struct GfxBackend gfx_sdl_backend;
+extern const struct GfxBackend gfx_null_backend;
+#ifdef HAVE_FBDEV
+extern const struct GfxBackend gfx_fbdev_backend;
+#endif
+#ifdef HAVE_DRM
+extern const struct GfxBackend gfx_drm_backend;
+#endif
+
+// Choose the backend used by the gfx_* calls below (before gfx_init).
+// Returns -1 if no backend by that name was built in.
+int
+gfx_select(const char *name);
+const char *
+gfx_backend_name(void);
+// Comma-separated list of the built-in backends
+const char *
+gfx_backend_list(void);
+
 int
 gfx_init(int width, int height, const char *title);
 void
 gfx_update(const unsigned char *pixels, int stride);
+
+// Lock texture memory (premultiplied ARGB, width x height) so the canvas can
+// draw into it directly, replacing gfx_update for the frame. The memory is
+// the same on every successful lock and keeps its contents; returns NULL if
+// the backend can't guarantee that, after which it never succeeds again.
+unsigned char *
+gfx_lock(int *stride);
+void
+gfx_unlock(void);
 void
 gfx_present(void);
 int
 gfx_poll_quit(void);
+enum GfxVisibility
+gfx_visibility(void);
 void
 gfx_cleanup(void);
+
+// For backends: copy a src_width x src_height frame centered into a
+// dst_width x dst_height buffer, cropping whatever doesn't fit
+void
+gfx_blit_centered(unsigned char *dst, int dst_stride, int dst_width,
+    int dst_height, const unsigned char *src, int src_stride, int src_width,
+    int src_height);
@@ -0,0 +1,261 @@
+#include "gfx.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+// DRM/KMS on the first connected output (/dev/dri/card0, or
+// $DWPLAY_DRM_DEVICE) using two dumb buffers and page flips
+
+struct DumbBuffer {
+    uint32_t handle;
+    uint32_t fb_id;
+    uint32_t pitch;
+    uint64_t size;
+    unsigned char *map;
+};
+
+static int fd = -1;
+static uint32_t connector_id;
+static uint32_t crtc_id;
+static drmModeModeInfo mode;
+static drmModeCrtc *saved_crtc;
+static struct DumbBuffer buffers[2];
+static int back;
+static bool flip_pending;
+static bool crtc_set;
+static int src_width, src_height;
+
+static void
+on_page_flip(int fd, unsigned int sequence, unsigned int tv_sec,
+    unsigned int tv_usec, void *user_data)
+{
+    (void) fd;
+    (void) sequence;
+    (void) tv_sec;
+    (void) tv_usec;
+    (void) user_data;
+    flip_pending = false;
+}
+
+static int
+dumb_create(struct DumbBuffer *buf, uint32_t width, uint32_t height)
+{
+    struct drm_mode_create_dumb create = {
+        .width = width,
+        .height = height,
+        .bpp = 32,
+    };
+    if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0)
+        return -1;
+    buf->handle = create.handle;
+    buf->pitch = create.pitch;
+    buf->size = create.size;
+
+    if (drmModeAddFB(fd, width, height, 24, 32, buf->pitch, buf->handle,
+            &buf->fb_id) < 0)
+        return -1;
+
+    struct drm_mode_map_dumb map = { .handle = buf->handle };
+    if (drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0)
+        return -1;
+    buf->map = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+        map.offset);
+    if (buf->map == MAP_FAILED) {
+        buf->map = NULL;
+        return -1;
+    }
+    memset(buf->map, 0, buf->size);
+    return 0;
+}
+
+static void
+dumb_destroy(struct DumbBuffer *buf)
+{
+    if (buf->map)
+        munmap(buf->map, buf->size);
+    if (buf->fb_id)
+        drmModeRmFB(fd, buf->fb_id);
+    if (buf->handle) {
+        struct drm_mode_destroy_dumb destroy = { .handle = buf->handle };
+        drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    }
+    memset(buf, 0, sizeof(*buf));
+}
+
+static int
+find_output(drmModeRes *res)
+{
+    for (int i = 0; i < res->count_connectors; i++) {
+        drmModeConnector *conn = drmModeGetConnector(fd, res->connectors[i]);
+        if (!conn)
+            continue;
+        if (conn->connection != DRM_MODE_CONNECTED || conn->count_modes == 0) {
+            drmModeFreeConnector(conn);
+            continue;
+        }
+
+        // Prefer the CRTC already driving this connector
+        uint32_t crtc = 0;
+        drmModeEncoder *enc = conn->encoder_id
+            ? drmModeGetEncoder(fd, conn->encoder_id)
+            : NULL;
+        if (enc) {
+            crtc = enc->crtc_id;
+            drmModeFreeEncoder(enc);
+        }
+        for (int e = 0; !crtc && e < conn->count_encoders; e++) {
+            enc = drmModeGetEncoder(fd, conn->encoders[e]);
+            if (!enc)
+                continue;
+            for (int c = 0; c < res->count_crtcs; c++) {
+                if (enc->possible_crtcs & (1u << c)) {
+                    crtc = res->crtcs[c];
+                    break;
+                }
+            }
+            drmModeFreeEncoder(enc);
+        }
+
+        if (crtc) {
+            connector_id = conn->connector_id;
+            crtc_id = crtc;
+            mode = conn->modes[0]; // preferred mode comes first
+            drmModeFreeConnector(conn);
+            return 0;
+        }
+        drmModeFreeConnector(conn);
+    }
+    return -1;
+}
+
+static void drm_cleanup(void);
+
+static int
+drm_init(int width, int height, const char *title)
+{
+    (void) title;
+
+    const char *path = getenv("DWPLAY_DRM_DEVICE");
+    if (!path)
+        path = "/dev/dri/card0";
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    drmModeRes *res = drmModeGetResources(fd);
+    if (!res) {
+        fprintf(stderr, "drm: no mode setting resources on %s\n", path);
+        goto fail;
+    }
+    int rc = find_output(res);
+    drmModeFreeResources(res);
+    if (rc < 0) {
+        fprintf(stderr, "drm: no connected output\n");
+        goto fail;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (dumb_create(&buffers[i], mode.hdisplay, mode.vdisplay) < 0) {
+            fprintf(stderr, "drm: could not create dumb buffer: %s\n",
+                strerror(errno));
+            goto fail;
+        }
+    }
+
+    saved_crtc = drmModeGetCrtc(fd, crtc_id);
+    if (drmModeSetCrtc(fd, crtc_id, buffers[0].fb_id, 0, 0, &connector_id, 1,
+            &mode) < 0) {
+        fprintf(stderr, "drm: could not set mode: %s\n", strerror(errno));
+        goto fail;
+    }
+    crtc_set = true;
+    back = 1;
+
+    src_width = width;
+    src_height = height;
+    return 0;
+
+fail:
+    drm_cleanup();
+    return -1;
+}
+
+static void
+wait_flip(void)
+{
+    drmEventContext ev = {
+        .version = 2,
+        .page_flip_handler = on_page_flip,
+    };
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    while (flip_pending) {
+        if (poll(&pfd, 1, 1000) <= 0) {
+            // Lost the event (e.g. VT switch); don't hang the player
+            flip_pending = false;
+            break;
+        }
+        drmHandleEvent(fd, &ev);
+    }
+}
+
+static void
+drm_update(const unsigned char *pixels, int stride)
+{
+    // The back buffer may still be scanned out until the last flip lands
+    wait_flip();
+    struct DumbBuffer *buf = &buffers[back];
+    gfx_blit_centered(buf->map, buf->pitch, mode.hdisplay, mode.vdisplay,
+        pixels, stride, src_width, src_height);
+}
+
+static void
+drm_present(void)
+{
+    wait_flip();
+    if (drmModePageFlip(fd, crtc_id, buffers[back].fb_id,
+            DRM_MODE_PAGE_FLIP_EVENT, NULL) == 0) {
+        flip_pending = true;
+        back ^= 1;
+    }
+}
+
+static void
+drm_cleanup(void)
+{
+    if (fd < 0)
+        return;
+    wait_flip();
+    if (saved_crtc) {
+        if (crtc_set)
+            drmModeSetCrtc(fd, saved_crtc->crtc_id, saved_crtc->buffer_id,
+                saved_crtc->x, saved_crtc->y, &connector_id, 1,
+                &saved_crtc->mode);
+        drmModeFreeCrtc(saved_crtc);
+        saved_crtc = NULL;
+    }
+    crtc_set = false;
+    for (int i = 0; i < 2; i++)
+        dumb_destroy(&buffers[i]);
+    close(fd);
+    fd = -1;
+}
+
+const struct GfxBackend gfx_drm_backend = {
+    .name = "drm",
+    .init = drm_init,
+    .update = drm_update,
+    .present = drm_present,
+    .cleanup = drm_cleanup,
+};
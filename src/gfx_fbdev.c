@@ -0,0 +1,126 @@
+#include "gfx.h"
+
+#include <fcntl.h>
+#include <linux/fb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Linux framebuffer console (/dev/fb0, or $DWPLAY_FBDEV). Double buffers by
+// panning when the virtual resolution has room for two screens.
+
+static int fd = -1;
+static struct fb_var_screeninfo var;
+static unsigned char *fb_mem;
+static size_t fb_len;
+static int fb_stride;
+static int back;       // screen index (0 or 1) drawn into next
+static int nbuffers;
+static int src_width, src_height;
+
+static void fbdev_cleanup(void);
+
+static int
+fbdev_init(int width, int height, const char *title)
+{
+    (void) title;
+
+    const char *path = getenv("DWPLAY_FBDEV");
+    if (!path)
+        path = "/dev/fb0";
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    struct fb_fix_screeninfo fix;
+    if (ioctl(fd, FBIOGET_VSCREENINFO, &var) < 0 ||
+        ioctl(fd, FBIOGET_FSCREENINFO, &fix) < 0) {
+        perror("fbdev: FBIOGET_*SCREENINFO");
+        goto fail;
+    }
+
+    // The canvas is ARGB8888 (opaque, so premultiplication doesn't matter);
+    // only accept the matching XRGB8888 layout rather than converting
+    if (var.bits_per_pixel != 32 || var.red.offset != 16 ||
+        var.green.offset != 8 || var.blue.offset != 0) {
+        fprintf(stderr, "fbdev: unsupported pixel format (%u bpp)\n",
+            var.bits_per_pixel);
+        goto fail;
+    }
+
+    fb_stride = fix.line_length;
+    fb_len = fix.smem_len;
+    fb_mem = mmap(NULL, fb_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fb_mem == MAP_FAILED) {
+        fb_mem = NULL;
+        perror("fbdev: mmap");
+        goto fail;
+    }
+
+    nbuffers = 1;
+    if (var.yres_virtual >= var.yres * 2 &&
+        fb_len >= (size_t) fb_stride * var.yres * 2) {
+        var.yoffset = 0;
+        if (ioctl(fd, FBIOPAN_DISPLAY, &var) == 0)
+            nbuffers = 2;
+    }
+    back = nbuffers - 1;
+
+    memset(fb_mem, 0, (size_t) fb_stride * var.yres * nbuffers);
+    src_width = width;
+    src_height = height;
+    return 0;
+
+fail:
+    fbdev_cleanup();
+    return -1;
+}
+
+static void
+fbdev_update(const unsigned char *pixels, int stride)
+{
+    unsigned char *dst = fb_mem + (size_t) back * var.yres * fb_stride;
+    gfx_blit_centered(dst, fb_stride, var.xres, var.yres, pixels, stride,
+        src_width, src_height);
+}
+
+static void
+fbdev_present(void)
+{
+    unsigned int crtc = 0;
+    ioctl(fd, FBIO_WAITFORVSYNC, &crtc);
+    if (nbuffers == 2) {
+        var.yoffset = back * var.yres;
+        ioctl(fd, FBIOPAN_DISPLAY, &var);
+        back ^= 1;
+    }
+}
+
+static void
+fbdev_cleanup(void)
+{
+    if (fb_mem) {
+        if (nbuffers == 2) {
+            var.yoffset = 0;
+            ioctl(fd, FBIOPAN_DISPLAY, &var);
+        }
+        munmap(fb_mem, fb_len);
+        fb_mem = NULL;
+    }
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+const struct GfxBackend gfx_fbdev_backend = {
+    .name = "fbdev",
+    .init = fbdev_init,
+    .update = fbdev_update,
+    .present = fbdev_present,
+    .cleanup = fbdev_cleanup,
+};
@@ -0,0 +1,37 @@
+#include "gfx.h"
+
+// Displays nothing; for measuring rendering on its own
+
+static int
+null_init(int width, int height, const char *title)
+{
+    (void) width;
+    (void) height;
+    (void) title;
+    return 0;
+}
+
+static void
+null_update(const unsigned char *pixels, int stride)
+{
+    (void) pixels;
+    (void) stride;
+}
+
+static void
+null_present(void)
+{
+}
+
+static void
+null_cleanup(void)
+{
+}
+
+const struct GfxBackend gfx_null_backend = {
+    .name = "null",
+    .init = null_init,
+    .update = null_update,
+    .present = null_present,
+    .cleanup = null_cleanup,
+};
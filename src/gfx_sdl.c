@@ -1,14 +1,51 @@
 #include "gfx.h"
 
 #include <SDL.h>
+#include <stdbool.h>
 
 static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_Texture *texture;
 static int tex_width, tex_height;
 
-int
-gfx_init(int width, int height, const char *title)
+// Window state from SDL_WINDOWEVENTs
+static bool hidden, focused;
+
+// Texture memory the canvas can rasterize into directly, if the renderer
+// hands out the same persistent buffer on every lock
+static void *direct_pixels;
+static int direct_pitch;
+
+static void
+probe_direct(void)
+{
+    Uint32 format;
+    if (SDL_QueryTexture(texture, &format, NULL, NULL, NULL) < 0 ||
+        format != SDL_PIXELFORMAT_ARGB8888)
+        return;
+
+    // Some renderers return fresh (write-only) staging memory per lock;
+    // only the stable case keeps the canvas contents across frames
+    void *first, *second;
+    int first_pitch, second_pitch;
+    if (SDL_LockTexture(texture, NULL, &first, &first_pitch) < 0)
+        return;
+    SDL_UnlockTexture(texture);
+    if (SDL_LockTexture(texture, NULL, &second, &second_pitch) < 0)
+        return;
+    SDL_UnlockTexture(texture);
+
+    if (first != second || first_pitch != second_pitch)
+        return;
+    if (first_pitch < tex_width * 4 || first_pitch % 4 != 0)
+        return;
+
+    direct_pixels = first;
+    direct_pitch = first_pitch;
+}
+
+static int
+sdl_init(int width, int height, const char *title)
 {
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
         return -1;
@@ -42,25 +79,59 @@ gfx_init(int width, int height, const char *title)
 
     tex_width = width;
     tex_height = height;
+    probe_direct();
+
+    Uint32 flags = SDL_GetWindowFlags(window);
+    hidden = flags & (SDL_WINDOW_HIDDEN | SDL_WINDOW_MINIMIZED);
+    focused = flags & SDL_WINDOW_INPUT_FOCUS;
     return 0;
 }
 
-void
-gfx_update(const unsigned char *pixels, int stride)
+static unsigned char *
+sdl_lock(int *stride)
+{
+    if (!direct_pixels)
+        return NULL;
+
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0) {
+        direct_pixels = NULL;
+        return NULL;
+    }
+    if (pixels != direct_pixels || pitch != direct_pitch) {
+        // The driver moved the buffer; stay on the copying path from now on
+        SDL_UnlockTexture(texture);
+        direct_pixels = NULL;
+        return NULL;
+    }
+
+    *stride = pitch;
+    return pixels;
+}
+
+static void
+sdl_unlock(void)
+{
+    SDL_UnlockTexture(texture);
+}
+
+static void
+sdl_update(const unsigned char *pixels, int stride)
 {
     SDL_UpdateTexture(texture, NULL, pixels, stride);
 }
 
-void
-gfx_present(void)
+static void
+sdl_present(void)
 {
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
 }
 
-int
-gfx_poll_quit(void)
+static int
+sdl_poll_quit(void)
 {
     SDL_Event e;
     while (SDL_PollEvent(&e)) {
@@ -68,15 +139,55 @@ gfx_poll_quit(void)
             return 1;
         if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_q)
             return 1;
+        if (e.type != SDL_WINDOWEVENT)
+            continue;
+        switch (e.window.event) {
+        case SDL_WINDOWEVENT_HIDDEN:
+        case SDL_WINDOWEVENT_MINIMIZED:
+            hidden = true;
+            break;
+        case SDL_WINDOWEVENT_SHOWN:
+        case SDL_WINDOWEVENT_EXPOSED:
+        case SDL_WINDOWEVENT_RESTORED:
+        case SDL_WINDOWEVENT_MAXIMIZED:
+            hidden = false;
+            break;
+        case SDL_WINDOWEVENT_FOCUS_GAINED:
+            focused = true;
+            break;
+        case SDL_WINDOWEVENT_FOCUS_LOST:
+            focused = false;
+            break;
+        }
     }
     return 0;
 }
 
-void
-gfx_cleanup(void)
+static enum GfxVisibility
+sdl_visibility(void)
+{
+    if (hidden)
+        return GFX_HIDDEN;
+    return focused ? GFX_VISIBLE : GFX_UNFOCUSED;
+}
+
+static void
+sdl_cleanup(void)
 {
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
+
+const struct GfxBackend gfx_sdl_backend = {
+    .name = "sdl",
+    .init = sdl_init,
+    .update = sdl_update,
+    .lock = sdl_lock,
+    .unlock = sdl_unlock,
+    .present = sdl_present,
+    .poll_quit = sdl_poll_quit,
+    .visibility = sdl_visibility,
+    .cleanup = sdl_cleanup,
+};
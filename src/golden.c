@@ -0,0 +1,337 @@
+#include "golden.h"
+
+#include "canvas.h"
+#include "dweet.h"
+#include "plutovg.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Frames are stepped like --sched fixed at this rate
+#define GOLDEN_FPS 60
+#define GOLDEN_SEED 1
+
+// Timestamps compared, in seconds
+static const double golden_times[] = { 0, 0.5, 1, 2, 4 };
+#define GOLDEN_NTIMES (sizeof(golden_times) / sizeof(golden_times[0]))
+
+struct Diff {
+    // Pixels with a channel off by more than the tolerance
+    unsigned long over;
+    // Largest difference in any channel
+    unsigned max;
+};
+
+static double
+get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// "dweets/11.js" -> "11"
+static void
+base_name(char *out, size_t size, const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    if (slash)
+        path = slash + 1;
+    size_t len = strlen(path);
+    if (len > 3 && strcmp(path + len - 3, ".js") == 0)
+        len -= 3;
+    snprintf(out, size, "%.*s", (int) len, path);
+}
+
+static unsigned
+channel_diff(uint32_t a, uint32_t b, int shift)
+{
+    int d = (int) ((a >> shift) & 0xFF) - (int) ((b >> shift) & 0xFF);
+    return d < 0 ? -d : d;
+}
+
+// Heatmap pixel: the render in dim gray where it matches, blue where it is
+// off within the tolerance, red to yellow with the size of a larger error
+static uint32_t
+heat_pixel(uint32_t actual, unsigned d, unsigned tolerance)
+{
+    if (d > tolerance) {
+        unsigned g = (d - tolerance) * 255 / (255 - tolerance);
+        return 0xFFFF0000 | g << 8;
+    }
+    if (d > 0)
+        return 0xFF2040C0;
+    unsigned r = (actual >> 16) & 0xFF, g = (actual >> 8) & 0xFF;
+    unsigned luma = (r * 77 + g * 150 + (actual & 0xFF) * 29) >> 8;
+    return 0xFF000000 | (luma / 4) * 0x010101;
+}
+
+// Both images are premultiplied ARGB32 of the same size
+static struct Diff
+compare(const plutovg_surface_t *actual, const plutovg_surface_t *golden,
+    unsigned tolerance, plutovg_surface_t *heat)
+{
+    struct Diff diff = { 0 };
+    int width = plutovg_surface_get_width(actual);
+    int height = plutovg_surface_get_height(actual);
+    const unsigned char *a = plutovg_surface_get_data(actual);
+    const unsigned char *g = plutovg_surface_get_data(golden);
+    unsigned char *h = plutovg_surface_get_data(heat);
+    int a_stride = plutovg_surface_get_stride(actual);
+    int g_stride = plutovg_surface_get_stride(golden);
+    int h_stride = plutovg_surface_get_stride(heat);
+    for (int y = 0; y < height; y++) {
+        const uint32_t *arow = (const uint32_t *) (a + (size_t) y * a_stride);
+        const uint32_t *grow = (const uint32_t *) (g + (size_t) y * g_stride);
+        uint32_t *hrow = (uint32_t *) (h + (size_t) y * h_stride);
+        for (int x = 0; x < width; x++) {
+            unsigned d = 0;
+            if (arow[x] != grow[x]) {
+                for (int shift = 0; shift < 32; shift += 8) {
+                    unsigned c = channel_diff(arow[x], grow[x], shift);
+                    if (c > d)
+                        d = c;
+                }
+            }
+            if (d > tolerance)
+                diff.over++;
+            if (d > diff.max)
+                diff.max = d;
+            hrow[x] = heat_pixel(arow[x], d, tolerance);
+        }
+    }
+    return diff;
+}
+
+static bool
+read_ms(const char *path, double *ms)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    bool ok = fscanf(f, "%lf", ms) == 1;
+    fclose(f);
+    return ok;
+}
+
+static int
+write_ms(const char *path, double ms)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+    fprintf(f, "%.3f\n", ms);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static int
+make_dir(const char *path)
+{
+    if (mkdir(path, 0777) < 0 && errno != EEXIST) {
+        fprintf(stderr, "error: could not create '%s': %s\n", path,
+            strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Compare one frame; returns 0 if it passed, 1 if it didn't, -1 on errors
+static int
+check_frame(plutovg_surface_t *frame, const char *dir, const char *name,
+    unsigned long n, unsigned tolerance)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s-%03lu.png", dir, name, n);
+    plutovg_surface_t *golden = plutovg_surface_load_from_image_file(path);
+    if (!golden) {
+        printf("%s: frame %lu has no golden image %s (run --update-golden)\n",
+            name, n, path);
+        return 1;
+    }
+
+    int width = plutovg_surface_get_width(frame);
+    int height = plutovg_surface_get_height(frame);
+    if (plutovg_surface_get_width(golden) != width ||
+        plutovg_surface_get_height(golden) != height) {
+        printf("%s: frame %lu is %dx%d, golden image is %dx%d\n", name, n,
+            width, height, plutovg_surface_get_width(golden),
+            plutovg_surface_get_height(golden));
+        plutovg_surface_destroy(golden);
+        return 1;
+    }
+
+    int ret = -1;
+    plutovg_surface_t *heat = plutovg_surface_create(width, height);
+    if (!heat) {
+        fprintf(stderr, "error: out of memory\n");
+        goto cleanup;
+    }
+    struct Diff diff = compare(frame, golden, tolerance, heat);
+    if (diff.over == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    snprintf(path, sizeof(path), "%s/diff", dir);
+    if (make_dir(path) < 0)
+        goto cleanup;
+    snprintf(path, sizeof(path), "%s/diff/%s-%03lu.png", dir, name, n);
+    if (!plutovg_surface_write_to_png(frame, path)) {
+        fprintf(stderr, "error: could not write '%s'\n", path);
+        goto cleanup;
+    }
+    snprintf(path, sizeof(path), "%s/diff/%s-%03lu.diff.png", dir, name, n);
+    if (!plutovg_surface_write_to_png(heat, path)) {
+        fprintf(stderr, "error: could not write '%s'\n", path);
+        goto cleanup;
+    }
+    printf("%s: frame %lu differs in %lu pixels, by up to %u (%s)\n", name, n,
+        diff.over, diff.max, path);
+    ret = 1;
+
+cleanup:
+    if (heat)
+        plutovg_surface_destroy(heat);
+    plutovg_surface_destroy(golden);
+    return ret;
+}
+
+// Returns 0 if every frame passed, 1 if not, -1 on errors
+static int
+golden_dweet(const char *code, const char *path_name, const char *dir,
+    unsigned tolerance, bool update)
+{
+    char name[NAME_MAX + 1], path[PATH_MAX];
+    base_name(name, sizeof(name), path_name);
+
+    struct Dweet *dweet =
+        dweet_new(code, path_name, DWEET_WIDTH, DWEET_HEIGHT);
+    if (!dweet)
+        return -1;
+    dweet_set_deterministic(dweet, GOLDEN_SEED);
+
+    struct Context2D *ctx2d = dweet_context2d(dweet);
+    plutovg_surface_t *frame = NULL;
+    int ret = 0;
+    unsigned long last =
+        lround(golden_times[GOLDEN_NTIMES - 1] * GOLDEN_FPS);
+    double total = 0, slowest = 0;
+    size_t next = 0;
+    for (unsigned long n = 0; n <= last; n++) {
+        double start = get_time();
+        if (dweet_frame(dweet, (double) n / GOLDEN_FPS) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+        double elapsed = get_time() - start;
+        total += elapsed;
+        if (elapsed > slowest)
+            slowest = elapsed;
+
+        if (n != (unsigned long) lround(golden_times[next] * GOLDEN_FPS))
+            continue;
+        next++;
+
+        // The surface can move between frames, so wrap it each time
+        plutovg_surface_destroy(frame);
+        frame = plutovg_surface_create_for_data(ctx2d_get_data(ctx2d),
+            ctx2d_get_width(ctx2d), ctx2d_get_height(ctx2d),
+            ctx2d_get_stride(ctx2d));
+        if (!frame) {
+            fprintf(stderr, "error: out of memory\n");
+            ret = -1;
+            goto cleanup;
+        }
+        if (update) {
+            snprintf(path, sizeof(path), "%s/%s-%03lu.png", dir, name, n);
+            if (!plutovg_surface_write_to_png(frame, path)) {
+                fprintf(stderr, "error: could not write '%s'\n", path);
+                ret = -1;
+                goto cleanup;
+            }
+            continue;
+        }
+        int rc = check_frame(frame, dir, name, n, tolerance);
+        if (rc < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+        if (rc > 0)
+            ret = 1;
+    }
+
+    double ms = total * 1000 / (last + 1);
+    snprintf(path, sizeof(path), "%s/%s.ms", dir, name);
+    if (update) {
+        if (write_ms(path, ms) < 0) {
+            fprintf(stderr, "error: could not write '%s'\n", path);
+            ret = -1;
+            goto cleanup;
+        }
+        printf("%s: wrote %zu frames, %.3f ms/frame, %.3f ms max\n", name,
+            GOLDEN_NTIMES, ms, slowest * 1000);
+        goto cleanup;
+    }
+
+    double golden_ms;
+    printf("%s: %s, %.3f ms/frame", name, ret ? "FAIL" : "ok", ms);
+    if (read_ms(path, &golden_ms) && golden_ms > 0)
+        printf(" (golden %.3f, %+.1f%%)", golden_ms,
+            (ms - golden_ms) * 100 / golden_ms);
+    printf(", %.3f ms max\n", slowest * 1000);
+
+cleanup:
+    plutovg_surface_destroy(frame);
+    dweet_destroy(dweet);
+    return ret;
+}
+
+// Whether dir has the first golden image of any of the dweets
+static bool
+have_goldens(char *const *names, int n, const char *dir)
+{
+    for (int i = 0; i < n; i++) {
+        char name[NAME_MAX + 1], path[PATH_MAX];
+        struct stat st;
+        base_name(name, sizeof(name), names[i]);
+        snprintf(path, sizeof(path), "%s/%s-%03lu.png", dir, name,
+            (unsigned long) lround(golden_times[0] * GOLDEN_FPS));
+        if (stat(path, &st) == 0)
+            return true;
+    }
+    return false;
+}
+
+int
+golden_run(char *const *codes, char *const *names, int n, const char *dir,
+    unsigned tolerance, bool update)
+{
+    if (update && make_dir(dir) < 0)
+        return 1;
+    if (!update && !have_goldens(names, n, dir)) {
+        fprintf(stderr,
+            "error: no golden images in %s (write them with "
+            "--update-golden)\n",
+            dir);
+        return 1;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < n; i++) {
+        int rc = golden_dweet(codes[i], names[i], dir, tolerance, update);
+        if (rc < 0)
+            fprintf(stderr, "error: %s did not render\n", names[i]);
+        if (rc != 0)
+            failed++;
+    }
+    if (!update)
+        printf("%d of %d dweets passed (tolerance %u)\n", n - failed, n,
+            tolerance);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Golden-image regression check. Each dweet renders headless at
+// DWEET_WIDTH x DWEET_HEIGHT with dweet_set_deterministic(), one frame per
+// 1/60 s from t = 0 so stateful dweets see the same history every run, and
+// the frames at a fixed set of timestamps are compared with
+// dir/<name>-<frame>.png, <name> being the file name without ".js".
+//
+// A frame passes when no channel of any pixel differs by more than
+// tolerance. Failing frames are written to dir/diff/ with a heatmap of the
+// differences next to them. The average time per frame is kept in
+// dir/<name>.ms and each run reports against it, so one run shows whether
+// a change is both correct and faster (on the machine that wrote it).
+//
+// With update, the golden images and timings are written instead.
+// Returns 0 if every frame of every dweet passed; a dir without golden
+// images for any of the dweets fails.
+int
+golden_run(char *const *codes, char *const *names, int n, const char *dir,
+    unsigned tolerance, bool update);
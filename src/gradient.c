@@ -0,0 +1,230 @@
+#include "gradient.h"
+
+#include "plutovg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct Gradient {
+    int refs;
+    enum GradientType type;
+    double x0, y0, r0;
+    double x1, y1, r1;
+
+    plutovg_gradient_stop_t *stops;
+    int nstops;
+    int cap;
+
+    // Built lazily, dropped when a stop is added
+    bool lut_valid;
+    uint32_t lut[GRADIENT_LUT_SIZE];
+    plutovg_paint_t *paint;
+};
+
+static struct Gradient *
+gradient_new(enum GradientType type)
+{
+    struct Gradient *gradient = calloc(1, sizeof(*gradient));
+    if (!gradient)
+        return NULL;
+    gradient->refs = 1;
+    gradient->type = type;
+    return gradient;
+}
+
+struct Gradient *
+gradient_new_linear(double x0, double y0, double x1, double y1)
+{
+    struct Gradient *gradient = gradient_new(GRADIENT_LINEAR);
+    if (!gradient)
+        return NULL;
+    gradient->x0 = x0;
+    gradient->y0 = y0;
+    gradient->x1 = x1;
+    gradient->y1 = y1;
+    return gradient;
+}
+
+struct Gradient *
+gradient_new_radial(double x0, double y0, double r0, double x1, double y1,
+    double r1)
+{
+    struct Gradient *gradient = gradient_new(GRADIENT_RADIAL);
+    if (!gradient)
+        return NULL;
+    gradient->x0 = x0;
+    gradient->y0 = y0;
+    gradient->r0 = r0;
+    gradient->x1 = x1;
+    gradient->y1 = y1;
+    gradient->r1 = r1;
+    return gradient;
+}
+
+struct Gradient *
+gradient_ref(struct Gradient *gradient)
+{
+    if (gradient)
+        gradient->refs++;
+    return gradient;
+}
+
+static void
+invalidate(struct Gradient *gradient)
+{
+    gradient->lut_valid = false;
+    if (gradient->paint) {
+        plutovg_paint_destroy(gradient->paint);
+        gradient->paint = NULL;
+    }
+}
+
+void
+gradient_unref(struct Gradient *gradient)
+{
+    if (!gradient || --gradient->refs > 0)
+        return;
+    invalidate(gradient);
+    free(gradient->stops);
+    free(gradient);
+}
+
+int
+gradient_add_color_stop(struct Gradient *gradient, double offset,
+    uint32_t argb)
+{
+    if (!(offset >= 0.0 && offset <= 1.0))
+        return -1;
+
+    if (gradient->nstops == gradient->cap) {
+        int cap = gradient->cap ? gradient->cap * 2 : 4;
+        plutovg_gradient_stop_t *stops =
+            realloc(gradient->stops, cap * sizeof(*stops));
+        if (!stops)
+            return -1;
+        gradient->stops = stops;
+        gradient->cap = cap;
+    }
+
+    // Keep stops sorted; a stop at the same offset as earlier ones goes
+    // after them, which makes a hard edge
+    int i = gradient->nstops;
+    while (i > 0 && gradient->stops[i - 1].offset > offset) {
+        gradient->stops[i] = gradient->stops[i - 1];
+        i--;
+    }
+    gradient->stops[i] = (plutovg_gradient_stop_t) {
+        .offset = (float) offset,
+        .color = PLUTOVG_MAKE_COLOR(((argb >> 16) & 0xFF) / 255.0f,
+            ((argb >> 8) & 0xFF) / 255.0f, (argb & 0xFF) / 255.0f,
+            ((argb >> 24) & 0xFF) / 255.0f),
+    };
+    gradient->nstops++;
+    invalidate(gradient);
+    return 0;
+}
+
+enum GradientType
+gradient_get_type(const struct Gradient *gradient)
+{
+    return gradient->type;
+}
+
+void
+gradient_get_geometry(const struct Gradient *gradient, double *x0,
+    double *y0, double *r0, double *x1, double *y1, double *r1)
+{
+    *x0 = gradient->x0;
+    *y0 = gradient->y0;
+    *r0 = gradient->r0;
+    *x1 = gradient->x1;
+    *y1 = gradient->y1;
+    *r1 = gradient->r1;
+}
+
+static uint32_t
+premultiply(plutovg_color_t c)
+{
+    uint32_t a = (uint32_t) (c.a * 255.0f + 0.5f);
+    uint32_t r = (uint32_t) (c.r * c.a * 255.0f + 0.5f);
+    uint32_t g = (uint32_t) (c.g * c.a * 255.0f + 0.5f);
+    uint32_t b = (uint32_t) (c.b * c.a * 255.0f + 0.5f);
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// Interpolate unpremultiplied, as PlutoVG does, then premultiply
+static void
+build_lut(struct Gradient *gradient)
+{
+    const plutovg_gradient_stop_t *stops = gradient->stops;
+    int n = gradient->nstops;
+    int k = 0;
+
+    for (int i = 0; i < GRADIENT_LUT_SIZE; i++) {
+        float t = (float) i / (GRADIENT_LUT_SIZE - 1);
+        while (k < n && stops[k].offset <= t)
+            k++;
+
+        plutovg_color_t c;
+        if (k == 0) {
+            c = stops[0].color;
+        } else if (k == n) {
+            c = stops[n - 1].color;
+        } else {
+            const plutovg_gradient_stop_t *a = &stops[k - 1];
+            const plutovg_gradient_stop_t *b = &stops[k];
+            float f = (t - a->offset) / (b->offset - a->offset);
+            c = PLUTOVG_MAKE_COLOR(a->color.r + (b->color.r - a->color.r) * f,
+                a->color.g + (b->color.g - a->color.g) * f,
+                a->color.b + (b->color.b - a->color.b) * f,
+                a->color.a + (b->color.a - a->color.a) * f);
+        }
+        gradient->lut[i] = premultiply(c);
+    }
+    gradient->lut_valid = true;
+}
+
+static bool
+paints_nothing(const struct Gradient *gradient)
+{
+    if (gradient->nstops == 0)
+        return true;
+    if (gradient->type == GRADIENT_LINEAR)
+        return gradient->x0 == gradient->x1 && gradient->y0 == gradient->y1;
+    return gradient->x0 == gradient->x1 && gradient->y0 == gradient->y1 &&
+        gradient->r0 == gradient->r1;
+}
+
+const uint32_t *
+gradient_get_lut(struct Gradient *gradient)
+{
+    if (paints_nothing(gradient))
+        return NULL;
+    if (!gradient->lut_valid)
+        build_lut(gradient);
+    return gradient->lut;
+}
+
+struct plutovg_paint *
+gradient_get_paint(struct Gradient *gradient)
+{
+    if (paints_nothing(gradient))
+        return NULL;
+    if (gradient->paint)
+        return gradient->paint;
+
+    if (gradient->type == GRADIENT_LINEAR) {
+        gradient->paint = plutovg_paint_create_linear_gradient(
+            (float) gradient->x0, (float) gradient->y0, (float) gradient->x1,
+            (float) gradient->y1, PLUTOVG_SPREAD_METHOD_PAD, gradient->stops,
+            gradient->nstops, NULL);
+    } else {
+        // PlutoVG's focal circle is the canvas start circle
+        gradient->paint = plutovg_paint_create_radial_gradient(
+            (float) gradient->x1, (float) gradient->y1, (float) gradient->r1,
+            (float) gradient->x0, (float) gradient->y0, (float) gradient->r0,
+            PLUTOVG_SPREAD_METHOD_PAD, gradient->stops, gradient->nstops,
+            NULL);
+    }
+    return gradient->paint;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// CanvasGradient. Reference counted: the JS object and any Context2D
+// using it as its fill style each hold a reference.
+//
+// The sampled color table and the PlutoVG paint are built on first use and
+// kept until the next addColorStop, so filling with the same gradient many
+// times per frame doesn't interpolate the stops again.
+
+#define GRADIENT_LUT_SIZE 1024
+
+enum GradientType {
+    GRADIENT_LINEAR,
+    GRADIENT_RADIAL,
+};
+
+struct Gradient;
+struct plutovg_paint;
+
+struct Gradient *
+gradient_new_linear(double x0, double y0, double x1, double y1);
+struct Gradient *
+gradient_new_radial(double x0, double y0, double r0, double x1, double y1,
+    double r1);
+struct Gradient *
+gradient_ref(struct Gradient *gradient);
+void
+gradient_unref(struct Gradient *gradient);
+
+// Fails (-1) for an offset outside [0, 1]
+int
+gradient_add_color_stop(struct Gradient *gradient, double offset,
+    uint32_t argb);
+
+enum GradientType
+gradient_get_type(const struct Gradient *gradient);
+// Start and end points (linear), or start and end circles (radial, with
+// r0 and r1 set)
+void
+gradient_get_geometry(const struct Gradient *gradient, double *x0,
+    double *y0, double *r0, double *x1, double *y1, double *r1);
+// Premultiplied ARGB32 colors for offsets 0..1; NULL when the gradient
+// paints nothing (no stops, or zero length / identical circles)
+const uint32_t *
+gradient_get_lut(struct Gradient *gradient);
+// NULL when the gradient paints nothing
+struct plutovg_paint *
+gradient_get_paint(struct Gradient *gradient);
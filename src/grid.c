@@ -0,0 +1,290 @@
+#include "grid.h"
+
+#include "canvas.h"
+#include "dweet.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct Cell {
+    struct Grid *grid;
+    struct Dweet *dweet;
+    const char *name;
+    pthread_t thread;
+    bool started;
+
+    // Placement in the composite image
+    unsigned x, y;
+    unsigned width, height;
+
+    // Last completed frame, handed from the worker to the presenter
+    pthread_mutex_t lock;
+    unsigned char *front;
+    uint64_t front_seq;
+    uint64_t shown_seq;
+
+    // Only touched by the worker until it exits
+    uint64_t frames;
+    uint64_t skipped;
+    double total_time;
+    double max_time;
+    bool failed;
+};
+
+struct Grid {
+    unsigned rows, cols;
+    struct Cell *cells;
+
+    // Frame ticks from the presenter; a worker renders the newest tick and
+    // skips any it missed while busy
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t tick;
+    double t;
+    bool quit;
+    unsigned nfailed;
+
+    unsigned char *composite;
+    int stride;
+};
+
+static double
+get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+cell_publish(struct Cell *cell)
+{
+    struct Context2D *ctx2d = dweet_context2d(cell->dweet);
+    const unsigned char *src = ctx2d_get_data(ctx2d);
+    int src_stride = ctx2d_get_stride(ctx2d);
+    size_t row = (size_t) cell->width * 4;
+
+    pthread_mutex_lock(&cell->lock);
+    for (unsigned y = 0; y < cell->height; y++)
+        memcpy(cell->front + y * row, src + (size_t) y * src_stride, row);
+    cell->front_seq++;
+    pthread_mutex_unlock(&cell->lock);
+}
+
+static void *
+cell_worker(void *arg)
+{
+    struct Cell *cell = arg;
+    struct Grid *grid = cell->grid;
+    uint64_t last_tick = 0;
+
+    dweet_attach_thread(cell->dweet);
+
+    pthread_mutex_lock(&grid->lock);
+    for (;;) {
+        while (grid->tick == last_tick && !grid->quit)
+            pthread_cond_wait(&grid->cond, &grid->lock);
+        if (grid->quit)
+            break;
+        cell->skipped += grid->tick - last_tick - 1;
+        last_tick = grid->tick;
+        double t = grid->t;
+        pthread_mutex_unlock(&grid->lock);
+
+        double start = get_time();
+        int rc = dweet_frame(cell->dweet, t);
+        double elapsed = get_time() - start;
+
+        pthread_mutex_lock(&grid->lock);
+        if (rc < 0) {
+            fprintf(stderr, "error: %s stopped\n", cell->name);
+            cell->failed = true;
+            grid->nfailed++;
+            break;
+        }
+        pthread_mutex_unlock(&grid->lock);
+
+        cell_publish(cell);
+        cell->frames++;
+        cell->total_time += elapsed;
+        if (elapsed > cell->max_time)
+            cell->max_time = elapsed;
+
+        pthread_mutex_lock(&grid->lock);
+    }
+    pthread_mutex_unlock(&grid->lock);
+    return NULL;
+}
+
+struct Grid *
+grid_new(unsigned rows, unsigned cols, unsigned width, unsigned height,
+    char **codes, char **names, int ndweets,
+    void (*setup)(struct Dweet *dweet, void *arg), void *arg)
+{
+    if (rows == 0 || cols == 0 || ndweets <= 0)
+        return NULL;
+
+    struct Grid *grid = calloc(1, sizeof(*grid));
+    if (!grid)
+        return NULL;
+    grid->rows = rows;
+    grid->cols = cols;
+    grid->stride = width * 4;
+    pthread_mutex_init(&grid->lock, NULL);
+    pthread_cond_init(&grid->cond, NULL);
+
+    // Unused border pixels (when the size doesn't divide evenly) stay black
+    grid->composite = calloc((size_t) height, grid->stride);
+    grid->cells = calloc((size_t) rows * cols, sizeof(*grid->cells));
+    if (!grid->composite || !grid->cells)
+        goto fail;
+
+    unsigned cell_width = width / cols;
+    unsigned cell_height = height / rows;
+
+    // Create every runtime on this thread before any worker starts; class
+    // registration in js.c is not thread safe
+    for (unsigned i = 0; i < rows * cols; i++) {
+        struct Cell *cell = &grid->cells[i];
+        *cell = (struct Cell) {
+            .grid = grid,
+            .name = names[i % ndweets],
+            .x = (i % cols) * cell_width,
+            .y = (i / cols) * cell_height,
+            .width = cell_width,
+            .height = cell_height,
+        };
+        pthread_mutex_init(&cell->lock, NULL);
+        cell->front = malloc((size_t) cell_width * cell_height * 4);
+        if (!cell->front)
+            goto fail;
+        cell->dweet = dweet_new(codes[i % ndweets], cell->name, cell_width,
+            cell_height);
+        if (!cell->dweet)
+            goto fail;
+        if (setup)
+            setup(cell->dweet, arg);
+    }
+
+    for (unsigned i = 0; i < rows * cols; i++) {
+        struct Cell *cell = &grid->cells[i];
+        if (pthread_create(&cell->thread, NULL, cell_worker, cell) != 0)
+            goto fail;
+        cell->started = true;
+    }
+
+    return grid;
+
+fail:
+    grid_destroy(grid);
+    return NULL;
+}
+
+void
+grid_stop(struct Grid *grid)
+{
+    pthread_mutex_lock(&grid->lock);
+    grid->quit = true;
+    pthread_cond_broadcast(&grid->cond);
+    pthread_mutex_unlock(&grid->lock);
+
+    if (!grid->cells)
+        return;
+    for (unsigned i = 0; i < grid->rows * grid->cols; i++) {
+        struct Cell *cell = &grid->cells[i];
+        if (cell->started)
+            pthread_join(cell->thread, NULL);
+        cell->started = false;
+    }
+}
+
+void
+grid_destroy(struct Grid *grid)
+{
+    if (!grid)
+        return;
+
+    grid_stop(grid);
+
+    if (grid->cells) {
+        for (unsigned i = 0; i < grid->rows * grid->cols; i++) {
+            struct Cell *cell = &grid->cells[i];
+            dweet_destroy(cell->dweet);
+            free(cell->front);
+            if (cell->grid)
+                pthread_mutex_destroy(&cell->lock);
+        }
+    }
+
+    pthread_cond_destroy(&grid->cond);
+    pthread_mutex_destroy(&grid->lock);
+    free(grid->cells);
+    free(grid->composite);
+    free(grid);
+}
+
+int
+grid_frame(struct Grid *grid, double t)
+{
+    unsigned ncells = grid->rows * grid->cols;
+
+    pthread_mutex_lock(&grid->lock);
+    grid->tick++;
+    grid->t = t;
+    pthread_cond_broadcast(&grid->cond);
+    bool all_failed = grid->nfailed == ncells;
+    pthread_mutex_unlock(&grid->lock);
+
+    for (unsigned i = 0; i < ncells; i++) {
+        struct Cell *cell = &grid->cells[i];
+        size_t row = (size_t) cell->width * 4;
+
+        pthread_mutex_lock(&cell->lock);
+        if (cell->front_seq != cell->shown_seq) {
+            unsigned char *dst = grid->composite +
+                (size_t) cell->y * grid->stride + (size_t) cell->x * 4;
+            for (unsigned y = 0; y < cell->height; y++)
+                memcpy(dst + (size_t) y * grid->stride, cell->front + y * row,
+                    row);
+            cell->shown_seq = cell->front_seq;
+        }
+        pthread_mutex_unlock(&cell->lock);
+    }
+
+    return all_failed ? -1 : 0;
+}
+
+const unsigned char *
+grid_get_data(struct Grid *grid)
+{
+    return grid->composite;
+}
+
+int
+grid_get_stride(struct Grid *grid)
+{
+    return grid->stride;
+}
+
+void
+grid_print_stats(struct Grid *grid)
+{
+    uint64_t ticks = grid->tick;
+
+    for (unsigned i = 0; i < grid->rows * grid->cols; i++) {
+        struct Cell *cell = &grid->cells[i];
+        double avg = cell->frames ? cell->total_time / cell->frames : 0;
+        fprintf(stderr,
+            "cell %u,%u (%s): %llu/%llu frames, %llu skipped, "
+            "avg %.2f ms, max %.2f ms%s\n",
+            i / grid->cols, i % grid->cols, cell->name,
+            (unsigned long long) cell->frames, (unsigned long long) ticks,
+            (unsigned long long) cell->skipped, avg * 1e3,
+            cell->max_time * 1e3, cell->failed ? " (failed)" : "");
+    }
+}
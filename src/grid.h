@@ -0,0 +1,33 @@
+#pragma once
+
+struct Dweet;
+struct Grid;
+
+// A rows x cols mosaic of dweets, each with its own runtime and worker thread,
+// composited into a single width x height ARGB image. setup (if not NULL) is
+// called with arg on every cell's dweet before the workers start.
+struct Grid *
+grid_new(unsigned rows, unsigned cols, unsigned width, unsigned height,
+    char **codes, char **names, int ndweets,
+    void (*setup)(struct Dweet *dweet, void *arg), void *arg);
+void
+grid_destroy(struct Grid *grid);
+
+// Stop and join the workers; the grid can only be destroyed afterwards
+void
+grid_stop(struct Grid *grid);
+
+// Ask every cell to render time t and composite whatever cells have finished
+// since the last call; never waits on a cell that has fallen behind.
+// Returns -1 once every cell has failed.
+int
+grid_frame(struct Grid *grid, double t);
+
+const unsigned char *
+grid_get_data(struct Grid *grid);
+int
+grid_get_stride(struct Grid *grid);
+
+// Per-cell frame counts and frame times; call after grid_stop
+void
+grid_print_stats(struct Grid *grid);
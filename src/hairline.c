@@ -0,0 +1,102 @@
+#include "hairline.h"
+
+#include <math.h>
+#include <stddef.h>
+
+// x * a / 255 rounded, for x, a <= 255
+static inline unsigned
+div255(unsigned x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t
+mul_px(uint32_t p, unsigned a)
+{
+    return div255((p & 0xFF) * a) | div255(((p >> 8) & 0xFF) * a) << 8 |
+        div255(((p >> 16) & 0xFF) * a) << 16 | div255((p >> 24) * a) << 24;
+}
+
+// Source-over of color at coverage / 255; no channel can carry into the
+// next since premultiplied channels never exceed alpha
+static inline void
+plot(uint32_t *p, uint32_t color, unsigned coverage)
+{
+    uint32_t s = mul_px(color, coverage);
+    *p = s + mul_px(*p, 255 - (s >> 24));
+}
+
+void
+hairline_line(const struct Hairline *hl, float x0, float y0, float x1,
+    float y1)
+{
+    if (!(isfinite(x0) && isfinite(y0) && isfinite(x1) && isfinite(y1)))
+        return;
+
+    // Step along x; steep lines swap the axes
+    bool steep = fabsf(y1 - y0) > fabsf(x1 - x0);
+    int major = hl->width, minor = hl->height;
+    if (steep) {
+        float t = x0;
+        x0 = y0;
+        y0 = t;
+        t = x1;
+        x1 = y1;
+        y1 = t;
+        major = hl->height;
+        minor = hl->width;
+    }
+    if (x0 == x1)
+        return;
+
+    // Pixel centers i + 0.5 from the start up to, not including, the end
+    double first, last;
+    if (x0 < x1) {
+        first = ceil(x0 - 0.5);
+        last = ceil(x1 - 0.5) - 1;
+    } else {
+        first = floor(x1 - 0.5) + 1;
+        last = floor(x0 - 0.5);
+    }
+    first = fmax(first, 0);
+    last = fmin(last, major - 1);
+    if (first > last)
+        return;
+
+    double slope = ((double) y1 - y0) / ((double) x1 - x0);
+    // Thickness of the stroke along the minor axis
+    double half = hl->weight * sqrt(1 + slope * slope) / 2;
+    for (int i = (int) first; i <= (int) last; i++) {
+        double m = y0 + (i + 0.5 - x0) * slope;
+        double top = m - half, bottom = m + half;
+        if (bottom <= 0 || top >= minor)
+            continue;
+        if (hl->aliased) {
+            int j0 = (int) ceil(top - 0.5), j1 = (int) ceil(bottom - 0.5);
+            if (j0 >= j1) {
+                j0 = (int) floor(m);
+                j1 = j0 + 1;
+            }
+            j0 = j0 > 0 ? j0 : 0;
+            j1 = j1 < minor ? j1 : minor;
+            for (int j = j0; j < j1; j++)
+                plot(steep ? hl->data + (size_t) i * hl->stride + j
+                           : hl->data + (size_t) j * hl->stride + i,
+                    hl->color, 255);
+            continue;
+        }
+        int j0 = top > 0 ? (int) top : 0;
+        int j1 = bottom < minor ? (int) ceil(bottom) : minor;
+        for (int j = j0; j < j1; j++) {
+            double cover = fmin(j + 1, bottom) - fmax(j, top);
+            unsigned coverage =
+                cover >= 1 ? 255 : (unsigned) (cover * 255 + 0.5);
+            if (coverage == 0)
+                continue;
+            uint32_t *p = steep ? hl->data + (size_t) i * hl->stride + j
+                                : hl->data + (size_t) j * hl->stride + i;
+            plot(p, hl->color, coverage);
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Antialiased lines for strokes at most ~1.5 device pixels wide, drawn
+// straight into a premultiplied ARGB32 surface with source-over. Each step
+// along the major axis covers the pixels the stroke's cross-section overlaps
+// on the minor axis, two for a 1px line as in Wu's algorithm. That is far
+// cheaper than outlining and scan-converting a polygon this thin.
+
+struct Hairline {
+    uint32_t *data;
+    int stride; // in pixels
+    int width, height;
+    // Premultiplied stroke color
+    uint32_t color;
+    // Stroke width in device pixels
+    float weight;
+    // Draw the pixels whose centers the stroke covers at full strength,
+    // or the one under the line where it covers none, with no antialiasing
+    bool aliased;
+};
+
+// Line from (x0, y0) to (x1, y1) in device pixels. Pixels whose centers
+// lie in [x0, x1) along the major axis are drawn, so polylines don't draw
+// their joints twice.
+void
+hairline_line(const struct Hairline *hl, float x0, float y0, float x1,
+    float y1);
@@ -1,11 +1,19 @@
+#include "js.h"
+
 #include "canvas.h"
-#include "quickjs.h"
+#include "gradient.h"
+#include "surfpool.h"
 
+#include <limits.h>
 #include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
 
 static JSClassID canvas_class_id;
 static JSClassID ctx2d_class_id;
+static JSClassID gradient_class_id;
 
 // ============================================================================
 // Binding helper macros
@@ -211,6 +219,62 @@ parse_color(const char *str)
     return (alpha << 24) | (r << 16) | (g << 8) | b;
 }
 
+// ============================================================================
+// CanvasGradient JS bindings
+// ============================================================================
+
+static void
+js_gradient_finalizer(JSRuntime *rt, JSValue val)
+{
+    (void) rt;
+    gradient_unref(JS_GetOpaque(val, gradient_class_id));
+}
+
+static JSClassDef gradient_class = {
+    "CanvasGradient",
+    .finalizer = js_gradient_finalizer,
+};
+
+// addColorStop(offset, color)
+static JSValue
+js_gradient_addColorStop(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(gradient, this_val, struct Gradient, gradient_class_id);
+    double offset;
+    if (JS_ToFloat64(ctx, &offset, argv[0]))
+        return JS_EXCEPTION;
+    const char *str = JS_ToCString(ctx, argv[1]);
+    if (!str)
+        return JS_EXCEPTION;
+    uint32_t color = parse_color(str);
+    JS_FreeCString(ctx, str);
+    if (gradient_add_color_stop(gradient, offset, color) < 0)
+        return JS_ThrowRangeError(ctx, "color stop offset out of range");
+    return JS_UNDEFINED;
+}
+
+// Gradients are often created every frame, so their methods live on a
+// shared prototype rather than on each object
+static const JSCFunctionListEntry gradient_proto_funcs[] = {
+    JS_CFUNC_DEF("addColorStop", 2, js_gradient_addColorStop),
+};
+
+static JSValue
+js_gradient_wrap(JSContext *ctx, struct Gradient *gradient)
+{
+    if (!gradient)
+        return JS_ThrowOutOfMemory(ctx);
+    JSValue obj = JS_NewObjectClass(ctx, gradient_class_id);
+    if (JS_IsException(obj)) {
+        gradient_unref(gradient);
+        return obj;
+    }
+    JS_SetOpaque(obj, gradient);
+    return obj;
+}
+
 // ============================================================================
 // Context2D JS bindings
 // ============================================================================
@@ -241,6 +305,11 @@ static JSValue
 js_ctx2d_fillStyle_set(JSContext *ctx, JSValueConst this_val, JSValueConst val)
 {
     GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    struct Gradient *gradient = JS_GetOpaque(val, gradient_class_id);
+    if (gradient) {
+        ctx2d_fillStyle_set_gradient(ctx2d, gradient);
+        return JS_UNDEFINED;
+    }
     const char *str = JS_ToCString(ctx, val);
     if (str) {
         ctx2d_fillStyle_set(ctx2d, parse_color(str));
@@ -263,7 +332,48 @@ METHOD_RECT(js_ctx2d_clearRect, struct Context2D, ctx2d_class_id,
 // Path methods
 METHOD_VOID(js_ctx2d_beginPath, struct Context2D, ctx2d_class_id,
     ctx2d_beginPath)
+METHOD_VOID(js_ctx2d_closePath, struct Context2D, ctx2d_class_id,
+    ctx2d_closePath)
 METHOD_VOID(js_ctx2d_stroke, struct Context2D, ctx2d_class_id, ctx2d_stroke)
+METHOD_VOID(js_ctx2d_fill, struct Context2D, ctx2d_class_id, ctx2d_fill)
+
+// State and transform methods
+METHOD_VOID(js_ctx2d_save, struct Context2D, ctx2d_class_id, ctx2d_save)
+METHOD_VOID(js_ctx2d_restore, struct Context2D, ctx2d_class_id, ctx2d_restore)
+METHOD_VOID(js_ctx2d_resetTransform, struct Context2D, ctx2d_class_id,
+    ctx2d_resetTransform)
+
+// moveTo(x, y)
+static JSValue
+js_ctx2d_moveTo(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    double x, y;
+    if (JS_ToFloat64(ctx, &x, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToFloat64(ctx, &y, argv[1]))
+        return JS_EXCEPTION;
+    ctx2d_moveTo(ctx2d, x, y);
+    return JS_UNDEFINED;
+}
+
+// lineTo(x, y)
+static JSValue
+js_ctx2d_lineTo(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    double x, y;
+    if (JS_ToFloat64(ctx, &x, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToFloat64(ctx, &y, argv[1]))
+        return JS_EXCEPTION;
+    ctx2d_lineTo(ctx2d, x, y);
+    return JS_UNDEFINED;
+}
 
 // arc(x, y, radius, startAngle, endAngle, counterclockwise)
 static JSValue
@@ -303,27 +413,71 @@ js_ctx2d_scale(JSContext *ctx, JSValueConst this_val, int argc,
     return JS_UNDEFINED;
 }
 
-// setTransform(a, b, c, d, e, f)
+// translate(x, y)
 static JSValue
-js_ctx2d_setTransform(JSContext *ctx, JSValueConst this_val, int argc,
+js_ctx2d_translate(JSContext *ctx, JSValueConst this_val, int argc,
     JSValueConst *argv)
 {
     (void) argc;
     GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
-    double a, b, c, d, e, f;
-    if (JS_ToFloat64(ctx, &a, argv[0]))
-        return JS_EXCEPTION;
-    if (JS_ToFloat64(ctx, &b, argv[1]))
+    double x, y;
+    if (JS_ToFloat64(ctx, &x, argv[0]))
         return JS_EXCEPTION;
-    if (JS_ToFloat64(ctx, &c, argv[2]))
+    if (JS_ToFloat64(ctx, &y, argv[1]))
         return JS_EXCEPTION;
-    if (JS_ToFloat64(ctx, &d, argv[3]))
+    ctx2d_translate(ctx2d, x, y);
+    return JS_UNDEFINED;
+}
+
+// rotate(angle)
+static JSValue
+js_ctx2d_rotate(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    double angle;
+    if (JS_ToFloat64(ctx, &angle, argv[0]))
         return JS_EXCEPTION;
-    if (JS_ToFloat64(ctx, &e, argv[4]))
+    ctx2d_rotate(ctx2d, angle);
+    return JS_UNDEFINED;
+}
+
+// The six matrix arguments of transform() and setTransform()
+static int
+get_matrix_args(JSContext *ctx, JSValueConst *argv, double m[6])
+{
+    for (int i = 0; i < 6; i++)
+        if (JS_ToFloat64(ctx, &m[i], argv[i]))
+            return -1;
+    return 0;
+}
+
+// transform(a, b, c, d, e, f)
+static JSValue
+js_ctx2d_transform(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    double m[6];
+    if (get_matrix_args(ctx, argv, m) < 0)
         return JS_EXCEPTION;
-    if (JS_ToFloat64(ctx, &f, argv[5]))
+    ctx2d_transform(ctx2d, m[0], m[1], m[2], m[3], m[4], m[5]);
+    return JS_UNDEFINED;
+}
+
+// setTransform(a, b, c, d, e, f)
+static JSValue
+js_ctx2d_setTransform(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    double m[6];
+    if (get_matrix_args(ctx, argv, m) < 0)
         return JS_EXCEPTION;
-    ctx2d_setTransform(ctx2d, a, b, c, d, e, f);
+    ctx2d_setTransform(ctx2d, m[0], m[1], m[2], m[3], m[4], m[5]);
     return JS_UNDEFINED;
 }
 
@@ -351,19 +505,427 @@ js_ctx2d_fillText(JSContext *ctx, JSValueConst this_val, int argc,
     return JS_UNDEFINED;
 }
 
+// createLinearGradient(x0, y0, x1, y1)
+static JSValue
+js_ctx2d_createLinearGradient(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    (void) ctx2d;
+    double v[4];
+    for (int i = 0; i < 4; i++) {
+        if (JS_ToFloat64(ctx, &v[i], argv[i]))
+            return JS_EXCEPTION;
+        if (!isfinite(v[i]))
+            return JS_ThrowTypeError(ctx, "non-finite gradient coordinate");
+    }
+    return js_gradient_wrap(ctx, gradient_new_linear(v[0], v[1], v[2], v[3]));
+}
+
+// createRadialGradient(x0, y0, r0, x1, y1, r1)
+static JSValue
+js_ctx2d_createRadialGradient(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    (void) ctx2d;
+    double v[6];
+    for (int i = 0; i < 6; i++) {
+        if (JS_ToFloat64(ctx, &v[i], argv[i]))
+            return JS_EXCEPTION;
+        if (!isfinite(v[i]))
+            return JS_ThrowTypeError(ctx, "non-finite gradient coordinate");
+    }
+    if (v[2] < 0 || v[5] < 0)
+        return JS_ThrowRangeError(ctx, "negative gradient radius");
+    return js_gradient_wrap(ctx,
+        gradient_new_radial(v[0], v[1], v[2], v[3], v[4], v[5]));
+}
+
+// ImageData is a plain { width, height, data } object; data is a
+// Uint8ClampedArray of straight RGBA
+
+// Largest ImageData in pixels, keeping byte sizes well inside int
+#define IMAGE_DATA_MAX_PIXELS (1 << 28)
+
+static void
+js_image_data_free(JSRuntime *rt, void *opaque, void *ptr)
+{
+    (void) rt;
+    ctx2d_image_data_free(opaque, ptr);
+}
+
+// Takes ownership of buffer (an ArrayBuffer or a byte length)
+static JSValue
+js_image_data_new(JSContext *ctx, JSValue buffer, int w, int h)
+{
+    if (JS_IsException(buffer))
+        return buffer;
+    JSValue data = JS_NewTypedArray(ctx, 1, &buffer, JS_TYPED_ARRAY_UINT8C);
+    JS_FreeValue(ctx, buffer);
+    if (JS_IsException(data))
+        return data;
+    JSValue obj = JS_NewObject(ctx);
+    if (JS_IsException(obj)) {
+        JS_FreeValue(ctx, data);
+        return obj;
+    }
+    JS_SetPropertyStr(ctx, obj, "width", JS_NewInt32(ctx, w));
+    JS_SetPropertyStr(ctx, obj, "height", JS_NewInt32(ctx, h));
+    JS_SetPropertyStr(ctx, obj, "data", data);
+    return obj;
+}
+
+// Width and height arguments; a negative size extends left/up from x/y
+static int
+js_image_data_size(JSContext *ctx, JSValueConst *argv, int *x, int *y, int *w,
+    int *h)
+{
+    double v[2];
+    for (int i = 0; i < 2; i++)
+        if (JS_ToFloat64(ctx, &v[i], argv[i]))
+            return -1;
+    if (!(fabs(v[0]) >= 1 && fabs(v[1]) >= 1)) {
+        JS_ThrowRangeError(ctx, "ImageData size must be non-zero");
+        return -1;
+    }
+    if (fabs(v[0]) * fabs(v[1]) > IMAGE_DATA_MAX_PIXELS) {
+        JS_ThrowRangeError(ctx, "ImageData too large");
+        return -1;
+    }
+    *w = (int) v[0];
+    *h = (int) v[1];
+    // In 64 bits, as x or y near INT_MIN would overflow; clamped, the rect
+    // is still all outside the canvas
+    if (*w < 0) {
+        int64_t x0 = (int64_t) *x + *w;
+        *x = x0 < INT_MIN ? INT_MIN : (int) x0;
+        *w = -*w;
+    }
+    if (*h < 0) {
+        int64_t y0 = (int64_t) *y + *h;
+        *y = y0 < INT_MIN ? INT_MIN : (int) y0;
+        *h = -*h;
+    }
+    return 0;
+}
+
+// getImageData(sx, sy, sw, sh)
+static JSValue
+js_ctx2d_getImageData(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    int x, y, w, h;
+    if (JS_ToInt32(ctx, &x, argv[0]) || JS_ToInt32(ctx, &y, argv[1]) ||
+        js_image_data_size(ctx, argv + 2, &x, &y, &w, &h) < 0)
+        return JS_EXCEPTION;
+
+    // The array is backed by the context's pixel buffers; the free function
+    // hands them back
+    void *owner;
+    unsigned char *rgba = ctx2d_getImageData(ctx2d, x, y, w, h, &owner);
+    if (!rgba)
+        return JS_ThrowOutOfMemory(ctx);
+    JSValue buffer = JS_NewArrayBuffer(ctx, rgba, (size_t) w * h * 4,
+        js_image_data_free, owner, false);
+    if (JS_IsException(buffer)) {
+        ctx2d_image_data_free(owner, rgba);
+        return buffer;
+    }
+    return js_image_data_new(ctx, buffer, w, h);
+}
+
+// createImageData(sw, sh) or createImageData(imagedata)
+static JSValue
+js_ctx2d_createImageData(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    (void) ctx2d;
+    int x = 0, y = 0, w, h;
+    if (argc == 1 && JS_IsObject(argv[0])) {
+        JSValue size[2] = {
+            JS_GetPropertyStr(ctx, argv[0], "width"),
+            JS_GetPropertyStr(ctx, argv[0], "height"),
+        };
+        int rc = js_image_data_size(ctx, size, &x, &y, &w, &h);
+        JS_FreeValue(ctx, size[0]);
+        JS_FreeValue(ctx, size[1]);
+        if (rc < 0)
+            return JS_EXCEPTION;
+    } else if (js_image_data_size(ctx, argv, &x, &y, &w, &h) < 0) {
+        return JS_EXCEPTION;
+    }
+    // Transparent black, allocated by QuickJS
+    return js_image_data_new(ctx, JS_NewInt64(ctx, (int64_t) w * h * 4), w,
+        h);
+}
+
+// putImageData(imagedata, dx, dy)
+static JSValue
+js_ctx2d_putImageData(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) argc;
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    int w, h, dx, dy;
+    JSValue width = JS_GetPropertyStr(ctx, argv[0], "width");
+    JSValue height = JS_GetPropertyStr(ctx, argv[0], "height");
+    int rc = JS_ToInt32(ctx, &w, width) || JS_ToInt32(ctx, &h, height) ||
+        JS_ToInt32(ctx, &dx, argv[1]) || JS_ToInt32(ctx, &dy, argv[2]);
+    JS_FreeValue(ctx, width);
+    JS_FreeValue(ctx, height);
+    if (rc)
+        return JS_EXCEPTION;
+
+    JSValue data = JS_GetPropertyStr(ctx, argv[0], "data");
+    size_t offset, length, bytes_per_element, size;
+    JSValue buffer = JS_GetTypedArrayBuffer(ctx, data, &offset, &length,
+        &bytes_per_element);
+    JS_FreeValue(ctx, data);
+    if (JS_IsException(buffer))
+        return JS_EXCEPTION;
+    uint8_t *bytes = JS_GetArrayBuffer(ctx, &size, buffer);
+    JS_FreeValue(ctx, buffer);
+    if (!bytes || bytes_per_element != 1 || w <= 0 || h <= 0 ||
+        length != (size_t) w * h * 4)
+        return JS_ThrowTypeError(ctx, "not an ImageData");
+    ctx2d_putImageData(ctx2d, bytes + offset, w, h, dx, dy);
+    return JS_UNDEFINED;
+}
+
+// Bytes of a typed array, which must be one of types (ending with -1), or
+// NULL with a TypeError
+static void *
+typed_array_bytes(JSContext *ctx, JSValueConst obj, const int *types,
+    size_t *length, const char *error)
+{
+    int type = JS_GetTypedArrayType(obj);
+    while (*types >= 0 && *types != type)
+        types++;
+    if (type < 0 || *types < 0) {
+        JS_ThrowTypeError(ctx, "%s", error);
+        return NULL;
+    }
+    size_t offset, bytes_per_element, size;
+    JSValue buffer =
+        JS_GetTypedArrayBuffer(ctx, obj, &offset, length, &bytes_per_element);
+    if (JS_IsException(buffer))
+        return NULL;
+    uint8_t *bytes = JS_GetArrayBuffer(ctx, &size, buffer);
+    JS_FreeValue(ctx, buffer);
+    if (!bytes) {
+        JS_ThrowTypeError(ctx, "%s", error);
+        return NULL;
+    }
+    return bytes + offset;
+}
+
+// fillRects(rects, count, stride) and fillRectsColored(rects, colors, count,
+// stride): rects is a Float32Array with x, y, w, h at the start of every
+// stride (default 4) floats, colors RGBA bytes, four a rect, in a Uint8Array,
+// Uint8ClampedArray or a Uint32Array over one. count defaults to every rect
+// rects holds.
+static JSValue
+fill_rects(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv,
+    bool colored)
+{
+    static const int rect_types[] = { JS_TYPED_ARRAY_FLOAT32, -1 };
+    static const int color_types[] = {
+        JS_TYPED_ARRAY_UINT8,
+        JS_TYPED_ARRAY_UINT8C,
+        JS_TYPED_ARRAY_UINT32,
+        -1,
+    };
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    JSValueConst rects_val = argc > 0 ? argv[0] : JS_UNDEFINED;
+    JSValueConst colors_val = JS_UNDEFINED;
+    if (colored) {
+        colors_val = argc > 1 ? argv[1] : JS_UNDEFINED;
+        argc--;
+        argv++;
+    }
+
+    // Numbers first: their valueOf could resize or detach the arrays
+    int64_t count = -1;
+    uint32_t stride = 4;
+    if (argc > 1 && !JS_IsUndefined(argv[1]) &&
+        JS_ToInt64(ctx, &count, argv[1]))
+        return JS_EXCEPTION;
+    if (argc > 2 && !JS_IsUndefined(argv[2]) &&
+        JS_ToUint32(ctx, &stride, argv[2]))
+        return JS_EXCEPTION;
+    if (stride < 4)
+        return JS_ThrowRangeError(ctx, "fillRects: stride must be at least 4");
+
+    size_t rects_size, colors_size = 0;
+    const float *rects = typed_array_bytes(ctx, rects_val, rect_types,
+        &rects_size, "fillRects: rects must be a Float32Array");
+    if (!rects)
+        return JS_EXCEPTION;
+    const uint8_t *colors = NULL;
+    if (colored) {
+        colors = typed_array_bytes(ctx, colors_val, color_types, &colors_size,
+            "fillRectsColored: colors must be a Uint8Array, "
+            "Uint8ClampedArray or Uint32Array");
+        if (!colors)
+            return JS_EXCEPTION;
+    }
+
+    size_t floats = rects_size / sizeof(float);
+    size_t fit = floats >= 4 ? (floats - 4) / stride + 1 : 0;
+    if (colored && colors_size / 4 < fit)
+        fit = colors_size / 4;
+    if (count < 0)
+        count = fit;
+    else if ((uint64_t) count > fit)
+        return JS_ThrowRangeError(ctx,
+            "fillRects: count is more than the arrays hold");
+
+    ctx2d_fillRects(ctx2d, rects, colors, count, stride);
+    return JS_UNDEFINED;
+}
+
+static JSValue
+js_ctx2d_fillRects(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    return fill_rects(ctx, this_val, argc, argv, false);
+}
+
+static JSValue
+js_ctx2d_fillRectsColored(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    return fill_rects(ctx, this_val, argc, argv, true);
+}
+
+// drawImage(image, dx, dy), drawImage(image, dx, dy, dw, dh) or
+// drawImage(image, sx, sy, sw, sh, dx, dy, dw, dh); image is a canvas
+static JSValue
+js_ctx2d_drawImage(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    struct Canvas *image = JS_GetOpaque(argv[0], canvas_class_id);
+    if (!image)
+        return JS_ThrowTypeError(ctx, "drawImage: image is not a canvas");
+    if (argc != 3 && argc != 5 && argc != 9)
+        return JS_ThrowTypeError(ctx, "drawImage: wrong number of arguments");
+
+    double v[8];
+    for (int i = 0; i < argc - 1; i++)
+        if (JS_ToFloat64(ctx, &v[i], argv[i + 1]))
+            return JS_EXCEPTION;
+    double iw = canvas_width_get(image), ih = canvas_height_get(image);
+    if (argc == 3)
+        ctx2d_drawImage(ctx2d, image, 0, 0, iw, ih, v[0], v[1], iw, ih);
+    else if (argc == 5)
+        ctx2d_drawImage(ctx2d, image, 0, 0, iw, ih, v[0], v[1], v[2], v[3]);
+    else
+        ctx2d_drawImage(ctx2d, image, v[0], v[1], v[2], v[3], v[4], v[5],
+            v[6], v[7]);
+    return JS_UNDEFINED;
+}
+
+static JSValue
+js_ctx2d_globalCompositeOperation_get(JSContext *ctx, JSValueConst this_val)
+{
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    return JS_NewString(ctx, ctx2d_globalCompositeOperation_get(ctx2d));
+}
+
+// Unsupported operations are ignored, as in browsers
+static JSValue
+js_ctx2d_globalCompositeOperation_set(JSContext *ctx, JSValueConst this_val,
+    JSValueConst val)
+{
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    const char *str = JS_ToCString(ctx, val);
+    if (!str)
+        return JS_EXCEPTION;
+    ctx2d_globalCompositeOperation_set(ctx2d, str);
+    JS_FreeCString(ctx, str);
+    return JS_UNDEFINED;
+}
+
+static JSValue
+js_ctx2d_antialias_get(JSContext *ctx, JSValueConst this_val)
+{
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    return JS_NewString(ctx, ctx2d_antialias_get(ctx2d));
+}
+
+// Unknown modes are ignored, like unsupported composite operations
+static JSValue
+js_ctx2d_antialias_set(JSContext *ctx, JSValueConst this_val, JSValueConst val)
+{
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    const char *str = JS_ToCString(ctx, val);
+    if (!str)
+        return JS_EXCEPTION;
+    ctx2d_antialias_set(ctx2d, str);
+    JS_FreeCString(ctx, str);
+    return JS_UNDEFINED;
+}
+
+static JSValue
+js_ctx2d_imageSmoothingEnabled_get(JSContext *ctx, JSValueConst this_val)
+{
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    return JS_NewBool(ctx, ctx2d_imageSmoothingEnabled_get(ctx2d));
+}
+
+static JSValue
+js_ctx2d_imageSmoothingEnabled_set(JSContext *ctx, JSValueConst this_val,
+    JSValueConst val)
+{
+    GET_OPAQUE(ctx2d, this_val, struct Context2D, ctx2d_class_id);
+    ctx2d_imageSmoothingEnabled_set(ctx2d, JS_ToBool(ctx, val));
+    return JS_UNDEFINED;
+}
+
 static const JSCFunctionListEntry ctx2d_proto_funcs[] = {
     JS_CGETSET_DEF("fillStyle", js_ctx2d_fillStyle_get, js_ctx2d_fillStyle_set),
     JS_CGETSET_DEF("globalAlpha", js_ctx2d_globalAlpha_get,
         js_ctx2d_globalAlpha_set),
     JS_CGETSET_DEF("lineWidth", js_ctx2d_lineWidth_get, js_ctx2d_lineWidth_set),
+    JS_CGETSET_DEF("globalCompositeOperation",
+        js_ctx2d_globalCompositeOperation_get,
+        js_ctx2d_globalCompositeOperation_set),
+    JS_CGETSET_DEF("imageSmoothingEnabled", js_ctx2d_imageSmoothingEnabled_get,
+        js_ctx2d_imageSmoothingEnabled_set),
+    JS_CGETSET_DEF("antialias", js_ctx2d_antialias_get, js_ctx2d_antialias_set),
     JS_CFUNC_DEF("fillRect", 4, js_ctx2d_fillRect),
+    JS_CFUNC_DEF("fillRects", 3, js_ctx2d_fillRects),
+    JS_CFUNC_DEF("fillRectsColored", 4, js_ctx2d_fillRectsColored),
     JS_CFUNC_DEF("clearRect", 4, js_ctx2d_clearRect),
     JS_CFUNC_DEF("beginPath", 0, js_ctx2d_beginPath),
+    JS_CFUNC_DEF("moveTo", 2, js_ctx2d_moveTo),
+    JS_CFUNC_DEF("lineTo", 2, js_ctx2d_lineTo),
+    JS_CFUNC_DEF("closePath", 0, js_ctx2d_closePath),
     JS_CFUNC_DEF("arc", 5, js_ctx2d_arc),
     JS_CFUNC_DEF("stroke", 0, js_ctx2d_stroke),
+    JS_CFUNC_DEF("fill", 0, js_ctx2d_fill),
     JS_CFUNC_DEF("scale", 2, js_ctx2d_scale),
+    JS_CFUNC_DEF("save", 0, js_ctx2d_save),
+    JS_CFUNC_DEF("restore", 0, js_ctx2d_restore),
+    JS_CFUNC_DEF("translate", 2, js_ctx2d_translate),
+    JS_CFUNC_DEF("rotate", 1, js_ctx2d_rotate),
+    JS_CFUNC_DEF("transform", 6, js_ctx2d_transform),
     JS_CFUNC_DEF("setTransform", 6, js_ctx2d_setTransform),
+    JS_CFUNC_DEF("resetTransform", 0, js_ctx2d_resetTransform),
     JS_CFUNC_DEF("fillText", 3, js_ctx2d_fillText),
+    JS_CFUNC_DEF("drawImage", 3, js_ctx2d_drawImage),
+    JS_CFUNC_DEF("createLinearGradient", 4, js_ctx2d_createLinearGradient),
+    JS_CFUNC_DEF("createRadialGradient", 6, js_ctx2d_createRadialGradient),
+    JS_CFUNC_DEF("getImageData", 4, js_ctx2d_getImageData),
+    JS_CFUNC_DEF("putImageData", 3, js_ctx2d_putImageData),
+    JS_CFUNC_DEF("createImageData", 2, js_ctx2d_createImageData),
 };
 
 // ============================================================================
@@ -383,11 +945,48 @@ static JSClassDef canvas_class = {
     .finalizer = js_canvas_finalizer,
 };
 
-// Canvas properties using macros
-PROP_UINT32(js_canvas_width, struct Canvas, canvas_class_id, canvas_width_get,
-    canvas_width_set)
-PROP_UINT32(js_canvas_height, struct Canvas, canvas_class_id, canvas_height_get,
-    canvas_height_set)
+// Canvas properties using macros; the setters can fail for offscreen
+// canvases, which resize
+PROP_UINT32_GET(js_canvas_width, struct Canvas, canvas_class_id,
+    canvas_width_get)
+PROP_UINT32_GET(js_canvas_height, struct Canvas, canvas_class_id,
+    canvas_height_get)
+
+static JSValue
+throw_canvas_memory(JSContext *ctx)
+{
+    struct SurfacePool *surfaces = JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
+    size_t limit = surfaces ? surface_pool_limit(surfaces) : 0;
+    if (limit)
+        return JS_ThrowRangeError(ctx,
+            "canvas too large, or over the %zu MB canvas memory limit",
+            limit >> 20);
+    return JS_ThrowRangeError(ctx, "canvas too large");
+}
+
+static JSValue
+js_canvas_width_set(JSContext *ctx, JSValueConst this_val, JSValueConst val)
+{
+    GET_OPAQUE(canvas, this_val, struct Canvas, canvas_class_id);
+    uint32_t v;
+    if (JS_ToUint32(ctx, &v, val))
+        return JS_EXCEPTION;
+    if (canvas_width_set(canvas, v) < 0)
+        return throw_canvas_memory(ctx);
+    return JS_UNDEFINED;
+}
+
+static JSValue
+js_canvas_height_set(JSContext *ctx, JSValueConst this_val, JSValueConst val)
+{
+    GET_OPAQUE(canvas, this_val, struct Canvas, canvas_class_id);
+    uint32_t v;
+    if (JS_ToUint32(ctx, &v, val))
+        return JS_EXCEPTION;
+    if (canvas_height_set(canvas, v) < 0)
+        return throw_canvas_memory(ctx);
+    return JS_UNDEFINED;
+}
 
 // getContext is special
 static JSValue
@@ -401,11 +1000,12 @@ js_canvas_getContext(JSContext *ctx, JSValueConst this_val, int argc,
     if (!type)
         return JS_EXCEPTION;
 
+    bool is_2d = strcmp(type, "2d") == 0;
     struct Context2D *ctx2d = canvas_getContext(canvas, type);
     JS_FreeCString(ctx, type);
 
     if (!ctx2d)
-        return JS_NULL;
+        return is_2d ? throw_canvas_memory(ctx) : JS_NULL;
 
     JSValue obj = JS_NewObjectClass(ctx, ctx2d_class_id);
     if (JS_IsException(obj))
@@ -414,6 +1014,12 @@ js_canvas_getContext(JSContext *ctx, JSValueConst this_val, int argc,
     JS_SetOpaque(obj, ctx2d);
     JS_SetPropertyFunctionList(ctx, obj, ctx2d_proto_funcs,
         sizeof(ctx2d_proto_funcs) / sizeof(ctx2d_proto_funcs[0]));
+    // x.canvas, which also keeps an offscreen canvas (and so the context)
+    // alive for as long as JS holds the context. It can be neither deleted
+    // nor replaced: the canvas owns the Context2D, and without this
+    // reference it could be collected while the context still draws.
+    JS_DefinePropertyValueStr(ctx, obj, "canvas", JS_DupValue(ctx, this_val),
+        0);
 
     return obj;
 }
@@ -424,17 +1030,9 @@ static const JSCFunctionListEntry canvas_proto_funcs[] = {
     JS_CFUNC_DEF("getContext", 1, js_canvas_getContext),
 };
 
-// ============================================================================
-// Public API
-// ============================================================================
-
-JSValue
-js_canvas_new(JSContext *ctx, unsigned width, unsigned height)
+static JSValue
+wrap_canvas(JSContext *ctx, struct Canvas *canvas)
 {
-    struct Canvas *canvas = canvas_new(width, height);
-    if (!canvas)
-        return JS_EXCEPTION;
-
     JSValue obj = JS_NewObjectClass(ctx, canvas_class_id);
     if (JS_IsException(obj)) {
         canvas_destroy(canvas);
@@ -448,13 +1046,91 @@ js_canvas_new(JSContext *ctx, unsigned width, unsigned height)
     return obj;
 }
 
+static JSValue
+new_offscreen(JSContext *ctx, uint32_t width, uint32_t height)
+{
+    struct SurfacePool *surfaces = JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
+    struct Canvas *canvas = canvas_new_offscreen(width, height, surfaces);
+    if (!canvas)
+        return throw_canvas_memory(ctx);
+    return wrap_canvas(ctx, canvas);
+}
+
+// document.createElement('canvas'), 300 x 150 like in browsers
+static JSValue
+js_document_createElement(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv)
+{
+    (void) this_val;
+    const char *tag = JS_ToCString(ctx, argc > 0 ? argv[0] : JS_UNDEFINED);
+    if (!tag)
+        return JS_EXCEPTION;
+    bool is_canvas = strcasecmp(tag, "canvas") == 0;
+    JS_FreeCString(ctx, tag);
+    if (!is_canvas)
+        return JS_ThrowTypeError(ctx,
+            "createElement: only canvas elements are supported");
+    return new_offscreen(ctx, 300, 150);
+}
+
+// new OffscreenCanvas(width, height)
+static JSValue
+js_offscreen_canvas(JSContext *ctx, JSValueConst new_target, int argc,
+    JSValueConst *argv)
+{
+    (void) new_target;
+    uint32_t width, height;
+    if (argc < 2)
+        return JS_ThrowTypeError(ctx, "OffscreenCanvas: width and height "
+                                      "are required");
+    if (JS_ToUint32(ctx, &width, argv[0]) || JS_ToUint32(ctx, &height, argv[1]))
+        return JS_EXCEPTION;
+    return new_offscreen(ctx, width, height);
+}
+
+static const JSCFunctionListEntry document_funcs[] = {
+    JS_CFUNC_DEF("createElement", 1, js_document_createElement),
+};
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+JSValue
+js_canvas_new(JSContext *ctx, unsigned width, unsigned height)
+{
+    struct SurfacePool *surfaces = JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
+    struct Canvas *canvas = canvas_new(width, height, surfaces);
+    if (!canvas)
+        return JS_EXCEPTION;
+    return wrap_canvas(ctx, canvas);
+}
+
 void
-js_canvas_init(JSContext *ctx)
+js_canvas_init(JSContext *ctx, struct SurfacePool *surfaces)
 {
+    JS_SetRuntimeOpaque(JS_GetRuntime(ctx), surfaces);
     JS_NewClassID(JS_GetRuntime(ctx), &canvas_class_id);
     JS_NewClassID(JS_GetRuntime(ctx), &ctx2d_class_id);
+    JS_NewClassID(JS_GetRuntime(ctx), &gradient_class_id);
     JS_NewClass(JS_GetRuntime(ctx), canvas_class_id, &canvas_class);
     JS_NewClass(JS_GetRuntime(ctx), ctx2d_class_id, &ctx2d_class);
+    JS_NewClass(JS_GetRuntime(ctx), gradient_class_id, &gradient_class);
+
+    JSValue proto = JS_NewObject(ctx);
+    JS_SetPropertyFunctionList(ctx, proto, gradient_proto_funcs,
+        sizeof(gradient_proto_funcs) / sizeof(gradient_proto_funcs[0]));
+    JS_SetClassProto(ctx, gradient_class_id, proto);
+
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSValue document = JS_NewObject(ctx);
+    JS_SetPropertyFunctionList(ctx, document, document_funcs,
+        sizeof(document_funcs) / sizeof(document_funcs[0]));
+    JS_SetPropertyStr(ctx, global, "document", document);
+    JS_SetPropertyStr(ctx, global, "OffscreenCanvas",
+        JS_NewCFunction2(ctx, js_offscreen_canvas, "OffscreenCanvas", 2,
+            JS_CFUNC_constructor, 0));
+    JS_FreeValue(ctx, global);
 }
 
 struct Context2D *
@@ -466,3 +1142,13 @@ js_canvas_get_context2d(JSContext *ctx, JSValue canvas_val)
         return NULL;
     return canvas_getContext(canvas, "2d");
 }
+
+void
+js_canvas_set_resolution(JSContext *ctx, JSValue canvas_val, unsigned width,
+    unsigned height)
+{
+    (void) ctx;
+    struct Canvas *canvas = JS_GetOpaque(canvas_val, canvas_class_id);
+    if (canvas)
+        canvas_set_resolution(canvas, width, height);
+}
@@ -3,10 +3,17 @@
 #include "quickjs.h"
 
 struct Context2D;
+struct SurfacePool;
 
+// Register the canvas classes, document.createElement('canvas') and
+// OffscreenCanvas. Every canvas of ctx's runtime takes its pixels from
+// surfaces (NULL: malloc), which must outlive the runtime.
 void
-js_canvas_init(JSContext *ctx);
+js_canvas_init(JSContext *ctx, struct SurfacePool *surfaces);
 JSValue
 js_canvas_new(JSContext *ctx, unsigned width, unsigned height);
 struct Context2D *
 js_canvas_get_context2d(JSContext *ctx, JSValue canvas);
+void
+js_canvas_set_resolution(JSContext *ctx, JSValue canvas, unsigned width,
+    unsigned height);
@@ -0,0 +1,155 @@
+#include "perfctr.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const struct {
+    const char *name;
+    uint64_t config;
+} events[PERF_NCOUNTERS] = {
+    [PERF_CYCLES] = { "cycles", PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS] = { "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+    // The generic cache miss event counts last level cache misses
+    [PERF_LLC_MISSES] = { "llc_misses", PERF_COUNT_HW_CACHE_MISSES },
+    [PERF_BRANCH_MISSES] = { "branch_misses", PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+// The counters are one group, so a single read() gets them all, counted
+// over the same stretch of time
+struct PerfCounters {
+    int fds[PERF_NCOUNTERS];
+    int leader;
+    // Counter at each position of a group read
+    enum PerfCounter order[PERF_NCOUNTERS];
+    unsigned n;
+};
+
+// What PERF_FORMAT_GROUP with both times reads
+struct GroupRead {
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[PERF_NCOUNTERS];
+};
+
+static int
+open_event(uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = config,
+        .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING,
+        // The group starts together once it is complete
+        .disabled = group_fd < 0,
+        // User space only, which perf_event_paranoid 2 still allows
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group_fd,
+        PERF_FLAG_FD_CLOEXEC);
+}
+
+static void
+print_unavailable(int err)
+{
+    const char *reason = strerror(err);
+    if (err == EACCES || err == EPERM)
+        reason = "not allowed, see /proc/sys/kernel/perf_event_paranoid";
+    else if (err == ENOENT || err == EOPNOTSUPP || err == ENODEV)
+        reason = "this CPU or virtual machine has none";
+    else if (err == ENOSYS)
+        reason = "the kernel has no perf_event_open";
+    fprintf(stderr, "error: no hardware counters (%s); timings only\n",
+        reason);
+}
+
+struct PerfCounters *
+perf_counters_open(void)
+{
+    struct PerfCounters *pc = malloc(sizeof(*pc));
+    if (!pc)
+        return NULL;
+    pc->leader = -1;
+    pc->n = 0;
+    int err = 0;
+    for (int i = 0; i < PERF_NCOUNTERS; i++) {
+        pc->fds[i] = open_event(events[i].config, pc->leader);
+        if (pc->fds[i] < 0) {
+            err = errno;
+            continue;
+        }
+        if (pc->leader < 0)
+            pc->leader = pc->fds[i];
+        pc->order[pc->n++] = i;
+    }
+    if (pc->leader < 0) {
+        print_unavailable(err);
+        free(pc);
+        return NULL;
+    }
+    ioctl(pc->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return pc;
+}
+
+void
+perf_counters_close(struct PerfCounters *pc)
+{
+    if (!pc)
+        return;
+    for (int i = 0; i < PERF_NCOUNTERS; i++)
+        if (pc->fds[i] >= 0)
+            close(pc->fds[i]);
+    free(pc);
+}
+
+bool
+perf_counters_has(const struct PerfCounters *pc, enum PerfCounter counter)
+{
+    return pc->fds[counter] >= 0;
+}
+
+int
+perf_counters_read(struct PerfCounters *pc, struct PerfSample *sample)
+{
+    struct GroupRead group;
+    ssize_t size = read(pc->leader, &group, sizeof(group));
+    if (size < (ssize_t) (3 * sizeof(uint64_t)) || group.nr != pc->n)
+        return -1;
+
+    memset(sample, 0, sizeof(*sample));
+    sample->time_enabled = group.time_enabled;
+    sample->time_running = group.time_running;
+    for (unsigned i = 0; i < pc->n; i++)
+        sample->values[pc->order[i]] = group.values[i];
+    return 0;
+}
+
+void
+perf_counters_delta(const struct PerfSample *begin,
+    const struct PerfSample *end, double values[PERF_NCOUNTERS])
+{
+    // Extrapolate from the share of this interval the group was counting;
+    // the raw counts and times only ever grow
+    uint64_t enabled = end->time_enabled - begin->time_enabled;
+    uint64_t running = end->time_running - begin->time_running;
+    double scale = 1;
+    if (running > 0 && running < enabled)
+        scale = (double) enabled / running;
+    for (int i = 0; i < PERF_NCOUNTERS; i++)
+        values[i] = (double) (end->values[i] - begin->values[i]) * scale;
+}
+
+const char *
+perf_counter_name(enum PerfCounter counter)
+{
+    return events[counter].name;
+}
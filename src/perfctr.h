@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hardware performance counters of the calling thread, through
+// perf_event_open. Counters the CPU, kernel or perf_event_paranoid don't
+// allow are left out; when none are, there is nothing to open.
+
+enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NCOUNTERS,
+};
+
+struct PerfCounters;
+
+// Raw counts since the counters were opened, with how long the group was
+// enabled and how long it actually counted (the kernel takes turns when
+// there are more events than registers)
+struct PerfSample {
+    uint64_t values[PERF_NCOUNTERS];
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+// NULL if no counter could be opened, after saying why on stderr
+struct PerfCounters *
+perf_counters_open(void);
+void
+perf_counters_close(struct PerfCounters *pc);
+
+bool
+perf_counters_has(const struct PerfCounters *pc, enum PerfCounter counter);
+// 0 for counters that aren't there. Returns -1 if they could not be read.
+int
+perf_counters_read(struct PerfCounters *pc, struct PerfSample *sample);
+// Counts between two samples, scaled up by that interval's own share of
+// time switched out, so the result never goes negative
+void
+perf_counters_delta(const struct PerfSample *begin,
+    const struct PerfSample *end, double values[PERF_NCOUNTERS]);
+
+// Name for reports, e.g. "llc_misses"
+const char *
+perf_counter_name(enum PerfCounter counter);
@@ -0,0 +1,632 @@
+#include "pixfmt.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXFMT_X86 1
+#include <immintrin.h>
+#endif
+
+// Row kernels; every version handles any width (SIMD ones finish the tail
+// with the scalar code)
+struct Kernels {
+    void (*rgba_row)(uint8_t *dst, const uint8_t *src, int width);
+    void (*argb_row)(uint8_t *dst, const uint8_t *src, int width);
+    void (*luma_row)(uint8_t *y, const uint8_t *src, int width);
+    // width source pixels from two rows -> (width + 1) / 2 samples, written
+    // every step bytes
+    void (*chroma_row)(uint8_t *u, uint8_t *v, int step, const uint8_t *src0,
+        const uint8_t *src1, int width);
+    void (*downscale_row)(uint8_t *dst, const uint8_t *src0,
+        const uint8_t *src1, int dst_width);
+};
+
+// ============================================================================
+// Scalar reference
+// ============================================================================
+
+// Bytes of a little-endian ARGB32 pixel
+#define B 0
+#define G 1
+#define R 2
+#define A 3
+
+static inline uint8_t
+unpremultiply(int c, int a)
+{
+    int v = (c * 255 + a / 2) / a;
+    return v > 255 ? 255 : v;
+}
+
+static inline uint8_t
+luma(int r, int g, int b)
+{
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline uint8_t
+chroma_u(int r, int g, int b)
+{
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline uint8_t
+chroma_v(int r, int g, int b)
+{
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static inline uint8_t
+premultiply(int c, int a)
+{
+    int t = c * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+// Both directions work in place (dst == src)
+static void
+rgba_row_scalar(uint8_t *dst, const uint8_t *src, int width)
+{
+    for (int x = 0; x < width; x++, src += 4, dst += 4) {
+        int r = src[R], g = src[G], b = src[B], a = src[A];
+        if (a == 255) {
+            dst[0] = r;
+            dst[1] = g;
+            dst[2] = b;
+        } else if (a == 0) {
+            dst[0] = dst[1] = dst[2] = 0;
+        } else {
+            dst[0] = unpremultiply(r, a);
+            dst[1] = unpremultiply(g, a);
+            dst[2] = unpremultiply(b, a);
+        }
+        dst[3] = a;
+    }
+}
+
+static void
+argb_row_scalar(uint8_t *dst, const uint8_t *src, int width)
+{
+    for (int x = 0; x < width; x++, src += 4, dst += 4) {
+        int r = src[0], g = src[1], b = src[2], a = src[3];
+        dst[R] = premultiply(r, a);
+        dst[G] = premultiply(g, a);
+        dst[B] = premultiply(b, a);
+        dst[A] = a;
+    }
+}
+
+static void
+luma_row_scalar(uint8_t *y, const uint8_t *src, int width)
+{
+    for (int x = 0; x < width; x++, src += 4)
+        y[x] = luma(src[R], src[G], src[B]);
+}
+
+static void
+chroma_row_scalar(uint8_t *u, uint8_t *v, int step, const uint8_t *src0,
+    const uint8_t *src1, int width)
+{
+    for (int x = 0; x < width; x += 2) {
+        // An odd last column pairs with itself
+        int x1 = x + 1 < width ? x + 1 : x;
+        const uint8_t *p00 = src0 + x * 4, *p01 = src0 + x1 * 4;
+        const uint8_t *p10 = src1 + x * 4, *p11 = src1 + x1 * 4;
+        int r = (p00[R] + p01[R] + p10[R] + p11[R] + 2) >> 2;
+        int g = (p00[G] + p01[G] + p10[G] + p11[G] + 2) >> 2;
+        int b = (p00[B] + p01[B] + p10[B] + p11[B] + 2) >> 2;
+        u[(x / 2) * step] = chroma_u(r, g, b);
+        v[(x / 2) * step] = chroma_v(r, g, b);
+    }
+}
+
+static void
+downscale_row_scalar(uint8_t *dst, const uint8_t *src0, const uint8_t *src1,
+    int dst_width)
+{
+    for (int x = 0; x < dst_width; x++, dst += 4, src0 += 8, src1 += 8) {
+        for (int c = 0; c < 4; c++)
+            dst[c] = (src0[c] + src0[c + 4] + src1[c] + src1[c + 4] + 2) >> 2;
+    }
+}
+
+static const struct Kernels scalar_kernels = {
+    .rgba_row = rgba_row_scalar,
+    .argb_row = argb_row_scalar,
+    .luma_row = luma_row_scalar,
+    .chroma_row = chroma_row_scalar,
+    .downscale_row = downscale_row_scalar,
+};
+
+#ifdef PIXFMT_X86
+
+// ============================================================================
+// SSE2
+// ============================================================================
+
+// Division in float is exact here: c * 255 + a / 2 fits in 24 bits and a
+// non-integer quotient is at least 1/a away from the next integer, far more
+// than the rounding error, so truncating matches the integer division.
+static inline __m128i
+unpremultiply4_sse2(__m128i px)
+{
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    __m128i a = _mm_srli_epi32(px, 24);
+    __m128 af = _mm_cvtepi32_ps(a);
+    __m128 half = _mm_cvtepi32_ps(_mm_srli_epi32(a, 1));
+    __m128 c255 = _mm_set1_ps(255.0f);
+
+    __m128 rf = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+    __m128 gf = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+    __m128 bf = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+    __m128i r = _mm_cvttps_epi32(
+        _mm_div_ps(_mm_add_ps(_mm_mul_ps(rf, c255), half), af));
+    __m128i g = _mm_cvttps_epi32(
+        _mm_div_ps(_mm_add_ps(_mm_mul_ps(gf, c255), half), af));
+    __m128i b = _mm_cvttps_epi32(
+        _mm_div_ps(_mm_add_ps(_mm_mul_ps(bf, c255), half), af));
+
+    // Clamp to 255 (only reachable with invalid premultiplied input)
+    __m128i over;
+    over = _mm_cmpgt_epi32(r, mask);
+    r = _mm_or_si128(_mm_andnot_si128(over, r), _mm_and_si128(over, mask));
+    over = _mm_cmpgt_epi32(g, mask);
+    g = _mm_or_si128(_mm_andnot_si128(over, g), _mm_and_si128(over, mask));
+    over = _mm_cmpgt_epi32(b, mask);
+    b = _mm_or_si128(_mm_andnot_si128(over, b), _mm_and_si128(over, mask));
+
+    // RGBA bytes: r | g << 8 | b << 16 | a << 24; zero where alpha is zero
+    __m128i out = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)),
+        _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24)));
+    __m128i transparent = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+    return _mm_andnot_si128(transparent, out);
+}
+
+static inline __m128i
+swap_rb_sse2(__m128i px)
+{
+    const __m128i ga = _mm_set1_epi32((int) 0xFF00FF00);
+    const __m128i lo = _mm_set1_epi32(0xFF);
+    return _mm_or_si128(_mm_and_si128(px, ga),
+        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(px, 16), lo),
+            _mm_slli_epi32(_mm_and_si128(px, lo), 16)));
+}
+
+static void
+rgba_row_sse2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m128i opaque = _mm_set1_epi32((int) 0xFF000000);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i *) (src + x * 4));
+        __m128i out;
+        // Canvases are usually opaque; skip the divisions then
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(px, opaque),
+                opaque)) == 0xFFFF)
+            out = swap_rb_sse2(px);
+        else
+            out = unpremultiply4_sse2(px);
+        _mm_storeu_si128((__m128i *) (dst + x * 4), out);
+    }
+    rgba_row_scalar(dst + x * 4, src + x * 4, width - x);
+}
+
+// Two RGBA pixels widened to 16 bits -> premultiplied, alpha kept
+static inline __m128i
+premultiply2_sse2(__m128i px)
+{
+    const __m128i rgb = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+    const __m128i alpha = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+    __m128i a = _mm_shufflehi_epi16(
+        _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+        _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i t = _mm_mullo_epi16(px,
+        _mm_or_si128(_mm_and_si128(a, rgb), alpha));
+    t = _mm_add_epi16(t, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static void
+argb_row_sse2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m128i opaque = _mm_set1_epi32((int) 0xFF000000);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i *) (src + x * 4));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(px, opaque),
+                opaque)) != 0xFFFF)
+            px = _mm_packus_epi16(premultiply2_sse2(_mm_unpacklo_epi8(px,
+                                      zero)),
+                premultiply2_sse2(_mm_unpackhi_epi8(px, zero)));
+        _mm_storeu_si128((__m128i *) (dst + x * 4), swap_rb_sse2(px));
+    }
+    argb_row_scalar(dst + x * 4, src + x * 4, width - x);
+}
+
+// Weighted sum of B, G, R per pixel for 4 pixels (coefficients as 16-bit
+// B, G, R, 0 repeated twice)
+static inline __m128i
+dot4_sse2(__m128i px, __m128i coef)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef);
+    __m128 lof = _mm_castsi128_ps(lo), hif = _mm_castsi128_ps(hi);
+    __m128i even = _mm_castps_si128(
+        _mm_shuffle_ps(lof, hif, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd = _mm_castps_si128(
+        _mm_shuffle_ps(lof, hif, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm_add_epi32(even, odd);
+}
+
+static void
+luma_row_sse2(uint8_t *y, const uint8_t *src, int width)
+{
+    const __m128i coef = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i offset = _mm_set1_epi16(16);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i *p = (const __m128i *) (src + x * 4);
+        __m128i y0 = dot4_sse2(_mm_loadu_si128(p + 0), coef);
+        __m128i y1 = dot4_sse2(_mm_loadu_si128(p + 1), coef);
+        __m128i y2 = dot4_sse2(_mm_loadu_si128(p + 2), coef);
+        __m128i y3 = dot4_sse2(_mm_loadu_si128(p + 3), coef);
+        y0 = _mm_srai_epi32(_mm_add_epi32(y0, round), 8);
+        y1 = _mm_srai_epi32(_mm_add_epi32(y1, round), 8);
+        y2 = _mm_srai_epi32(_mm_add_epi32(y2, round), 8);
+        y3 = _mm_srai_epi32(_mm_add_epi32(y3, round), 8);
+        __m128i lo = _mm_add_epi16(_mm_packs_epi32(y0, y1), offset);
+        __m128i hi = _mm_add_epi16(_mm_packs_epi32(y2, y3), offset);
+        _mm_storeu_si128((__m128i *) (y + x), _mm_packus_epi16(lo, hi));
+    }
+    luma_row_scalar(y + x, src + x * 4, width - x);
+}
+
+// 2x2 block averages of 4 pixels from each row -> 2 averaged pixels as
+// 16-bit B, G, R, A
+static inline __m128i
+box2x2_sse2(__m128i row0, __m128i row1)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero),
+        _mm_unpacklo_epi8(row1, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero),
+        _mm_unpackhi_epi8(row1, zero));
+    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+        _mm_unpackhi_epi64(lo, hi));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+// U or V for 4 averaged pixels (two box2x2 results)
+static inline __m128i
+chroma4_sse2(__m128i avg0, __m128i avg1, __m128i coef)
+{
+    __m128 m0 = _mm_castsi128_ps(_mm_madd_epi16(avg0, coef));
+    __m128 m1 = _mm_castsi128_ps(_mm_madd_epi16(avg1, coef));
+    __m128i even = _mm_castps_si128(
+        _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd = _mm_castps_si128(
+        _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(3, 1, 3, 1)));
+    __m128i c = _mm_add_epi32(_mm_add_epi32(even, odd), _mm_set1_epi32(128));
+    return _mm_add_epi32(_mm_srai_epi32(c, 8), _mm_set1_epi32(128));
+}
+
+static void
+chroma_row_sse2(uint8_t *u, uint8_t *v, int step, const uint8_t *src0,
+    const uint8_t *src1, int width)
+{
+    const __m128i coef_u = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+    const __m128i coef_v = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m128i *p0 = (const __m128i *) (src0 + x * 4);
+        const __m128i *p1 = (const __m128i *) (src1 + x * 4);
+        __m128i avg0 = box2x2_sse2(_mm_loadu_si128(p0), _mm_loadu_si128(p1));
+        __m128i avg1 = box2x2_sse2(_mm_loadu_si128(p0 + 1),
+            _mm_loadu_si128(p1 + 1));
+        __m128i u4 = chroma4_sse2(avg0, avg1, coef_u);
+        __m128i v4 = chroma4_sse2(avg0, avg1, coef_v);
+        // Values are 0..255, so packing saturates nothing
+        __m128i uv = _mm_packus_epi16(_mm_packs_epi32(u4, v4), u4);
+        int i = x / 2;
+        if (step == 1) {
+            int32_t u32 = _mm_cvtsi128_si32(uv);
+            int32_t v32 = _mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+            memcpy(u + i, &u32, 4);
+            memcpy(v + i, &v32, 4);
+        } else {
+            // NV12: interleave U0 V0 U1 V1 ...
+            __m128i inter = _mm_unpacklo_epi8(uv, _mm_srli_si128(uv, 4));
+            _mm_storel_epi64((__m128i *) (u + i * step), inter);
+        }
+    }
+    int i = x / 2;
+    chroma_row_scalar(u + i * step, v + i * step, step, src0 + x * 4,
+        src1 + x * 4, width - x);
+}
+
+static void
+downscale_row_sse2(uint8_t *dst, const uint8_t *src0, const uint8_t *src1,
+    int dst_width)
+{
+    int x = 0;
+    for (; x + 4 <= dst_width; x += 4) {
+        const __m128i *p0 = (const __m128i *) (src0 + x * 8);
+        const __m128i *p1 = (const __m128i *) (src1 + x * 8);
+        __m128i avg0 = box2x2_sse2(_mm_loadu_si128(p0), _mm_loadu_si128(p1));
+        __m128i avg1 = box2x2_sse2(_mm_loadu_si128(p0 + 1),
+            _mm_loadu_si128(p1 + 1));
+        _mm_storeu_si128((__m128i *) (dst + x * 4),
+            _mm_packus_epi16(avg0, avg1));
+    }
+    downscale_row_scalar(dst + x * 4, src0 + x * 8, src1 + x * 8,
+        dst_width - x);
+}
+
+static const struct Kernels sse2_kernels = {
+    .rgba_row = rgba_row_sse2,
+    .argb_row = argb_row_sse2,
+    .luma_row = luma_row_sse2,
+    .chroma_row = chroma_row_sse2,
+    .downscale_row = downscale_row_sse2,
+};
+
+// ============================================================================
+// AVX2 (the per-pixel kernels; premultiply, chroma and downscale stay on
+// SSE2, where they are bound by loads rather than arithmetic)
+// ============================================================================
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i
+unpremultiply8_avx2(__m256i px)
+{
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    __m256i a = _mm256_srli_epi32(px, 24);
+    __m256 af = _mm256_cvtepi32_ps(a);
+    __m256 half = _mm256_cvtepi32_ps(_mm256_srli_epi32(a, 1));
+    __m256 c255 = _mm256_set1_ps(255.0f);
+
+    __m256 rf = _mm256_cvtepi32_ps(
+        _mm256_and_si256(_mm256_srli_epi32(px, 16), mask));
+    __m256 gf = _mm256_cvtepi32_ps(
+        _mm256_and_si256(_mm256_srli_epi32(px, 8), mask));
+    __m256 bf = _mm256_cvtepi32_ps(_mm256_and_si256(px, mask));
+    __m256i r = _mm256_cvttps_epi32(
+        _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(rf, c255), half), af));
+    __m256i g = _mm256_cvttps_epi32(
+        _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(gf, c255), half), af));
+    __m256i b = _mm256_cvttps_epi32(
+        _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(bf, c255), half), af));
+    r = _mm256_min_epi32(r, mask);
+    g = _mm256_min_epi32(g, mask);
+    b = _mm256_min_epi32(b, mask);
+
+    __m256i out = _mm256_or_si256(
+        _mm256_or_si256(r, _mm256_slli_epi32(g, 8)),
+        _mm256_or_si256(_mm256_slli_epi32(b, 16), _mm256_slli_epi32(a, 24)));
+    __m256i transparent = _mm256_cmpeq_epi32(a, _mm256_setzero_si256());
+    return _mm256_andnot_si256(transparent, out);
+}
+
+AVX2 static void
+rgba_row_avx2(uint8_t *dst, const uint8_t *src, int width)
+{
+    const __m256i opaque = _mm256_set1_epi32((int) 0xFF000000);
+    const __m256i swap = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8,
+        11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12,
+        15);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i px = _mm256_loadu_si256((const __m256i *) (src + x * 4));
+        __m256i out;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(
+                _mm256_and_si256(px, opaque), opaque)) == -1)
+            out = _mm256_shuffle_epi8(px, swap);
+        else
+            out = unpremultiply8_avx2(px);
+        _mm256_storeu_si256((__m256i *) (dst + x * 4), out);
+    }
+    rgba_row_scalar(dst + x * 4, src + x * 4, width - x);
+}
+
+AVX2 static inline __m256i
+dot8_avx2(__m256i px, __m256i coef)
+{
+    // Per 128-bit lane, like dot4_sse2: pixels 0-3 | 4-7
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef);
+    __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef);
+    __m256 lof = _mm256_castsi256_ps(lo), hif = _mm256_castsi256_ps(hi);
+    __m256i even = _mm256_castps_si256(
+        _mm256_shuffle_ps(lof, hif, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m256i odd = _mm256_castps_si256(
+        _mm256_shuffle_ps(lof, hif, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm256_add_epi32(even, odd);
+}
+
+AVX2 static void
+luma_row_avx2(uint8_t *y, const uint8_t *src, int width)
+{
+    const __m256i coef = _mm256_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0, 25,
+        129, 66, 0, 25, 129, 66, 0);
+    const __m256i round = _mm256_set1_epi32(128);
+    const __m256i offset = _mm256_set1_epi16(16);
+    // Packing works within lanes; this puts the 4-pixel groups back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        const __m256i *p = (const __m256i *) (src + x * 4);
+        __m256i y0 = dot8_avx2(_mm256_loadu_si256(p + 0), coef);
+        __m256i y1 = dot8_avx2(_mm256_loadu_si256(p + 1), coef);
+        __m256i y2 = dot8_avx2(_mm256_loadu_si256(p + 2), coef);
+        __m256i y3 = dot8_avx2(_mm256_loadu_si256(p + 3), coef);
+        y0 = _mm256_srai_epi32(_mm256_add_epi32(y0, round), 8);
+        y1 = _mm256_srai_epi32(_mm256_add_epi32(y1, round), 8);
+        y2 = _mm256_srai_epi32(_mm256_add_epi32(y2, round), 8);
+        y3 = _mm256_srai_epi32(_mm256_add_epi32(y3, round), 8);
+        __m256i lo = _mm256_add_epi16(_mm256_packs_epi32(y0, y1), offset);
+        __m256i hi = _mm256_add_epi16(_mm256_packs_epi32(y2, y3), offset);
+        __m256i out = _mm256_permutevar8x32_epi32(
+            _mm256_packus_epi16(lo, hi), order);
+        _mm256_storeu_si256((__m256i *) (y + x), out);
+    }
+    luma_row_sse2(y + x, src + x * 4, width - x);
+}
+
+static const struct Kernels avx2_kernels = {
+    .rgba_row = rgba_row_avx2,
+    .argb_row = argb_row_sse2,
+    .luma_row = luma_row_avx2,
+    .chroma_row = chroma_row_sse2,
+    .downscale_row = downscale_row_sse2,
+};
+
+#endif // PIXFMT_X86
+
+// ============================================================================
+// Dispatch
+// ============================================================================
+
+static const struct Kernels *kernels;
+static enum PixfmtIsa current_isa;
+
+static enum PixfmtIsa
+best_isa(void)
+{
+#ifdef PIXFMT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return PIXFMT_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return PIXFMT_SSE2;
+#endif
+    return PIXFMT_SCALAR;
+}
+
+enum PixfmtIsa
+pixfmt_set_isa(enum PixfmtIsa isa)
+{
+    enum PixfmtIsa best = best_isa();
+    if (isa > best)
+        isa = best;
+
+    switch (isa) {
+#ifdef PIXFMT_X86
+    case PIXFMT_AVX2:
+        kernels = &avx2_kernels;
+        break;
+    case PIXFMT_SSE2:
+        kernels = &sse2_kernels;
+        break;
+#endif
+    default:
+        isa = PIXFMT_SCALAR;
+        kernels = &scalar_kernels;
+        break;
+    }
+    current_isa = isa;
+    return isa;
+}
+
+static const struct Kernels *
+get_kernels(void)
+{
+    if (!kernels)
+        pixfmt_set_isa(PIXFMT_AVX2);
+    return kernels;
+}
+
+enum PixfmtIsa
+pixfmt_get_isa(void)
+{
+    get_kernels();
+    return current_isa;
+}
+
+const char *
+pixfmt_isa_name(enum PixfmtIsa isa)
+{
+    switch (isa) {
+    case PIXFMT_SSE2:
+        return "sse2";
+    case PIXFMT_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+void
+pixfmt_argb_to_rgba(uint8_t *dst, int dst_stride, const uint8_t *src,
+    int src_stride, int width, int height)
+{
+    const struct Kernels *k = get_kernels();
+    for (int y = 0; y < height; y++)
+        k->rgba_row(dst + (size_t) y * dst_stride,
+            src + (size_t) y * src_stride, width);
+}
+
+void
+pixfmt_rgba_to_argb(uint8_t *dst, int dst_stride, const uint8_t *src,
+    int src_stride, int width, int height)
+{
+    const struct Kernels *k = get_kernels();
+    for (int y = 0; y < height; y++)
+        k->argb_row(dst + (size_t) y * dst_stride,
+            src + (size_t) y * src_stride, width);
+}
+
+static void
+argb_to_yuv420(uint8_t *y, int y_stride, uint8_t *u, int u_stride, uint8_t *v,
+    int v_stride, int step, const uint8_t *src, int src_stride, int width,
+    int height)
+{
+    const struct Kernels *k = get_kernels();
+    for (int row = 0; row < height; row++)
+        k->luma_row(y + (size_t) row * y_stride,
+            src + (size_t) row * src_stride, width);
+    for (int row = 0; row < height; row += 2) {
+        const uint8_t *src0 = src + (size_t) row * src_stride;
+        // An odd last row pairs with itself
+        const uint8_t *src1 = row + 1 < height ? src0 + src_stride : src0;
+        k->chroma_row(u + (size_t) (row / 2) * u_stride,
+            v + (size_t) (row / 2) * v_stride, step, src0, src1, width);
+    }
+}
+
+void
+pixfmt_argb_to_i420(uint8_t *y, int y_stride, uint8_t *u, int u_stride,
+    uint8_t *v, int v_stride, const uint8_t *src, int src_stride, int width,
+    int height)
+{
+    argb_to_yuv420(y, y_stride, u, u_stride, v, v_stride, 1, src, src_stride,
+        width, height);
+}
+
+void
+pixfmt_argb_to_nv12(uint8_t *y, int y_stride, uint8_t *uv, int uv_stride,
+    const uint8_t *src, int src_stride, int width, int height)
+{
+    argb_to_yuv420(y, y_stride, uv, uv_stride, uv + 1, uv_stride, 2, src,
+        src_stride, width, height);
+}
+
+void
+pixfmt_downscale_2x(uint8_t *dst, int dst_stride, const uint8_t *src,
+    int src_stride, int width, int height)
+{
+    const struct Kernels *k = get_kernels();
+    for (int y = 0; y < height / 2; y++) {
+        const uint8_t *src0 = src + (size_t) (2 * y) * src_stride;
+        k->downscale_row(dst + (size_t) y * dst_stride, src0,
+            src0 + src_stride, width / 2);
+    }
+}
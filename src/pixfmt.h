@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+// Conversions from the canvas format (premultiplied ARGB32, as returned by
+// ctx2d_get_data) for export paths. Each conversion has a scalar reference
+// and SIMD versions picked at runtime; all versions give identical output.
+
+enum PixfmtIsa {
+    PIXFMT_SCALAR,
+    PIXFMT_SSE2,
+    PIXFMT_AVX2,
+};
+
+// Use at most the given instruction set (e.g. PIXFMT_SCALAR for reference
+// output); returns the one actually selected. The best available is used
+// by default.
+enum PixfmtIsa
+pixfmt_set_isa(enum PixfmtIsa isa);
+enum PixfmtIsa
+pixfmt_get_isa(void);
+const char *
+pixfmt_isa_name(enum PixfmtIsa isa);
+
+// Straight (unpremultiplied) RGBA bytes, e.g. for PNG or ImageData, and
+// back. Both work in place (dst == src with the same stride).
+void
+pixfmt_argb_to_rgba(uint8_t *dst, int dst_stride, const uint8_t *src,
+    int src_stride, int width, int height);
+void
+pixfmt_rgba_to_argb(uint8_t *dst, int dst_stride, const uint8_t *src,
+    int src_stride, int width, int height);
+
+// BT.601 limited-range YUV 4:2:0. Chroma is the 2x2 average; odd edges
+// repeat the last row/column. Premultiplied values are used as-is, which is
+// the image composited over black.
+void
+pixfmt_argb_to_i420(uint8_t *y, int y_stride, uint8_t *u, int u_stride,
+    uint8_t *v, int v_stride, const uint8_t *src, int src_stride, int width,
+    int height);
+void
+pixfmt_argb_to_nv12(uint8_t *y, int y_stride, uint8_t *uv, int uv_stride,
+    const uint8_t *src, int src_stride, int width, int height);
+
+// Half-size premultiplied ARGB by 2x2 box filter (width/2 x height/2,
+// rounding down)
+void
+pixfmt_downscale_2x(uint8_t *dst, int dst_stride, const uint8_t *src,
+    int src_stride, int width, int height);
@@ -0,0 +1,505 @@
+#define _GNU_SOURCE // asprintf
+
+#include "profile.h"
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+struct Stack {
+    char *frames;
+    unsigned long count;
+};
+
+// A sampled source position, with the binding running there if any
+struct Spot {
+    int line, column;
+    const char *binding;
+    unsigned long count;
+};
+
+struct Profile {
+    JSContext *ctx;
+    char *code;
+    int column_offset;
+
+    // Labels of the wrapped bindings, indexed by the wrappers' magic
+    char **labels;
+    unsigned nlabels, labels_cap;
+
+    struct Stack *stacks;
+    unsigned nstacks, stacks_cap;
+    struct Spot *spots;
+    unsigned nspots, spots_cap;
+    unsigned long samples;
+
+    struct sigaction old_action;
+    bool running;
+};
+
+// Shared with the signal handler
+static struct Profile *active;
+static volatile sig_atomic_t in_frame;
+static volatile sig_atomic_t pending;
+static volatile sig_atomic_t outside;
+// Label of the binding running now, and when the last sample came due
+static const char *volatile binding;
+static const char *volatile pending_binding;
+
+static void
+on_sigprof(int sig)
+{
+    (void) sig;
+    if (!in_frame) {
+        outside++;
+        return;
+    }
+    pending_binding = binding;
+    pending++;
+}
+
+static void
+add_stack(struct Profile *profile, const char *frames, unsigned long count)
+{
+    profile->samples += count;
+    for (unsigned i = 0; i < profile->nstacks; i++) {
+        if (strcmp(profile->stacks[i].frames, frames) == 0) {
+            profile->stacks[i].count += count;
+            return;
+        }
+    }
+    if (profile->nstacks == profile->stacks_cap) {
+        unsigned cap = profile->stacks_cap ? profile->stacks_cap * 2 : 64;
+        struct Stack *stacks = realloc(profile->stacks,
+            cap * sizeof(*stacks));
+        if (!stacks)
+            return;
+        profile->stacks = stacks;
+        profile->stacks_cap = cap;
+    }
+    char *copy = strdup(frames);
+    if (!copy)
+        return;
+    profile->stacks[profile->nstacks++] = (struct Stack) { copy, count };
+}
+
+static void
+add_spot(struct Profile *profile, int line, int column, const char *label,
+    unsigned long count)
+{
+    for (unsigned i = 0; i < profile->nspots; i++) {
+        struct Spot *spot = &profile->spots[i];
+        if (spot->line == line && spot->column == column &&
+            spot->binding == label) {
+            spot->count += count;
+            return;
+        }
+    }
+    if (profile->nspots == profile->spots_cap) {
+        unsigned cap = profile->spots_cap ? profile->spots_cap * 2 : 64;
+        struct Spot *spots = realloc(profile->spots, cap * sizeof(*spots));
+        if (!spots)
+            return;
+        profile->spots = spots;
+        profile->spots_cap = cap;
+    }
+    profile->spots[profile->nspots++] = (struct Spot) { line, column, label,
+        count };
+}
+
+// One backtrace line, "    at name (file:line:column)", "    at
+// file:line:column" or "    at name (native)". Returns false for anything
+// else; line is 0 when there is no position.
+static bool
+parse_frame(const char *s, size_t len, char *name, size_t name_size,
+    int *line, int *column)
+{
+    while (len > 0 && *s == ' ') {
+        s++;
+        len--;
+    }
+    if (len < 3 || strncmp(s, "at ", 3) != 0)
+        return false;
+    s += 3;
+    len -= 3;
+
+    const char *loc = s;
+    size_t loc_len = len;
+    name[0] = '\0';
+    const char *paren = memchr(s, '(', len);
+    if (paren && s[len - 1] == ')') {
+        size_t n = paren - s;
+        while (n > 0 && s[n - 1] == ' ')
+            n--;
+        if (n >= name_size)
+            n = name_size - 1;
+        memcpy(name, s, n);
+        name[n] = '\0';
+        loc = paren + 1;
+        loc_len = s + len - 1 - loc;
+    }
+
+    // file:line:column, read from the end since file may contain colons
+    *line = *column = 0;
+    char buf[64];
+    const char *tail = loc_len > sizeof(buf) - 1
+        ? loc + loc_len - (sizeof(buf) - 1)
+        : loc;
+    size_t tail_len = loc + loc_len - tail;
+    memcpy(buf, tail, tail_len);
+    buf[tail_len] = '\0';
+    char *colon = strrchr(buf, ':');
+    if (colon) {
+        *colon = '\0';
+        char *prev = strrchr(buf, ':');
+        if (prev) {
+            *line = atoi(prev + 1);
+            *column = atoi(colon + 1);
+        }
+    }
+    if (!name[0])
+        snprintf(name, name_size, "%s", "<anonymous>");
+    return true;
+}
+
+static void
+take_sample(struct Profile *profile, unsigned long count, const char *label)
+{
+    JSContext *ctx = profile->ctx;
+    JSValue error = JS_NewError(ctx);
+    JSValue stack_val = JS_GetPropertyStr(ctx, error, "stack");
+    const char *stack = JS_ToCString(ctx, stack_val);
+
+    // Backtraces list the innermost frame first; folded stacks want the
+    // root first, so frames are prepended
+    char frames[1024] = "";
+    size_t used = 0;
+    int top_line = 0, top_column = 0;
+    bool top = true;
+    for (const char *s = stack ? stack : ""; *s;) {
+        const char *end = strchr(s, '\n');
+        size_t len = end ? (size_t) (end - s) : strlen(s);
+        char name[64];
+        int line, column;
+        if (parse_frame(s, len, name, sizeof(name), &line, &column)) {
+            if (line == 1)
+                column -= profile->column_offset;
+            if (top && line > 0) {
+                top_line = line;
+                top_column = column;
+                top = false;
+            }
+            char frame[96];
+            int n = line > 0
+                ? snprintf(frame, sizeof(frame), "%s:%d:%d", name, line,
+                      column)
+                : snprintf(frame, sizeof(frame), "%s", name);
+            if (n > 0 && used + n + 1 < sizeof(frames)) {
+                memmove(frames + n + (used ? 1 : 0), frames, used + 1);
+                memcpy(frames, frame, n);
+                if (used)
+                    frames[n] = ';';
+                used += n + (used ? 1 : 0);
+            }
+        }
+        s += len + (end ? 1 : 0);
+    }
+    if (!used)
+        used = snprintf(frames, sizeof(frames), "u");
+    if (label)
+        snprintf(frames + used, sizeof(frames) - used, ";%s", label);
+
+    add_stack(profile, frames, count);
+    if (top_line > 0)
+        add_spot(profile, top_line, top_column, label, count);
+
+    JS_FreeCString(ctx, stack);
+    JS_FreeValue(ctx, stack_val);
+    JS_FreeValue(ctx, error);
+}
+
+static unsigned long
+take_pending(const char **label)
+{
+    sig_atomic_t n = __atomic_exchange_n(&pending, 0, __ATOMIC_ACQ_REL);
+    *label = pending_binding;
+    return n > 0 ? (unsigned long) n : 0;
+}
+
+static int
+interrupt_handler(JSRuntime *rt, void *opaque)
+{
+    (void) rt;
+    if (pending) {
+        const char *label;
+        unsigned long n = take_pending(&label);
+        if (n)
+            take_sample(opaque, n, label);
+    }
+    return 0;
+}
+
+struct Profile *
+profile_new(void)
+{
+    return calloc(1, sizeof(struct Profile));
+}
+
+void
+profile_destroy(struct Profile *profile)
+{
+    if (!profile)
+        return;
+    profile_stop(profile);
+    if (active == profile)
+        active = NULL;
+    for (unsigned i = 0; i < profile->nlabels; i++)
+        free(profile->labels[i]);
+    for (unsigned i = 0; i < profile->nstacks; i++)
+        free(profile->stacks[i].frames);
+    free(profile->labels);
+    free(profile->stacks);
+    free(profile->spots);
+    free(profile->code);
+    free(profile);
+}
+
+void
+profile_attach(struct Profile *profile, JSContext *ctx, const char *code,
+    int column_offset)
+{
+    profile->ctx = ctx;
+    free(profile->code);
+    profile->code = strdup(code);
+    profile->column_offset = column_offset;
+    active = profile;
+    JS_SetInterruptHandler(JS_GetRuntime(ctx), interrupt_handler, profile);
+}
+
+// Calls the wrapped function (func_data[0]) with its label set
+static JSValue
+call_wrapped(JSContext *ctx, JSValueConst this_val, int argc,
+    JSValueConst *argv, int magic, JSValue *func_data)
+{
+    const char *saved = binding;
+    if (active && (unsigned) magic < active->nlabels)
+        binding = active->labels[magic];
+    JSValue ret = JS_Call(ctx, func_data[0], this_val, argc, argv);
+    binding = saved;
+    return ret;
+}
+
+// Wrapper for func labelled label (taken over), or JS_UNDEFINED
+static JSValue
+wrap_function(struct Profile *profile, JSContext *ctx, JSValueConst func,
+    char *label)
+{
+    if (!label)
+        return JS_UNDEFINED;
+    if (profile->nlabels == profile->labels_cap) {
+        unsigned cap = profile->labels_cap ? profile->labels_cap * 2 : 64;
+        char **labels = realloc(profile->labels, cap * sizeof(*labels));
+        if (!labels) {
+            free(label);
+            return JS_UNDEFINED;
+        }
+        profile->labels = labels;
+        profile->labels_cap = cap;
+    }
+    int magic = (int) profile->nlabels;
+    profile->labels[profile->nlabels++] = label;
+    return JS_NewCFunctionData(ctx, call_wrapped, 0, magic, 1, &func);
+}
+
+static void
+wrap_property(struct Profile *profile, JSContext *ctx, JSValueConst obj,
+    JSAtom atom, const char *prefix)
+{
+    JSPropertyDescriptor desc;
+    if (JS_GetOwnProperty(ctx, &desc, obj, atom) <= 0)
+        return;
+    const char *name = JS_AtomToCString(ctx, atom);
+    char *label = NULL;
+
+    if (!name) {
+        // Nothing to label it with
+    } else if (desc.flags & JS_PROP_GETSET) {
+        JSValue getter = JS_UNDEFINED, setter = JS_UNDEFINED;
+        if (JS_IsFunction(ctx, desc.getter) &&
+            asprintf(&label, "%s%s%s", prefix ? prefix : "",
+                prefix ? "." : "", name) >= 0)
+            getter = wrap_function(profile, ctx, desc.getter, label);
+        if (JS_IsFunction(ctx, desc.setter) &&
+            asprintf(&label, "%s%s%s=", prefix ? prefix : "",
+                prefix ? "." : "", name) >= 0)
+            setter = wrap_function(profile, ctx, desc.setter, label);
+        JS_DefineProperty(ctx, obj, atom, JS_UNDEFINED,
+            JS_IsUndefined(getter) ? desc.getter : getter,
+            JS_IsUndefined(setter) ? desc.setter : setter,
+            desc.flags | JS_PROP_HAS_GET | JS_PROP_HAS_SET);
+        JS_FreeValue(ctx, getter);
+        JS_FreeValue(ctx, setter);
+    } else if (JS_IsFunction(ctx, desc.value) &&
+        asprintf(&label, "%s%s%s", prefix ? prefix : "", prefix ? "." : "",
+            name) >= 0) {
+        JSValue wrapper = wrap_function(profile, ctx, desc.value, label);
+        if (!JS_IsUndefined(wrapper))
+            JS_DefinePropertyValue(ctx, obj, atom, wrapper,
+                desc.flags & JS_PROP_C_W_E);
+    }
+
+    JS_FreeCString(ctx, name);
+    JS_FreeValue(ctx, desc.value);
+    JS_FreeValue(ctx, desc.getter);
+    JS_FreeValue(ctx, desc.setter);
+}
+
+int
+profile_wrap(struct Profile *profile, JSContext *ctx, JSValueConst obj,
+    const char *prefix, const char *const *names)
+{
+    if (names) {
+        for (; *names; names++) {
+            JSAtom atom = JS_NewAtom(ctx, *names);
+            wrap_property(profile, ctx, obj, atom, prefix);
+            JS_FreeAtom(ctx, atom);
+        }
+        return 0;
+    }
+
+    JSPropertyEnum *props;
+    uint32_t nprops;
+    if (JS_GetOwnPropertyNames(ctx, &props, &nprops, obj,
+            JS_GPN_STRING_MASK) < 0)
+        return -1;
+    for (uint32_t i = 0; i < nprops; i++)
+        wrap_property(profile, ctx, obj, props[i].atom, prefix);
+    JS_FreePropertyEnum(ctx, props, nprops);
+    return 0;
+}
+
+int
+profile_start(struct Profile *profile, unsigned hz)
+{
+    if (profile->running || hz == 0)
+        return -1;
+    struct sigaction action = { .sa_handler = on_sigprof,
+        .sa_flags = SA_RESTART };
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &profile->old_action) < 0)
+        return -1;
+
+    long usec = 1000000 / hz;
+    struct itimerval timer = {
+        .it_interval = { usec / 1000000, usec % 1000000 },
+        .it_value = { usec / 1000000, usec % 1000000 },
+    };
+    if (setitimer(ITIMER_PROF, &timer, NULL) < 0) {
+        sigaction(SIGPROF, &profile->old_action, NULL);
+        return -1;
+    }
+    profile->running = true;
+    return 0;
+}
+
+void
+profile_stop(struct Profile *profile)
+{
+    if (!profile->running)
+        return;
+    struct itimerval timer = { 0 };
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &profile->old_action, NULL);
+    profile->running = false;
+}
+
+void
+profile_frame_begin(struct Profile *profile)
+{
+    (void) profile;
+    in_frame = 1;
+}
+
+void
+profile_frame_end(struct Profile *profile)
+{
+    in_frame = 0;
+    // Due too late for the interrupt handler, so no position
+    const char *label;
+    unsigned long n = take_pending(&label);
+    if (!n)
+        return;
+    char frames[96];
+    snprintf(frames, sizeof(frames), "u%s%s", label ? ";" : "",
+        label ? label : "");
+    add_stack(profile, frames, n);
+}
+
+int
+profile_write_folded(struct Profile *profile, FILE *f)
+{
+    for (unsigned i = 0; i < profile->nstacks; i++)
+        fprintf(f, "%s %lu\n", profile->stacks[i].frames,
+            profile->stacks[i].count);
+    if (outside)
+        fprintf(f, "(outside u) %lu\n", (unsigned long) outside);
+    return ferror(f) ? -1 : 0;
+}
+
+static int
+compare_spots(const void *a, const void *b)
+{
+    const struct Spot *x = a, *y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+// Source line number line (from 1), its length in *len
+static const char *
+find_line(const char *code, int line, size_t *len)
+{
+    for (int i = 1; i < line && code; i++) {
+        code = strchr(code, '\n');
+        if (code)
+            code++;
+    }
+    if (!code)
+        return NULL;
+    *len = strcspn(code, "\n");
+    return code;
+}
+
+void
+profile_print_hotspots(struct Profile *profile, FILE *f, unsigned n)
+{
+    unsigned long total = profile->samples + (unsigned long) outside;
+    fprintf(f, "profile: %lu samples, %lu in u(t)\n", total,
+        profile->samples);
+    if (!profile->samples)
+        return;
+    qsort(profile->spots, profile->nspots, sizeof(*profile->spots),
+        compare_spots);
+
+    // Enough source either side of the column to recognize the spot in a
+    // minified one-liner
+    enum { CONTEXT = 30 };
+    for (unsigned i = 0; i < profile->nspots && i < n; i++) {
+        const struct Spot *spot = &profile->spots[i];
+        fprintf(f, "%5.1f%%  %d:%d%s%s\n", 100.0 * spot->count / total,
+            spot->line, spot->column, spot->binding ? "  " : "",
+            spot->binding ? spot->binding : "");
+
+        size_t len;
+        const char *text = profile->code
+            ? find_line(profile->code, spot->line, &len)
+            : NULL;
+        if (!text || spot->column < 1 || (size_t) spot->column > len + 1)
+            continue;
+        size_t at = spot->column - 1;
+        size_t from = at > CONTEXT ? at - CONTEXT : 0;
+        size_t to = at + CONTEXT < len ? at + CONTEXT : len;
+        fprintf(f, "        %.*s\n        %*s^\n", (int) (to - from),
+            text + from, (int) (at - from), "");
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "quickjs.h"
+
+#include <stdio.h>
+
+// Sampling profiler for dweet JavaScript. A SIGPROF timer marks a sample as
+// due and the QuickJS interrupt handler takes it at the next safe point,
+// from the backtrace of the running code (line and column of each frame).
+// Native bindings wrapped by profile_wrap() record their name while they
+// run, so a sample that lands in one gets it as the leaf frame.
+//
+// One profile runs at a time, sampling the thread that runs the dweet.
+
+struct Profile;
+
+struct Profile *
+profile_new(void);
+void
+profile_destroy(struct Profile *profile);
+
+// Sample the code running in ctx. code is the dweet source, compiled with
+// column_offset characters of wrapper in front of its first line.
+void
+profile_attach(struct Profile *profile, JSContext *ctx, const char *code,
+    int column_offset);
+// Attribute time in the functions, getters and setters of obj to
+// "prefix.name" (just "name" for a NULL prefix). With names, only those
+// properties are wrapped; names ends with NULL.
+int
+profile_wrap(struct Profile *profile, JSContext *ctx, JSValueConst obj,
+    const char *prefix, const char *const *names);
+
+// Sample hz times per second of process CPU time
+int
+profile_start(struct Profile *profile, unsigned hz);
+void
+profile_stop(struct Profile *profile);
+// Bracket each u(t) call; samples outside it count as "(outside u)"
+void
+profile_frame_begin(struct Profile *profile);
+void
+profile_frame_end(struct Profile *profile);
+
+// Folded stacks, one "frame;frame;... count" line per stack, for
+// flamegraph.pl, inferno or speedscope. JS frames read "u:1:42".
+int
+profile_write_folded(struct Profile *profile, FILE *f);
+// The n source positions with the most samples on top of the JS stack,
+// each with the surrounding source and a caret under the column
+void
+profile_print_hotspots(struct Profile *profile, FILE *f, unsigned n);
@@ -0,0 +1,267 @@
+#include "record.h"
+
+#include "canvas.h"
+#include "gradient.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct Recording {
+    struct RecordCmd *cmds;
+    size_t ncmds, cmds_cap;
+    // Text and rect arrays, each starting 8-byte aligned
+    unsigned char *bytes;
+    size_t nbytes, bytes_cap;
+    const char *unplayable;
+    unsigned long resets;
+};
+
+struct Recording *
+recording_new(void)
+{
+    return calloc(1, sizeof(struct Recording));
+}
+
+void
+recording_destroy(struct Recording *rec)
+{
+    if (!rec)
+        return;
+    recording_clear(rec);
+    free(rec->cmds);
+    free(rec->bytes);
+    free(rec);
+}
+
+void
+recording_clear(struct Recording *rec)
+{
+    for (size_t i = 0; i < rec->ncmds; i++)
+        if (rec->cmds[i].op == REC_FILL_GRADIENT)
+            gradient_unref((struct Gradient *) rec->cmds[i].ptr);
+    rec->ncmds = 0;
+    rec->nbytes = 0;
+    rec->unplayable = NULL;
+}
+
+void
+recording_reset(struct Recording *rec)
+{
+    recording_clear(rec);
+    rec->resets++;
+}
+
+unsigned long
+recording_resets(const struct Recording *rec)
+{
+    return rec->resets;
+}
+
+void
+recording_fail(struct Recording *rec, const char *call)
+{
+    if (!rec->unplayable)
+        rec->unplayable = call;
+}
+
+static struct RecordCmd *
+cmd_add(struct Recording *rec)
+{
+    if (rec->unplayable)
+        return NULL;
+    if (rec->ncmds == rec->cmds_cap) {
+        size_t cap = rec->cmds_cap ? rec->cmds_cap * 2 : 256;
+        struct RecordCmd *cmds = realloc(rec->cmds, cap * sizeof(*cmds));
+        if (!cmds) {
+            recording_fail(rec, "out of memory");
+            return NULL;
+        }
+        rec->cmds = cmds;
+        rec->cmds_cap = cap;
+    }
+    return &rec->cmds[rec->ncmds++];
+}
+
+// Room for size bytes; returns their offset, or -1 (and fails the
+// recording) when out of memory
+static ptrdiff_t
+bytes_add(struct Recording *rec, size_t size)
+{
+    size_t offset = (rec->nbytes + 7) & ~(size_t) 7;
+    if (offset + size > rec->bytes_cap) {
+        size_t cap = rec->bytes_cap ? rec->bytes_cap : 4096;
+        while (cap < offset + size)
+            cap *= 2;
+        unsigned char *bytes = realloc(rec->bytes, cap);
+        if (!bytes) {
+            recording_fail(rec, "out of memory");
+            return -1;
+        }
+        rec->bytes = bytes;
+        rec->bytes_cap = cap;
+    }
+    rec->nbytes = offset + size;
+    return (ptrdiff_t) offset;
+}
+
+void
+recording_add(struct Recording *rec, const struct RecordCmd *cmd)
+{
+    struct RecordCmd *slot = cmd_add(rec);
+    if (!slot)
+        return;
+    *slot = *cmd;
+    if (cmd->op == REC_FILL_GRADIENT)
+        gradient_ref((struct Gradient *) cmd->ptr);
+}
+
+void
+recording_add_text(struct Recording *rec, const char *text, double x,
+    double y)
+{
+    size_t size = strlen(text) + 1;
+    ptrdiff_t offset = rec->unplayable ? -1 : bytes_add(rec, size);
+    if (offset < 0)
+        return;
+    memcpy(rec->bytes + offset, text, size);
+    struct RecordCmd *cmd = cmd_add(rec);
+    if (cmd)
+        *cmd = (struct RecordCmd) {REC_FILL_TEXT, {x, y}, .data = offset};
+}
+
+void
+recording_add_rects(struct Recording *rec, const float *rects,
+    const uint8_t *colors, size_t count, size_t stride)
+{
+    size_t rects_size = count * 4 * sizeof(float);
+    size_t size = rects_size + (colors ? count * 4 : 0);
+    ptrdiff_t offset = rec->unplayable ? -1 : bytes_add(rec, size);
+    if (offset < 0)
+        return;
+    float *dst = (float *) (rec->bytes + offset);
+    for (size_t i = 0; i < count; i++)
+        memcpy(dst + i * 4, rects + i * stride, 4 * sizeof(float));
+    if (colors)
+        memcpy(rec->bytes + offset + rects_size, colors, count * 4);
+    struct RecordCmd *cmd = cmd_add(rec);
+    if (cmd)
+        *cmd = (struct RecordCmd) {
+            REC_FILL_RECTS, {(double) count, colors != NULL}, .data = offset};
+}
+
+const char *
+recording_unplayable(const struct Recording *rec)
+{
+    return rec->unplayable;
+}
+
+size_t
+recording_length(const struct Recording *rec)
+{
+    return rec->ncmds;
+}
+
+size_t
+recording_memory(const struct Recording *rec)
+{
+    return rec->cmds_cap * sizeof(*rec->cmds) + rec->bytes_cap;
+}
+
+static void
+play(const struct Recording *rec, const struct RecordCmd *cmd,
+    struct Context2D *ctx2d)
+{
+    const double *v = cmd->v;
+    switch (cmd->op) {
+    case REC_FILL_STYLE:
+        ctx2d_fillStyle_set(ctx2d, (uint32_t) v[0]);
+        break;
+    case REC_FILL_GRADIENT:
+        ctx2d_fillStyle_set_gradient(ctx2d, (struct Gradient *) cmd->ptr);
+        break;
+    case REC_GLOBAL_ALPHA:
+        ctx2d_globalAlpha_set(ctx2d, v[0]);
+        break;
+    case REC_LINE_WIDTH:
+        ctx2d_lineWidth_set(ctx2d, v[0]);
+        break;
+    case REC_IMAGE_SMOOTHING:
+        ctx2d_imageSmoothingEnabled_set(ctx2d, v[0] != 0);
+        break;
+    case REC_ANTIALIAS:
+        ctx2d_antialias_set(ctx2d, antialias_name((enum Antialias) v[0]));
+        break;
+    case REC_COMPOSITE:
+        ctx2d_globalCompositeOperation_set(ctx2d, cmd->ptr);
+        break;
+    case REC_FILL_RECT:
+        ctx2d_fillRect(ctx2d, v[0], v[1], v[2], v[3]);
+        break;
+    case REC_FILL_RECTS: {
+        size_t count = (size_t) v[0];
+        const unsigned char *data = rec->bytes + cmd->data;
+        ctx2d_fillRects(ctx2d, (const float *) data,
+            v[1] != 0 ? data + count * 4 * sizeof(float) : NULL, count, 4);
+        break;
+    }
+    case REC_CLEAR_RECT:
+        ctx2d_clearRect(ctx2d, v[0], v[1], v[2], v[3]);
+        break;
+    case REC_BEGIN_PATH:
+        ctx2d_beginPath(ctx2d);
+        break;
+    case REC_MOVE_TO:
+        ctx2d_moveTo(ctx2d, v[0], v[1]);
+        break;
+    case REC_LINE_TO:
+        ctx2d_lineTo(ctx2d, v[0], v[1]);
+        break;
+    case REC_CLOSE_PATH:
+        ctx2d_closePath(ctx2d);
+        break;
+    case REC_ARC:
+        ctx2d_arc(ctx2d, v[0], v[1], v[2], v[3], v[4], v[5] != 0);
+        break;
+    case REC_STROKE:
+        ctx2d_stroke(ctx2d);
+        break;
+    case REC_FILL:
+        ctx2d_fill(ctx2d);
+        break;
+    case REC_SAVE:
+        ctx2d_save(ctx2d);
+        break;
+    case REC_RESTORE:
+        ctx2d_restore(ctx2d);
+        break;
+    case REC_SCALE:
+        ctx2d_scale(ctx2d, v[0], v[1]);
+        break;
+    case REC_TRANSLATE:
+        ctx2d_translate(ctx2d, v[0], v[1]);
+        break;
+    case REC_ROTATE:
+        ctx2d_rotate(ctx2d, v[0]);
+        break;
+    case REC_TRANSFORM:
+        ctx2d_transform(ctx2d, v[0], v[1], v[2], v[3], v[4], v[5]);
+        break;
+    case REC_SET_TRANSFORM:
+        ctx2d_setTransform(ctx2d, v[0], v[1], v[2], v[3], v[4], v[5]);
+        break;
+    case REC_RESET_TRANSFORM:
+        ctx2d_resetTransform(ctx2d);
+        break;
+    case REC_FILL_TEXT:
+        ctx2d_fillText(ctx2d, (const char *) rec->bytes + cmd->data, v[0],
+            v[1]);
+        break;
+    }
+}
+
+void
+recording_play(const struct Recording *rec, struct Context2D *ctx2d)
+{
+    for (size_t i = 0; i < rec->ncmds; i++)
+        play(rec, &rec->cmds[i], ctx2d);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The drawing calls made on a context since it was last reset, kept so they
+// can be played back into other contexts: the offline export renders a
+// frame once without pixels and then replays it band by band into a small
+// surface (see ctx2d_set_recording and canvas_set_band).
+//
+// Calls that read pixels back (getImageData, drawImage of a canvas) can't
+// be recorded; the recording remembers the first one and stays unplayable
+// until it is cleared. Gradients are kept by reference, so color stops added
+// after one was set as the fill style show up in earlier fills on playback.
+
+struct Context2D;
+struct Gradient;
+struct Recording;
+
+enum RecordOp {
+    REC_FILL_STYLE,
+    REC_FILL_GRADIENT,
+    REC_GLOBAL_ALPHA,
+    REC_LINE_WIDTH,
+    REC_IMAGE_SMOOTHING,
+    REC_ANTIALIAS,
+    REC_COMPOSITE,
+    REC_FILL_RECT,
+    REC_FILL_RECTS,
+    REC_CLEAR_RECT,
+    REC_BEGIN_PATH,
+    REC_MOVE_TO,
+    REC_LINE_TO,
+    REC_CLOSE_PATH,
+    REC_ARC,
+    REC_STROKE,
+    REC_FILL,
+    REC_SAVE,
+    REC_RESTORE,
+    REC_SCALE,
+    REC_TRANSLATE,
+    REC_ROTATE,
+    REC_TRANSFORM,
+    REC_SET_TRANSFORM,
+    REC_RESET_TRANSFORM,
+    REC_FILL_TEXT,
+};
+
+struct RecordCmd {
+    enum RecordOp op;
+    // Arguments in call order
+    double v[6];
+    // The gradient (REC_FILL_GRADIENT, which the recording references) or
+    // a name with static storage (REC_COMPOSITE)
+    const void *ptr;
+    // Where the text or rects (then colors) start in the recording's bytes
+    size_t data;
+};
+
+struct Recording *
+recording_new(void);
+void
+recording_destroy(struct Recording *rec);
+
+// Drop every call and any unplayable one, e.g. once they have been played
+void
+recording_clear(struct Recording *rec);
+// The context was reset: clear and count it
+void
+recording_reset(struct Recording *rec);
+// Resets so far, to tell whether a frame started from a blank canvas
+unsigned long
+recording_resets(const struct Recording *rec);
+
+// Out of memory marks the recording unplayable
+void
+recording_add(struct Recording *rec, const struct RecordCmd *cmd);
+void
+recording_add_text(struct Recording *rec, const char *text, double x,
+    double y);
+// Rects are copied four floats each, whatever their stride
+void
+recording_add_rects(struct Recording *rec, const float *rects,
+    const uint8_t *colors, size_t count, size_t stride);
+// call (a string with static storage) can't be played back
+void
+recording_fail(struct Recording *rec, const char *call);
+
+// NULL if the recording can be played, else the first call that can't be
+const char *
+recording_unplayable(const struct Recording *rec);
+size_t
+recording_length(const struct Recording *rec);
+// Bytes held, for reports
+size_t
+recording_memory(const struct Recording *rec);
+
+// Make the calls on ctx2d, which should start where the recorded context
+// did after its last reset (or when it was made)
+void
+recording_play(const struct Recording *rec, struct Context2D *ctx2d);
@@ -0,0 +1,219 @@
+#include "ring.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_ALIGN(x) (((x) + 4095) & ~(uint64_t) 4095)
+
+struct Ring {
+    char *name;
+    bool producer;
+    struct RingHeader *header;
+    unsigned char *base;
+    uint64_t size;
+    uint64_t next; // producer: frame being written
+};
+
+static uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static struct Ring *
+ring_map(const char *name, int fd, uint64_t size, bool producer)
+{
+    void *base = mmap(NULL, size, PROT_READ | (producer ? PROT_WRITE : 0),
+        MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    struct Ring *ring = malloc(sizeof(*ring));
+    if (!ring) {
+        munmap(base, size);
+        return NULL;
+    }
+    *ring = (struct Ring) {
+        .name = strdup(name),
+        .producer = producer,
+        .header = base,
+        .base = base,
+        .size = size,
+    };
+    return ring;
+}
+
+struct Ring *
+ring_create(const char *name, unsigned width, unsigned height, unsigned nslots)
+{
+    if (nslots < 2)
+        return NULL;
+
+    uint32_t stride = width * 4;
+    uint64_t header_size = PAGE_ALIGN(sizeof(struct RingHeader) +
+        nslots * sizeof(struct RingSlot));
+    uint64_t slot_size = PAGE_ALIGN((uint64_t) stride * height);
+    uint64_t size = header_size + slot_size * nslots;
+
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+    if (ftruncate(fd, size) < 0) {
+        perror(name);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    struct Ring *ring = ring_map(name, fd, size, true);
+    close(fd);
+    if (!ring) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    struct RingHeader *h = ring->header;
+    h->width = width;
+    h->height = height;
+    h->stride = stride;
+    h->nslots = nslots;
+    h->size = size;
+    atomic_init(&h->head, 0);
+    atomic_init(&h->closed, 0);
+    for (unsigned i = 0; i < nslots; i++) {
+        atomic_init(&h->slots[i].seq, 0);
+        h->slots[i].offset = header_size + slot_size * i;
+    }
+    h->version = RING_VERSION;
+    // Written last so a consumer never sees a half-initialized header
+    atomic_thread_fence(memory_order_release);
+    h->magic = RING_MAGIC;
+
+    ring->next = 1;
+    return ring;
+}
+
+unsigned char *
+ring_begin(struct Ring *ring, int *stride)
+{
+    struct RingHeader *h = ring->header;
+    struct RingSlot *slot = &h->slots[ring->next % h->nslots];
+    atomic_store_explicit(&slot->seq, 2 * ring->next - 1,
+        memory_order_relaxed);
+    // Keeps the pixel writes after the odd sequence: a consumer whose
+    // acquire fence sees any of them sees the slot as being written
+    atomic_thread_fence(memory_order_release);
+    *stride = h->stride;
+    return ring->base + slot->offset;
+}
+
+void
+ring_publish(struct Ring *ring, double t)
+{
+    struct RingHeader *h = ring->header;
+    struct RingSlot *slot = &h->slots[ring->next % h->nslots];
+    slot->t = t;
+    slot->timestamp_ns = monotonic_ns();
+    atomic_store_explicit(&slot->seq, 2 * ring->next, memory_order_release);
+    atomic_store_explicit(&h->head, ring->next, memory_order_release);
+    ring->next++;
+}
+
+struct Ring *
+ring_open(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct RingHeader)) {
+        fprintf(stderr, "%s: not a frame ring\n", name);
+        close(fd);
+        return NULL;
+    }
+    struct Ring *ring = ring_map(name, fd, st.st_size, false);
+    close(fd);
+    if (!ring)
+        return NULL;
+
+    struct RingHeader *h = ring->header;
+    if (h->magic != RING_MAGIC || h->version != RING_VERSION ||
+        h->size != (uint64_t) st.st_size) {
+        fprintf(stderr, "%s: not a compatible frame ring\n", name);
+        ring_destroy(ring);
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return ring;
+}
+
+uint64_t
+ring_head(struct Ring *ring)
+{
+    return atomic_load_explicit(&ring->header->head, memory_order_acquire);
+}
+
+bool
+ring_acquire(struct Ring *ring, uint64_t seq, struct RingFrame *frame)
+{
+    struct RingHeader *h = ring->header;
+    struct RingSlot *slot = &h->slots[seq % h->nslots];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != 2 * seq)
+        return false;
+
+    *frame = (struct RingFrame) {
+        .seq = seq,
+        .pixels = ring->base + slot->offset,
+        .t = slot->t,
+        .timestamp_ns = slot->timestamp_ns,
+    };
+    return ring_validate(ring, frame);
+}
+
+bool
+ring_validate(struct Ring *ring, const struct RingFrame *frame)
+{
+    struct RingHeader *h = ring->header;
+    struct RingSlot *slot = &h->slots[frame->seq % h->nslots];
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) ==
+        2 * frame->seq;
+}
+
+bool
+ring_closed(struct Ring *ring)
+{
+    return atomic_load(&ring->header->closed) != 0;
+}
+
+const struct RingHeader *
+ring_header(struct Ring *ring)
+{
+    return ring->header;
+}
+
+void
+ring_destroy(struct Ring *ring)
+{
+    if (!ring)
+        return;
+    if (ring->producer) {
+        atomic_store(&ring->header->closed, 1);
+        shm_unlink(ring->name);
+    }
+    munmap(ring->base, ring->size);
+    free(ring->name);
+    free(ring);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// A POSIX shared-memory ring of frames for external consumers (encoders,
+// streaming sidecars). One producer writes frames in place; any number of
+// consumers read them in place without taking locks.
+//
+// Frames are numbered from 1. Frame n lives in slot n % nslots. Each slot has
+// a sequence word: 2n - 1 while frame n is being written and 2n once it is
+// published, after which the header's head is set to n. A consumer reads
+// head, checks that the slot's sequence is 2n, uses the pixels and then checks
+// the sequence again; if it changed, the producer lapped the consumer and the
+// frame must be discarded.
+
+#define RING_MAGIC   0x47525744u // "DWRG"
+#define RING_VERSION 1
+
+struct RingSlot {
+    _Atomic uint64_t seq;
+    double t;              // dweet time the frame was rendered for
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC when published
+    uint64_t offset;       // of the pixels from the start of the mapping
+};
+
+struct RingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride; // premultiplied ARGB, as produced by ctx2d_get_data
+    uint32_t nslots;
+    uint64_t size;   // of the whole mapping
+    _Atomic uint64_t head;
+    _Atomic uint32_t closed;
+    struct RingSlot slots[];
+};
+
+struct Ring;
+
+struct RingFrame {
+    uint64_t seq;
+    const unsigned char *pixels;
+    double t;
+    uint64_t timestamp_ns;
+};
+
+// Producer
+struct Ring *
+ring_create(const char *name, unsigned width, unsigned height,
+    unsigned nslots);
+// Start the next frame; returns its slot's pixels to render into
+unsigned char *
+ring_begin(struct Ring *ring, int *stride);
+void
+ring_publish(struct Ring *ring, double t);
+
+// Consumer
+struct Ring *
+ring_open(const char *name);
+// Newest published frame number, 0 if none yet
+uint64_t
+ring_head(struct Ring *ring);
+// Look up published frame seq; false if it has already been overwritten
+bool
+ring_acquire(struct Ring *ring, uint64_t seq, struct RingFrame *frame);
+// After using a frame's pixels: false if they were overwritten meanwhile
+bool
+ring_validate(struct Ring *ring, const struct RingFrame *frame);
+bool
+ring_closed(struct Ring *ring);
+const struct RingHeader *
+ring_header(struct Ring *ring);
+
+// Producer: marks the ring closed and unlinks it. Consumer: unmaps.
+void
+ring_destroy(struct Ring *ring);
@@ -0,0 +1,255 @@
+#include "scanfill.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ScanEdge {
+    // Top to bottom; dir is +1 if the edge was drawn downwards
+    float x0, y0, x1, y1;
+    float dxdy;
+    int dir;
+};
+
+struct Crossing {
+    float x;
+    int dir;
+};
+
+struct Scanfill {
+    struct ScanEdge *edges;
+    unsigned nedges, edges_cap;
+    float ymin, ymax;
+
+    // Scratch for scanfill_fill, grown to fit
+    unsigned *active;
+    struct Crossing *crossings;
+    unsigned scratch_cap;
+    uint16_t *counts;
+    int counts_cap;
+};
+
+struct Scanfill *
+scanfill_new(void)
+{
+    struct Scanfill *sf = calloc(1, sizeof(*sf));
+    if (sf)
+        scanfill_reset(sf);
+    return sf;
+}
+
+void
+scanfill_destroy(struct Scanfill *sf)
+{
+    if (!sf)
+        return;
+    free(sf->edges);
+    free(sf->active);
+    free(sf->crossings);
+    free(sf->counts);
+    free(sf);
+}
+
+void
+scanfill_reset(struct Scanfill *sf)
+{
+    sf->nedges = 0;
+    sf->ymin = INFINITY;
+    sf->ymax = -INFINITY;
+}
+
+size_t
+scanfill_memory(const struct Scanfill *sf)
+{
+    if (!sf)
+        return 0;
+    return sizeof(*sf) + sf->edges_cap * sizeof(*sf->edges) +
+        sf->scratch_cap * (sizeof(*sf->active) + sizeof(*sf->crossings)) +
+        sf->counts_cap * sizeof(*sf->counts);
+}
+
+int
+scanfill_line(struct Scanfill *sf, float x0, float y0, float x1, float y1)
+{
+    // Horizontal edges never cross a sample row; NaNs fail every compare
+    if (!(y0 != y1) || !isfinite(x0) || !isfinite(x1) || !isfinite(y0) ||
+        !isfinite(y1))
+        return 0;
+    if (sf->nedges == sf->edges_cap) {
+        unsigned cap = sf->edges_cap ? sf->edges_cap * 2 : 64;
+        struct ScanEdge *edges = realloc(sf->edges, cap * sizeof(*edges));
+        if (!edges)
+            return -1;
+        sf->edges = edges;
+        sf->edges_cap = cap;
+    }
+    int dir = y0 < y1 ? 1 : -1;
+    if (dir < 0) {
+        float t = x0;
+        x0 = x1;
+        x1 = t;
+        t = y0;
+        y0 = y1;
+        y1 = t;
+    }
+    sf->edges[sf->nedges++] = (struct ScanEdge) {
+        .x0 = x0,
+        .y0 = y0,
+        .x1 = x1,
+        .y1 = y1,
+        .dxdy = (x1 - x0) / (y1 - y0),
+        .dir = dir,
+    };
+    sf->ymin = fminf(sf->ymin, y0);
+    sf->ymax = fmaxf(sf->ymax, y1);
+    return 0;
+}
+
+static int
+compare_edges(const void *a, const void *b)
+{
+    float ya = ((const struct ScanEdge *) a)->y0;
+    float yb = ((const struct ScanEdge *) b)->y0;
+    return (ya > yb) - (ya < yb);
+}
+
+static int
+reserve(struct Scanfill *sf, int width)
+{
+    if (sf->nedges > sf->scratch_cap) {
+        unsigned *active = realloc(sf->active, sf->nedges * sizeof(*active));
+        if (!active)
+            return -1;
+        sf->active = active;
+        struct Crossing *crossings =
+            realloc(sf->crossings, sf->nedges * sizeof(*crossings));
+        if (!crossings)
+            return -1;
+        sf->crossings = crossings;
+        sf->scratch_cap = sf->nedges;
+    }
+    if (width > sf->counts_cap) {
+        uint16_t *counts = realloc(sf->counts, width * sizeof(*counts));
+        if (!counts)
+            return -1;
+        sf->counts = counts;
+        sf->counts_cap = width;
+    }
+    return 0;
+}
+
+// Sample columns k / samples .. (k + 1) / samples - 1 lie in [xa, xb)
+static inline void
+span_samples(float xa, float xb, int samples, int limit, int *k0, int *k1)
+{
+    double a = ceil(xa * samples - 0.5), b = ceil(xb * samples - 0.5);
+    *k0 = a < 0 ? 0 : a > limit ? limit : (int) a;
+    *k1 = b < 0 ? 0 : b > limit ? limit : (int) b;
+}
+
+// Grow the counted range [*d0, *d1) to take in [p0, p1), zeroing the
+// counts it gains
+static inline void
+mark_dirty(uint16_t *counts, int *d0, int *d1, int p0, int p1)
+{
+    if (*d0 >= *d1) {
+        memset(counts + p0, 0, (p1 - p0) * sizeof(*counts));
+        *d0 = p0;
+        *d1 = p1;
+        return;
+    }
+    if (p0 < *d0) {
+        memset(counts + p0, 0, (*d0 - p0) * sizeof(*counts));
+        *d0 = p0;
+    }
+    if (p1 > *d1) {
+        memset(counts + *d1, 0, (p1 - *d1) * sizeof(*counts));
+        *d1 = p1;
+    }
+}
+
+int
+scanfill_fill(struct Scanfill *sf, uint32_t *data, int stride, int width,
+    int height, enum BlitOp op, uint32_t color, int samples)
+{
+    if (sf->nedges == 0 || width <= 0 || height <= 0)
+        return 0;
+    if (reserve(sf, width) < 0)
+        return -1;
+    if (samples < 1)
+        samples = 1;
+    if (samples > SCANFILL_MAX_SAMPLES)
+        samples = SCANFILL_MAX_SAMPLES;
+    qsort(sf->edges, sf->nedges, sizeof(*sf->edges), compare_edges);
+
+    int py0 = (int) fmaxf(floorf(sf->ymin), 0);
+    int py1 = (int) fminf(ceilf(sf->ymax), height);
+    int limit = width * samples;
+    unsigned next = 0, nactive = 0;
+    for (int py = py0; py < py1; py++) {
+        uint32_t *row = data + (size_t) py * stride;
+        int dirty0 = 0, dirty1 = 0;
+        for (int s = 0; s < samples; s++) {
+            float y = py + (s + 0.5f) / samples;
+
+            // Edges that span y, in no particular order
+            while (next < sf->nedges && sf->edges[next].y0 <= y)
+                sf->active[nactive++] = next++;
+            unsigned ncross = 0;
+            for (unsigned i = 0; i < nactive; i++) {
+                const struct ScanEdge *e = &sf->edges[sf->active[i]];
+                if (e->y1 <= y) {
+                    sf->active[i--] = sf->active[--nactive];
+                    continue;
+                }
+                struct Crossing c = { e->x0 + (y - e->y0) * e->dxdy, e->dir };
+                // Insertion sort; there are few crossings per row
+                unsigned j = ncross++;
+                for (; j > 0 && sf->crossings[j - 1].x > c.x; j--)
+                    sf->crossings[j] = sf->crossings[j - 1];
+                sf->crossings[j] = c;
+            }
+
+            int winding = 0;
+            for (unsigned i = 0; i + 1 < ncross; i++) {
+                winding += sf->crossings[i].dir;
+                if (winding == 0)
+                    continue;
+                int k0, k1;
+                span_samples(sf->crossings[i].x, sf->crossings[i + 1].x,
+                    samples, limit, &k0, &k1);
+                if (k0 >= k1)
+                    continue;
+                if (samples == 1) {
+                    blit_fill_row(op, row + k0, color, k1 - k0, 255);
+                    continue;
+                }
+
+                int p0 = k0 / samples, p1 = (k1 - 1) / samples;
+                mark_dirty(sf->counts, &dirty0, &dirty1, p0, p1 + 1);
+                if (p0 == p1) {
+                    sf->counts[p0] += k1 - k0;
+                    continue;
+                }
+                sf->counts[p0] += samples - k0 % samples;
+                for (int p = p0 + 1; p < p1; p++)
+                    sf->counts[p] += samples;
+                sf->counts[p1] += (k1 - 1) % samples + 1;
+            }
+        }
+
+        // Runs of equal coverage go to the kernel together
+        unsigned total = samples * samples;
+        for (int p = dirty0; p < dirty1;) {
+            unsigned count = sf->counts[p];
+            int q = p + 1;
+            while (q < dirty1 && sf->counts[q] == count)
+                q++;
+            if (count)
+                blit_fill_row(op, row + p, color, q - p,
+                    (count * 255 + total / 2) / total);
+            p = q;
+        }
+    }
+    return 0;
+}
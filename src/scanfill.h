@@ -0,0 +1,42 @@
+#pragma once
+
+#include "blit.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Polygon fill by point sampling, for the context's non-analytic
+// antialiasing modes. Each pixel holds a grid of samples x samples points
+// and is covered by the share of them inside the polygon under the nonzero
+// rule. With one sample, pixels are in or out and spans go straight to the
+// blit kernel with no coverage accumulated at all. With more, the rule is
+// decided per sample, so subpaths that overlap get the right coverage where
+// their edges share a pixel, which summed area coverage gets wrong.
+
+#define SCANFILL_MAX_SAMPLES 8
+
+struct Scanfill;
+
+struct Scanfill *
+scanfill_new(void);
+void
+scanfill_destroy(struct Scanfill *sf);
+
+// Start a new polygon; buffers are kept for the next one
+void
+scanfill_reset(struct Scanfill *sf);
+// Add an edge in device pixels; subpaths must be closed by the caller.
+// Returns -1 if out of memory.
+int
+scanfill_line(struct Scanfill *sf, float x0, float y0, float x1, float y1);
+
+// Composite color (premultiplied) over the polygon's pixels in a width x
+// height surface with stride in pixels. Returns -1 if out of memory, with
+// nothing drawn.
+int
+scanfill_fill(struct Scanfill *sf, uint32_t *data, int stride, int width,
+    int height, enum BlitOp op, uint32_t color, int samples);
+
+// Bytes of edge and scratch buffers held for the next polygon
+size_t
+scanfill_memory(const struct Scanfill *sf);
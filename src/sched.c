@@ -0,0 +1,149 @@
+#include "sched.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+static const char *policy_names[] = {
+    [SCHED_REALTIME] = "realtime",
+    [SCHED_FIXED] = "fixed",
+    [SCHED_CATCHUP] = "catchup",
+};
+
+void
+sched_init(struct Sched *sched, enum SchedPolicy policy, double fps,
+    unsigned max_catchup)
+{
+    *sched = (struct Sched) {
+        .policy = policy,
+        .step = 1.0 / fps,
+        .max_catchup = max_catchup < SCHED_MAX_CATCHUP ? max_catchup
+                                                       : SCHED_MAX_CATCHUP,
+        .start = -1,
+    };
+}
+
+unsigned
+sched_plan(struct Sched *sched, double now,
+    struct SchedFrame steps[SCHED_MAX_CATCHUP + 1])
+{
+    if (sched->start < 0)
+        sched->start = now;
+    double elapsed = now - sched->start;
+    unsigned n = 0;
+
+    switch (sched->policy) {
+    case SCHED_REALTIME:
+        steps[n++] = (struct SchedFrame) { elapsed, true };
+        break;
+
+    case SCHED_FIXED:
+        steps[n++] = (struct SchedFrame) { sched->next * sched->step, true };
+        sched->next++;
+        break;
+
+    case SCHED_CATCHUP: {
+        uint64_t due = (uint64_t) floor(elapsed / sched->step);
+        if (due < sched->next)
+            return 0;
+        uint64_t behind = due - sched->next;
+        if (behind > sched->max_catchup) {
+            sched->dropped += behind - sched->max_catchup;
+            sched->next = due - sched->max_catchup;
+        }
+        for (; sched->next <= due; sched->next++)
+            steps[n++] = (struct SchedFrame) { sched->next * sched->step,
+                sched->next == due };
+        sched->simulated += n - 1;
+        break;
+    }
+    }
+
+    sched->rendered++;
+    double lag = elapsed - steps[n - 1].t;
+    if (lag > sched->max_lag)
+        sched->max_lag = lag;
+    sched->total_lag += fabs(lag);
+    return n;
+}
+
+// Left to spin after the sleep in sched_sleep_until
+#define SPIN_SECONDS 0.0005
+
+static double
+get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void
+sched_wait(struct Sched *sched)
+{
+    double due = sched->start + sched->next * sched->step;
+    struct timespec ts = {
+        .tv_sec = (time_t) due,
+        .tv_nsec = (long) ((due - floor(due)) * 1e9),
+    };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+void
+sched_pace(struct Sched *sched, double interval)
+{
+    if (interval <= 0) {
+        sched->pace_next = 0;
+        return;
+    }
+    double start = get_time();
+    if (sched->pace_next > start) {
+        sched_sleep_until(sched->pace_next);
+        start = sched->pace_next;
+    }
+    sched->pace_next = start + interval;
+}
+
+void
+sched_pause(struct Sched *sched, double seconds)
+{
+    if (sched->start >= 0)
+        sched->start += seconds;
+}
+
+void
+sched_sleep_until(double due)
+{
+    double sleep_until = due - SPIN_SECONDS;
+    if (sleep_until > get_time()) {
+        struct timespec ts = {
+            .tv_sec = (time_t) sleep_until,
+            .tv_nsec = (long) ((sleep_until - floor(sleep_until)) * 1e9),
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+            EINTR)
+            ;
+    }
+    while (get_time() < due)
+        ;
+}
+
+int
+sched_parse_policy(const char *name, enum SchedPolicy *policy)
+{
+    for (unsigned i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]);
+         i++) {
+        if (strcmp(name, policy_names[i]) == 0) {
+            *policy = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *
+sched_policy_name(enum SchedPolicy policy)
+{
+    return policy_names[policy];
+}
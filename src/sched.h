@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decides which t values u(t) is called with for each presented frame
+enum SchedPolicy {
+    // t is wall-clock time since start; one u(t) per presented frame
+    SCHED_REALTIME,
+    // t advances by exactly one step per presented frame (dwitter runs
+    // at 60 fps with t += 1/60), whatever the display rate
+    SCHED_FIXED,
+    // Fixed steps locked to the wall clock: frames a slow presenter missed
+    // are simulated (u(t) runs, nothing is rasterized) up to a bound, and
+    // the rest dropped
+    SCHED_CATCHUP,
+};
+
+#define SCHED_MAX_CATCHUP 60
+
+struct SchedFrame {
+    double t;
+    bool render; // false: run u(t) for its side effects only
+};
+
+struct Sched {
+    enum SchedPolicy policy;
+    double step;
+    unsigned max_catchup;
+
+    double start;
+    uint64_t next; // index of the next fixed step
+
+    uint64_t simulated;
+    uint64_t rendered;
+    uint64_t dropped;
+    // How far the rendered t trailed the wall clock
+    double max_lag;
+    double total_lag;
+
+    // When sched_pace lets the next frame start
+    double pace_next;
+};
+
+void
+sched_init(struct Sched *sched, enum SchedPolicy policy, double fps,
+    unsigned max_catchup);
+// Steps for the frame presented at time now; the last one is rendered.
+// Returns 0 when the next fixed step isn't due yet.
+unsigned
+sched_plan(struct Sched *sched, double now,
+    struct SchedFrame steps[SCHED_MAX_CATCHUP + 1]);
+// Sleep until the next fixed step is due
+void
+sched_wait(struct Sched *sched);
+// Start frames at most every interval seconds (0 = no limit), sleeping as
+// needed. Frames keep a steady cadence without bursting after a slow one.
+void
+sched_pace(struct Sched *sched, double interval);
+// Leave the last seconds out of t, as if the clock had stopped
+void
+sched_pause(struct Sched *sched, double seconds);
+// Sleep until the CLOCK_MONOTONIC time due in seconds; the last fraction of
+// a millisecond is spun so timer slack doesn't add to the interval
+void
+sched_sleep_until(double due);
+
+int
+sched_parse_policy(const char *name, enum SchedPolicy *policy);
+const char *
+sched_policy_name(enum SchedPolicy policy);
@@ -0,0 +1,158 @@
+#include "surfpool.h"
+
+#include <stdlib.h>
+
+// The smallest class; smaller buffers are rounded up to it
+#define MIN_CLASS_SHIFT 12
+// Octaves of classes above it; larger buffers are not kept for reuse
+#define CLASS_OCTAVES 20
+#define NUM_CLASSES (CLASS_OCTAVES * 4 + 1)
+// Freed memory past this goes back to the system
+#define MAX_CACHED ((size_t) 64 << 20)
+
+struct FreeBuffer {
+    struct FreeBuffer *next;
+};
+
+struct SurfacePool {
+    size_t limit;
+    size_t in_use;
+    size_t cached;
+    struct FreeBuffer *free[NUM_CLASSES];
+};
+
+// Index of the class size falls in, with its size in *capacity; -1 for
+// buffers too large to keep
+static int
+size_class(size_t size, size_t *capacity)
+{
+    size_t base = (size_t) 1 << MIN_CLASS_SHIFT;
+    if (size <= base) {
+        *capacity = base;
+        return 0;
+    }
+    // base < size <= 2 * base, in quarters of base
+    int octave = 0;
+    while (size > base * 2 && octave < CLASS_OCTAVES) {
+        base *= 2;
+        octave++;
+    }
+    if (octave == CLASS_OCTAVES) {
+        *capacity = size;
+        return -1;
+    }
+    size_t step = base / 4;
+    size_t k = (size - base + step - 1) / step;
+    *capacity = base + k * step;
+    return octave * 4 + (int) k;
+}
+
+struct SurfacePool *
+surface_pool_new(size_t limit)
+{
+    struct SurfacePool *pool = calloc(1, sizeof(*pool));
+    if (pool)
+        pool->limit = limit;
+    return pool;
+}
+
+static void
+drop_cache(struct SurfacePool *pool)
+{
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        while (pool->free[i]) {
+            struct FreeBuffer *buf = pool->free[i];
+            pool->free[i] = buf->next;
+            free(buf);
+        }
+    }
+    pool->cached = 0;
+}
+
+void
+surface_pool_destroy(struct SurfacePool *pool)
+{
+    if (!pool)
+        return;
+    drop_cache(pool);
+    free(pool);
+}
+
+void *
+surface_pool_take(struct SurfacePool *pool, size_t size)
+{
+    if (!pool)
+        return malloc(size ? size : 1);
+
+    size_t capacity;
+    int c = size_class(size, &capacity);
+    if (pool->limit &&
+        (capacity > pool->limit || pool->in_use > pool->limit - capacity))
+        return NULL;
+
+    void *data;
+    if (c >= 0 && pool->free[c]) {
+        struct FreeBuffer *buf = pool->free[c];
+        pool->free[c] = buf->next;
+        pool->cached -= capacity;
+        data = buf;
+    } else {
+        data = malloc(capacity);
+        if (!data && pool->cached) {
+            drop_cache(pool);
+            data = malloc(capacity);
+        }
+        if (!data)
+            return NULL;
+    }
+    pool->in_use += capacity;
+    return data;
+}
+
+void
+surface_pool_give(struct SurfacePool *pool, void *data, size_t size)
+{
+    if (!data)
+        return;
+    if (!pool) {
+        free(data);
+        return;
+    }
+
+    size_t capacity;
+    int c = size_class(size, &capacity);
+    pool->in_use -= capacity;
+    if (c < 0 || pool->cached + capacity > MAX_CACHED) {
+        free(data);
+        return;
+    }
+    struct FreeBuffer *buf = data;
+    buf->next = pool->free[c];
+    pool->free[c] = buf;
+    pool->cached += capacity;
+}
+
+void
+surface_pool_trim(struct SurfacePool *pool)
+{
+    if (pool)
+        drop_cache(pool);
+}
+
+size_t
+surface_pool_in_use(const struct SurfacePool *pool)
+{
+    return pool->in_use;
+}
+
+size_t
+surface_pool_cached(const struct SurfacePool *pool)
+{
+    return pool->cached;
+}
+
+size_t
+surface_pool_limit(const struct SurfacePool *pool)
+{
+    return pool->limit;
+}
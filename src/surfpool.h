@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+// Pixel memory for all the canvases of one dweet. Freed buffers are kept in
+// size classes, four to an octave, so a dweet that makes a canvas each
+// frame, or resizes one by a few pixels, reuses the last one's memory. The
+// pool is not thread safe; each dweet runs on one thread at a time.
+//
+// The limit caps the bytes handed out and not yet given back; past it, takes
+// fail and the canvas bindings throw a RangeError into the dweet.
+
+struct SurfacePool;
+
+// limit in bytes, 0 for none
+struct SurfacePool *
+surface_pool_new(size_t limit);
+// Only once every buffer has been given back or is no longer used
+void
+surface_pool_destroy(struct SurfacePool *pool);
+
+// size bytes of pixel memory; NULL past the limit or when out of memory.
+// A NULL pool is plain malloc and free.
+void *
+surface_pool_take(struct SurfacePool *pool, size_t size);
+// Return memory from surface_pool_take with the same size (data may be NULL)
+void
+surface_pool_give(struct SurfacePool *pool, void *data, size_t size);
+
+// Free the memory kept for reuse
+void
+surface_pool_trim(struct SurfacePool *pool);
+
+// Bytes handed out, counting the whole size class of each buffer
+size_t
+surface_pool_in_use(const struct SurfacePool *pool);
+// Bytes kept for reuse
+size_t
+surface_pool_cached(const struct SurfacePool *pool);
+size_t
+surface_pool_limit(const struct SurfacePool *pool);
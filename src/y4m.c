@@ -0,0 +1,98 @@
+#include "y4m.h"
+
+#include "pixfmt.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Y4m {
+    FILE *f;
+    int width, height;
+    // Y for the rows being written; U and V for the whole frame, back to
+    // back, since they follow all of Y in the stream
+    uint8_t *luma;
+    size_t luma_size;
+    uint8_t *chroma;
+};
+
+struct Y4m *
+y4m_open(const char *path, int width, int height, int fps)
+{
+    struct Y4m *y4m = calloc(1, sizeof(*y4m));
+    if (!y4m)
+        return NULL;
+    y4m->width = width;
+    y4m->height = height;
+
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    y4m->chroma = malloc((size_t) cw * ch * 2);
+    y4m->f = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (!y4m->chroma || !y4m->f) {
+        if (!y4m->f)
+            perror(path);
+        y4m_close(y4m);
+        return NULL;
+    }
+
+    // 2x2 averaged chroma is centered, which is what C420jpeg means
+    fprintf(y4m->f,
+        "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+        width, height, fps);
+    return y4m;
+}
+
+int
+y4m_write_frame(struct Y4m *y4m, const unsigned char *argb, int stride)
+{
+    return y4m_write_rows(y4m, argb, stride, 0, y4m->height);
+}
+
+int
+y4m_write_rows(struct Y4m *y4m, const unsigned char *argb, int stride, int y,
+    int rows)
+{
+    int w = y4m->width, h = y4m->height;
+    int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    if (y < 0 || y >= h || y % 2 != 0 || rows <= 0)
+        return -1;
+    if (rows > h - y)
+        rows = h - y;
+
+    size_t luma_size = (size_t) w * rows;
+    if (luma_size > y4m->luma_size) {
+        free(y4m->luma);
+        y4m->luma = malloc(luma_size);
+        y4m->luma_size = y4m->luma ? luma_size : 0;
+        if (!y4m->luma)
+            return -1;
+    }
+    uint8_t *u = y4m->chroma + (size_t) cw * (y / 2);
+    uint8_t *v = y4m->chroma + (size_t) cw * ch + (size_t) cw * (y / 2);
+    pixfmt_argb_to_i420(y4m->luma, w, u, cw, v, cw, argb, stride, w, rows);
+
+    if (y == 0 && fputs("FRAME\n", y4m->f) < 0)
+        return -1;
+    if (fwrite(y4m->luma, 1, luma_size, y4m->f) != luma_size)
+        return -1;
+    size_t chroma_size = (size_t) cw * ch * 2;
+    if (y + rows == h &&
+        fwrite(y4m->chroma, 1, chroma_size, y4m->f) != chroma_size)
+        return -1;
+    return 0;
+}
+
+void
+y4m_close(struct Y4m *y4m)
+{
+    if (!y4m)
+        return;
+    if (y4m->f && y4m->f != stdout)
+        fclose(y4m->f);
+    else if (y4m->f)
+        fflush(y4m->f);
+    free(y4m->luma);
+    free(y4m->chroma);
+    free(y4m);
+}
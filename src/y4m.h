@@ -0,0 +1,18 @@
+#pragma once
+
+struct Y4m;
+
+// YUV4MPEG2 (I420) stream writer, e.g. for piping into an encoder.
+// path "-" writes to stdout.
+struct Y4m *
+y4m_open(const char *path, int width, int height, int fps);
+int
+y4m_write_frame(struct Y4m *y4m, const unsigned char *argb, int stride);
+// Write a frame a band at a time, top to bottom: rows rows starting at row
+// y (even), from argb, which holds just those rows. Luma goes out as it
+// comes; chroma is kept until the frame's last row.
+int
+y4m_write_rows(struct Y4m *y4m, const unsigned char *argb, int stride, int y,
+    int rows);
+void
+y4m_close(struct Y4m *y4m);
@@ -0,0 +1,90 @@
+// Classifications of small dweets by the stateless analysis. Anything that
+// can carry a value from one frame to the next must not come out stateless,
+// or parallel export renders it wrong.
+
+#include "analyze.h"
+
+#include <stdio.h>
+
+static const struct {
+    const char *code;
+    enum DweetKind kind;
+} cases[] = {
+    { "c.width|=0;for(i=9;i--;)x.fillRect(i,0,9,9)", DWEET_STATELESS },
+    { "c.width|=0;x.fillStyle=R(99,0,0);x.globalAlpha=.5;x.lineWidth=2;"
+      "x.fillRect(0,0,9,9)",
+        DWEET_STATELESS },
+    { "c.width|=0;o={};o.k=t;x.fillRect(o.k,0,9,9)", DWEET_STATELESS },
+    { "c.width|=0;for(k of[1,2])x.fillRect(k,0,9,9)", DWEET_STATELESS },
+    { "x.fillRect(t,0,9,9)", DWEET_ACCUMULATING },
+    { "c.width|=0;f=f||[];f.push(t)", DWEET_STATEFUL },
+    // Properties of the context other than its state
+    { "c.width|=0;x.k=(x.k|0)+1;x.fillRect(x.k,0,9,9)", DWEET_STATEFUL },
+    { "c.width|=0;x.k++", DWEET_STATEFUL },
+    { "c.width|=0;x.canvas.k=(x.canvas.k|0)+1", DWEET_STATEFUL },
+    // Builtins, however they are reached
+    { "c.width|=0;Math.q=(Math.q|0)+1", DWEET_STATEFUL },
+    { "c.width|=0;Math['q']=(Math['q']|0)+1", DWEET_STATEFUL },
+    { "c.width|=0;++Math.q", DWEET_STATEFUL },
+    { "c.width|=0;delete Math.PI", DWEET_STATEFUL },
+    { "c.width|=0;Array.prototype.q=t", DWEET_STATEFUL },
+    { "c.width|=0;arguments.callee.k=t", DWEET_STATEFUL },
+    { "c.width|=0;a=[];a[0]=t", DWEET_STATEFUL },
+    // An empty loop leaves its variable as the last frame left it
+    { "c.width|=0;for(k of[]);x.fillRect(k,0,9,9)", DWEET_STATEFUL },
+    { "c.width|=0;for(k in{});x.fillRect(k,0,9,9)", DWEET_STATEFUL },
+};
+
+// Whether a dweet may rebind one of dwitter's shorthands
+static const char *const shorthands[] = { "c", "x", "S", "C", "T", "R" };
+
+static const struct {
+    const char *code;
+    bool rebinds;
+} rebind_cases[] = {
+    { "c.width|=0;x.fillRect(S(t)*9,C(t),T(1),R(1))", false },
+    { "x.fillStyle=R(9);c.k=t;a=[x,c];b={x:1}", false },
+    { "for(i=9;i--;)x.fillRect(i,0,9,9);(x=>x)(1);a[x]=1", false },
+    { "P=globalThis.P||[];this.K=1;o.eval=1", false },
+    { "x=c.getContext('2d')", true },
+    { "S+=1", true },
+    { "T++", true },
+    { "--R", true },
+    { "[x,y]=[1,2]", true },
+    { "({C}=Math)", true },
+    { "for(c of[1]);", true },
+    { "for([c]of[[1]]);", true },
+    { "eval('x=1')", true },
+    { "this.x=1", true },
+    { "this['x']=1", true },
+    { "Object.assign(globalThis,{S:Math.cos})", true },
+    { "globalThis.S=Math.cos", true },
+    { "Function('c=1')()", true },
+};
+
+int
+main(void)
+{
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(rebind_cases) / sizeof(rebind_cases[0]);
+         i++) {
+        bool rebinds = analyze_rebinds(rebind_cases[i].code, shorthands,
+            sizeof(shorthands) / sizeof(shorthands[0]));
+        if (rebinds != rebind_cases[i].rebinds) {
+            fprintf(stderr, "error: %s: %s\n", rebind_cases[i].code,
+                rebinds ? "rebinds a shorthand" : "rebinds nothing");
+            failures++;
+        }
+    }
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        struct DweetAnalysis an;
+        analyze_dweet(cases[i].code, &an);
+        if (an.kind != cases[i].kind) {
+            fprintf(stderr, "error: %s: %s (%s), not %s\n", cases[i].code,
+                analyze_kind_name(an.kind), an.reason,
+                analyze_kind_name(cases[i].kind));
+            failures++;
+        }
+    }
+    return failures != 0;
+}
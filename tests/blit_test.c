@@ -0,0 +1,189 @@
+// Checks the SIMD blit kernels against the scalar reference at every
+// instruction set level the CPU has: the composite and fill kernels of
+// every operator and the bilinear kernel, for widths 0 to 70 at every
+// alignment of a 16-byte vector, with and without global alpha and
+// coverage. Rows, including the pixels around them, must be identical.
+
+#include "blit.h"
+#include "pixfmt.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_WIDTH 70
+// Pixels around every row, to catch writes past either end
+#define PAD 8
+#define CANARY 0xa5a5a5a5u
+
+static const char *const op_names[BLIT_OP_COUNT] = {
+    [BLIT_SRC_OVER] = "source-over",
+    [BLIT_COPY] = "copy",
+    [BLIT_LIGHTER] = "lighter",
+    [BLIT_DST_OUT] = "destination-out",
+    [BLIT_XOR] = "xor",
+    [BLIT_MULTIPLY] = "multiply",
+};
+
+// Global alpha and coverage: opaque, the extremes and values in between
+static const unsigned alphas[] = { 255, 254, 128, 77, 1, 0 };
+
+static uint32_t rng = 0x9e3779b9;
+
+static uint32_t
+next_u32(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Premultiplied, with extra weight on transparent and opaque pixels
+static uint32_t
+random_pixel(void)
+{
+    uint32_t k = next_u32();
+    unsigned a = (k & 3) == 0 ? 0 : (k & 3) == 1 ? 255 : (k >> 24);
+    uint32_t px = a << 24;
+    for (int shift = 0; shift < 24; shift += 8)
+        px |= (a ? next_u32() % (a + 1) : 0) << shift;
+    return px;
+}
+
+static void
+fill_random(uint32_t *px, int n)
+{
+    for (int i = 0; i < n; i++)
+        px[i] = random_pixel();
+}
+
+// dst rows with a canary border: [PAD][width][PAD] starting at off
+struct Rows {
+    uint32_t want[PAD + 3 + MAX_WIDTH + PAD];
+    uint32_t got[PAD + 3 + MAX_WIDTH + PAD];
+    uint32_t *want_row, *got_row;
+};
+
+static void
+rows_init(struct Rows *r, const uint32_t *dst, int width, int off)
+{
+    for (size_t i = 0; i < sizeof(r->want) / sizeof(r->want[0]); i++)
+        r->want[i] = r->got[i] = CANARY;
+    r->want_row = r->want + PAD + off;
+    r->got_row = r->got + PAD + off;
+    memcpy(r->want_row, dst, width * sizeof(*dst));
+    memcpy(r->got_row, dst, width * sizeof(*dst));
+}
+
+static bool
+rows_check(const struct Rows *r, enum PixfmtIsa isa, const char *kernel,
+    int width, int off, unsigned alpha)
+{
+    size_t n = sizeof(r->want) / sizeof(r->want[0]);
+    for (size_t i = 0; i < n; i++) {
+        if (r->want[i] != r->got[i]) {
+            fprintf(stderr,
+                "error: %s %s: width %d, offset %d, alpha %u: pixel %d is "
+                "%08x, not %08x\n",
+                pixfmt_isa_name(isa), kernel, width, off, alpha,
+                (int) i - PAD - off, r->got[i], r->want[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static unsigned
+check_ops(enum PixfmtIsa isa)
+{
+    unsigned failures = 0;
+    uint32_t src[MAX_WIDTH], dst[MAX_WIDTH];
+    for (enum BlitOp op = 0; op < BLIT_OP_COUNT; op++) {
+        char composite[64], fill[64];
+        snprintf(composite, sizeof(composite), "%s composite", op_names[op]);
+        snprintf(fill, sizeof(fill), "%s fill", op_names[op]);
+        for (int width = 0; width <= MAX_WIDTH; width++) {
+            for (int off = 0; off < 4; off++) {
+                for (size_t k = 0; k < sizeof(alphas) / sizeof(*alphas); k++) {
+                    unsigned alpha = alphas[k];
+                    struct Rows r;
+                    fill_random(src, width);
+                    fill_random(dst, width);
+
+                    rows_init(&r, dst, width, off);
+                    pixfmt_set_isa(PIXFMT_SCALAR);
+                    blit_composite_row(op, r.want_row, src, width, alpha);
+                    pixfmt_set_isa(isa);
+                    blit_composite_row(op, r.got_row, src, width, alpha);
+                    failures += !rows_check(&r, isa, composite, width, off,
+                        alpha);
+
+                    // Every color once per row, from the source pixels
+                    uint32_t color = width ? src[width / 2] : random_pixel();
+                    rows_init(&r, dst, width, off);
+                    pixfmt_set_isa(PIXFMT_SCALAR);
+                    blit_fill_row(op, r.want_row, color, width, alpha);
+                    pixfmt_set_isa(isa);
+                    blit_fill_row(op, r.got_row, color, width, alpha);
+                    failures += !rows_check(&r, isa, fill, width, off, alpha);
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+static unsigned
+check_bilinear(enum PixfmtIsa isa)
+{
+    // Steps that shrink, keep and enlarge, and one that runs backwards;
+    // starts before, inside and past the row so the edges clamp
+    static const int32_t steps[] = { 0x28000, 0x10000, 0x5555, 0x100, -0x9000 };
+    static const int32_t starts[] = { -0x38000, -0x8000, 0, 0x12345, 0x7f0000 };
+    static const int fys[] = { 0, 1, 64, 127, 128 };
+    unsigned failures = 0;
+    uint32_t src0[MAX_WIDTH], src1[MAX_WIDTH], dst[MAX_WIDTH];
+    for (int width = 0; width <= MAX_WIDTH; width++) {
+        for (int off = 0; off < 4; off++) {
+            for (size_t s = 0; s < sizeof(steps) / sizeof(*steps); s++) {
+                for (size_t u = 0; u < sizeof(starts) / sizeof(*starts); u++) {
+                    for (size_t f = 0; f < sizeof(fys) / sizeof(*fys); f++) {
+                        int src_width = 1 + (int) (next_u32() % MAX_WIDTH);
+                        fill_random(src0, src_width);
+                        fill_random(src1, src_width);
+                        fill_random(dst, width);
+                        struct Rows r;
+                        rows_init(&r, dst, width, off);
+                        pixfmt_set_isa(PIXFMT_SCALAR);
+                        blit_bilinear_row(r.want_row, src0, src1, src_width,
+                            fys[f], starts[u], steps[s], width);
+                        pixfmt_set_isa(isa);
+                        blit_bilinear_row(r.got_row, src0, src1, src_width,
+                            fys[f], starts[u], steps[s], width);
+                        failures += !rows_check(&r, isa, "bilinear", width,
+                            off, 255);
+                    }
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int
+main(void)
+{
+    unsigned failures = 0;
+    enum PixfmtIsa best = pixfmt_get_isa();
+    for (enum PixfmtIsa isa = PIXFMT_SSE2; isa <= best; isa++) {
+        if (pixfmt_set_isa(isa) != isa)
+            continue;
+        unsigned n = check_ops(isa) + check_bilinear(isa);
+        printf("%s: %s\n", pixfmt_isa_name(isa), n ? "FAILED" : "ok");
+        failures += n;
+    }
+    if (best == PIXFMT_SCALAR)
+        printf("scalar only: nothing to compare\n");
+    return failures != 0;
+}
@@ -0,0 +1,177 @@
+// Checks disc_fill against references computed independently of its chord
+// integrals: the exact-area mode against a fine numerical integration of
+// each pixel's coverage, and the sampled modes against the same sample
+// grid tested point by point. Discs and rings of many sizes, down to
+// sub-pixel radii and ring widths, are drawn at fractional centers, across
+// every edge of the surface and off it, onto a surface with a canary
+// border that must stay untouched.
+
+#include "disc.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDTH 61
+#define HEIGHT 47
+// Pixels around the surface, to catch writes past its edges
+#define PAD 8
+#define STRIDE (WIDTH + 2 * PAD)
+#define CANARY 0xa5a5a5a5u
+// Sub-columns per pixel in the reference integration
+#define STEPS 512
+// Largest coverage error in the exact-area mode, in 1/255 steps: the
+// rounding of either side
+#define MAX_ERROR 1
+
+static uint32_t buf[(HEIGHT + 2 * PAD) * STRIDE];
+
+// Length of [lo, hi] inside [-h, h]
+static double
+overlap(double lo, double hi, double h)
+{
+    return fmax(fmin(hi, h) - fmax(lo, -h), 0);
+}
+
+// Area of the ring in the pixel whose top left corner is (x, y), relative
+// to the center, by the midpoint rule over thin vertical strips
+static double
+reference_area(double x, double y, double outer, double inner)
+{
+    double area = 0;
+    for (int i = 0; i < STEPS; i++) {
+        double u = x + (i + 0.5) / STEPS;
+        double ho = outer * outer - u * u;
+        if (ho <= 0)
+            continue;
+        double a = overlap(y, y + 1, sqrt(ho));
+        double hi = inner * inner - u * u;
+        if (inner > 0 && hi > 0)
+            a -= overlap(y, y + 1, sqrt(hi));
+        area += a;
+    }
+    return area / STEPS;
+}
+
+// Samples of a samples x samples grid in the ring, as disc.h defines them
+static unsigned
+reference_samples(int samples, double x, double y, double outer,
+    double inner)
+{
+    unsigned inside = 0;
+    for (int j = 0; j < samples; j++) {
+        for (int i = 0; i < samples; i++) {
+            double sx = x + (i + 0.5) / samples;
+            double sy = y + (j + 0.5) / samples;
+            double d2 = sx * sx + sy * sy;
+            inside += d2 <= outer * outer && d2 >= inner * inner;
+        }
+    }
+    unsigned total = samples * samples;
+    return (inside * 255 + total / 2) / total;
+}
+
+// Draws the ring in opaque white over transparent black, so that each
+// pixel's alpha is its coverage, and compares every pixel. An empty ring
+// must leave every pixel transparent.
+static bool
+check(int samples, double cx, double cy, double outer, double inner,
+    bool empty)
+{
+    for (size_t i = 0; i < sizeof(buf) / sizeof(buf[0]); i++)
+        buf[i] = CANARY;
+    uint32_t *data = buf + PAD * STRIDE + PAD;
+    for (int y = 0; y < HEIGHT; y++)
+        memset(data + y * STRIDE, 0, WIDTH * sizeof(*data));
+    struct Disc disc = {
+        .data = data,
+        .stride = STRIDE,
+        .width = WIDTH,
+        .height = HEIGHT,
+        .op = BLIT_SRC_OVER,
+        .color = 0xFFFFFFFF,
+        .samples = samples,
+    };
+    disc_fill(&disc, cx, cy, outer, inner);
+
+    for (int y = -PAD; y < HEIGHT + PAD; y++) {
+        for (int x = -PAD; x < WIDTH + PAD; x++) {
+            uint32_t px = data[y * STRIDE + x];
+            bool outside = x < 0 || y < 0 || x >= WIDTH || y >= HEIGHT;
+            int got = px >> 24, want;
+            if (outside) {
+                if (px == CANARY)
+                    continue;
+                want = -1;
+            } else if (empty) {
+                want = 0;
+            } else if (samples > 0) {
+                want = reference_samples(samples, x - cx, y - cy, outer,
+                    inner > 0 ? inner : 0);
+            } else {
+                double a = reference_area(x - cx, y - cy, outer,
+                    inner > 0 ? inner : 0);
+                want = (int) lround(fmin(a, 1) * 255);
+            }
+            int tolerance = samples > 0 ? 0 : MAX_ERROR;
+            if (want < 0 || abs(got - want) > tolerance) {
+                fprintf(stderr,
+                    "error: samples %d, center (%g, %g), radii %g %g: pixel "
+                    "(%d, %d) is %08x, coverage not %d\n",
+                    samples, cx, cy, outer, inner, x, y, px, want);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int
+main(void)
+{
+    // Centers inside, on and across every edge, and off the surface
+    static const double centers[][2] = {
+        { 30.5, 23.5 }, { 30.27, 23.81 }, { 0, 0 }, { -3.4, 20.1 },
+        { 60.8, 46.6 }, { 12.3, -5.7 }, { 64.2, 49.9 }, { -40, 10 },
+    };
+    static const double radii[] = { 0.1, 0.3, 0.5, 0.71, 1, 1.6, 3.25, 9.9,
+        22.5, 40 };
+    // Ring widths as a share of the outer radius, and fixed sub-pixel ones
+    static const double widths[] = { 1, 0.5, 0.1, -0.2, -0.7 };
+    static const int modes[] = { 0, 1, 4 };
+    unsigned failures = 0, cases = 0;
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(*modes); m++) {
+        for (size_t c = 0; c < sizeof(centers) / sizeof(*centers); c++) {
+            for (size_t r = 0; r < sizeof(radii) / sizeof(*radii); r++) {
+                for (size_t w = 0; w < sizeof(widths) / sizeof(*widths);
+                     w++) {
+                    double outer = radii[r];
+                    double width = widths[w] > 0 ? widths[w] * outer
+                                                 : -widths[w];
+                    double inner = outer - width;
+                    cases++;
+                    failures += !check(modes[m], centers[c][0],
+                        centers[c][1], outer, inner, false);
+                }
+            }
+        }
+    }
+
+    // Nothing to draw: these must leave the surface alone
+    static const double empty[][2] = {
+        { 0, 0 }, { -1, 0 }, { 5, 5 }, { 5, 6 }, { NAN, 0 },
+        { 2 * DISC_MAX_RADIUS, 0 },
+    };
+    for (size_t i = 0; i < sizeof(empty) / sizeof(*empty); i++) {
+        cases++;
+        failures += !check(0, 30, 20, empty[i][0], empty[i][1], true);
+    }
+    cases++;
+    failures += !check(0, NAN, 20, 5, 0, true);
+
+    printf("%u of %u cases passed\n", cases - failures, cases);
+    return failures != 0;
+}
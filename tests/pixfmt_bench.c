@@ -0,0 +1,113 @@
+// Throughput of each pixfmt conversion at each instruction set level the
+// CPU has, in GB/s of source pixels, on a canvas-sized frame.
+//
+// usage: pixfmt_bench [width height [seconds per kernel]]
+
+#include "pixfmt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum Op {
+    OP_RGBA,
+    OP_ARGB,
+    OP_I420,
+    OP_NV12,
+    OP_DOWNSCALE,
+    NOPS,
+};
+
+static const char *const op_names[NOPS] = {
+    [OP_RGBA] = "argb_to_rgba",
+    [OP_ARGB] = "rgba_to_argb",
+    [OP_I420] = "argb_to_i420",
+    [OP_NV12] = "argb_to_nv12",
+    [OP_DOWNSCALE] = "downscale_2x",
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+run(enum Op op, uint8_t *dst, const uint8_t *src, int width, int height)
+{
+    int stride = width * 4;
+    uint8_t *u = dst + (size_t) width * height;
+    uint8_t *v = u + (size_t) width * height / 4;
+    switch (op) {
+    case OP_RGBA:
+        pixfmt_argb_to_rgba(dst, stride, src, stride, width, height);
+        break;
+    case OP_ARGB:
+        pixfmt_rgba_to_argb(dst, stride, src, stride, width, height);
+        break;
+    case OP_I420:
+        pixfmt_argb_to_i420(dst, width, u, width / 2, v, width / 2, src,
+            stride, width, height);
+        break;
+    case OP_NV12:
+        pixfmt_argb_to_nv12(dst, width, u, width, src, stride, width, height);
+        break;
+    case OP_DOWNSCALE:
+        pixfmt_downscale_2x(dst, stride / 2, src, stride, width, height);
+        break;
+    default:
+        break;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int width = argc > 2 ? atoi(argv[1]) : 1920;
+    int height = argc > 2 ? atoi(argv[2]) : 1080;
+    double seconds = argc > 3 ? atof(argv[3]) : 0.25;
+    if (width < 2 || height < 2 || width % 2 || height % 2) {
+        fprintf(stderr, "error: the size must be even and at least 2x2\n");
+        return 1;
+    }
+
+    size_t size = (size_t) width * height * 4;
+    uint8_t *src = malloc(size), *dst = malloc(size);
+    if (!src || !dst) {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+    srand(1);
+    for (size_t i = 0; i < size; i += 4) {
+        int a = rand() % 256;
+        for (int c = 0; c < 3; c++)
+            src[i + c] = rand() % (a + 1);
+        src[i + 3] = a;
+    }
+
+    printf("%dx%d\n", width, height);
+    enum PixfmtIsa best = pixfmt_get_isa();
+    for (enum PixfmtIsa isa = PIXFMT_SCALAR; isa <= best; isa++) {
+        if (pixfmt_set_isa(isa) != isa)
+            continue;
+        for (enum Op op = 0; op < NOPS; op++) {
+            // Warm up the caches and the page tables first
+            run(op, dst, src, width, height);
+            unsigned n = 0;
+            double start = now(), elapsed;
+            do {
+                run(op, dst, src, width, height);
+                n++;
+                elapsed = now() - start;
+            } while (elapsed < seconds);
+            printf("%-7s %-13s %7.2f GB/s %8.3f ms/frame\n",
+                pixfmt_isa_name(isa), op_names[op],
+                (double) size * n / elapsed / 1e9, elapsed * 1e3 / n);
+        }
+    }
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,269 @@
+// Checks every pixfmt conversion at every instruction set level the CPU
+// has against the scalar reference: widths 0 to 67 (past two blocks of the
+// widest kernel plus every tail), odd and even heights, source and
+// destination pointers misaligned by 0 to 3 bytes, conversions in place,
+// and every input value each kernel's arithmetic depends on. Outputs,
+// including the bytes around them, must be identical.
+
+#include "pixfmt.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_WIDTH 67
+#define MAX_HEIGHT 3
+// Around every row and plane, to catch writes past the end
+#define PAD 32
+#define CANARY 0xa5
+
+enum Op {
+    OP_RGBA,
+    OP_ARGB,
+    OP_RGBA_IN_PLACE,
+    OP_ARGB_IN_PLACE,
+    OP_I420,
+    OP_NV12,
+    OP_DOWNSCALE,
+    NOPS,
+};
+
+static const char *const op_names[NOPS] = {
+    [OP_RGBA] = "argb_to_rgba",
+    [OP_ARGB] = "rgba_to_argb",
+    [OP_RGBA_IN_PLACE] = "argb_to_rgba in place",
+    [OP_ARGB_IN_PLACE] = "rgba_to_argb in place",
+    [OP_I420] = "argb_to_i420",
+    [OP_NV12] = "argb_to_nv12",
+    [OP_DOWNSCALE] = "downscale_2x",
+};
+
+static uint32_t rng = 0x12345678;
+
+static uint8_t
+next_byte(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng >> 24;
+}
+
+// Premultiplied ARGB, as the canvas makes, with extra weight on the alpha
+// values the kernels treat specially
+static void
+fill_argb(uint8_t *px, size_t n)
+{
+    for (size_t i = 0; i < n; i++, px += 4) {
+        uint8_t k = next_byte();
+        int a = k < 32 ? 0 : k < 96 ? 255 : next_byte();
+        for (int c = 0; c < 3; c++)
+            px[c] = a ? next_byte() % (a + 1) : 0;
+        px[3] = a;
+    }
+}
+
+static void
+fill_random(uint8_t *px, size_t n)
+{
+    for (size_t i = 0; i < n * 4; i++)
+        px[i] = next_byte();
+}
+
+// Runs op on a width x height image at src (with stride src_stride) and
+// writes everything it produces to out, each row or plane at dst_off
+static void
+run(enum Op op, uint8_t *out, size_t out_size, const uint8_t *src,
+    int src_stride, int width, int height, int dst_off)
+{
+    memset(out, CANARY, out_size);
+    uint8_t *dst = out + PAD + dst_off;
+    int stride = width * 4 + PAD;
+    switch (op) {
+    case OP_RGBA:
+        pixfmt_argb_to_rgba(dst, stride, src, src_stride, width, height);
+        break;
+    case OP_ARGB:
+        pixfmt_rgba_to_argb(dst, stride, src, src_stride, width, height);
+        break;
+    case OP_RGBA_IN_PLACE:
+    case OP_ARGB_IN_PLACE:
+        for (int y = 0; y < height; y++)
+            memcpy(dst + (size_t) y * src_stride,
+                src + (size_t) y * src_stride, (size_t) width * 4);
+        if (op == OP_RGBA_IN_PLACE)
+            pixfmt_argb_to_rgba(dst, src_stride, dst, src_stride, width,
+                height);
+        else
+            pixfmt_rgba_to_argb(dst, src_stride, dst, src_stride, width,
+                height);
+        break;
+    case OP_I420:
+    case OP_NV12: {
+        int y_stride = width + PAD;
+        int c_stride = 2 * ((width + 1) / 2) + PAD;
+        uint8_t *u = dst + (size_t) height * y_stride + PAD;
+        uint8_t *v = u + (size_t) ((height + 1) / 2) * c_stride + PAD;
+        if (op == OP_I420)
+            pixfmt_argb_to_i420(dst, y_stride, u, c_stride, v, c_stride, src,
+                src_stride, width, height);
+        else
+            pixfmt_argb_to_nv12(dst, y_stride, u, c_stride, src, src_stride,
+                width, height);
+        break;
+    }
+    case OP_DOWNSCALE:
+        pixfmt_downscale_2x(dst, stride, src, src_stride, width, height);
+        break;
+    default:
+        break;
+    }
+}
+
+static size_t
+out_size(int width, int height)
+{
+    // Enough for any op's output with its padding
+    return (size_t) (height + 4) * (width * 4 + 4 * PAD);
+}
+
+static bool
+check(enum PixfmtIsa isa, enum Op op, const uint8_t *src, int src_stride,
+    int width, int height, int dst_off, uint8_t *want, uint8_t *got,
+    const char *what)
+{
+    size_t size = out_size(width, height);
+    if (op == OP_RGBA_IN_PLACE || op == OP_ARGB_IN_PLACE)
+        size = (size_t) PAD * 2 + 4 + (size_t) height * src_stride;
+    pixfmt_set_isa(PIXFMT_SCALAR);
+    run(op, want, size, src, src_stride, width, height, dst_off);
+    pixfmt_set_isa(isa);
+    run(op, got, size, src, src_stride, width, height, dst_off);
+    if (memcmp(want, got, size) == 0)
+        return true;
+    size_t i = 0;
+    while (want[i] == got[i])
+        i++;
+    fprintf(stderr,
+        "error: %s %s %s: %dx%d, dst offset %d: byte %zu is %d, not %d\n",
+        pixfmt_isa_name(isa), op_names[op], what, width, height, dst_off,
+        i, got[i], want[i]);
+    return false;
+}
+
+// Every width, height and alignment on random pixels
+static unsigned
+check_shapes(enum PixfmtIsa isa)
+{
+    int src_stride = MAX_WIDTH * 4 + PAD;
+    uint8_t *src = malloc((size_t) MAX_HEIGHT * src_stride + 4);
+    size_t size = out_size(MAX_WIDTH, MAX_HEIGHT);
+    uint8_t *want = malloc(size), *got = malloc(size);
+    unsigned failures = 0;
+    for (enum Op op = 0; op < NOPS; op++) {
+        for (int src_off = 0; src_off < 4; src_off++) {
+            for (int dst_off = 0; dst_off < 4; dst_off++) {
+                for (int height = 1; height <= MAX_HEIGHT; height++) {
+                    for (int width = 0; width <= MAX_WIDTH; width++) {
+                        uint8_t *s = src + src_off;
+                        if (op == OP_ARGB || op == OP_ARGB_IN_PLACE)
+                            fill_random(s, (size_t) MAX_HEIGHT * src_stride / 4);
+                        else
+                            fill_argb(s, (size_t) MAX_HEIGHT * src_stride / 4);
+                        if (!check(isa, op, s, src_stride, width, height,
+                                dst_off, want, got, "shape"))
+                            failures++;
+                    }
+                }
+            }
+        }
+    }
+    free(src);
+    free(want);
+    free(got);
+    return failures;
+}
+
+// Every value the arithmetic sees: all (color, alpha) pairs for the
+// premultiplication in both directions, and every RGB color for luma and
+// chroma (in 2x2 blocks of one color, so the average is that color)
+static unsigned
+check_values(enum PixfmtIsa isa)
+{
+    int width = 65536;
+    int src_stride = width * 4;
+    uint8_t *src = malloc((size_t) src_stride);
+    size_t size = out_size(width, 1);
+    uint8_t *want = malloc(size), *got = malloc(size);
+    unsigned failures = 0;
+
+    for (int i = 0; i < width; i++) {
+        int c = i & 255, a = i >> 8;
+        uint8_t *p = src + i * 4;
+        p[0] = c;
+        p[1] = 255 - c;
+        p[2] = c ^ 0x5a;
+        p[3] = a;
+    }
+    if (!check(isa, OP_ARGB, src, src_stride, width, 1, 0, want, got,
+            "all values"))
+        failures++;
+    // Premultiplied input only: color at most alpha
+    for (int i = 0; i < width; i++) {
+        uint8_t *p = src + i * 4;
+        for (int c = 0; c < 3; c++)
+            if (p[c] > p[3])
+                p[c] = p[3];
+    }
+    if (!check(isa, OP_RGBA, src, src_stride, width, 1, 0, want, got,
+            "all values"))
+        failures++;
+
+    free(src);
+    free(want);
+    free(got);
+
+    // Each green and blue twice in a row, for one red per pass
+    width = 2 * 65536;
+    src_stride = width * 4;
+    src = malloc((size_t) src_stride);
+    size = out_size(width, 1);
+    want = malloc(size);
+    got = malloc(size);
+    for (int r = 0; r < 256; r++) {
+        for (int i = 0; i < width; i++) {
+            uint8_t *p = src + i * 4;
+            p[0] = (i / 2) >> 8;
+            p[1] = (i / 2) & 255;
+            p[2] = r;
+            p[3] = 255;
+        }
+        if (!check(isa, OP_I420, src, src_stride, width, 1, 0, want, got,
+                "all colors") ||
+            !check(isa, OP_NV12, src, src_stride, width, 1, 0, want, got,
+                "all colors"))
+            failures++;
+    }
+    free(src);
+    free(want);
+    free(got);
+    return failures;
+}
+
+int
+main(void)
+{
+    unsigned failures = 0;
+    enum PixfmtIsa best = pixfmt_get_isa();
+    for (enum PixfmtIsa isa = PIXFMT_SSE2; isa <= best; isa++) {
+        if (pixfmt_set_isa(isa) != isa)
+            continue;
+        unsigned n = check_shapes(isa) + check_values(isa);
+        printf("%s: %s\n", pixfmt_isa_name(isa), n ? "FAILED" : "ok");
+        failures += n;
+    }
+    if (best == PIXFMT_SCALAR)
+        printf("scalar only: nothing to compare\n");
+    return failures != 0;
+}
@@ -0,0 +1,161 @@
+// Two-process throughput test of the frame ring: the parent publishes
+// frames as fast as it can, each filled with its own frame number, and a
+// forked consumer maps the ring by name and checks every frame it gets.
+// A frame that passes ring_validate but holds another frame's pixels is a
+// torn read and fails the test; drops (the producer lapping the consumer)
+// are expected and only reported.
+//
+// usage: ring_test [frames [width height]]
+
+#include "ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static bool
+frame_is(const struct RingHeader *h, const unsigned char *pixels,
+    uint32_t value)
+{
+    for (uint32_t y = 0; y < h->height; y++) {
+        const uint32_t *row = (const uint32_t *) (pixels + (size_t) y * h->stride);
+        for (uint32_t x = 0; x < h->width; x++)
+            if (row[x] != value)
+                return false;
+    }
+    return true;
+}
+
+static int
+consume(const char *name, int ready_fd)
+{
+    struct Ring *ring = ring_open(name);
+    if (!ring)
+        return 1;
+    const struct RingHeader *h = ring_header(ring);
+    if (write(ready_fd, "", 1) != 1)
+        return 1;
+    close(ready_fd);
+
+    uint64_t last = 0, frames = 0, dropped = 0, torn = 0;
+    uint64_t start = monotonic_ns();
+    for (;;) {
+        // Closed is read before head so that the last frames are not missed
+        bool closed = ring_closed(ring);
+        uint64_t head = ring_head(ring);
+        if (head == last) {
+            if (closed)
+                break;
+            struct timespec ts = { 0, 50000 };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        for (uint64_t seq = last + 1; seq <= head; seq++) {
+            struct RingFrame frame;
+            if (!ring_acquire(ring, seq, &frame)) {
+                dropped++;
+                continue;
+            }
+            bool ok = frame_is(h, frame.pixels, (uint32_t) seq);
+            if (!ring_validate(ring, &frame)) {
+                dropped++;
+                continue;
+            }
+            if (!ok) {
+                fprintf(stderr, "error: frame %llu torn\n",
+                    (unsigned long long) seq);
+                torn++;
+            }
+            frames++;
+        }
+        last = head;
+    }
+    double secs = (monotonic_ns() - start) / 1e9;
+
+    printf("consumer: %llu frames checked, %llu dropped, %llu torn, "
+           "%.1f fps, %.2f GB/s\n",
+        (unsigned long long) frames, (unsigned long long) dropped,
+        (unsigned long long) torn, frames / secs,
+        frames * (double) h->stride * h->height / secs / 1e9);
+    fflush(stdout);
+    ring_destroy(ring);
+    return torn || !frames;
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned nframes = argc > 1 ? strtoul(argv[1], NULL, 10) : 500;
+    unsigned width = argc > 3 ? strtoul(argv[2], NULL, 10) : 1920;
+    unsigned height = argc > 3 ? strtoul(argv[3], NULL, 10) : 1080;
+
+    char name[64];
+    snprintf(name, sizeof(name), "/dwring-test-%d", (int) getpid());
+    struct Ring *ring = ring_create(name, width, height, 3);
+    if (!ring) {
+        fprintf(stderr, "error: could not create ring '%s'\n", name);
+        return 1;
+    }
+
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        ring_destroy(ring);
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        ring_destroy(ring);
+        return 1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        _exit(consume(name, fds[1]));
+    }
+
+    // Start once the consumer has the ring mapped
+    close(fds[1]);
+    char ready;
+    if (read(fds[0], &ready, 1) != 1) {
+        fprintf(stderr, "error: the consumer did not start\n");
+        ring_destroy(ring);
+        waitpid(pid, NULL, 0);
+        return 1;
+    }
+    close(fds[0]);
+
+    uint64_t start = monotonic_ns();
+    for (unsigned n = 1; n <= nframes; n++) {
+        int stride;
+        unsigned char *pixels = ring_begin(ring, &stride);
+        for (unsigned y = 0; y < height; y++) {
+            uint32_t *row = (uint32_t *) (pixels + (size_t) y * stride);
+            for (unsigned x = 0; x < width; x++)
+                row[x] = n;
+        }
+        ring_publish(ring, n / 60.0);
+    }
+    double secs = (monotonic_ns() - start) / 1e9;
+    printf("producer: %u frames, %.1f fps, %.2f GB/s\n", nframes,
+        nframes / secs, nframes * (double) width * 4 * height / secs / 1e9);
+    ring_destroy(ring);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "error: the consumer failed\n");
+        return 1;
+    }
+    return 0;
+}